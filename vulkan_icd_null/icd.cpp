@@ -0,0 +1,1445 @@
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cstring>
+#include <Windows.h>
+
+#define VK_PROTOTYPES
+#define VK_USE_PLATFORM_WIN32_KHR
+
+#include "../vulkan_sdk/include/vulkan.h"
+#include "../vulkan_sdk/include/vk_icd.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Defines
+//
+// Null driver: implements entry points vulkan_init uses on top of vk_icd.h loader contract, without a
+// GPU. Calls succeed and take as long as configured. GPU work is modelled as a timeline per queue,
+// fences and semaphores signal when work submitted with them would have finished.
+// Use it with VK_ICD_FILENAMES pointing to VkICD_null.json. Environment:
+//   VK_NULL_GPUS				physical devices reported, 1 by default
+//   VK_NULL_HEAP_MB			device local heap size, 8192 by default
+//   VK_NULL_MAX_ALLOCATIONS	maxMemoryAllocationCount, 4096 by default
+//   VK_NULL_SWAPCHAIN_IMAGES	maxImageCount of surfaces, 8 by default
+//   VK_NULL_REFRESH_HZ		rate FIFO presents are paced to, 60 by default, 0 to not pace
+//   VK_NULL_CREATE_NS			CPU time of each object creation
+//   VK_NULL_SUBMIT_NS			CPU time of each submit and present
+//   VK_NULL_RECORD_NS			CPU time of each recorded command
+//   VK_NULL_GPU_SUBMIT_NS		GPU time of each VkSubmitInfo
+//   VK_NULL_GPU_COMMAND_NS	GPU time of each recorded command
+//
+
+typedef				__int8		i8;
+typedef				__int16		i16;
+typedef				__int32		i32;
+typedef				__int64		i64;
+typedef unsigned	__int8		u8;
+typedef unsigned	__int16		u16;
+typedef unsigned	__int32		u32;
+typedef unsigned	__int64		u64;
+
+#define DRIVER_NAME				"Null Vulkan driver"
+#define NOT_SIGNALED			0xFFFFFFFFFFFFFFFFull	// signal time of fence or semaphore nothing will signal
+#define QUEUE_FAMILY_COUNT		3
+#define HEAP_COUNT				3
+#define MEMORY_TYPE_COUNT		4
+#define DEVICE_LOCAL_TYPES		0x9						// memory types optimal images can live in
+
+// Entry points returned by vk_icdGetInstanceProcAddr and vkGetDeviceProcAddr. Surfaces are created
+// and destroyed by loader, driver only reads VkIcdSurfaceWin32 it's handed.
+#define NULL_ENTRY_POINTS( X )																				\
+	X( DestroyInstance ) X( EnumeratePhysicalDevices ) X( GetPhysicalDeviceFeatures )						\
+	X( GetPhysicalDeviceFormatProperties ) X( GetPhysicalDeviceImageFormatProperties )						\
+	X( GetPhysicalDeviceProperties ) X( GetPhysicalDeviceQueueFamilyProperties )								\
+	X( GetPhysicalDeviceMemoryProperties ) X( EnumerateDeviceExtensionProperties )							\
+	X( EnumerateDeviceLayerProperties ) X( GetPhysicalDeviceSurfaceSupportKHR )								\
+	X( GetPhysicalDeviceSurfaceCapabilitiesKHR ) X( GetPhysicalDeviceSurfaceFormatsKHR )						\
+	X( GetPhysicalDeviceSurfacePresentModesKHR ) X( GetPhysicalDeviceWin32PresentationSupportKHR )			\
+	X( CreateDevice ) X( DestroyDevice ) X( GetDeviceQueue ) X( QueueSubmit ) X( QueueWaitIdle )				\
+	X( DeviceWaitIdle ) X( AllocateMemory ) X( FreeMemory ) X( MapMemory ) X( UnmapMemory )					\
+	X( FlushMappedMemoryRanges ) X( InvalidateMappedMemoryRanges ) X( GetImageMemoryRequirements )			\
+	X( GetBufferMemoryRequirements ) X( BindImageMemory ) X( BindBufferMemory ) X( CreateFence )				\
+	X( DestroyFence ) X( GetFenceStatus ) X( ResetFences ) X( WaitForFences ) X( CreateSemaphore )			\
+	X( DestroySemaphore ) X( CreateBuffer ) X( DestroyBuffer ) X( CreateImage ) X( DestroyImage )				\
+	X( CreateImageView ) X( DestroyImageView ) X( CreateCommandPool ) X( DestroyCommandPool )				\
+	X( ResetCommandPool ) X( AllocateCommandBuffers ) X( FreeCommandBuffers ) X( BeginCommandBuffer )		\
+	X( EndCommandBuffer ) X( ResetCommandBuffer ) X( CmdPipelineBarrier ) X( CmdClearColorImage )			\
+	X( CmdCopyBuffer ) X( CmdCopyBufferToImage ) X( CmdCopyImageToBuffer ) X( CmdExecuteCommands )			\
+	X( CreateQueryPool ) X( DestroyQueryPool ) X( GetQueryPoolResults ) X( CmdResetQueryPool )				\
+	X( CmdWriteTimestamp ) X( CreateSwapchainKHR ) X( DestroySwapchainKHR ) X( GetSwapchainImagesKHR )		\
+	X( AcquireNextImageKHR ) X( QueuePresentKHR )
+
+// Dispatchable objects start with loader data, loader puts its dispatch table pointer there
+struct Instance;
+struct Device;
+
+struct PhysicalDevice
+{
+	VK_LOADER_DATA						loaderData;
+	Instance*							instance;
+	VkPhysicalDeviceProperties			properties;
+	VkPhysicalDeviceMemoryProperties	memory;
+	VkQueueFamilyProperties				families[QUEUE_FAMILY_COUNT];
+};
+
+struct Instance
+{
+	VK_LOADER_DATA						loaderData;
+	std::vector<PhysicalDevice*>		physicalDevices;
+};
+
+// Work submitted to queue runs after everything submitted before it
+struct Queue
+{
+	VK_LOADER_DATA						loaderData;
+	Device*								device;
+	u64									busyUntil;
+};
+
+struct Device
+{
+	VK_LOADER_DATA						loaderData;
+	PhysicalDevice*						physicalDevice;
+	std::vector<Queue*>					queues[QUEUE_FAMILY_COUNT];
+	std::atomic<u64>					heapUsed[HEAP_COUNT];
+	std::atomic<u32>					allocations;
+};
+
+struct Memory
+{
+	VkDeviceSize						size;
+	u32									type;
+	u8*									data;		// host visible types only, allocated on first map
+};
+
+struct Buffer
+{
+	VkDeviceSize						size;
+};
+
+struct Image
+{
+	VkExtent3D							extent;
+	VkFormat							format;
+	VkImageTiling						tiling;
+	u32									mipLevels;
+	u32									arrayLayers;
+};
+
+struct ImageView
+{
+	VkImage								image;
+};
+
+// Signal time, signaled once it has passed
+struct Fence
+{
+	std::atomic<u64>					signalTicks;
+};
+
+struct Semaphore
+{
+	u64									signalTicks;
+};
+
+// Timestamps are in ns of simulated GPU timeline, available once it passed them
+struct QueryPool
+{
+	std::vector<u64>					values;
+	std::vector<u64>					availableTicks;
+};
+
+// Query command, applied at submit when its GPU time is known
+struct QueryOp
+{
+	QueryPool*							pool;
+	u32									query;
+	u32									resetCount;	// 0 for timestamp write
+	u32									command;	// commands recorded before it
+};
+
+struct CommandPool;
+
+struct CommandBuffer
+{
+	VK_LOADER_DATA						loaderData;
+	CommandPool*						pool;
+	u32									commands;
+	std::vector<QueryOp>				queries;
+};
+
+struct CommandPool
+{
+	std::vector<CommandBuffer*>			buffers;
+};
+
+// Image leaves the screen when the one presented after it is displayed
+struct SwapchainImage
+{
+	VkImage								image;
+	bool								acquired;
+	u64									releaseTicks;
+};
+
+struct Swapchain
+{
+	VkIcdSurfaceWin32*					surface;
+	VkExtent2D							extent;
+	VkPresentModeKHR					presentMode;
+	std::vector<SwapchainImage>			images;
+	i32									onScreen;
+	u64									lastDisplay;
+};
+
+struct EntryPoint
+{
+	const char*							name;
+	PFN_vkVoidFunction					function;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Globals
+//
+double									gTicksPerNs = 0.0;
+
+// settings, read from environment on first instance
+u32										gGpuCount = 1;
+u64										gHeapMb = 8192;
+u32										gMaxAllocations = 4096;
+u32										gMaxSwapchainImages = 8;
+u64										gRefreshTicks = 0;
+u64										gCreateTicks = 0;
+u64										gSubmitTicks = 0;
+u64										gRecordTicks = 0;
+u64										gGpuSubmitTicks = 0;
+u64										gGpuCommandTicks = 0;
+
+// queue timelines, fence and semaphore signal times
+std::mutex								gTimelineMutex;
+
+const VkExtensionProperties				gInstanceExtensions[] =
+{
+	{ VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_SURFACE_SPEC_VERSION },
+	{ VK_KHR_WIN32_SURFACE_EXTENSION_NAME, VK_KHR_WIN32_SURFACE_SPEC_VERSION },
+};
+
+const VkExtensionProperties				gDeviceExtensions[] =
+{
+	{ VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_SWAPCHAIN_SPEC_VERSION },
+};
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Utils
+//
+u64 getTicks()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter( &counter );
+	return counter.QuadPart;
+}
+
+u64 nsToTicks( u64 ns )
+{
+	return (u64)( (double)ns * gTicksPerNs );
+}
+
+std::string getEnvironment( const char* name )
+{
+	char value[MAX_PATH];
+	DWORD length = GetEnvironmentVariable( name, value, sizeof( value ) );
+	return length && length < sizeof( value ) ? std::string( value, length ) : std::string();
+}
+
+u64 getEnvironmentU64( const char* name, u64 defaultValue )
+{
+	std::string value = getEnvironment( name );
+	return value.empty() ? defaultValue : _strtoui64( value.c_str(), nullptr, 10 );
+}
+
+void initSettings()
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency( &freq );
+	gTicksPerNs = (double)freq.QuadPart / 1000000000.0;
+
+	gGpuCount = max( (u32)getEnvironmentU64( "VK_NULL_GPUS", gGpuCount ), 1u );
+	gHeapMb = getEnvironmentU64( "VK_NULL_HEAP_MB", gHeapMb );
+	gMaxAllocations = (u32)getEnvironmentU64( "VK_NULL_MAX_ALLOCATIONS", gMaxAllocations );
+	gMaxSwapchainImages = max( (u32)getEnvironmentU64( "VK_NULL_SWAPCHAIN_IMAGES", gMaxSwapchainImages ), 2u );
+	u64 refreshHz = getEnvironmentU64( "VK_NULL_REFRESH_HZ", 60 );
+	gRefreshTicks = refreshHz ? (u64)freq.QuadPart / refreshHz : 0;
+	gCreateTicks = nsToTicks( getEnvironmentU64( "VK_NULL_CREATE_NS", 0 ) );
+	gSubmitTicks = nsToTicks( getEnvironmentU64( "VK_NULL_SUBMIT_NS", 0 ) );
+	gRecordTicks = nsToTicks( getEnvironmentU64( "VK_NULL_RECORD_NS", 0 ) );
+	gGpuSubmitTicks = nsToTicks( getEnvironmentU64( "VK_NULL_GPU_SUBMIT_NS", 0 ) );
+	gGpuCommandTicks = nsToTicks( getEnvironmentU64( "VK_NULL_GPU_COMMAND_NS", 0 ) );
+}
+
+// Artificial CPU cost, spun so it's accurate at ns scale
+void burn( u64 ticks )
+{
+	if( ticks )
+	{
+		u64 end = getTicks() + ticks;
+		while( getTicks() < end )
+		{
+			YieldProcessor();
+		}
+	}
+}
+
+// Sleeps most of the way and spins the rest, Sleep alone is too coarse for short GPU times
+void waitUntil( u64 ticks )
+{
+	for( ;; )
+	{
+		u64 now = getTicks();
+		if( now >= ticks )
+		{
+			return;
+		}
+		u64 ms = (u64)( (double)( ticks - now ) / ( gTicksPerNs * 1000000.0 ) );
+		if( ms > 2 )
+		{
+			Sleep( (DWORD)( ms - 1 ) );
+		}
+		else
+		{
+			YieldProcessor();
+		}
+	}
+}
+
+// Non-dispatchable handles are pointers on 64 bit and uint64_t on 32 bit builds
+template< typename T, typename Object >
+T toHandle( Object* object )
+{
+	return (T)(uintptr_t)object;
+}
+
+template< typename Object, typename T >
+Object* fromHandle( T handle )
+{
+	return (Object*)(uintptr_t)handle;
+}
+
+template< typename T >
+VkResult enumerate( const T* items, u32 count, uint32_t* pCount, T* pItems )
+{
+	if( !pItems )
+	{
+		*pCount = count;
+		return VK_SUCCESS;
+	}
+	u32 copied = min( *pCount, count );
+	std::copy( items, items + copied, pItems );
+	*pCount = copied;
+	return copied < count ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+u32 formatSize( VkFormat format )
+{
+	switch( format )
+	{
+	case VK_FORMAT_R8_UNORM:
+		return 1;
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R16_SFLOAT:
+	case VK_FORMAT_D16_UNORM:
+		return 2;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32_SFLOAT:
+		return 8;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+VkExtent2D surfaceExtent( const VkIcdSurfaceWin32* surface )
+{
+	VkExtent2D extent = { 0xFFFFFFFF, 0xFFFFFFFF };
+	RECT rect;
+	if( surface->hwnd && GetClientRect( surface->hwnd, &rect ) )
+	{
+		extent.width = rect.right - rect.left;
+		extent.height = rect.bottom - rect.top;
+	}
+	return extent;
+}
+
+bool outOfDate( const Swapchain* swapchain )
+{
+	VkExtent2D extent = surfaceExtent( swapchain->surface );
+	return extent.width != 0xFFFFFFFF && ( extent.width != swapchain->extent.width || extent.height != swapchain->extent.height );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Instance and physical devices
+//
+// Physical devices look like a discrete GPU with a combined family and dedicated compute and
+// transfer ones, memory layout matches the fake heaps of vulkan_init's allocator benchmark.
+//
+void initPhysicalDevice( PhysicalDevice* gpu, u32 index )
+{
+	VkPhysicalDeviceProperties& props = gpu->properties;
+	props = VkPhysicalDeviceProperties();
+	props.apiVersion = VK_MAKE_VERSION( 1, 0, VK_HEADER_VERSION );
+	props.driverVersion = 1;
+	props.deviceID = index;
+	props.deviceType = VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+	_snprintf( props.deviceName, sizeof( props.deviceName ) - 1, "Null GPU %u", index );
+
+	VkPhysicalDeviceLimits& limits = props.limits;
+	limits.maxImageDimension1D = 16384;
+	limits.maxImageDimension2D = 16384;
+	limits.maxImageDimension3D = 2048;
+	limits.maxImageDimensionCube = 16384;
+	limits.maxImageArrayLayers = 2048;
+	limits.maxMemoryAllocationCount = gMaxAllocations;
+	limits.bufferImageGranularity = 1024;
+	limits.maxBoundDescriptorSets = 8;
+	limits.maxComputeWorkGroupCount[0] = limits.maxComputeWorkGroupCount[1] = limits.maxComputeWorkGroupCount[2] = 65535;
+	limits.maxComputeWorkGroupInvocations = 1024;
+	limits.maxComputeWorkGroupSize[0] = limits.maxComputeWorkGroupSize[1] = 1024;
+	limits.maxComputeWorkGroupSize[2] = 64;
+	limits.maxViewports = 16;
+	limits.maxViewportDimensions[0] = limits.maxViewportDimensions[1] = 16384;
+	limits.maxFramebufferWidth = limits.maxFramebufferHeight = 16384;
+	limits.maxFramebufferLayers = 2048;
+	limits.maxColorAttachments = 8;
+	limits.minMemoryMapAlignment = 64;
+	limits.minTexelBufferOffsetAlignment = 16;
+	limits.minUniformBufferOffsetAlignment = 256;
+	limits.minStorageBufferOffsetAlignment = 16;
+	limits.timestampComputeAndGraphics = VK_TRUE;
+	limits.timestampPeriod = 1.0f;
+	limits.optimalBufferCopyOffsetAlignment = 16;
+	limits.optimalBufferCopyRowPitchAlignment = 16;
+	limits.nonCoherentAtomSize = 64;
+
+	VkPhysicalDeviceMemoryProperties& memory = gpu->memory;
+	memory = VkPhysicalDeviceMemoryProperties();
+	memory.memoryHeapCount = HEAP_COUNT;
+	memory.memoryHeaps[0].size = gHeapMb * 1024 * 1024;
+	memory.memoryHeaps[0].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+	memory.memoryHeaps[1].size = (VkDeviceSize)16 * 1024 * 1024 * 1024;
+	memory.memoryHeaps[2].size = 256 * 1024 * 1024;
+	memory.memoryHeaps[2].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+	memory.memoryTypeCount = MEMORY_TYPE_COUNT;
+	memory.memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	memory.memoryTypes[0].heapIndex = 0;
+	memory.memoryTypes[1].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	memory.memoryTypes[1].heapIndex = 1;
+	memory.memoryTypes[2].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	memory.memoryTypes[2].heapIndex = 1;
+	memory.memoryTypes[3].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	memory.memoryTypes[3].heapIndex = 2;
+
+	const VkQueueFlags flags[QUEUE_FAMILY_COUNT] =
+	{
+		VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT,
+		VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT,
+		VK_QUEUE_TRANSFER_BIT,
+	};
+	for( u32 i = 0; i < QUEUE_FAMILY_COUNT; ++i )
+	{
+		VkQueueFamilyProperties& family = gpu->families[i];
+		family.queueFlags = flags[i];
+		family.queueCount = i == 1 ? 2 : 1;
+		family.timestampValidBits = 64;
+		family.minImageTransferGranularity.width = 1;
+		family.minImageTransferGranularity.height = 1;
+		family.minImageTransferGranularity.depth = 1;
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateInstance( const VkInstanceCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkInstance* pInstance )
+{
+	if( !gTicksPerNs )
+	{
+		initSettings();
+	}
+
+	Instance* instance = new Instance;
+	set_loader_magic_value( instance );
+	for( u32 i = 0; i < gGpuCount; ++i )
+	{
+		PhysicalDevice* gpu = new PhysicalDevice;
+		set_loader_magic_value( gpu );
+		gpu->instance = instance;
+		initPhysicalDevice( gpu, i );
+		instance->physicalDevices.push_back( gpu );
+	}
+
+	burn( gCreateTicks );
+	*pInstance = (VkInstance)instance;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyInstance( VkInstance instance, const VkAllocationCallbacks* pAllocator )
+{
+	Instance* data = (Instance*)instance;
+	if( data )
+	{
+		for( size_t i = 0; i < data->physicalDevices.size(); ++i )
+		{
+			delete data->physicalDevices[i];
+		}
+		delete data;
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateInstanceExtensionProperties( const char* pLayerName, uint32_t* pPropertyCount, VkExtensionProperties* pProperties )
+{
+	return enumerate( gInstanceExtensions, sizeof( gInstanceExtensions ) / sizeof( gInstanceExtensions[0] ), pPropertyCount, pProperties );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullEnumeratePhysicalDevices( VkInstance instance, uint32_t* pPhysicalDeviceCount, VkPhysicalDevice* pPhysicalDevices )
+{
+	Instance* data = (Instance*)instance;
+	return enumerate( (const VkPhysicalDevice*)data->physicalDevices.data(), (u32)data->physicalDevices.size(), pPhysicalDeviceCount, pPhysicalDevices );
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetPhysicalDeviceFeatures( VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures* pFeatures )
+{
+	*pFeatures = VkPhysicalDeviceFeatures();
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetPhysicalDeviceFormatProperties( VkPhysicalDevice physicalDevice, VkFormat format, VkFormatProperties* pFormatProperties )
+{
+	pFormatProperties->linearTilingFeatures = 0x1FFF;
+	pFormatProperties->optimalTilingFeatures = 0x1FFF;
+	pFormatProperties->bufferFeatures = 0x78;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullGetPhysicalDeviceImageFormatProperties( VkPhysicalDevice physicalDevice, VkFormat format, VkImageType type, VkImageTiling tiling,
+																		   VkImageUsageFlags usage, VkImageCreateFlags flags, VkImageFormatProperties* pImageFormatProperties )
+{
+	pImageFormatProperties->maxExtent.width = 16384;
+	pImageFormatProperties->maxExtent.height = 16384;
+	pImageFormatProperties->maxExtent.depth = type == VK_IMAGE_TYPE_3D ? 2048 : 1;
+	pImageFormatProperties->maxMipLevels = 15;
+	pImageFormatProperties->maxArrayLayers = 2048;
+	pImageFormatProperties->sampleCounts = VK_SAMPLE_COUNT_1_BIT;
+	pImageFormatProperties->maxResourceSize = (VkDeviceSize)1 << 32;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetPhysicalDeviceProperties( VkPhysicalDevice physicalDevice, VkPhysicalDeviceProperties* pProperties )
+{
+	*pProperties = ( (PhysicalDevice*)physicalDevice )->properties;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetPhysicalDeviceQueueFamilyProperties( VkPhysicalDevice physicalDevice, uint32_t* pQueueFamilyPropertyCount, VkQueueFamilyProperties* pQueueFamilyProperties )
+{
+	enumerate( ( (PhysicalDevice*)physicalDevice )->families, QUEUE_FAMILY_COUNT, pQueueFamilyPropertyCount, pQueueFamilyProperties );
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetPhysicalDeviceMemoryProperties( VkPhysicalDevice physicalDevice, VkPhysicalDeviceMemoryProperties* pMemoryProperties )
+{
+	*pMemoryProperties = ( (PhysicalDevice*)physicalDevice )->memory;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullEnumerateDeviceExtensionProperties( VkPhysicalDevice physicalDevice, const char* pLayerName, uint32_t* pPropertyCount, VkExtensionProperties* pProperties )
+{
+	return enumerate( gDeviceExtensions, sizeof( gDeviceExtensions ) / sizeof( gDeviceExtensions[0] ), pPropertyCount, pProperties );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullEnumerateDeviceLayerProperties( VkPhysicalDevice physicalDevice, uint32_t* pPropertyCount, VkLayerProperties* pProperties )
+{
+	*pPropertyCount = 0;
+	return VK_SUCCESS;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Surfaces
+//
+// VkSurfaceKHR is VkIcdSurfaceWin32 loader created, its extent is the window's client area.
+//
+VKAPI_ATTR VkResult VKAPI_CALL nullGetPhysicalDeviceSurfaceSupportKHR( VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, VkSurfaceKHR surface, VkBool32* pSupported )
+{
+	*pSupported = queueFamilyIndex == 0 ? VK_TRUE : VK_FALSE;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL nullGetPhysicalDeviceWin32PresentationSupportKHR( VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex )
+{
+	return queueFamilyIndex == 0 ? VK_TRUE : VK_FALSE;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullGetPhysicalDeviceSurfaceCapabilitiesKHR( VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceCapabilitiesKHR* pSurfaceCapabilities )
+{
+	VkSurfaceCapabilitiesKHR& caps = *pSurfaceCapabilities;
+	caps.minImageCount = 2;
+	caps.maxImageCount = gMaxSwapchainImages;
+	caps.currentExtent = surfaceExtent( fromHandle<VkIcdSurfaceWin32>( surface ) );
+	caps.minImageExtent.width = 1;
+	caps.minImageExtent.height = 1;
+	caps.maxImageExtent.width = 16384;
+	caps.maxImageExtent.height = 16384;
+	caps.maxImageArrayLayers = 1;
+	caps.supportedTransforms = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+	caps.currentTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+	caps.supportedCompositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	caps.supportedUsageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullGetPhysicalDeviceSurfaceFormatsKHR( VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, uint32_t* pSurfaceFormatCount, VkSurfaceFormatKHR* pSurfaceFormats )
+{
+	const VkSurfaceFormatKHR formats[] =
+	{
+		{ VK_FORMAT_B8G8R8A8_UNORM, VK_COLORSPACE_SRGB_NONLINEAR_KHR },
+		{ VK_FORMAT_R8G8B8A8_UNORM, VK_COLORSPACE_SRGB_NONLINEAR_KHR },
+	};
+	return enumerate( formats, sizeof( formats ) / sizeof( formats[0] ), pSurfaceFormatCount, pSurfaceFormats );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullGetPhysicalDeviceSurfacePresentModesKHR( VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, uint32_t* pPresentModeCount, VkPresentModeKHR* pPresentModes )
+{
+	const VkPresentModeKHR modes[] = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+	return enumerate( modes, sizeof( modes ) / sizeof( modes[0] ), pPresentModeCount, pPresentModes );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Device and queues
+//
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateDevice( VkPhysicalDevice physicalDevice, const VkDeviceCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDevice* pDevice )
+{
+	Device* device = new Device;
+	set_loader_magic_value( device );
+	device->physicalDevice = (PhysicalDevice*)physicalDevice;
+	for( u32 i = 0; i < HEAP_COUNT; ++i )
+	{
+		device->heapUsed[i] = 0;
+	}
+	device->allocations = 0;
+
+	for( u32 i = 0; i < pCreateInfo->queueCreateInfoCount; ++i )
+	{
+		const VkDeviceQueueCreateInfo& info = pCreateInfo->pQueueCreateInfos[i];
+		if( info.queueFamilyIndex >= QUEUE_FAMILY_COUNT )
+		{
+			continue;
+		}
+		for( u32 q = 0; q < info.queueCount; ++q )
+		{
+			Queue* queue = new Queue;
+			set_loader_magic_value( queue );
+			queue->device = device;
+			queue->busyUntil = 0;
+			device->queues[info.queueFamilyIndex].push_back( queue );
+		}
+	}
+
+	burn( gCreateTicks );
+	*pDevice = (VkDevice)device;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyDevice( VkDevice device, const VkAllocationCallbacks* pAllocator )
+{
+	Device* data = (Device*)device;
+	if( data )
+	{
+		for( u32 family = 0; family < QUEUE_FAMILY_COUNT; ++family )
+		{
+			for( size_t i = 0; i < data->queues[family].size(); ++i )
+			{
+				delete data->queues[family][i];
+			}
+		}
+		delete data;
+	}
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetDeviceQueue( VkDevice device, uint32_t queueFamilyIndex, uint32_t queueIndex, VkQueue* pQueue )
+{
+	*pQueue = (VkQueue)( (Device*)device )->queues[queueFamilyIndex][queueIndex];
+}
+
+// Each submit info starts once queue is free and its semaphores are signaled, and takes fixed time
+// plus time per recorded command. Waits consume semaphore signal.
+VKAPI_ATTR VkResult VKAPI_CALL nullQueueSubmit( VkQueue queue, uint32_t submitCount, const VkSubmitInfo* pSubmits, VkFence fence )
+{
+	burn( gSubmitTicks );
+
+	Queue* data = (Queue*)queue;
+	std::lock_guard<std::mutex> lock( gTimelineMutex );
+	u64 end = max( data->busyUntil, getTicks() );
+	for( u32 i = 0; i < submitCount; ++i )
+	{
+		const VkSubmitInfo& submit = pSubmits[i];
+		for( u32 s = 0; s < submit.waitSemaphoreCount; ++s )
+		{
+			Semaphore* semaphore = fromHandle<Semaphore>( submit.pWaitSemaphores[s] );
+			if( semaphore->signalTicks != NOT_SIGNALED )
+			{
+				end = max( end, semaphore->signalTicks );
+			}
+			semaphore->signalTicks = NOT_SIGNALED;
+		}
+
+		end += gGpuSubmitTicks;
+		for( u32 c = 0; c < submit.commandBufferCount; ++c )
+		{
+			const CommandBuffer* cmd = (const CommandBuffer*)submit.pCommandBuffers[c];
+			for( size_t q = 0; q < cmd->queries.size(); ++q )
+			{
+				const QueryOp& op = cmd->queries[q];
+				u64 ticks = end + op.command * gGpuCommandTicks;
+				for( u32 i = 0; i < op.resetCount; ++i )
+				{
+					op.pool->availableTicks[op.query + i] = NOT_SIGNALED;
+				}
+				if( !op.resetCount )
+				{
+					op.pool->values[op.query] = (u64)( (double)ticks / gTicksPerNs );
+					op.pool->availableTicks[op.query] = ticks;
+				}
+			}
+			end += cmd->commands * gGpuCommandTicks;
+		}
+
+		for( u32 s = 0; s < submit.signalSemaphoreCount; ++s )
+		{
+			fromHandle<Semaphore>( submit.pSignalSemaphores[s] )->signalTicks = end;
+		}
+	}
+
+	data->busyUntil = end;
+	if( fence )
+	{
+		fromHandle<Fence>( fence )->signalTicks = end;
+	}
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullQueueWaitIdle( VkQueue queue )
+{
+	u64 busyUntil;
+	{
+		std::lock_guard<std::mutex> lock( gTimelineMutex );
+		busyUntil = ( (Queue*)queue )->busyUntil;
+	}
+	waitUntil( busyUntil );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullDeviceWaitIdle( VkDevice device )
+{
+	Device* data = (Device*)device;
+	u64 busyUntil = 0;
+	{
+		std::lock_guard<std::mutex> lock( gTimelineMutex );
+		for( u32 family = 0; family < QUEUE_FAMILY_COUNT; ++family )
+		{
+			for( size_t i = 0; i < data->queues[family].size(); ++i )
+			{
+				busyUntil = max( busyUntil, data->queues[family][i]->busyUntil );
+			}
+		}
+	}
+	waitUntil( busyUntil );
+	return VK_SUCCESS;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Memory and resources
+//
+// Allocations count against heap sizes and maxMemoryAllocationCount. Only host visible memory gets
+// backing storage, so huge device local heaps cost nothing.
+//
+VKAPI_ATTR VkResult VKAPI_CALL nullAllocateMemory( VkDevice device, const VkMemoryAllocateInfo* pAllocateInfo, const VkAllocationCallbacks* pAllocator, VkDeviceMemory* pMemory )
+{
+	Device* data = (Device*)device;
+	const VkPhysicalDeviceMemoryProperties& props = data->physicalDevice->memory;
+	if( pAllocateInfo->memoryTypeIndex >= props.memoryTypeCount )
+	{
+		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	}
+
+	u32 heap = props.memoryTypes[pAllocateInfo->memoryTypeIndex].heapIndex;
+	if( data->allocations.fetch_add( 1 ) >= gMaxAllocations )
+	{
+		--data->allocations;
+		return VK_ERROR_TOO_MANY_OBJECTS;
+	}
+	if( data->heapUsed[heap].fetch_add( pAllocateInfo->allocationSize ) + pAllocateInfo->allocationSize > props.memoryHeaps[heap].size )
+	{
+		data->heapUsed[heap] -= pAllocateInfo->allocationSize;
+		--data->allocations;
+		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	}
+
+	Memory* memory = new Memory;
+	memory->size = pAllocateInfo->allocationSize;
+	memory->type = pAllocateInfo->memoryTypeIndex;
+	memory->data = nullptr;
+
+	burn( gCreateTicks );
+	*pMemory = toHandle<VkDeviceMemory>( memory );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullFreeMemory( VkDevice device, VkDeviceMemory memory, const VkAllocationCallbacks* pAllocator )
+{
+	Memory* data = fromHandle<Memory>( memory );
+	if( data )
+	{
+		Device* owner = (Device*)device;
+		owner->heapUsed[owner->physicalDevice->memory.memoryTypes[data->type].heapIndex] -= data->size;
+		--owner->allocations;
+		_aligned_free( data->data );
+		delete data;
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullMapMemory( VkDevice device, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize size, VkMemoryMapFlags flags, void** ppData )
+{
+	Memory* data = fromHandle<Memory>( memory );
+	if( !( ( (Device*)device )->physicalDevice->memory.memoryTypes[data->type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT ) )
+	{
+		return VK_ERROR_MEMORY_MAP_FAILED;
+	}
+	if( !data->data )
+	{
+		data->data = (u8*)_aligned_malloc( (size_t)data->size, 64 );
+		if( !data->data )
+		{
+			return VK_ERROR_OUT_OF_HOST_MEMORY;
+		}
+	}
+	*ppData = data->data + offset;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullUnmapMemory( VkDevice device, VkDeviceMemory memory )
+{
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullFlushMappedMemoryRanges( VkDevice device, uint32_t memoryRangeCount, const VkMappedMemoryRange* pMemoryRanges )
+{
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullInvalidateMappedMemoryRanges( VkDevice device, uint32_t memoryRangeCount, const VkMappedMemoryRange* pMemoryRanges )
+{
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetImageMemoryRequirements( VkDevice device, VkImage image, VkMemoryRequirements* pMemoryRequirements )
+{
+	const Image* data = fromHandle<Image>( image );
+	VkDeviceSize size = (VkDeviceSize)data->extent.width * data->extent.height * data->extent.depth * data->arrayLayers * formatSize( data->format );
+	if( data->mipLevels > 1 )
+	{
+		size += size / 3;
+	}
+
+	bool linear = data->tiling == VK_IMAGE_TILING_LINEAR;
+	pMemoryRequirements->alignment = linear ? 256 : 4096;
+	pMemoryRequirements->size = ( size + pMemoryRequirements->alignment - 1 ) & ~( pMemoryRequirements->alignment - 1 );
+	pMemoryRequirements->memoryTypeBits = linear ? ( 1 << MEMORY_TYPE_COUNT ) - 1 : DEVICE_LOCAL_TYPES;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullGetBufferMemoryRequirements( VkDevice device, VkBuffer buffer, VkMemoryRequirements* pMemoryRequirements )
+{
+	pMemoryRequirements->alignment = 256;
+	pMemoryRequirements->size = ( fromHandle<Buffer>( buffer )->size + 255 ) & ~(VkDeviceSize)255;
+	pMemoryRequirements->memoryTypeBits = ( 1 << MEMORY_TYPE_COUNT ) - 1;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullBindImageMemory( VkDevice device, VkImage image, VkDeviceMemory memory, VkDeviceSize memoryOffset )
+{
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullBindBufferMemory( VkDevice device, VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize memoryOffset )
+{
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateBuffer( VkDevice device, const VkBufferCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkBuffer* pBuffer )
+{
+	Buffer* buffer = new Buffer;
+	buffer->size = pCreateInfo->size;
+	burn( gCreateTicks );
+	*pBuffer = toHandle<VkBuffer>( buffer );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyBuffer( VkDevice device, VkBuffer buffer, const VkAllocationCallbacks* pAllocator )
+{
+	delete fromHandle<Buffer>( buffer );
+}
+
+Image* createImage( VkExtent3D extent, VkFormat format, VkImageTiling tiling, u32 mipLevels, u32 arrayLayers )
+{
+	Image* image = new Image;
+	image->extent = extent;
+	image->format = format;
+	image->tiling = tiling;
+	image->mipLevels = mipLevels;
+	image->arrayLayers = arrayLayers;
+	return image;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateImage( VkDevice device, const VkImageCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkImage* pImage )
+{
+	Image* image = createImage( pCreateInfo->extent, pCreateInfo->format, pCreateInfo->tiling, pCreateInfo->mipLevels, pCreateInfo->arrayLayers );
+	burn( gCreateTicks );
+	*pImage = toHandle<VkImage>( image );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyImage( VkDevice device, VkImage image, const VkAllocationCallbacks* pAllocator )
+{
+	delete fromHandle<Image>( image );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateImageView( VkDevice device, const VkImageViewCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkImageView* pView )
+{
+	ImageView* view = new ImageView;
+	view->image = pCreateInfo->image;
+	burn( gCreateTicks );
+	*pView = toHandle<VkImageView>( view );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyImageView( VkDevice device, VkImageView imageView, const VkAllocationCallbacks* pAllocator )
+{
+	delete fromHandle<ImageView>( imageView );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Synchronization
+//
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateFence( VkDevice device, const VkFenceCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkFence* pFence )
+{
+	Fence* fence = new Fence;
+	fence->signalTicks = ( pCreateInfo->flags & VK_FENCE_CREATE_SIGNALED_BIT ) ? 0 : NOT_SIGNALED;
+	burn( gCreateTicks );
+	*pFence = toHandle<VkFence>( fence );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyFence( VkDevice device, VkFence fence, const VkAllocationCallbacks* pAllocator )
+{
+	delete fromHandle<Fence>( fence );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullGetFenceStatus( VkDevice device, VkFence fence )
+{
+	return fromHandle<Fence>( fence )->signalTicks <= getTicks() ? VK_SUCCESS : VK_NOT_READY;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullResetFences( VkDevice device, uint32_t fenceCount, const VkFence* pFences )
+{
+	for( u32 i = 0; i < fenceCount; ++i )
+	{
+		fromHandle<Fence>( pFences[i] )->signalTicks = NOT_SIGNALED;
+	}
+	return VK_SUCCESS;
+}
+
+// Fences not submitted yet may be by another thread, those are polled every millisecond
+VKAPI_ATTR VkResult VKAPI_CALL nullWaitForFences( VkDevice device, uint32_t fenceCount, const VkFence* pFences, VkBool32 waitAll, uint64_t timeout )
+{
+	u64 start = getTicks();
+	u64 timeoutTicks = nsToTicks( min( timeout, (uint64_t)1 << 62 ) );
+	u64 deadline = timeout == UINT64_MAX ? NOT_SIGNALED : start + timeoutTicks;
+	u64 pollTicks = nsToTicks( 1000000 );
+
+	for( ;; )
+	{
+		u64 now = getTicks();
+		u32 signaled = 0;
+		u64 next = now + pollTicks;
+		for( u32 i = 0; i < fenceCount; ++i )
+		{
+			u64 signalTicks = fromHandle<Fence>( pFences[i] )->signalTicks;
+			if( signalTicks <= now )
+			{
+				++signaled;
+			}
+			else if( signalTicks != NOT_SIGNALED )
+			{
+				next = min( next, signalTicks );
+			}
+		}
+
+		if( waitAll ? signaled == fenceCount : signaled > 0 )
+		{
+			return VK_SUCCESS;
+		}
+		if( now >= deadline )
+		{
+			return VK_TIMEOUT;
+		}
+		waitUntil( min( next, deadline ) );
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateSemaphore( VkDevice device, const VkSemaphoreCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkSemaphore* pSemaphore )
+{
+	Semaphore* semaphore = new Semaphore;
+	semaphore->signalTicks = NOT_SIGNALED;
+	burn( gCreateTicks );
+	*pSemaphore = toHandle<VkSemaphore>( semaphore );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroySemaphore( VkDevice device, VkSemaphore semaphore, const VkAllocationCallbacks* pAllocator )
+{
+	delete fromHandle<Semaphore>( semaphore );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Command buffers
+//
+// Recording only counts commands, submit turns the count into GPU time.
+//
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateCommandPool( VkDevice device, const VkCommandPoolCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkCommandPool* pCommandPool )
+{
+	CommandPool* pool = new CommandPool;
+	burn( gCreateTicks );
+	*pCommandPool = toHandle<VkCommandPool>( pool );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyCommandPool( VkDevice device, VkCommandPool commandPool, const VkAllocationCallbacks* pAllocator )
+{
+	CommandPool* pool = fromHandle<CommandPool>( commandPool );
+	if( pool )
+	{
+		for( size_t i = 0; i < pool->buffers.size(); ++i )
+		{
+			delete pool->buffers[i];
+		}
+		delete pool;
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullResetCommandPool( VkDevice device, VkCommandPool commandPool, VkCommandPoolResetFlags flags )
+{
+	CommandPool* pool = fromHandle<CommandPool>( commandPool );
+	for( size_t i = 0; i < pool->buffers.size(); ++i )
+	{
+		pool->buffers[i]->commands = 0;
+		pool->buffers[i]->queries.clear();
+	}
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullAllocateCommandBuffers( VkDevice device, const VkCommandBufferAllocateInfo* pAllocateInfo, VkCommandBuffer* pCommandBuffers )
+{
+	CommandPool* pool = fromHandle<CommandPool>( pAllocateInfo->commandPool );
+	for( u32 i = 0; i < pAllocateInfo->commandBufferCount; ++i )
+	{
+		CommandBuffer* cmd = new CommandBuffer;
+		set_loader_magic_value( cmd );
+		cmd->pool = pool;
+		cmd->commands = 0;
+		pool->buffers.push_back( cmd );
+		pCommandBuffers[i] = (VkCommandBuffer)cmd;
+	}
+	burn( gCreateTicks );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullFreeCommandBuffers( VkDevice device, VkCommandPool commandPool, uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers )
+{
+	CommandPool* pool = fromHandle<CommandPool>( commandPool );
+	for( u32 i = 0; i < commandBufferCount; ++i )
+	{
+		CommandBuffer* cmd = (CommandBuffer*)pCommandBuffers[i];
+		if( cmd )
+		{
+			pool->buffers.erase( std::find( pool->buffers.begin(), pool->buffers.end(), cmd ) );
+			delete cmd;
+		}
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullBeginCommandBuffer( VkCommandBuffer commandBuffer, const VkCommandBufferBeginInfo* pBeginInfo )
+{
+	( (CommandBuffer*)commandBuffer )->commands = 0;
+	( (CommandBuffer*)commandBuffer )->queries.clear();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullEndCommandBuffer( VkCommandBuffer commandBuffer )
+{
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullResetCommandBuffer( VkCommandBuffer commandBuffer, VkCommandBufferResetFlags flags )
+{
+	( (CommandBuffer*)commandBuffer )->commands = 0;
+	( (CommandBuffer*)commandBuffer )->queries.clear();
+	return VK_SUCCESS;
+}
+
+void recordCommand( VkCommandBuffer commandBuffer )
+{
+	++( (CommandBuffer*)commandBuffer )->commands;
+	burn( gRecordTicks );
+}
+
+VKAPI_ATTR void VKAPI_CALL nullCmdPipelineBarrier( VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask,
+												   VkDependencyFlags dependencyFlags, uint32_t memoryBarrierCount, const VkMemoryBarrier* pMemoryBarriers,
+												   uint32_t bufferMemoryBarrierCount, const VkBufferMemoryBarrier* pBufferMemoryBarriers,
+												   uint32_t imageMemoryBarrierCount, const VkImageMemoryBarrier* pImageMemoryBarriers )
+{
+	recordCommand( commandBuffer );
+}
+
+VKAPI_ATTR void VKAPI_CALL nullCmdClearColorImage( VkCommandBuffer commandBuffer, VkImage image, VkImageLayout imageLayout, const VkClearColorValue* pColor,
+												   uint32_t rangeCount, const VkImageSubresourceRange* pRanges )
+{
+	recordCommand( commandBuffer );
+}
+
+VKAPI_ATTR void VKAPI_CALL nullCmdCopyBuffer( VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkBuffer dstBuffer, uint32_t regionCount, const VkBufferCopy* pRegions )
+{
+	recordCommand( commandBuffer );
+}
+
+VKAPI_ATTR void VKAPI_CALL nullCmdCopyBufferToImage( VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkImage dstImage, VkImageLayout dstImageLayout,
+													 uint32_t regionCount, const VkBufferImageCopy* pRegions )
+{
+	recordCommand( commandBuffer );
+}
+
+VKAPI_ATTR void VKAPI_CALL nullCmdCopyImageToBuffer( VkCommandBuffer commandBuffer, VkImage srcImage, VkImageLayout srcImageLayout, VkBuffer dstBuffer,
+													 uint32_t regionCount, const VkBufferImageCopy* pRegions )
+{
+	recordCommand( commandBuffer );
+}
+
+// Secondaries' commands and queries run as part of primary
+VKAPI_ATTR void VKAPI_CALL nullCmdExecuteCommands( VkCommandBuffer commandBuffer, uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers )
+{
+	recordCommand( commandBuffer );
+	CommandBuffer* primary = (CommandBuffer*)commandBuffer;
+	for( u32 i = 0; i < commandBufferCount; ++i )
+	{
+		const CommandBuffer* secondary = (const CommandBuffer*)pCommandBuffers[i];
+		for( size_t q = 0; q < secondary->queries.size(); ++q )
+		{
+			QueryOp op = secondary->queries[q];
+			op.command += primary->commands;
+			primary->queries.push_back( op );
+		}
+		primary->commands += secondary->commands;
+	}
+}
+
+VKAPI_ATTR void VKAPI_CALL nullCmdResetQueryPool( VkCommandBuffer commandBuffer, VkQueryPool queryPool, uint32_t firstQuery, uint32_t queryCount )
+{
+	QueryOp op = { fromHandle<QueryPool>( queryPool ), firstQuery, queryCount, ( (CommandBuffer*)commandBuffer )->commands };
+	( (CommandBuffer*)commandBuffer )->queries.push_back( op );
+	recordCommand( commandBuffer );
+}
+
+// Timestamp is taken once commands recorded before it are done, whatever the stage
+VKAPI_ATTR void VKAPI_CALL nullCmdWriteTimestamp( VkCommandBuffer commandBuffer, VkPipelineStageFlagBits pipelineStage, VkQueryPool queryPool, uint32_t query )
+{
+	QueryOp op = { fromHandle<QueryPool>( queryPool ), query, 0, ( (CommandBuffer*)commandBuffer )->commands };
+	( (CommandBuffer*)commandBuffer )->queries.push_back( op );
+	recordCommand( commandBuffer );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Queries
+//
+// Only timestamps have meaningful results, other query types read as zero.
+//
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateQueryPool( VkDevice device, const VkQueryPoolCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkQueryPool* pQueryPool )
+{
+	QueryPool* pool = new QueryPool;
+	pool->values.resize( pCreateInfo->queryCount, 0 );
+	pool->availableTicks.resize( pCreateInfo->queryCount, NOT_SIGNALED );
+	burn( gCreateTicks );
+	*pQueryPool = toHandle<VkQueryPool>( pool );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroyQueryPool( VkDevice device, VkQueryPool queryPool, const VkAllocationCallbacks* pAllocator )
+{
+	delete fromHandle<QueryPool>( queryPool );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullGetQueryPoolResults( VkDevice device, VkQueryPool queryPool, uint32_t firstQuery, uint32_t queryCount,
+														size_t dataSize, void* pData, VkDeviceSize stride, VkQueryResultFlags flags )
+{
+	QueryPool* pool = fromHandle<QueryPool>( queryPool );
+	if( flags & VK_QUERY_RESULT_WAIT_BIT )
+	{
+		u64 last = 0;
+		{
+			std::lock_guard<std::mutex> lock( gTimelineMutex );
+			for( u32 i = 0; i < queryCount; ++i )
+			{
+				u64 ticks = pool->availableTicks[firstQuery + i];
+				last = ticks != NOT_SIGNALED ? max( last, ticks ) : last;
+			}
+		}
+		waitUntil( last );
+	}
+
+	std::lock_guard<std::mutex> lock( gTimelineMutex );
+	u64 now = getTicks();
+	bool wide = ( flags & VK_QUERY_RESULT_64_BIT ) != 0;
+	VkResult res = VK_SUCCESS;
+	for( u32 i = 0; i < queryCount; ++i )
+	{
+		u8* result = (u8*)pData + (size_t)( i * stride );
+		bool available = pool->availableTicks[firstQuery + i] <= now;
+		u64 value = pool->values[firstQuery + i];
+		if( !available )
+		{
+			res = VK_NOT_READY;
+		}
+
+		if( available || ( flags & VK_QUERY_RESULT_PARTIAL_BIT ) )
+		{
+			if( wide )
+				memcpy( result, &value, sizeof( u64 ) );
+			else
+				*(u32*)result = (u32)value;
+		}
+		if( flags & VK_QUERY_RESULT_WITH_AVAILABILITY_BIT )
+		{
+			if( wide )
+				*(u64*)( result + sizeof( u64 ) ) = available;
+			else
+				*(u32*)( result + sizeof( u32 ) ) = available;
+		}
+	}
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Swapchain
+//
+// Acquire hands out image that leaves the screen first and signals once it has. FIFO presents are
+// displayed one refresh apart, others as soon as their semaphores are signaled. Swapchain is out of
+// date once window's client area no longer matches it.
+//
+VKAPI_ATTR VkResult VKAPI_CALL nullCreateSwapchainKHR( VkDevice device, const VkSwapchainCreateInfoKHR* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkSwapchainKHR* pSwapchain )
+{
+	Swapchain* swapchain = new Swapchain;
+	swapchain->surface = fromHandle<VkIcdSurfaceWin32>( pCreateInfo->surface );
+	swapchain->extent = pCreateInfo->imageExtent;
+	swapchain->presentMode = pCreateInfo->presentMode;
+	swapchain->onScreen = -1;
+	swapchain->lastDisplay = 0;
+
+	VkExtent3D extent = { pCreateInfo->imageExtent.width, pCreateInfo->imageExtent.height, 1 };
+	u32 count = min( max( pCreateInfo->minImageCount, 2u ), gMaxSwapchainImages );
+	for( u32 i = 0; i < count; ++i )
+	{
+		SwapchainImage image;
+		image.image = toHandle<VkImage>( createImage( extent, pCreateInfo->imageFormat, VK_IMAGE_TILING_OPTIMAL, 1, pCreateInfo->imageArrayLayers ) );
+		image.acquired = false;
+		image.releaseTicks = 0;
+		swapchain->images.push_back( image );
+	}
+
+	burn( gCreateTicks );
+	*pSwapchain = toHandle<VkSwapchainKHR>( swapchain );
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL nullDestroySwapchainKHR( VkDevice device, VkSwapchainKHR swapchain, const VkAllocationCallbacks* pAllocator )
+{
+	Swapchain* data = fromHandle<Swapchain>( swapchain );
+	if( data )
+	{
+		for( size_t i = 0; i < data->images.size(); ++i )
+		{
+			delete fromHandle<Image>( data->images[i].image );
+		}
+		delete data;
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullGetSwapchainImagesKHR( VkDevice device, VkSwapchainKHR swapchain, uint32_t* pSwapchainImageCount, VkImage* pSwapchainImages )
+{
+	Swapchain* data = fromHandle<Swapchain>( swapchain );
+	std::vector<VkImage> images;
+	for( size_t i = 0; i < data->images.size(); ++i )
+	{
+		images.push_back( data->images[i].image );
+	}
+	return enumerate( images.data(), (u32)images.size(), pSwapchainImageCount, pSwapchainImages );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullAcquireNextImageKHR( VkDevice device, VkSwapchainKHR swapchain, uint64_t timeout, VkSemaphore semaphore, VkFence fence, uint32_t* pImageIndex )
+{
+	Swapchain* data = fromHandle<Swapchain>( swapchain );
+	if( outOfDate( data ) )
+	{
+		return VK_ERROR_OUT_OF_DATE_KHR;
+	}
+
+	// Every image off screen is acquired, only a present from another thread can free one.
+	// That is polled every millisecond like unsubmitted fences until timeout runs out.
+	u64 deadline = timeout == UINT64_MAX ? NOT_SIGNALED : getTicks() + nsToTicks( min( timeout, (uint64_t)1 << 62 ) );
+	u64 pollTicks = nsToTicks( 1000000 );
+	std::unique_lock<std::mutex> lock( gTimelineMutex );
+	i32 best = -1;
+	for( ;; )
+	{
+		for( u32 i = 0; i < data->images.size(); ++i )
+		{
+			const SwapchainImage& image = data->images[i];
+			if( !image.acquired && (i32)i != data->onScreen && ( best < 0 || image.releaseTicks < data->images[best].releaseTicks ) )
+			{
+				best = i;
+			}
+		}
+		if( best >= 0 )
+		{
+			break;
+		}
+		if( !timeout )
+		{
+			return VK_NOT_READY;
+		}
+
+		u64 now = getTicks();
+		if( now >= deadline )
+		{
+			return VK_TIMEOUT;
+		}
+		lock.unlock();
+		waitUntil( min( now + pollTicks, deadline ) );
+		lock.lock();
+	}
+
+	SwapchainImage& image = data->images[best];
+	image.acquired = true;
+	u64 ready = max( image.releaseTicks, getTicks() );
+	if( semaphore )
+	{
+		fromHandle<Semaphore>( semaphore )->signalTicks = ready;
+	}
+	if( fence )
+	{
+		fromHandle<Fence>( fence )->signalTicks = ready;
+	}
+	*pImageIndex = best;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL nullQueuePresentKHR( VkQueue queue, const VkPresentInfoKHR* pPresentInfo )
+{
+	burn( gSubmitTicks );
+
+	std::lock_guard<std::mutex> lock( gTimelineMutex );
+	u64 ready = getTicks();
+	for( u32 i = 0; i < pPresentInfo->waitSemaphoreCount; ++i )
+	{
+		Semaphore* semaphore = fromHandle<Semaphore>( pPresentInfo->pWaitSemaphores[i] );
+		if( semaphore->signalTicks != NOT_SIGNALED )
+		{
+			ready = max( ready, semaphore->signalTicks );
+		}
+		semaphore->signalTicks = NOT_SIGNALED;
+	}
+
+	VkResult res = VK_SUCCESS;
+	for( u32 i = 0; i < pPresentInfo->swapchainCount; ++i )
+	{
+		Swapchain* data = fromHandle<Swapchain>( pPresentInfo->pSwapchains[i] );
+		u32 index = pPresentInfo->pImageIndices[i];
+
+		bool fifo = data->presentMode == VK_PRESENT_MODE_FIFO_KHR || data->presentMode == VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+		u64 display = fifo && data->lastDisplay ? max( ready, data->lastDisplay + gRefreshTicks ) : ready;
+		data->lastDisplay = display;
+
+		if( data->onScreen >= 0 )
+		{
+			data->images[data->onScreen].releaseTicks = display;
+		}
+		data->onScreen = index;
+		data->images[index].acquired = false;
+		data->images[index].releaseTicks = NOT_SIGNALED;
+
+		VkResult swapchainRes = outOfDate( data ) ? VK_ERROR_OUT_OF_DATE_KHR : VK_SUCCESS;
+		if( pPresentInfo->pResults )
+		{
+			pPresentInfo->pResults[i] = swapchainRes;
+		}
+		res = swapchainRes != VK_SUCCESS ? swapchainRes : res;
+	}
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Exports
+//
+#define NULL_ENTRY_POINT( name )	{ "vk" #name, (PFN_vkVoidFunction)&null##name },
+
+const EntryPoint gEntryPoints[] =
+{
+	{ "vkCreateInstance", (PFN_vkVoidFunction)&vkCreateInstance },
+	{ "vkEnumerateInstanceExtensionProperties", (PFN_vkVoidFunction)&vkEnumerateInstanceExtensionProperties },
+	NULL_ENTRY_POINTS( NULL_ENTRY_POINT )
+};
+
+const u32 gEntryPointCount = sizeof( gEntryPoints ) / sizeof( gEntryPoints[0] );
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetDeviceProcAddr( VkDevice device, const char* pName )
+{
+	if( !strcmp( pName, "vkGetDeviceProcAddr" ) )
+	{
+		return (PFN_vkVoidFunction)&vkGetDeviceProcAddr;
+	}
+	for( u32 i = 0; i < gEntryPointCount; ++i )
+	{
+		if( !strcmp( gEntryPoints[i].name, pName ) )
+		{
+			return gEntryPoints[i].function;
+		}
+	}
+	return nullptr;
+}
+
+// Loader interface: loader asks this for everything, including global functions with null instance
+extern "C" PFN_vkVoidFunction VKAPI_CALL vk_icdGetInstanceProcAddr( VkInstance instance, const char* pName )
+{
+	if( !strcmp( pName, "vkGetInstanceProcAddr" ) )
+	{
+		return (PFN_vkVoidFunction)&vk_icdGetInstanceProcAddr;
+	}
+	return vkGetDeviceProcAddr( VK_NULL_HANDLE, pName );
+}
+
+// Older loaders look for plain vkGetInstanceProcAddr
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetInstanceProcAddr( VkInstance instance, const char* pName )
+{
+	return vk_icdGetInstanceProcAddr( instance, pName );
+}
@@ -1,6 +1,20 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <vector>
+#include <deque>
+#include <algorithm>
 #include <cassert>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <unordered_map>
+#include <string>
+#include <set>
+#include <cmath>
 #include <Windows.h>
 
 #define VK_PROTOTYPES
@@ -36,6 +50,83 @@ typedef unsigned	__int64		u64;
 	}																		\
 }
 
+// Posted to window when render thread has events for it
+#define WM_RENDER_EVENTS	( WM_APP + 1 )
+
+// Fixed size single producer single consumer queue. Producer only writes head and consumer only
+// writes tail, so neither side ever takes a lock or waits for the other. Capacity is power of two.
+template< typename T, u32 Capacity >
+struct SpscQueue
+{
+	T					items[Capacity];
+	std::atomic<u32>	head;		// next item producer writes
+	std::atomic<u32>	tail;		// next item consumer reads
+};
+
+enum WindowEventType
+{
+	WINDOW_EVENT_RESIZE,
+	WINDOW_EVENT_INPUT,
+};
+
+// Sent from window thread to render thread
+struct WindowEvent
+{
+	WindowEventType		type;
+	u32					width;		// client area
+	u32					height;
+	bool				minimized;
+	u32					message;	// input message
+	u64					ticks;		// when window procedure got input
+};
+
+enum RenderEventType
+{
+	RENDER_EVENT_STATS,
+};
+
+// Sent from render thread to window thread
+struct RenderEvent
+{
+	RenderEventType		type;
+	double				frameMs;	// average over last stats period
+};
+
+// CPU zone, written once it ends. Name must outlive profiler, string literals only.
+struct ZoneEvent
+{
+	const char*			name;
+	u64					begin;		// timer ticks
+	u64					end;
+};
+
+// Events are appended by owning thread only and published by count, so export can read them
+// while thread is still recording. Full chunk is never touched again, thread links a new one.
+struct ZoneChunk
+{
+	ZoneEvent				events[4096];
+	std::atomic<u32>		count;
+	std::atomic<ZoneChunk*>	next;
+};
+
+struct ZoneThread
+{
+	u32					id;			// tid in exported trace
+	const char*			name;
+	ZoneChunk*			first;
+	ZoneChunk*			current;	// owning thread only
+};
+
+// Times scope it lives in, does nothing when profiler is off as it starts
+struct CpuZone
+{
+	const char*			name;
+	u64					begin;		// 0 if zone isn't recorded
+
+	explicit CpuZone( const char* zoneName );
+	~CpuZone();
+};
+
 // Vulkan related structs
 
 struct SwapChainBuffer
@@ -44,6 +135,524 @@ struct SwapChainBuffer
 	VkImageView		view;
 };
 
+// Swapchain replaced on resize. Frames recorded before recreation may still present its
+// images, so it's destroyed once their slots are retired.
+struct RetiredSwapchain
+{
+	VkSwapchainKHR					swapchain;
+	std::vector<SwapChainBuffer>	buffers;
+	u64								frame;		// first frame rendered to its replacement
+};
+
+// Named presentation setups, picked with -present_policy
+enum PresentPolicy
+{
+	PRESENT_LOW_LATENCY,		// newest frame shown as soon as possible, shallow queues
+	PRESENT_VSYNC,				// every frame shown on vblank, no tearing
+	PRESENT_MAX_THROUGHPUT,		// as many frames as GPU can do, tearing allowed
+	PRESENT_POWER_SAVE,			// vsync capped at 30 fps
+	PRESENT_POLICY_COUNT,
+};
+
+struct PresentPolicyDesc
+{
+	const char*			name;
+	VkPresentModeKHR	modes[3];		// in order of preference, FIFO is always supported
+	u32					extraImages;	// swapchain images on top of surface minImageCount
+	u32					framesInFlight;	// if policy was picked, unless forced by -frames_in_flight
+	double				targetFrameMs;	// default pacing target, 0 means not paced
+};
+
+// Pacing controller holds frame starts to target frame time and measures what was achieved
+struct FramePacer
+{
+	u64					frameTicks;		// target frame time, 0 if pacing is off
+	u64					deadline;		// earliest start of next frame
+	u64					lastStart;
+	u64					frames;
+	u64					missed;			// frames started more than a whole period late
+	double				sleepMs;
+	double				intervalMs;		// sum of intervals between frame starts
+	double				intervalSqMs;	// sum of their squares, for jitter
+	std::vector<float>	latencies;		// frame start to GPU done of recent frames, ms, ring of LATENCY_SAMPLES
+	u64					latencyCount;	// latencies recorded so far
+};
+
+// Input consumed by one frame, latencies are measured from the oldest input in it
+struct InputFrameRecord
+{
+	u64		frame;
+	u32		inputs;
+	u64		inputTicks;
+	float	presentMs;		// input to vkQueuePresentKHR returning, 0 if frame wasn't presented
+	float	gpuMs;			// input to frame fence seen signaled
+};
+
+struct SwapchainStats
+{
+	u32		recreations;
+	double	totalMs;
+	double	maxMs;
+};
+
+// What device selection knows about physical device. Everything except identity and name
+// is probed once per device and driver version and then read from cache file.
+struct DeviceInfo
+{
+	VkPhysicalDevice		device;
+	std::string				name;
+	u32						vendorID;
+	u32						deviceID;
+	u32						driverVersion;
+	VkPhysicalDeviceType	type;
+	VkDeviceSize			deviceLocalBytes;	// biggest device local heap
+	bool					graphics;			// has family with graphics
+	bool					asyncCompute;		// has compute family without graphics
+	bool					asyncTransfer;		// has transfer only family
+	u32						maxImageDimension2D;
+	i32						score;				// negative if device can't be used at all
+};
+
+// Kinds of work scheduler has queues for
+enum QueueType
+{
+	QUEUE_GRAPHICS,
+	QUEUE_COMPUTE,
+	QUEUE_TRANSFER,
+	QUEUE_TYPE_COUNT,
+};
+
+// Queue work of one type is submitted to. Types device has no family or no spare queue for
+// alias another queue of the same family and share its mutex, so callers never have to care.
+struct DeviceQueue
+{
+	VkQueue		queue;
+	u32			familyIndex;
+	u32			queueIndex;
+	bool		dedicated;		// family differs from graphics one
+	std::mutex*	mutex;			// vkQueueSubmit needs external synchronization
+	u64			submits;
+};
+
+// Transient command pool which is only ever reset as a whole. Buffers handed out since
+// last reset are returned to free lists on reset and reused instead of being allocated again.
+// Like the pool itself it must be used by one thread at a time.
+struct CommandAllocator
+{
+	VkCommandPool					pool;
+	std::vector<VkCommandBuffer>	freePrimaries;
+	std::vector<VkCommandBuffer>	freeSecondaries;
+	std::vector<VkCommandBuffer>	usedPrimaries;
+	std::vector<VkCommandBuffer>	usedSecondaries;
+};
+
+// Counters over all command allocators
+struct CommandAllocatorStats
+{
+	std::atomic<u64>	allocations;	// vkAllocateCommandBuffers calls
+	std::atomic<u64>	recycled;		// buffers handed out from free lists
+	std::atomic<u64>	resets;			// vkResetCommandPool calls
+};
+
+// Last known use of one image subresource, in command recording order
+struct ImageSubresourceState
+{
+	VkImageLayout			layout;
+	VkAccessFlags			access;		// accesses since last barrier
+	VkPipelineStageFlags	stages;		// stages of those accesses
+};
+
+// Image known to state tracker, states are stored as [mip * arrayLayers + layer]
+struct TrackedImage
+{
+	VkImageAspectFlags					aspects;
+	u32									mipLevels;
+	u32									arrayLayers;
+	std::vector<ImageSubresourceState>	states;
+	QueueType							queue;		// queue which used image last
+};
+
+// Last known use of whole buffer
+struct BufferState
+{
+	VkAccessFlags			access;
+	VkPipelineStageFlags	stages;
+	QueueType				queue;
+	bool					streamed;		// rewritten by uploads every frame, belongs to transfer queue in between
+	u64						releaseFrame;	// frame which handed streamed buffer back to transfer queue
+};
+
+// Resource declared in frame graph. Images must be known to state tracker.
+struct GraphResource
+{
+	std::string				name;
+	VkImage					image;
+	VkBuffer				buffer;
+	bool					output;			// consumed outside of the graph, keeps producers alive
+	VkImageLayout			finalLayout;	// state output is left in after the graph
+	VkAccessFlags			finalAccess;
+	VkPipelineStageFlags	finalStages;
+	i32						firstPass;		// lifetime in compiled order, -1 if never used
+	i32						lastPass;
+};
+
+// How pass uses a resource
+struct GraphAccess
+{
+	u32						resource;
+	bool					write;
+	bool					keep;			// write keeps previous contents, e.g. partial update, so earlier writers stay live
+	VkImageLayout			layout;			// ignored for buffers
+	VkAccessFlags			access;
+	VkPipelineStageFlags	stages;
+};
+
+struct GraphPass
+{
+	std::string								name;
+	std::vector<GraphAccess>				accesses;
+	std::function<void( VkCommandBuffer )>	execute;
+	bool									culled;
+};
+
+struct FrameGraph
+{
+	std::vector<GraphResource>	resources;
+	std::vector<GraphPass>		passes;
+	std::vector<u32>			order;		// live passes in execution order, filled by graphCompile()
+};
+
+// Submit collected by batcher, ranges point into flat batcher arrays
+struct BatchedSubmit
+{
+	u32		firstCmd;
+	u32		cmdCount;
+	u32		firstWait;
+	u32		waitCount;
+	u32		firstSignal;
+	u32		signalCount;
+};
+
+struct SubmitBatchStats
+{
+	u64		flushes;
+	u64		queueSubmits;		// vkQueueSubmit calls
+	u64		submitInfos;		// VkSubmitInfo entries after merging
+	u64		submits;			// batchSubmit() calls
+	u64		cmdBuffers;
+};
+
+// Compute work of one frame, submitted to compute queue. Resources shared with graphics are handed
+// over with semaphores, plus queue family ownership transfers when families differ.
+struct ComputeLane
+{
+	CommandAllocator					allocator;			// of compute family, reset with the slot
+	VkCommandBuffer						cmd;
+	VkSemaphore							graphicsDone;		// signaled by graphics work recorded before lane
+	VkSemaphore							computeDone;		// waited for by graphics work after lane
+	VkPipelineStageFlags				waitStages;			// compute stages waiting for graphics, 0 if none
+	VkPipelineStageFlags				graphicsWaitStages;	// graphics stages waiting for compute
+	std::vector<VkImageMemoryBarrier>	releaseImages;		// graphics side halves of transfers to compute
+	std::vector<VkBufferMemoryBarrier>	releaseBuffers;
+	VkPipelineStageFlags				releaseStages;
+	std::vector<VkImageMemoryBarrier>	acquireImages;		// graphics side halves of transfers from compute
+	std::vector<VkBufferMemoryBarrier>	acquireBuffers;
+	bool								submitted;			// rest of the frame has to wait for computeDone
+};
+
+struct ComputeStats
+{
+	u64		lanes;
+	u64		splits;			// graphics submits made so compute could wait for them
+	u64		folded;			// lanes batched with graphics work, compute shares graphics queue
+	u64		transfers;		// ownership transfers, counted once per release/acquire pair
+};
+
+// Pass timed in one frame, its timestamps are queries query and query + 1
+struct GpuTimerScope
+{
+	u32		pass;		// index into gGpuPassStats
+	u32		query;
+};
+
+// Timestamp queries of one frame slot. Pool is reset when slot is reused and read once its fence
+// is signaled, so results are always available and reading them never waits for GPU.
+struct GpuTimers
+{
+	VkQueryPool					pool;		// VK_NULL_HANDLE if GPU timers are off
+	u32							used;		// queries written this frame
+	std::vector<GpuTimerScope>	scopes;
+};
+
+// GPU time of one pass over all frames, by pass name
+struct GpuPassStats
+{
+	std::string			name;
+	std::vector<float>	samples;	// ms, one per frame the pass ran in
+};
+
+// How often CPU has to wait for GPU to release a frame slot
+struct FramePacingStats
+{
+	u64		frames;
+	u64		waits;
+	double	waitMs;
+	double	maxWaitMs;
+};
+
+// Bump allocator over big chunks for objects living as long as instance or device.
+// Frees are only counted, chunks are released all at once on destroy.
+struct HostArena
+{
+	std::vector<u8*>	chunks;			// all chunkSize bytes, allocations are carved from last one
+	std::vector<u8*>	bigBlocks;		// allocations too big for a chunk, one block each
+	size_t				chunkSize;
+	size_t				used;			// bytes taken from last chunk
+	std::mutex			mutex;
+};
+
+// Linear allocator for command scope allocations, which never outlive the call they were made in.
+// State packs count of live allocations (high 32 bits) and used bytes (low 32 bits), so it
+// can be rewound only when nothing is live. Allocations which don't fit go to heap.
+struct HostLinearAllocator
+{
+	u8*					memory;
+	u32					size;
+	std::atomic<u64>	state;
+};
+
+struct HostScopeStats
+{
+	std::atomic<u64>	allocations;
+	std::atomic<u64>	reallocations;
+	std::atomic<u64>	frees;
+	std::atomic<u64>	bytes;				// total requested
+	std::atomic<i64>	liveBytes;
+	std::atomic<u64>	internalAllocations;	// driver's own allocations it only reports to us
+	std::atomic<u64>	internalBytes;
+};
+
+// Host memory handed to driver through VkAllocationCallbacks
+struct HostAllocator
+{
+	VkAllocationCallbacks	callbacks;
+	HostArena				arena;
+	HostLinearAllocator		frameLinear;
+	HostScopeStats			scopes[VK_SYSTEM_ALLOCATION_SCOPE_RANGE_SIZE];
+	std::atomic<u64>		linearFallbacks;	// command scope allocations which didn't fit
+	std::atomic<u64>		frameResets;
+};
+
+// Large VkDeviceMemory block resources are carved from with buddy system. Offsets of free
+// blocks of order k are multiples of MIN_ALLOCATION_SIZE << k, so alignment comes for free.
+struct MemoryBlock
+{
+	VkDeviceMemory							memory;			// null for fake heaps
+	u8*										mapped;			// host visible blocks stay mapped
+	VkDeviceSize							size;
+	u32										memoryType;
+	bool									linear;			// holds buffers and linear images only
+	bool									dedicated;		// single allocation, no buddy lists
+	u32										maxOrder;
+	std::vector< std::set<VkDeviceSize> >	freeLists;		// free offsets per order
+	std::unordered_map<VkDeviceSize, u32>	orders;			// order of every allocated offset
+	VkDeviceSize							allocatedBytes;	// rounded to buddy sizes
+	VkDeviceSize							requestedBytes;
+};
+
+struct MemoryAllocation
+{
+	MemoryBlock*	block;
+	VkDeviceMemory	memory;
+	VkDeviceSize	offset;
+	VkDeviceSize	size;			// requested size
+	void*			mapped;			// nullptr if memory is not host visible
+	u32				memoryType;
+	bool			coherent;
+};
+
+// Sub-allocator over memory types described by props. With device == VK_NULL_HANDLE no Vulkan calls
+// are made at all, so allocation logic can be tested and benchmarked on made up heaps without GPU.
+struct MemoryAllocator
+{
+	VkDevice							device;
+	VkPhysicalDeviceMemoryProperties	props;
+	VkDeviceSize						blockSize;				// power of two
+	VkDeviceSize						bufferImageGranularity;
+	VkDeviceSize						nonCoherentAtomSize;
+	std::vector<MemoryBlock*>			blocks;
+	VkDeviceSize						heapUsage[VK_MAX_MEMORY_HEAPS];	// bytes of blocks per heap
+	u64									allocations;			// live sub-allocations
+	u64									deviceAllocations;		// vkAllocateMemory calls so far
+	std::mutex							mutex;
+};
+
+// Copy queued into upload ring, waiting to be recorded
+struct UploadBufferCopy
+{
+	VkBuffer		dst;
+	VkBufferCopy	region;
+};
+
+struct UploadImageCopy
+{
+	VkImage				dst;
+	VkBufferImageCopy	region;
+};
+
+struct UploadStats
+{
+	u64		uploads;
+	u64		bytes;
+	u64		regions;
+	u64		flushes;
+	u64		stalls;
+	u64		laneRegions;	// regions copied on transfer queue
+	u64		transfers;		// ownership transfers, counted once per release/acquire pair
+};
+
+// Copies of one frame done on transfer queue. Every lane submit signals done and the next graphics
+// submit of the frame waits for it, so there is at most one lane submit in flight per frame.
+struct UploadLane
+{
+	CommandAllocator		allocator;		// of transfer family, reset with the slot
+	VkSemaphore				done;
+	bool					waitPending;	// lane submitted, graphics hasn't waited for it yet
+	std::vector<VkBuffer>	returnBuffers;	// streamed buffers handed back to transfer queue at frame end
+};
+
+// Persistently mapped staging ring. Positions are monotonic, ring offset is position % size.
+// [tail, flushedHead) holds copies recorded into command buffers still in flight,
+// [flushedHead, head) holds copies queued but not recorded yet.
+struct UploadRing
+{
+	VkBuffer						buffer;
+	MemoryAllocation				memory;
+	u8*								data;
+	VkDeviceSize					size;
+	VkDeviceSize					alignment;		// optimalBufferCopyOffsetAlignment
+	VkDeviceSize					head;
+	VkDeviceSize					flushedHead;
+	VkDeviceSize					tail;
+	std::vector<UploadBufferCopy>	bufferCopies;
+	std::vector<UploadImageCopy>	imageCopies;
+	CommandAllocator				stallAllocator;	// for copies queued outside of frames, submitted right away when ring is full
+	UploadStats						stats;
+};
+
+// One slot of frames in flight ring. CPU records frame N+1 into next slot while GPU is still
+// executing frame N, slot is reused only after its fence is signaled.
+struct FrameSlot
+{
+	CommandAllocator		cmdAllocator;		// reset as a whole when slot is reused
+	VkCommandBuffer			cmd;				// primary command buffer of the frame
+	VkSemaphore				acquireSemaphore;	// signaled when swapchain image is acquired
+	VkSemaphore				renderSemaphore;	// signaled when rendering is done, present waits for it
+	VkFence					fence;				// signaled when GPU is done with the slot
+	bool					submitted;
+	u64						frame;				// number of frame recorded into slot
+	std::function<void()>	onComplete;			// called once fence is signaled, before slot is reused
+	std::vector<CommandAllocator>	threadAllocators;	// one per recording thread, reset with the slot
+	VkDeviceSize			uploadEnd;			// upload ring position freed when fence is signaled
+	VkBuffer				overlay;			// overlay texels uploaded by the frame
+	MemoryAllocation		overlayMemory;
+	UploadLane				uploads;
+	ComputeLane				compute;
+	u64						startTicks;			// when frame started, for latency
+	bool					latencyPending;		// GPU completion of frame not seen yet
+	i32						inputRecord;		// index into gInputRecords, -1 if frame consumed no input
+	GpuTimers				timers;				// per pass GPU time of frame recorded into slot
+};
+
+// One logical device per GPU used for batch jobs. Context owns everything a job needs,
+// so device threads never touch globals of the main device.
+struct GpuContext
+{
+	std::string			name;
+	VkPhysicalDevice	physicalDevice;
+	VkDevice			device;
+	VkQueue				queue;
+	u32					familyIndex;
+	VkCommandPool		pool;
+	VkCommandBuffer		cmd;
+	VkFence				fence;
+	MemoryAllocator		memory;
+	VkImage				image;			// render target of jobs
+	MemoryAllocation	imageMemory;
+	VkBuffer			readback;
+	MemoryAllocation	readbackMemory;
+	std::thread			thread;
+	u32					jobs;			// jobs done by this device
+	double				busyMs;
+};
+
+// Independent unit of work. record fills command buffer, complete runs once GPU is done with it.
+struct GpuJob
+{
+	std::function<void( GpuContext&, VkCommandBuffer )>	record;
+	std::function<void( GpuContext& )>					complete;
+};
+
+// Submission waiting for its fence on completion thread
+struct PendingSubmit
+{
+	VkFence					fence;
+	u64						serial;
+	std::function<void()>	onComplete;
+};
+
+// Offscreen render target used in headless mode. Image lives in device local memory,
+// finished frame is copied to host visible readback buffer which stays mapped.
+struct OffscreenTarget
+{
+	VkImage				image;
+	MemoryAllocation	imageMemory;
+	VkBuffer			readback;
+	MemoryAllocation	readbackMemory;
+};
+
+// Steps of startup, every stage comes after all stages it depends on
+enum StartupStageId
+{
+	STARTUP_WINDOW,
+	STARTUP_INSTANCE,
+	STARTUP_DEVICE_LIST,
+	STARTUP_PHYSICAL_DEVICE,
+	STARTUP_QUEUES,
+	STARTUP_DEVICE,
+	STARTUP_WORKERS,
+	STARTUP_COMPLETION,
+	STARTUP_COMMAND_BUFFERS,
+	STARTUP_SWAPCHAIN,
+	STARTUP_UPLOAD_RING,
+	STARTUP_OFFSCREEN,
+	STARTUP_FRAME_RING,
+	STARTUP_STAGE_COUNT
+};
+
+enum StartupState
+{
+	STARTUP_PENDING,
+	STARTUP_UNUSED,			// not needed in this mode, stages depending on it don't wait for it
+	STARTUP_RUNNING,
+	STARTUP_DONE,
+	STARTUP_FAILED,
+	STARTUP_SKIPPED,		// stage it depends on failed
+};
+
+// Node of startup graph, deps is mask of stages which have to be done before it starts
+struct StartupStage
+{
+	const char*				name;
+	std::function<bool()>	run;
+	u32						deps;
+	bool					mainThread;		// has to run on main thread
+	StartupState			state;
+	bool					ranOnMain;
+	double					startMs;		// since startup began
+	double					ms;
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Globals
@@ -52,28 +661,146 @@ struct SwapChainBuffer
 // WinAPI stuff
 HWND									ghWnd;
 HINSTANCE								ghInstance;
-bool									gClose = false;
+std::atomic<bool>						gClose( false );	// set by window thread, render thread stops on it
 u32										gWidth = 640;
 u32										gHeight = 480;
 
+// Run settings (see parseCommandLine)
+bool									gHeadless = false;	// render offscreen, no window and no surface at all
+u32										gHeadlessFrames = 600;	// frames rendered in headless mode before exit
+bool									gHeadlessDump = false;	// write finished frames to disk as .ppm
+u64										gTimerFrequency = 0;	// QueryPerformanceCounter ticks per second
+u32										gBenchSubmits = 0;	// run submit benchmark with this count of submits
+bool									gMultiGpu = false;	// shard headless frames across all usable GPUs
+u32										gBenchAllocs = 0;	// run memory allocator benchmark on fake heaps with this count of operations
+bool									gSelfTest = false;	// run CPU side self tests and exit
+u32										gSelfTestFailures = 0;
+bool									gHostAlloc = false;	// pass our host allocator to driver instead of system heap
+
+// CPU zones, every thread records into its own chunks
+std::atomic<bool>						gZonesEnabled( false );	// checked as zone starts, can be flipped any time
+std::string								gZoneFile = "zones.json";	// Chrome trace event JSON written on exit
+std::vector<ZoneThread*>				gZoneThreads;		// registered on first zone of each thread
+std::mutex								gZoneThreadsMutex;
+__declspec(thread) ZoneThread*			gZoneThread = nullptr;	// of calling thread
+__declspec(thread) const char*			gZoneThreadName = nullptr;
+u64										gZoneStartTicks = 0;	// trace time 0
+
+// render thread, talks to window thread through lock-free queues only
+std::thread								gRenderThread;
+std::atomic<bool>						gRenderDone( false );	// render thread finished, window may be destroyed
+HANDLE									gRenderWakeEvent = NULL;	// set on every window event, render thread sleeps on it while minimized
+SpscQueue<WindowEvent, 256>				gWindowEvents;		// window thread -> render thread
+SpscQueue<RenderEvent, 64>				gRenderEvents;		// render thread -> window thread
+u32										gDroppedWindowEvents = 0;	// queue was full, written by window thread only
+
+// input latency, owned by render thread
+u64										gPendingInputTicks = 0;	// oldest input not consumed by a frame yet
+u32										gPendingInputCount = 0;
+std::vector<InputFrameRecord>			gInputRecords;		// one per frame which consumed input
+std::string								gLatencyCsvFile;	// per frame records are written here if set
+
+// Multi GPU jobs
+std::vector<GpuContext*>				gGpuContexts;
+std::vector<GpuJob>						gGpuJobs;
+std::atomic<u32>						gNextGpuJob;		// shared queue every device pulls from
+
 // Vulkan stuff
+HostAllocator							gHostAllocator;
+VkAllocationCallbacks*					gAllocator = nullptr;	// passed to every vkCreate*/vkDestroy*, nullptr means driver default
 VkInstance								gInstance;			// Like Direct3D instance
-VkPhysicalDevice						gDevices[1];		// Just list of videoadapters presented in system
+std::vector<DeviceInfo>					gDevices;			// Just list of videoadapters presented in system
 u32										gDeviceCount = 0;	// Count of physical videadapters in the system
+VkPhysicalDevice						gPhysicalDevice = VK_NULL_HANDLE;	// the one device is created on
+i32										gDeviceIndex = -1;	// forced device, -1 means best scored one
+std::string								gDeviceName;		// forced device by part of its name
+const char*								gDeviceCacheFile = "device_cache.txt";
+const char*								gConfigFile = "vulkan_init.cfg";
+std::vector<std::string>				gLayers;			// -layer, enabled on instance and every device
 
 VkDevice								gDevice;			// Vulkan logical device as D3D11Device
 
 // queue info
 std::vector<VkQueueFamilyProperties>	gQueueProps;		// What is queue in vulkan???
 u32										gQueueCount = 0;	// Number of queues of device
-u32										gQueueFamilyIndex = -1;	// Selected queue index
-VkDeviceQueueCreateInfo					gQueueInfo = {};	// Info about selected queue
-float									gQueuePriorities[1] = { 1.0f };
-VkQueue									gQueue;
+u32										gQueueFamilyIndex = -1;	// Selected graphics queue family
+std::vector<VkDeviceQueueCreateInfo>	gQueueInfos;		// one per used family
+float									gQueuePriorities[QUEUE_TYPE_COUNT] = { 1.0f, 1.0f, 1.0f };
+DeviceQueue								gQueues[QUEUE_TYPE_COUNT];
+std::mutex								gQueueMutexes[QUEUE_TYPE_COUNT];
+bool									gSingleQueue = false;	// everything goes to graphics queue
+bool									gAsyncCompute = false;	// run suitable frame work on compute queue
+ComputeStats							gComputeStats;
+
+// image state tracking
+std::unordered_map<VkImage, TrackedImage>	gTrackedImages;
+std::vector<VkImageMemoryBarrier>		gPendingImageBarriers;	// merged into one vkCmdPipelineBarrier on flush
+std::unordered_map<VkBuffer, BufferState>	gTrackedBuffers;
+std::vector<VkBufferMemoryBarrier>		gPendingBufferBarriers;
+VkPipelineStageFlags					gPendingSrcStages = 0;
+VkPipelineStageFlags					gPendingDstStages = 0;
+
+// submit batching
+std::vector<BatchedSubmit>				gBatchedSubmits;	// submits collected since last flush
+std::vector<VkCommandBuffer>			gBatchCmds;
+std::vector<VkSemaphore>				gBatchWaits;
+std::vector<VkPipelineStageFlags>		gBatchWaitStages;
+std::vector<VkSemaphore>				gBatchSignals;
+std::vector<VkSubmitInfo>				gBatchInfos;		// kept to avoid allocations on flush
+std::mutex								gBatchMutex;
+SubmitBatchStats						gBatchStats = {};
+
+// frame graph rebuilt every frame, vectors keep their capacity
+FrameGraph								gFrameGraph;
+bool									gPrintGraph = true;	// print first compiled graph
+
+// frames in flight
+std::vector<FrameSlot>					gFrames;			// ring of frame slots
+u32										gFramesInFlight = 2;	// ring depth
+bool									gFramesInFlightSet = false;	// forced from command line, policy doesn't change it
+u64										gFrameNumber = 0;	// next frame to record
+FrameSlot*								gRecordingFrame = nullptr;	// between beginFrame() and endFrame()
+std::vector<u8>							gOverlayTexels;		// written every frame, kept to avoid allocations
+FramePacingStats						gFramePacing = {};
+
+// GPU timers
+bool									gGpuTimers = false;	// time frame graph passes with timestamp queries
+u64										gTimestampMask = 0;	// valid bits of graphics queue timestamps
+std::vector<GpuPassStats>				gGpuPassStats;
+u64										gGpuTimerOverflows = 0;	// passes not timed because slot ran out of queries
+u64										gGpuTimerMisses = 0;	// frames which results weren't available after fence
+
+// worker threads, caller of runParallel() works as worker 0
+std::vector<std::thread>				gWorkers;
+u32										gWorkerCount = 0;	// workers including calling thread, 0 means one per core
+std::mutex								gWorkMutex;
+std::condition_variable					gWorkCondition;		// wakes workers when new work is posted
+std::condition_variable					gWorkDoneCondition;	// wakes caller when all workers are done
+const std::function<void( u32, u32 )>*	gWorkFunc = nullptr;	// job( jobIndex, workerIndex )
+u32										gWorkCount = 0;
+std::atomic<u32>						gWorkNext;			// next job to take
+u32										gWorkBusy = 0;		// workers still running current work
+u64										gWorkGeneration = 0;
+bool									gWorkQuit = false;
+
+// fences
+std::vector<VkFence>					gFreeFences;		// signaled and reset fences ready for reuse
+u32										gFencesCreated = 0;
+std::mutex								gFencePoolMutex;
+
+// async submit completion
+std::deque<PendingSubmit>				gPendingSubmits;	// submits which fences are not signaled yet, oldest first
+std::mutex								gPendingMutex;
+std::condition_variable					gPendingCondition;	// wakes completion thread and serial waiters
+std::thread								gCompletionThread;
+bool									gCompletionQuit = false;
+u64										gSubmitSerial = 0;	// last serial given to async submit
+u64										gCompletedSerial = 0;	// all submits up to this serial are finished
 
 // command buffers for selected queue
-VkCommandPool							gCmdPool;			// OK, it looks like command buffers in DirectX 11
+CommandAllocator						gCmdAllocator;		// OK, it looks like command buffers in DirectX 11
 VkCommandBuffer							gCmd;				// ...
+CommandAllocatorStats					gCmdAllocatorStats;
 
 // swapchaing info
 VkSurfaceKHR							gSurface;			// surface selected for drawing
@@ -82,549 +809,6513 @@ std::vector<VkPresentModeKHR>			gPresentModes;		// surface supported present mod
 VkPresentModeKHR						gPresentMode;		// selected present mode
 VkSwapchainKHR							gSwapchain;			// main swapchain
 std::vector<SwapChainBuffer>			gSwapBuffers;		// images used in swapchain
+std::vector<RetiredSwapchain>			gRetiredSwapchains;	// waiting for frames which use them
+bool									gSwapchainDirty = false;	// resized or out of date, recreated before next frame
+bool									gMinimized = false;	// surface has zero size, nothing to render
+SwapchainStats							gSwapchainStats;
+
+// presentation policies, default keeps MAILBOX > IMMEDIATE > FIFO order
+const PresentPolicyDesc					gPresentPolicies[PRESENT_POLICY_COUNT] =
+{
+	{ "low_latency",	{ VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR }, 1, 1, 0.0 },
+	{ "vsync",			{ VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR }, 1, 2, 0.0 },
+	{ "max_throughput",	{ VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR }, 2, 3, 0.0 },
+	{ "power_save",		{ VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR }, 0, 2, 1000.0 / 30.0 },
+};
+PresentPolicy							gPresentPolicy = PRESENT_LOW_LATENCY;
+bool									gPresentPolicySet = false;	// picked with -present_policy, ring depth follows it
+double									gTargetFrameMs = -1.0;	// -target_fps, negative means policy default
+FramePacer								gFramePacer;
 
 // surface formats
 std::vector<VkSurfaceFormatKHR>			gFormates;			// supported surface formates
 VkFormat								gFormat;			// selected format
 
+// memory
+VkPhysicalDeviceProperties				gDeviceProps;		// limits of selected device
+VkPhysicalDeviceMemoryProperties		gMemoryProps;		// memory types and heaps of selected device
+MemoryAllocator							gMemoryAllocator;	// all device memory goes through it
+VkDeviceSize							gMemoryBlockSize = 64 * 1024 * 1024;
+UploadRing								gUploadRing;		// staging memory for all uploads
+VkDeviceSize							gUploadRingSize = 32 * 1024 * 1024;
+
+// headless rendering
+std::vector<OffscreenTarget>			gOffscreenTargets;	// images we render to instead of swapchain, one per frame slot
+
+// startup graph, see runStartup()
+StartupStage							gStartup[STARTUP_STAGE_COUNT];
+std::mutex								gStartupMutex;
+std::condition_variable					gStartupCondition;	// signaled whenever stage finishes
+std::vector<std::thread>				gStartupThreads;	// one per stage run off main thread, joined when startup ends
+u64										gStartupTicks = 0;	// startup began
+double									gStartupMs = 0.0;	// wall time of whole startup
+bool									gSerialStartup = false;	// run stages one by one on main thread
+
 
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
-// WinAPI
+// Utils
 //
-LRESULT CALLBACK wndCallback( HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam )
+u64 getTimerTicks()
 {
-	switch( msg )
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter( &counter );
+	return counter.QuadPart;
+}
+
+u64 getTimerFrequency()
+{
+	if( !gTimerFrequency )
 	{
-	case WM_CLOSE:
-		DestroyWindow( hwnd );
-		gClose = true;
-		break;
-	default:
-		return DefWindowProc(hwnd, msg, wparam, lparam);
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency( &freq );
+		gTimerFrequency = freq.QuadPart;
 	}
-	return 0;
+	return gTimerFrequency;
 }
 
-bool createWindow()
+double ticksToMs( u64 ticks )
 {
-	std::cout << "creating window...";
-	ghInstance = GetModuleHandle( NULL );
-	WNDCLASS wndclass = {};
-	wndclass.lpszClassName	= "vulkan_test";
-	wndclass.cbClsExtra		= 0;
-	wndclass.style			= CS_HREDRAW | CS_VREDRAW;
-	wndclass.lpfnWndProc	= &wndCallback;
-	wndclass.cbWndExtra		= 0;
-	wndclass.hbrBackground	= (HBRUSH)COLOR_WINDOW;
-	wndclass.hCursor		= NULL;
-	wndclass.hIcon			= NULL;
-	wndclass.hInstance		= ghInstance;
-	wndclass.lpszMenuName	= NULL;
+	return (double)ticks * 1000.0 / (double)getTimerFrequency();
+}
 
-	if( !RegisterClass( &wndclass ) )
+u64 msToTicks( double ms )
+{
+	return (u64)( ms * (double)getTimerFrequency() / 1000.0 );
+}
+
+// Nearest rank percentile of sorted samples, p in [0, 100]
+float percentile( const std::vector<float>& sorted, u32 p )
+{
+	return sorted.empty() ? 0.0f : sorted[min( (u32)( sorted.size() * p / 100 ), (u32)sorted.size() - 1 )];
+}
+
+// Returns false if queue is full. Producer side only.
+template< typename T, u32 Capacity >
+bool spscPush( SpscQueue<T, Capacity>& queue, const T& item )
+{
+	u32 head = queue.head.load( std::memory_order_relaxed );
+	if( head - queue.tail.load( std::memory_order_acquire ) == Capacity )
 	{
-		std::cout << "error registering window class" << std::endl;
 		return false;
 	}
 
-	ghWnd = CreateWindow("vulkan_test", "Vulkan Test", WS_OVERLAPPEDWINDOW,	CW_USEDEFAULT, 
-						  CW_USEDEFAULT, gWidth, gHeight, NULL, NULL, ghInstance, NULL);
-	if( !ghWnd )
+	queue.items[head & ( Capacity - 1 )] = item;
+	queue.head.store( head + 1, std::memory_order_release );
+	return true;
+}
+
+// Returns false if queue is empty. Consumer side only.
+template< typename T, u32 Capacity >
+bool spscPop( SpscQueue<T, Capacity>& queue, T* item )
+{
+	u32 tail = queue.tail.load( std::memory_order_relaxed );
+	if( tail == queue.head.load( std::memory_order_acquire ) )
 	{
-		std::cout << "error creating window\n";
 		return false;
 	}
 
-	ShowWindow( ghWnd, false );
-
-	std::cout << "window created\n";
+	*item = queue.items[tail & ( Capacity - 1 )];
+	queue.tail.store( tail + 1, std::memory_order_release );
 	return true;
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//
-// Vulkan init
-//
-bool initVkInstance( const char* appName, const char* engineName )
+void parseCommandLine( int argc, char** argv )
 {
-	std::cout << "\nTrying to init vulkan API\n";
-
-	std::vector<const char*> extensions;
-	std::vector<const char*> layers;
-
-	extensions.push_back( VK_KHR_SURFACE_EXTENSION_NAME );
-	extensions.push_back( VK_KHR_WIN32_SURFACE_EXTENSION_NAME );
-
-	VkApplicationInfo appInfo = {};
-	appInfo.apiVersion = VK_API_VERSION_1_0;
-	appInfo.applicationVersion = 1;
-	appInfo.engineVersion = 1;
-	appInfo.pApplicationName = appName;
-	appInfo.pEngineName = engineName;
-	appInfo.pNext = nullptr;
-	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-
+	for( int i = 1; i < argc; ++i )
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
 
-	VkInstanceCreateInfo instInfo = {};
-	instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-	instInfo.pNext = nullptr;
-	instInfo.pApplicationInfo = &appInfo;
-	instInfo.flags = 0;
-	instInfo.enabledExtensionCount = extensions.size();
-	instInfo.ppEnabledExtensionNames = extensions.size() ? extensions.data() : nullptr;
-	instInfo.enabledLayerCount = layers.size();
-	instInfo.ppEnabledLayerNames = layers.size() ? layers.data() : nullptr;
-
-	VkResult res;
+		if( !strcmp( arg, "-headless" ) )
+		{
+			gHeadless = true;
+		}
+		else if( !strcmp( arg, "-dump" ) )
+		{
+			gHeadlessDump = true;
+		}
+		else if( !strcmp( arg, "-host_alloc" ) )
+		{
+			gHostAlloc = true;
+		}
+		else if( !strcmp( arg, "-multi_gpu" ) )
+		{
+			gMultiGpu = true;
+			gHeadless = true;
+		}
+		else if( !strcmp( arg, "-frames" ) && value )
+		{
+			gHeadlessFrames = atoi( value );
+			++i;
+		}
+		else if( !strcmp( arg, "-bench_submit" ) && value )
+		{
+			gBenchSubmits = atoi( value );
+			gHeadless = true;
+			++i;
+		}
+		else if( !strcmp( arg, "-self_test" ) )
+		{
+			gSelfTest = true;
+		}
+		else if( !strcmp( arg, "-bench_alloc" ) && value )
+		{
+			gBenchAllocs = atoi( value );
+			++i;
+		}
+		else if( !strcmp( arg, "-memory_block_mb" ) && value )
+		{
+			gMemoryBlockSize = (VkDeviceSize)max( atoi( value ), 1 ) * 1024 * 1024;
+			++i;
+		}
+		else if( !strcmp( arg, "-upload_ring_mb" ) && value )
+		{
+			gUploadRingSize = (VkDeviceSize)max( atoi( value ), 1 ) * 1024 * 1024;
+			++i;
+		}
+		else if( !strcmp( arg, "-single_queue" ) )
+		{
+			gSingleQueue = true;
+		}
+		else if( !strcmp( arg, "-async_compute" ) )
+		{
+			gAsyncCompute = true;
+		}
+		else if( !strcmp( arg, "-gpu_timers" ) )
+		{
+			gGpuTimers = true;
+		}
+		else if( !strcmp( arg, "-serial_startup" ) )
+		{
+			gSerialStartup = true;
+		}
+		else if( !strcmp( arg, "-zones" ) && value )
+		{
+			gZoneFile = value;
+			gZonesEnabled = true;
+			++i;
+		}
+		else if( !strcmp( arg, "-device" ) && value )
+		{
+			gDeviceIndex = atoi( value );
+			++i;
+		}
+		else if( !strcmp( arg, "-layer" ) && value )
+		{
+			gLayers.push_back( value );
+			++i;
+		}
+		else if( !strcmp( arg, "-latency_csv" ) && value )
+		{
+			gLatencyCsvFile = value;
+			++i;
+		}
+		else if( !strcmp( arg, "-device_name" ) && value )
+		{
+			gDeviceName = value;
+			++i;
+		}
+		else if( !strcmp( arg, "-frames_in_flight" ) && value )
+		{
+			gFramesInFlight = max( atoi( value ), 1 );
+			gFramesInFlightSet = true;
+			++i;
+		}
+		else if( !strcmp( arg, "-present_policy" ) && value )
+		{
+			u32 policy = 0;
+			while( policy < PRESENT_POLICY_COUNT && strcmp( gPresentPolicies[policy].name, value ) )
+			{
+				++policy;
+			}
+			if( policy < PRESENT_POLICY_COUNT )
+			{
+				gPresentPolicy = (PresentPolicy)policy;
+				gPresentPolicySet = true;
+			}
+			else
+				std::cout << "unknown present policy " << value << std::endl;
+			++i;
+		}
+		else if( !strcmp( arg, "-target_fps" ) && value )
+		{
+			double fps = atof( value );
+			gTargetFrameMs = fps > 0.0 ? 1000.0 / fps : 0.0;
+			++i;
+		}
+		else if( !strcmp( arg, "-record_threads" ) && value )
+		{
+			gWorkerCount = max( atoi( value ), 1 );
+			++i;
+		}
+		else if( !strcmp( arg, "-width" ) && value )
+		{
+			gWidth = atoi( value );
+			++i;
+		}
+		else if( !strcmp( arg, "-height" ) && value )
+		{
+			gHeight = atoi( value );
+			++i;
+		}
+		else
+		{
+			std::cout << "unknown argument " << arg << std::endl;
+		}
+	}
+}
 
-	res = vkCreateInstance( &instInfo, nullptr, &gInstance );
-	if( res == VK_ERROR_INCOMPATIBLE_DRIVER )
+// Config file holds the same options as command line, whitespace separated. Text in quotes is one
+// option, # starts comment till end of line. It's parsed before command line, which overrides it.
+void loadConfig( const char* path )
+{
+	std::ifstream file( path );
+	if( !file )
 	{
-		std::cout << "Incompatible driver\n";
+		return;
 	}
-	else if( res )
+
+	std::vector<std::string> tokens( 1, std::string( path ) );
+	std::string line;
+	while( std::getline( file, line ) )
 	{
-		std::cout << "Unknown error\n";
+		std::string token;
+		bool quoted = false;
+		bool started = false;
+		for( u32 i = 0; i <= line.size(); ++i )
+		{
+			char c = i < line.size() ? line[i] : ' ';
+			if( !quoted && c == '#' )
+			{
+				c = ' ';
+				i = line.size();
+			}
+
+			if( c == '"' )
+			{
+				quoted = !quoted;
+				started = true;
+			}
+			else if( quoted || ( c != ' ' && c != '\t' && c != '\r' ) )
+			{
+				token += c;
+				started = true;
+			}
+			else if( started )
+			{
+				tokens.push_back( token );
+				token.clear();
+				started = false;
+			}
+		}
 	}
-	else
+
+	std::vector<char*> args;
+	for( u32 i = 0; i < tokens.size(); ++i )
 	{
-		std::cout << "Instance inited\n";
-		return true;
+		args.push_back( &tokens[i][0] );
 	}
-	return false;
+	std::cout << "config " << path << ": " << tokens.size() - 1 << " options\n";
+	parseCommandLine( args.size(), args.data() );
 }
 
-void getDevicesList()
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CPU zones
+//
+// Zone costs two timer reads and one store into thread's own chunk, no locks and no allocations
+// except a new chunk every ZoneChunk::events zones. Threads register once, which takes a lock.
+// -zones file enables profiler from start, F9 toggles it while window is open. Zones are exported
+// as Chrome trace events, which chrome://tracing and Perfetto open.
+//
+ZoneChunk* newZoneChunk()
 {
-	vkEnumeratePhysicalDevices( gInstance, &gDeviceCount, gDevices );
+	ZoneChunk* chunk = new ZoneChunk;
+	chunk->count = 0;
+	chunk->next = nullptr;
+	return chunk;
+}
 
-	std::cout << "Device list:\n";
-	for( u32 i = 0; i < gDeviceCount; ++i )
+ZoneThread* registerZoneThread()
+{
+	ZoneThread* thread = new ZoneThread;
+	thread->name = gZoneThreadName;
+	thread->first = newZoneChunk();
+	thread->current = thread->first;
+
+	std::lock_guard<std::mutex> lock( gZoneThreadsMutex );
+	thread->id = gZoneThreads.size();
+	gZoneThreads.push_back( thread );
+	return thread;
+}
+
+// Optional, threads which never call it are named by their id
+void setZoneThreadName( const char* name )
+{
+	gZoneThreadName = name;
+	if( gZoneThread )
 	{
-		VkPhysicalDeviceProperties properties;
-		vkGetPhysicalDeviceProperties( gDevices[i], &properties );
-		std::cout << "\t" << properties.deviceName << std::endl;
+		gZoneThread->name = name;
 	}
 }
 
-bool findSupportedQueue()
+void recordZone( const char* name, u64 begin, u64 end )
 {
-	std::cout << "looking for supported queue...";
-	
-	vkGetPhysicalDeviceQueueFamilyProperties( gDevices[0], &gQueueCount, nullptr );
+	ZoneThread* thread = gZoneThread;
+	if( !thread )
+	{
+		thread = gZoneThread = registerZoneThread();
+	}
 
-	gQueueProps.resize( gQueueCount );
-	vkGetPhysicalDeviceQueueFamilyProperties( gDevices[0], &gQueueCount, gQueueProps.data() );
+	ZoneChunk* chunk = thread->current;
+	u32 count = chunk->count.load( std::memory_order_relaxed );
+	if( count == sizeof( chunk->events ) / sizeof( chunk->events[0] ) )
+	{
+		ZoneChunk* next = newZoneChunk();
+		chunk->next.store( next, std::memory_order_release );
+		thread->current = chunk = next;
+		count = 0;
+	}
 
-	VkWin32SurfaceCreateInfoKHR createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-	createInfo.pNext = nullptr;
-	createInfo.hinstance = ghInstance;
-	createInfo.hwnd = ghWnd;
-	createInfo.flags = 0;
+	ZoneEvent& event = chunk->events[count];
+	event.name = name;
+	event.begin = begin;
+	event.end = end;
+	chunk->count.store( count + 1, std::memory_order_release );
+}
 
-	gQueueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	gQueueInfo.pNext = nullptr;
-	gQueueInfo.queueCount = 1;
-	gQueueInfo.pQueuePriorities = gQueuePriorities;
+CpuZone::CpuZone( const char* zoneName )
+	: name( zoneName )
+	, begin( gZonesEnabled.load( std::memory_order_relaxed ) ? getTimerTicks() : 0 )
+{
+}
 
-	VkResult res = vkCreateWin32SurfaceKHR( gInstance, &createInfo, nullptr, &gSurface );
+CpuZone::~CpuZone()
+{
+	if( begin )
+	{
+		recordZone( name, begin, getTimerTicks() );
+	}
+}
 
-	if( res != VK_SUCCESS )
+void writeJsonString( std::ostream& out, const char* str )
+{
+	out << '"';
+	for( ; *str; ++str )
 	{
-		std::cout << "surface creating error " << res << std::endl;
+		if( *str == '"' || *str == '\\' )
+			out << '\\';
+		out << *str;
+	}
+	out << '"';
+}
+
+// Writes zones recorded so far as Chrome trace event JSON, times in microseconds
+bool saveZones( const std::string& path )
+{
+	std::ofstream file( path.c_str() );
+	if( !file )
+	{
+		std::cout << "can't write zones to " << path << std::endl;
 		return false;
 	}
 
-	gQueueFamilyIndex = -1;
-	for( u32 i = 0; i < gQueueCount; ++i )
+	std::vector<ZoneThread*> threads;
 	{
-		if( gQueueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT )
+		std::lock_guard<std::mutex> lock( gZoneThreadsMutex );
+		threads = gZoneThreads;
+	}
+
+	double usPerTick = 1000000.0 / (double)getTimerFrequency();
+	u64 zones = 0;
+	bool first = true;
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" << std::fixed << std::setprecision( 3 );
+	for( u32 t = 0; t < threads.size(); ++t )
+	{
+		const ZoneThread* thread = threads[t];
+		if( thread->name )
 		{
-			VkBool32 support = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR( gDevices[0], i, gSurface, &support );
-			if( support == VK_TRUE )
+			file << ( first ? "" : ",\n" ) << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id << ",\"args\":{\"name\":";
+			writeJsonString( file, thread->name );
+			file << "}}";
+			first = false;
+		}
+
+		for( const ZoneChunk* chunk = thread->first; chunk; chunk = chunk->next.load( std::memory_order_acquire ) )
+		{
+			u32 count = chunk->count.load( std::memory_order_acquire );
+			for( u32 i = 0; i < count; ++i )
 			{
-				gQueueFamilyIndex = i;
-				break;
+				const ZoneEvent& event = chunk->events[i];
+				file << ( first ? "" : ",\n" ) << "{\"name\":";
+				writeJsonString( file, event.name );
+				file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+					 << ",\"ts\":" << ( event.begin - gZoneStartTicks ) * usPerTick
+					 << ",\"dur\":" << ( event.end - event.begin ) * usPerTick << "}";
+				first = false;
 			}
+			zones += count;
 		}
 	}
-	if( gQueueFamilyIndex == -1 )
-	{
-		std::cout << "supported queue not found\n" << std::endl;
-		return false;
-	}
+	file << "\n]}\n";
 
-	gQueueInfo.queueFamilyIndex = gQueueFamilyIndex;
-	
-	std::cout << "found\n";
+	std::cout << zones << " CPU zones of " << threads.size() << " threads written to " << path << std::endl;
 	return true;
 }
 
-bool createDevice()
+void destroyZones()
 {
-	std::cout << "creating vulkan device...";
-
-	std::vector<const char*> extensions;
-	std::vector<const char*> layers;
-
-	extensions.push_back( VK_KHR_SWAPCHAIN_EXTENSION_NAME );
-
-	VkDeviceCreateInfo deviceInfo = {};
-	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	deviceInfo.pNext = nullptr;
-	deviceInfo.queueCreateInfoCount = 1;
-	deviceInfo.pQueueCreateInfos = &gQueueInfo;
-	deviceInfo.enabledExtensionCount = extensions.size();
-	deviceInfo.ppEnabledExtensionNames = extensions.size() ? extensions.data() : nullptr;
-	deviceInfo.enabledLayerCount = layers.size();
-	deviceInfo.ppEnabledLayerNames = layers.size() ? layers.data() : nullptr;
-	deviceInfo.pEnabledFeatures = nullptr;
-
-	VkResult res = vkCreateDevice( gDevices[0], &deviceInfo, nullptr, &gDevice );
-	if( res != VK_SUCCESS )
+	std::lock_guard<std::mutex> lock( gZoneThreadsMutex );
+	for( u32 t = 0; t < gZoneThreads.size(); ++t )
 	{
-		std::cout << "vulkan device create error " << res <<std::endl;
-		return false;
+		ZoneChunk* chunk = gZoneThreads[t]->first;
+		while( chunk )
+		{
+			ZoneChunk* next = chunk->next;
+			delete chunk;
+			chunk = next;
+		}
+		delete gZoneThreads[t];
 	}
-	
-	std::cout << "device created\n";
-	return true;
+	gZoneThreads.clear();
+	gZoneThread = nullptr;
 }
- 
-bool initCommandBuffers()
-{
-	std::cout << "creating command buffers...";
-	VkCommandPoolCreateInfo cmdPoolInfo = {};
-	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	cmdPoolInfo.pNext = nullptr;
-	cmdPoolInfo.queueFamilyIndex = gQueueFamilyIndex;
-	cmdPoolInfo.flags = 0;
 
-	VkResult res = vkCreateCommandPool( gDevice, &cmdPoolInfo, nullptr, &gCmdPool );
-	if( res != VK_SUCCESS )
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// WinAPI
+//
+// Window thread never touches render state, it only hands events over
+void postWindowEvent( const WindowEvent& event )
+{
+	if( !spscPush( gWindowEvents, event ) )
 	{
-		std::cout << "error creating command pool\n";
-		return false;
+		++gDroppedWindowEvents;
 	}
-	else
+	if( gRenderWakeEvent )
 	{
-		VkCommandBufferAllocateInfo cmdInfo = {};
-		cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		cmdInfo.pNext = nullptr;
-		cmdInfo.commandPool = gCmdPool;
-		cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		cmdInfo.commandBufferCount = 1;
+		SetEvent( gRenderWakeEvent );
+	}
+}
 
-		res = vkAllocateCommandBuffers( gDevice, &cmdInfo, &gCmd );
-		if( res != VK_SUCCESS )
+void processRenderEvents()
+{
+	RenderEvent event;
+	while( spscPop( gRenderEvents, &event ) )
+	{
+		switch( event.type )
 		{
-			std::cout << "error allocating command buffer\n";
-			vkDestroyCommandPool( gDevice, gCmdPool, nullptr );
-			return false;
+		case RENDER_EVENT_STATS:
+			{
+				std::ostringstream title;
+				title << "Vulkan Test - " << std::fixed << std::setprecision( 1 ) << 1000.0 / event.frameMs << " fps, "
+					  << std::setprecision( 2 ) << event.frameMs << " ms";
+				SetWindowText( ghWnd, title.str().c_str() );
+			}
+			break;
 		}
 	}
 
-	std::cout << "command buffer created\n";
-	return true;
+	// Surface can go only after render thread is done presenting to it
+	if( gRenderDone.exchange( false ) )
+	{
+		DestroyWindow( ghWnd );
+	}
 }
 
-bool getSurfaceFormats()
+LRESULT CALLBACK wndCallback( HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam )
 {
-	VkResult res;
-	u32 formatCount = 0;
-	res = vkGetPhysicalDeviceSurfaceFormatsKHR( gDevices[0], gSurface, &formatCount, nullptr );
-	if( res == VK_SUCCESS )
+	// Every keyboard and mouse message is stamped on arrival, before any queueing of our own.
+	// It's still handled below, system keys like Alt+F4 need default handling.
+	if( ( msg >= WM_KEYFIRST && msg <= WM_KEYLAST ) || ( msg >= WM_MOUSEFIRST && msg <= WM_MOUSELAST ) )
 	{
-		gFormates.resize( formatCount );
-		res = vkGetPhysicalDeviceSurfaceFormatsKHR( gDevices[0], gSurface, &formatCount, gFormates.data() );
-		if( res != VK_SUCCESS )
-		{
-			std::cout << "getting surface formats failed\n";
-			return false;
-		}
+		WindowEvent event = {};
+		event.type = WINDOW_EVENT_INPUT;
+		event.message = msg;
+		event.ticks = getTimerTicks();
+		postWindowEvent( event );
+	}
 
-		if( formatCount == 1 && gFormates[0].format == VK_FORMAT_UNDEFINED )
+	switch( msg )
+	{
+	case WM_CLOSE:
+		// Render thread finishes its frames and asks for window to be destroyed
+		gClose = true;
+		if( gRenderWakeEvent )
 		{
-			gFormat = VK_FORMAT_B8G8R8A8_UNORM;
+			SetEvent( gRenderWakeEvent );
 		}
 		else
 		{
-			gFormat = gFormates[0].format;
+			DestroyWindow( hwnd );
 		}
+		break;
+	case WM_DESTROY:
+		PostQuitMessage( 0 );
+		break;
+	case WM_SIZE:
+		{
+			WindowEvent event = {};
+			event.type = WINDOW_EVENT_RESIZE;
+			event.width = LOWORD( lparam );
+			event.height = HIWORD( lparam );
+			event.minimized = wparam == SIZE_MINIMIZED || !event.width || !event.height;
+			postWindowEvent( event );
+		}
+		break;
+	case WM_RENDER_EVENTS:
+		processRenderEvents();
+		break;
+	case WM_KEYDOWN:
+		if( wparam == VK_F9 )
+		{
+			gZonesEnabled = !gZonesEnabled;
+		}
+		break;
+	default:
+		return DefWindowProc(hwnd, msg, wparam, lparam);
 	}
-	else
-	{
-		std::cout << "getting surface formats failed\n";
-		return false;
-	}
-	return true;
-}
-
-bool getSurfacePresentModes()
-{
-	u32 modesCount = 0;
-	HR( vkGetPhysicalDeviceSurfacePresentModesKHR( gDevices[0], gSurface, &modesCount, nullptr ) );
-	gPresentModes.resize( modesCount );
-	HR( vkGetPhysicalDeviceSurfacePresentModesKHR( gDevices[0], gSurface, &modesCount, gPresentModes.data() ) );
-	return true;
+	return 0;
 }
 
-bool setImageLayout( VkCommandBuffer cmdBuf, VkImage image, VkImageAspectFlags aspects, VkImageLayout oldLayout, VkImageLayout newLayout )
+bool createWindow()
 {
-	VkImageMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.pNext = nullptr;
-	barrier.srcAccessMask = 0;
-	barrier.dstAccessMask = 0;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = aspects;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
+	CpuZone zone( "createWindow" );
+	ghInstance = GetModuleHandle( NULL );
+	WNDCLASS wndclass = {};
+	wndclass.lpszClassName	= "vulkan_test";
+	wndclass.cbClsExtra		= 0;
+	wndclass.style			= CS_HREDRAW | CS_VREDRAW;
+	wndclass.lpfnWndProc	= &wndCallback;
+	wndclass.cbWndExtra		= 0;
+	wndclass.hbrBackground	= (HBRUSH)COLOR_WINDOW;
+	wndclass.hCursor		= NULL;
+	wndclass.hIcon			= NULL;
+	wndclass.hInstance		= ghInstance;
+	wndclass.lpszMenuName	= NULL;
 
-	switch( oldLayout )
+	if( !RegisterClass( &wndclass ) )
 	{
-		case VK_IMAGE_LAYOUT_PREINITIALIZED:
-			barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-			break;
+		std::cout << "error registering window class" << std::endl;
+		return false;
+	}
+
+	ghWnd = CreateWindow("vulkan_test", "Vulkan Test", WS_OVERLAPPEDWINDOW,	CW_USEDEFAULT, 
+						  CW_USEDEFAULT, gWidth, gHeight, NULL, NULL, ghInstance, NULL);
+	if( !ghWnd )
+	{
+		std::cout << "error creating window\n";
+		return false;
+	}
+
+	ShowWindow( ghWnd, false );
+
+	std::cout << "window created\n";
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Image state tracking
+//
+// Tracker remembers layout and last accesses of every subresource (and of every buffer as a whole)
+// in order commands are recorded, together with queue owning it. Recording order is execution order
+// only within one queue. Compute and transfer queues are ordered against graphics by semaphores and
+// resources change hands only through compute and upload lanes, which add queue family ownership
+// transfers when families differ. transitionImage() only queues barriers, flushBarriers() emits all
+// of them with one vkCmdPipelineBarrier using exact stages. Used from the rendering thread only.
+//
+const VkAccessFlags ACCESS_WRITE_MASK = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+										VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |
+										VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+// Accesses image in given layout is used for
+VkAccessFlags layoutAccess( VkImageLayout layout )
+{
+	switch( layout )
+	{
+		case VK_IMAGE_LAYOUT_GENERAL:
+			return VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-			barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			break;
+			return VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-			barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-			break;
-		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			break;
+			return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+			return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
 		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-			barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			break;
+			return VK_ACCESS_SHADER_READ_BIT;
+		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+			return VK_ACCESS_TRANSFER_READ_BIT;
+		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+			return VK_ACCESS_TRANSFER_WRITE_BIT;
+		case VK_IMAGE_LAYOUT_PREINITIALIZED:
+			return VK_ACCESS_HOST_WRITE_BIT;
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+			return VK_ACCESS_MEMORY_READ_BIT;
+		default:
+			return 0;
 	}
+}
 
-	switch( newLayout )
+// Pipeline stages which access image in given layout
+VkPipelineStageFlags layoutStages( VkImageLayout layout )
+{
+	switch( layout )
 	{
-		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			break;
-		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-			barrier.srcAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			break;
+		case VK_IMAGE_LAYOUT_GENERAL:
+			return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
 		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-			barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			break;
+			return VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-			barrier.dstAccessMask |=
-				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-			break;
+			return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+			return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-			barrier.srcAccessMask =
-				VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			break;
+			return VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+			return VK_PIPELINE_STAGE_TRANSFER_BIT;
+		case VK_IMAGE_LAYOUT_PREINITIALIZED:
+			return VK_PIPELINE_STAGE_HOST_BIT;
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+			return VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		default:
+			return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
 	}
-
-	vkCmdPipelineBarrier( cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
-						  0, 0, nullptr, 0, nullptr, 1, &barrier );
-
-	return true;
 }
 
-void beginCommandBuffer( VkCommandBuffer cmdBuf )
+void trackImage( VkImage image, VkImageAspectFlags aspects, u32 mipLevels, u32 arrayLayers, VkImageLayout layout )
 {
-	VkCommandBufferBeginInfo cmd = {};
-	cmd.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	cmd.pNext = nullptr;
-	cmd.flags = 0;
-	cmd.pInheritanceInfo = 0;
+	TrackedImage& tracked = gTrackedImages[image];
+	tracked.aspects = aspects;
+	tracked.mipLevels = mipLevels;
+	tracked.arrayLayers = arrayLayers;
 
-	HR( vkBeginCommandBuffer( cmdBuf, &cmd ) );
+	ImageSubresourceState state;
+	state.layout = layout;
+	state.access = 0;
+	state.stages = 0;
+	tracked.states.assign( mipLevels * arrayLayers, state );
+	tracked.queue = QUEUE_GRAPHICS;
 }
 
-void endCommandBuffer( VkCommandBuffer cmdBuf )
+void untrackImage( VkImage image )
 {
-	HR( vkEndCommandBuffer( cmdBuf ) );
+	gTrackedImages.erase( image );
 }
 
-void executeQueue( VkCommandBuffer cmd )
+// Overrides state of whole image after operation tracker can't see, like swapchain acquire.
+// Stages are the ones following barriers have to wait for, e.g. semaphore wait stage.
+void setImageState( VkImage image, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
 {
-	const VkCommandBuffer cmds[] = { cmd };
-	VkFenceCreateInfo fenceInfo;
-	VkFence drawFence;
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.pNext = nullptr;
-	fenceInfo.flags = 0;
-	vkCreateFence( gDevice, &fenceInfo, nullptr, &drawFence );
+	TrackedImage& tracked = gTrackedImages[image];
+	for( u32 i = 0; i < tracked.states.size(); ++i )
+	{
+		tracked.states[i].layout = layout;
+		tracked.states[i].access = access;
+		tracked.states[i].stages = stages;
+	}
+}
 
-	VkPipelineStageFlags pipeStageFlags = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	VkSubmitInfo submitInfo[1] = {};
-	submitInfo[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo[0].pNext = nullptr;
-	submitInfo[0].waitSemaphoreCount = 0;
-	submitInfo[0].pWaitSemaphores = nullptr;
-	submitInfo[0].pWaitDstStageMask = &pipeStageFlags;
-	submitInfo[0].commandBufferCount = 1;
-	submitInfo[0].pCommandBuffers = cmds;
-	submitInfo[0].signalSemaphoreCount = 0;
-	submitInfo[0].pSignalSemaphores = nullptr;
+VkImageLayout getImageLayout( VkImage image, u32 mip = 0, u32 layer = 0 )
+{
+	const TrackedImage& tracked = gTrackedImages[image];
+	return tracked.states[mip * tracked.arrayLayers + layer].layout;
+}
 
-	HR( vkQueueSubmit( gQueue, 1, submitInfo, drawFence ) );
+// Returns true if going from state to new layout/access needs a barrier. Reads after reads in the same
+// layout don't, they just extend the set of stages a later write has to wait for.
+bool needsBarrier( const ImageSubresourceState& state, VkImageLayout layout, VkAccessFlags access )
+{
+	return state.layout != layout || ( state.access & ACCESS_WRITE_MASK ) || ( access & ACCESS_WRITE_MASK );
+}
 
-	VkResult res;
-	do {
-		res = vkWaitForFences( gDevice, 1, &drawFence, VK_TRUE, 100000000 );
-	} while( res == VK_TIMEOUT );
+void queueImageBarrier( VkImage image, const TrackedImage& tracked, const ImageSubresourceState& oldState,
+						VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages,
+						u32 baseMip, u32 mipCount, u32 baseLayer, u32 layerCount )
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = oldState.access & ACCESS_WRITE_MASK;
+	barrier.dstAccessMask = access;
+	barrier.oldLayout = oldState.layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = tracked.aspects;
+	barrier.subresourceRange.baseMipLevel = baseMip;
+	barrier.subresourceRange.levelCount = mipCount;
+	barrier.subresourceRange.baseArrayLayer = baseLayer;
+	barrier.subresourceRange.layerCount = layerCount;
+	gPendingImageBarriers.push_back( barrier );
 
-	vkDestroyFence( gDevice, drawFence, nullptr );
+	gPendingSrcStages |= oldState.stages ? oldState.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	gPendingDstStages |= stages;
 }
 
-bool initSwapChains()
+// Queues transition of subresource range into layout for given access at given stages.
+// Subresources sharing the same old state are covered by one barrier.
+void transitionImage( VkImage image, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages,
+					  u32 baseMip = 0, u32 mipCount = VK_REMAINING_MIP_LEVELS,
+					  u32 baseLayer = 0, u32 layerCount = VK_REMAINING_ARRAY_LAYERS )
 {
-	std::cout << "initing swapchain...";
-	if( !getSurfaceFormats() || !getSurfacePresentModes() )
+	std::unordered_map<VkImage, TrackedImage>::iterator it = gTrackedImages.find( image );
+	if( it == gTrackedImages.end() )
 	{
-		return false;
+		std::cout << "transition of untracked image\n";
+		return;
 	}
 
-	VkResult res;
-	res = vkGetPhysicalDeviceSurfaceCapabilitiesKHR( gDevices[0], gSurface, &gSurfaceCaps );
-	if( res != VK_SUCCESS )
+	TrackedImage& tracked = it->second;
+	if( mipCount == VK_REMAINING_MIP_LEVELS )
+		mipCount = tracked.mipLevels - baseMip;
+	if( layerCount == VK_REMAINING_ARRAY_LAYERS )
+		layerCount = tracked.arrayLayers - baseLayer;
+
+	// Most often whole range is in one state, then single barrier is enough
+	const ImageSubresourceState first = tracked.states[baseMip * tracked.arrayLayers + baseLayer];
+	bool uniform = true;
+	for( u32 mip = baseMip; mip < baseMip + mipCount && uniform; ++mip )
 	{
-		std::cout << "error getting surface capabilities\n";
+		for( u32 layer = baseLayer; layer < baseLayer + layerCount; ++layer )
+		{
+			const ImageSubresourceState& state = tracked.states[mip * tracked.arrayLayers + layer];
+			if( state.layout != first.layout || state.access != first.access || state.stages != first.stages )
+			{
+				uniform = false;
+				break;
+			}
+		}
 	}
 
-	VkExtent2D swapChainExtent = gSurfaceCaps.currentExtent;
-	if( std::find( gPresentModes.begin(), gPresentModes.end(), VK_PRESENT_MODE_MAILBOX_KHR ) != gPresentModes.end() )
-		gPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-	else if( std::find( gPresentModes.begin(), gPresentModes.end(), VK_PRESENT_MODE_IMMEDIATE_KHR ) != gPresentModes.end() )
-		gPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+	if( uniform )
+	{
+		if( needsBarrier( first, layout, access ) )
+		{
+			queueImageBarrier( image, tracked, first, layout, access, stages, baseMip, mipCount, baseLayer, layerCount );
+		}
+	}
 	else
-		gPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	{
+		// Otherwise one barrier per run of layers in the same state inside every mip
+		for( u32 mip = baseMip; mip < baseMip + mipCount; ++mip )
+		{
+			u32 runStart = baseLayer;
+			for( u32 layer = baseLayer + 1; layer <= baseLayer + layerCount; ++layer )
+			{
+				const ImageSubresourceState& runState = tracked.states[mip * tracked.arrayLayers + runStart];
+				if( layer < baseLayer + layerCount )
+				{
+					const ImageSubresourceState& state = tracked.states[mip * tracked.arrayLayers + layer];
+					if( state.layout == runState.layout && state.access == runState.access && state.stages == runState.stages )
+					{
+						continue;
+					}
+				}
 
-	uint32_t desiredNumberOfSwapChainImages = gSurfaceCaps.minImageCount + 1;
-	desiredNumberOfSwapChainImages = gSurfaceCaps.maxImageCount ? max( desiredNumberOfSwapChainImages, gSurfaceCaps.maxImageCount ) : desiredNumberOfSwapChainImages;
+				if( needsBarrier( runState, layout, access ) )
+				{
+					queueImageBarrier( image, tracked, runState, layout, access, stages, mip, 1, runStart, layer - runStart );
+				}
+				runStart = layer;
+			}
+		}
+	}
 
-	VkSurfaceTransformFlagBitsKHR preTransform;
-	preTransform = gSurfaceCaps.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR ? VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR : gSurfaceCaps.currentTransform;
+	for( u32 mip = baseMip; mip < baseMip + mipCount; ++mip )
+	{
+		for( u32 layer = baseLayer; layer < baseLayer + layerCount; ++layer )
+		{
+			ImageSubresourceState& state = tracked.states[mip * tracked.arrayLayers + layer];
+			if( needsBarrier( state, layout, access ) )
+			{
+				state.layout = layout;
+				state.access = access;
+				state.stages = stages;
+			}
+			else
+			{
+				state.access |= access;
+				state.stages |= stages;
+			}
+		}
+	}
+}
 
-	VkSwapchainCreateInfoKHR swapChain = {};
-	swapChain.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-	swapChain.pNext = nullptr;
-	swapChain.surface = gSurface;
-	swapChain.minImageCount = desiredNumberOfSwapChainImages;
-	swapChain.imageFormat = gFormat;
-	swapChain.imageExtent = swapChainExtent;
-	swapChain.preTransform = preTransform;
-	swapChain.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	swapChain.imageArrayLayers = 1;
-	swapChain.presentMode = gPresentMode;
-	swapChain.oldSwapchain = NULL;
-	swapChain.clipped = true;
-	swapChain.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
-	swapChain.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-	swapChain.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	swapChain.queueFamilyIndexCount = 0;
-	swapChain.pQueueFamilyIndices = nullptr;
+// Same as above with access and stages derived from layout
+void transitionImage( VkImage image, VkImageLayout layout )
+{
+	transitionImage( image, layout, layoutAccess( layout ), layoutStages( layout ) );
+}
 
-	res = vkCreateSwapchainKHR( gDevice, &swapChain, nullptr, &gSwapchain );
-	if( res != VK_SUCCESS )
+void trackBuffer( VkBuffer buffer )
+{
+	BufferState& state = gTrackedBuffers[buffer];
+	state.access = 0;
+	state.stages = 0;
+	state.queue = QUEUE_GRAPHICS;
+	state.streamed = false;
+	state.releaseFrame = 0;
+}
+
+void untrackBuffer( VkBuffer buffer )
+{
+	gTrackedBuffers.erase( buffer );
+}
+
+// Queues barrier before buffer is accessed with given access at given stages, if previous use requires it
+void transitionBuffer( VkBuffer buffer, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	BufferState& state = gTrackedBuffers[buffer];
+	if( !( state.access & ACCESS_WRITE_MASK ) && !( access & ACCESS_WRITE_MASK ) )
 	{
-		std::cout << "error creating swapchain "<< res << std::endl;
-		return false;
+		state.access |= access;
+		state.stages |= stages;
+		return;
 	}
 
-	std::vector<VkImage> images;
-	u32 imagesCount = 0;
-	HR( vkGetSwapchainImagesKHR(gDevice, gSwapchain, &imagesCount, nullptr ) );
-	images.resize( imagesCount );
-	HR( vkGetSwapchainImagesKHR(gDevice, gSwapchain, &imagesCount, images.data() ) );
+	if( state.stages )
+	{
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = state.access & ACCESS_WRITE_MASK;
+		barrier.dstAccessMask = access;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		gPendingBufferBarriers.push_back( barrier );
 
-	beginCommandBuffer( gCmd );
-	vkGetDeviceQueue( gDevice, gQueueFamilyIndex, 0, &gQueue );
+		gPendingSrcStages |= state.stages;
+		gPendingDstStages |= stages;
+	}
 
-	gSwapBuffers.resize( imagesCount );
-	for( u32 i = 0; i < gSwapBuffers.size(); ++i )
-	{
-		VkImageViewCreateInfo imageView = {};
-		imageView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		imageView.pNext = nullptr;
-		imageView.format = gFormat;
-		imageView.components.r = VK_COMPONENT_SWIZZLE_R;
-		imageView.components.g = VK_COMPONENT_SWIZZLE_G;
-		imageView.components.b = VK_COMPONENT_SWIZZLE_B;
-		imageView.components.a = VK_COMPONENT_SWIZZLE_A;
-		imageView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		imageView.subresourceRange.baseMipLevel = 0;
-		imageView.subresourceRange.levelCount = 1;
-		imageView.subresourceRange.baseArrayLayer = 0;
-		imageView.subresourceRange.layerCount = 1;
-		imageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		imageView.flags = 0;
-		imageView.image = images[i];
+	state.access = access;
+	state.stages = stages;
+}
 
-		setImageLayout( gCmd, gSwapBuffers[i].image, VK_IMAGE_ASPECT_COLOR_BIT, 
-						VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL );
-		HR( vkCreateImageView( gDevice, &imageView, nullptr, &gSwapBuffers[i].view ) );
+// Emits all queued transitions as one barrier call
+void flushBarriers( VkCommandBuffer cmdBuf )
+{
+	if( gPendingImageBarriers.empty() && gPendingBufferBarriers.empty() )
+	{
+		return;
 	}
 
-	endCommandBuffer( gCmd );
-	executeQueue( gCmd );
+	vkCmdPipelineBarrier( cmdBuf, gPendingSrcStages, gPendingDstStages, 0, 0, nullptr,
+						  gPendingBufferBarriers.size(), gPendingBufferBarriers.size() ? gPendingBufferBarriers.data() : nullptr,
+						  gPendingImageBarriers.size(), gPendingImageBarriers.size() ? gPendingImageBarriers.data() : nullptr );
 
-	std::cout << "inited\n";
-	return true;
+	gPendingImageBarriers.clear();
+	gPendingBufferBarriers.clear();
+	gPendingSrcStages = 0;
+	gPendingDstStages = 0;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
-// Main
+// Host memory
 //
-int main()
+// Driver host allocations are routed by scope: instance and device scope objects go to arena,
+// command scope to per-frame linear allocator, object and cache scope to system heap.
+// Every allocation is preceded by header, so free and realloc know where memory came from.
+//
+enum HostAllocationKind
+{
+	HOST_HEAP,
+	HOST_ARENA,
+	HOST_LINEAR,
+};
+
+struct HostAllocationHeader
+{
+	size_t	size;
+	u8*		raw;			// start of heap allocation
+	u8		kind;
+	u8		scope;
+};
+
+const size_t HOST_ARENA_CHUNK_SIZE = 1024 * 1024;
+const u32 HOST_LINEAR_SIZE = 1024 * 1024;
+
+// Places header and aligned user memory into raw block of size + alignment + sizeof( header ) bytes
+void* placeHostAllocation( u8* raw, size_t size, size_t alignment, HostAllocationKind kind, VkSystemAllocationScope scope )
 {
-	if( createWindow() )
+	alignment = max( alignment, sizeof( void* ) );
+	size_t address = ( (size_t)raw + sizeof( HostAllocationHeader ) + alignment - 1 ) & ~( alignment - 1 );
+
+	HostAllocationHeader* header = (HostAllocationHeader*)address - 1;
+	header->size = size;
+	header->raw = raw;
+	header->kind = (u8)kind;
+	header->scope = (u8)scope;
+	return (void*)address;
+}
+
+HostAllocationHeader* getHostAllocationHeader( void* memory )
+{
+	return (HostAllocationHeader*)memory - 1;
+}
+
+u8* arenaAllocate( HostArena& arena, size_t size )
+{
+	std::lock_guard<std::mutex> lock( arena.mutex );
+
+	// Big allocations get their own block, current chunk stays in use
+	if( size > arena.chunkSize / 4 )
 	{
-		if( initVkInstance( "vulkan_test", "lamp_engine" ) )
-		{
-			getDevicesList();
+		u8* block = (u8*)malloc( size );
+		if( block )
+			arena.bigBlocks.push_back( block );
+		return block;
+	}
 
-			if( findSupportedQueue() && createDevice() )
-			{
-				if( initCommandBuffers() )
-				{
-					if( initSwapChains() )
-					{
-						ShowWindow( ghWnd, true );
-
-						// Start loop
-						MSG msg;
-						while( !gClose && GetMessage( &msg, NULL, 0, 0 ) > 0 )
-						{
-							TranslateMessage( &msg );
-							DispatchMessage( &msg );
-						}
-					}
+	if( arena.chunks.empty() || arena.used + size > arena.chunkSize )
+	{
+		u8* chunk = (u8*)malloc( arena.chunkSize );
+		if( !chunk )
+			return nullptr;
+		arena.chunks.push_back( chunk );
+		arena.used = 0;
+	}
 
-					vkFreeCommandBuffers( gDevice, gCmdPool, 1, &gCmd );
-					vkDestroyCommandPool( gDevice, gCmdPool, nullptr );
-				}
+	u8* result = arena.chunks.back() + arena.used;
+	arena.used += size;
+	return result;
+}
 
-				vkDestroyDevice( gDevice, nullptr );
-			}
-			vkDestroyInstance( gInstance, nullptr );
+u8* linearAllocate( HostLinearAllocator& linear, size_t size )
+{
+	u64 state = linear.state.load();
+	for( ;; )
+	{
+		u64 used = state & 0xFFFFFFFF;
+		if( used + size > linear.size )
+		{
+			return nullptr;
+		}
+
+		if( linear.state.compare_exchange_weak( state, state + ( (u64)1 << 32 ) + size ) )
+		{
+			return linear.memory + used;
 		}
 	}
+}
+
+void* VKAPI_CALL hostAllocation( void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope )
+{
+	HostAllocator& allocator = *(HostAllocator*)userData;
 
-	system("PAUSE");
+	size_t rawSize = size + max( alignment, sizeof( void* ) ) + sizeof( HostAllocationHeader );
+	HostAllocationKind kind = HOST_HEAP;
+	u8* raw = nullptr;
+
+	if( scope == VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE || scope == VK_SYSTEM_ALLOCATION_SCOPE_DEVICE )
+	{
+		kind = HOST_ARENA;
+		raw = arenaAllocate( allocator.arena, rawSize );
+	}
+	else if( scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND )
+	{
+		kind = HOST_LINEAR;
+		raw = linearAllocate( allocator.frameLinear, rawSize );
+		if( !raw )
+		{
+			++allocator.linearFallbacks;
+			kind = HOST_HEAP;
+		}
+	}
+
+	if( kind == HOST_HEAP )
+	{
+		raw = (u8*)malloc( rawSize );
+	}
+
+	if( !raw )
+	{
+		return nullptr;
+	}
+
+	HostScopeStats& stats = allocator.scopes[scope];
+	++stats.allocations;
+	stats.bytes += size;
+	stats.liveBytes += size;
+
+	return placeHostAllocation( raw, size, alignment, kind, scope );
+}
+
+void VKAPI_CALL hostFree( void* userData, void* memory )
+{
+	if( !memory )
+	{
+		return;
+	}
+
+	HostAllocator& allocator = *(HostAllocator*)userData;
+	HostAllocationHeader* header = getHostAllocationHeader( memory );
+
+	HostScopeStats& stats = allocator.scopes[header->scope];
+	++stats.frees;
+	stats.liveBytes -= header->size;
+
+	switch( header->kind )
+	{
+	case HOST_HEAP:
+		free( header->raw );
+		break;
+	case HOST_LINEAR:
+		allocator.frameLinear.state -= (u64)1 << 32;
+		break;
+	case HOST_ARENA:
+		// Released with the whole arena
+		break;
+	}
+}
+
+void* VKAPI_CALL hostReallocation( void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope )
+{
+	if( !original )
+	{
+		return hostAllocation( userData, size, alignment, scope );
+	}
+
+	if( !size )
+	{
+		hostFree( userData, original );
+		return nullptr;
+	}
+
+	HostAllocator& allocator = *(HostAllocator*)userData;
+
+	// Spec requires original memory untouched if reallocation fails, so it's always allocate, copy and free
+	void* memory = hostAllocation( userData, size, alignment, scope );
+	if( memory )
+	{
+		memcpy( memory, original, min( size, getHostAllocationHeader( original )->size ) );
+		hostFree( userData, original );
+		++allocator.scopes[scope].reallocations;
+	}
+	return memory;
+}
+
+void VKAPI_CALL hostInternalAllocation( void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope )
+{
+	HostAllocator& allocator = *(HostAllocator*)userData;
+	++allocator.scopes[scope].internalAllocations;
+	allocator.scopes[scope].internalBytes += size;
+}
+
+void VKAPI_CALL hostInternalFree( void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope )
+{
+	HostAllocator& allocator = *(HostAllocator*)userData;
+	allocator.scopes[scope].internalBytes -= size;
+}
+
+void initHostAllocator( HostAllocator& allocator )
+{
+	allocator.arena.chunkSize = HOST_ARENA_CHUNK_SIZE;
+	allocator.arena.used = 0;
+
+	allocator.frameLinear.memory = (u8*)malloc( HOST_LINEAR_SIZE );
+	allocator.frameLinear.size = allocator.frameLinear.memory ? HOST_LINEAR_SIZE : 0;
+	allocator.frameLinear.state = 0;
+
+	allocator.callbacks.pUserData = &allocator;
+	allocator.callbacks.pfnAllocation = hostAllocation;
+	allocator.callbacks.pfnReallocation = hostReallocation;
+	allocator.callbacks.pfnFree = hostFree;
+	allocator.callbacks.pfnInternalAllocation = hostInternalAllocation;
+	allocator.callbacks.pfnInternalFree = hostInternalFree;
+}
+
+// Arena memory is released here, so it must be called after instance is destroyed
+void destroyHostAllocator( HostAllocator& allocator )
+{
+	for( u32 i = 0; i < allocator.arena.chunks.size(); ++i )
+	{
+		free( allocator.arena.chunks[i] );
+	}
+	allocator.arena.chunks.clear();
+	for( u32 i = 0; i < allocator.arena.bigBlocks.size(); ++i )
+	{
+		free( allocator.arena.bigBlocks[i] );
+	}
+	allocator.arena.bigBlocks.clear();
+
+	free( allocator.frameLinear.memory );
+	allocator.frameLinear.memory = nullptr;
+	allocator.frameLinear.size = 0;
+}
+
+// Called once per frame. Rewinds linear allocator if no command scope allocation is live.
+void resetHostFrameAllocator( HostAllocator& allocator )
+{
+	u64 state = allocator.frameLinear.state.load();
+	if( ( state >> 32 ) == 0 && state && allocator.frameLinear.state.compare_exchange_strong( state, 0 ) )
+	{
+		++allocator.frameResets;
+	}
+}
+
+void printHostAllocatorStats( HostAllocator& allocator )
+{
+	const char* names[] = { "command", "object", "cache", "device", "instance" };
+
+	std::cout << "host allocations:\n";
+	for( u32 i = 0; i < VK_SYSTEM_ALLOCATION_SCOPE_RANGE_SIZE; ++i )
+	{
+		HostScopeStats& stats = allocator.scopes[i];
+		std::cout << "\t" << std::setw( 8 ) << names[i] << ": " << stats.allocations << " allocs, " << stats.reallocations << " reallocs, "
+				  << stats.frees << " frees, " << stats.bytes / 1024 << " KB total, " << stats.liveBytes / 1024 << " KB live, "
+				  << stats.internalAllocations << " internal allocs\n";
+	}
+	std::cout << "\tarena " << allocator.arena.chunks.size() << " chunks, " << allocator.arena.bigBlocks.size()
+			  << " big blocks, linear allocator rewound " << allocator.frameResets << " times, "
+			  << allocator.linearFallbacks << " fallbacks to heap\n";
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Device memory
+//
+// Resources are sub-allocated from large blocks per memory type instead of one vkAllocateMemory each.
+// Buffers and linear images never share a block with optimal images when bufferImageGranularity > 1,
+// so they can't end up on the same granularity page. Requests bigger than half a block get memory
+// of their own, buddy rounding would waste most of a block on them anyway.
+//
+const VkDeviceSize MIN_ALLOCATION_SIZE = 256;
+
+u32 log2Ceil( VkDeviceSize value )
+{
+	u32 result = 0;
+	while( ( (VkDeviceSize)1 << result ) < value )
+	{
+		++result;
+	}
+	return result;
+}
+
+void initMemoryAllocator( MemoryAllocator& allocator, VkDevice device, const VkPhysicalDeviceMemoryProperties& props,
+						  const VkPhysicalDeviceLimits& limits, VkDeviceSize blockSize )
+{
+	allocator.device = device;
+	allocator.props = props;
+	allocator.blockSize = (VkDeviceSize)1 << log2Ceil( max( blockSize, MIN_ALLOCATION_SIZE ) );
+	allocator.bufferImageGranularity = limits.bufferImageGranularity;
+	allocator.nonCoherentAtomSize = max( limits.nonCoherentAtomSize, (VkDeviceSize)1 );
+	allocator.allocations = 0;
+	allocator.deviceAllocations = 0;
+	for( u32 i = 0; i < VK_MAX_MEMORY_HEAPS; ++i )
+	{
+		allocator.heapUsage[i] = 0;
+	}
+}
+
+void destroyMemoryBlock( MemoryAllocator& allocator, MemoryBlock* block )
+{
+	if( block->memory )
+	{
+		if( block->mapped )
+			vkUnmapMemory( allocator.device, block->memory );
+		vkFreeMemory( allocator.device, block->memory, gAllocator );
+	}
+	allocator.heapUsage[allocator.props.memoryTypes[block->memoryType].heapIndex] -= block->size;
+	delete block;
+}
+
+void destroyMemoryAllocator( MemoryAllocator& allocator )
+{
+	if( allocator.allocations )
+	{
+		std::cout << allocator.allocations << " device memory allocations leaked\n";
+	}
+	for( u32 i = 0; i < allocator.blocks.size(); ++i )
+	{
+		destroyMemoryBlock( allocator, allocator.blocks[i] );
+	}
+	allocator.blocks.clear();
+}
+
+MemoryBlock* createMemoryBlock( MemoryAllocator& allocator, u32 memoryType, bool linear, VkDeviceSize size, bool dedicated )
+{
+	// Real heaps are enforced by vkAllocateMemory, made up ones here
+	u32 heap = allocator.props.memoryTypes[memoryType].heapIndex;
+	if( !allocator.device && allocator.heapUsage[heap] + size > allocator.props.memoryHeaps[heap].size )
+	{
+		return nullptr;
+	}
+
+	MemoryBlock* block = new MemoryBlock();
+	block->memory = VK_NULL_HANDLE;
+	block->mapped = nullptr;
+	block->size = size;
+	block->memoryType = memoryType;
+	block->linear = linear;
+	block->dedicated = dedicated;
+	block->maxOrder = 0;
+	block->allocatedBytes = 0;
+	block->requestedBytes = 0;
+
+	if( !dedicated )
+	{
+		block->maxOrder = log2Ceil( size / MIN_ALLOCATION_SIZE );
+		block->freeLists.resize( block->maxOrder + 1 );
+		block->freeLists[block->maxOrder].insert( 0 );
+	}
+
+	if( allocator.device )
+	{
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+
+		VkResult res = vkAllocateMemory( allocator.device, &allocInfo, gAllocator, &block->memory );
+		if( res != VK_SUCCESS )
+		{
+			std::cout << "error allocating " << size << " bytes of device memory " << res << std::endl;
+			delete block;
+			return nullptr;
+		}
+
+		if( allocator.props.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT )
+		{
+			void* data = nullptr;
+			HR( vkMapMemory( allocator.device, block->memory, 0, VK_WHOLE_SIZE, 0, &data ) );
+			block->mapped = (u8*)data;
+		}
+	}
+	++allocator.deviceAllocations;
+	allocator.heapUsage[heap] += size;
+
+	allocator.blocks.push_back( block );
+	return block;
+}
+
+// Takes free buddy of given order, splitting bigger ones. Returns false if block has none.
+bool blockAllocate( MemoryBlock* block, u32 order, VkDeviceSize* offset )
+{
+	u32 k = order;
+	while( k <= block->maxOrder && block->freeLists[k].empty() )
+	{
+		++k;
+	}
+	if( k > block->maxOrder )
+	{
+		return false;
+	}
+
+	VkDeviceSize result = *block->freeLists[k].begin();
+	block->freeLists[k].erase( block->freeLists[k].begin() );
+
+	// Upper halves go back to free lists
+	while( k > order )
+	{
+		--k;
+		block->freeLists[k].insert( result + ( MIN_ALLOCATION_SIZE << k ) );
+	}
+
+	block->orders[result] = order;
+	block->allocatedBytes += MIN_ALLOCATION_SIZE << order;
+	*offset = result;
+	return true;
+}
+
+// Returns buddy to free lists merging it with free neighbours
+void blockFree( MemoryBlock* block, VkDeviceSize offset )
+{
+	std::unordered_map<VkDeviceSize, u32>::iterator it = block->orders.find( offset );
+	assert( it != block->orders.end() );
+	u32 order = it->second;
+	block->orders.erase( it );
+	block->allocatedBytes -= MIN_ALLOCATION_SIZE << order;
+
+	while( order < block->maxOrder )
+	{
+		VkDeviceSize buddy = offset ^ ( MIN_ALLOCATION_SIZE << order );
+		std::set<VkDeviceSize>::iterator found = block->freeLists[order].find( buddy );
+		if( found == block->freeLists[order].end() )
+		{
+			break;
+		}
+		block->freeLists[order].erase( found );
+		offset = min( offset, buddy );
+		++order;
+	}
+	block->freeLists[order].insert( offset );
+}
+
+// Picks memory type having required flags, preferring ones with preferred flags as well
+bool selectMemoryType( const MemoryAllocator& allocator, u32 typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, u32* typeIndex )
+{
+	for( u32 pass = 0; pass < 2; ++pass )
+	{
+		VkMemoryPropertyFlags flags = pass == 0 ? required | preferred : required;
+		for( u32 i = 0; i < allocator.props.memoryTypeCount; ++i )
+		{
+			if( ( typeBits & ( 1 << i ) ) && ( allocator.props.memoryTypes[i].propertyFlags & flags ) == flags )
+			{
+				*typeIndex = i;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// linear is true for buffers and linear tiled images, false for optimal tiled images
+bool allocateMemory( MemoryAllocator& allocator, const VkMemoryRequirements& reqs, VkMemoryPropertyFlags required,
+					 VkMemoryPropertyFlags preferred, bool linear, MemoryAllocation* allocation )
+{
+	u32 memoryType;
+	if( !selectMemoryType( allocator, reqs.memoryTypeBits, required, preferred, &memoryType ) )
+	{
+		std::cout << "no memory type with flags " << required << " for type bits " << reqs.memoryTypeBits << std::endl;
+		return false;
+	}
+
+	// With granularity of 1 everything can share blocks
+	bool kind = allocator.bufferImageGranularity > 1 ? linear : true;
+
+	std::lock_guard<std::mutex> lock( allocator.mutex );
+
+	MemoryBlock* block = nullptr;
+	VkDeviceSize offset = 0;
+	VkDeviceSize needed = max( max( reqs.size, reqs.alignment ), MIN_ALLOCATION_SIZE );
+
+	if( needed > allocator.blockSize / 2 )
+	{
+		block = createMemoryBlock( allocator, memoryType, kind, reqs.size, true );
+		if( !block )
+		{
+			return false;
+		}
+		block->allocatedBytes = reqs.size;
+	}
+	else
+	{
+		u32 order = log2Ceil( needed ) - log2Ceil( MIN_ALLOCATION_SIZE );
+		for( u32 i = 0; i < allocator.blocks.size(); ++i )
+		{
+			MemoryBlock* candidate = allocator.blocks[i];
+			if( candidate->memoryType == memoryType && candidate->linear == kind && !candidate->dedicated &&
+				blockAllocate( candidate, order, &offset ) )
+			{
+				block = candidate;
+				break;
+			}
+		}
+
+		if( !block )
+		{
+			block = createMemoryBlock( allocator, memoryType, kind, allocator.blockSize, false );
+			if( !block || !blockAllocate( block, order, &offset ) )
+			{
+				return false;
+			}
+		}
+	}
+	block->requestedBytes += reqs.size;
+	++allocator.allocations;
+
+	allocation->block = block;
+	allocation->memory = block->memory;
+	allocation->offset = offset;
+	allocation->size = reqs.size;
+	allocation->mapped = block->mapped ? block->mapped + offset : nullptr;
+	allocation->memoryType = memoryType;
+	allocation->coherent = ( allocator.props.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT ) != 0;
+	return true;
+}
+
+void freeMemory( MemoryAllocator& allocator, MemoryAllocation& allocation )
+{
+	if( !allocation.block )
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock( allocator.mutex );
+
+	MemoryBlock* block = allocation.block;
+	block->requestedBytes -= allocation.size;
+	--allocator.allocations;
+
+	bool release = block->dedicated;
+	if( !block->dedicated )
+	{
+		blockFree( block, allocation.offset );
+
+		// Keep one empty block per memory type around, so alloc/free patterns don't thrash vkAllocateMemory
+		if( !block->allocatedBytes )
+		{
+			for( u32 i = 0; i < allocator.blocks.size() && !release; ++i )
+			{
+				MemoryBlock* other = allocator.blocks[i];
+				release = other != block && !other->dedicated && !other->allocatedBytes &&
+						  other->memoryType == block->memoryType && other->linear == block->linear;
+			}
+		}
+	}
+
+	if( release )
+	{
+		allocator.blocks.erase( std::find( allocator.blocks.begin(), allocator.blocks.end(), block ) );
+		destroyMemoryBlock( allocator, block );
+	}
+	allocation = MemoryAllocation();
+}
+
+// Range of allocation aligned to nonCoherentAtomSize, as flush and invalidate require. Offset and size
+// select part of allocation, whole of it by default.
+VkMappedMemoryRange getMappedRange( MemoryAllocator& allocator, const MemoryAllocation& allocation,
+									VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE )
+{
+	if( size == VK_WHOLE_SIZE )
+	{
+		size = allocation.size - offset;
+	}
+
+	VkDeviceSize atom = allocator.nonCoherentAtomSize;
+	VkDeviceSize begin = ( allocation.offset + offset ) / atom * atom;
+	VkDeviceSize end = min( ( allocation.offset + offset + size + atom - 1 ) / atom * atom, allocation.block->size );
+
+	VkMappedMemoryRange range = {};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.pNext = nullptr;
+	range.memory = allocation.memory;
+	range.offset = begin;
+	range.size = end - begin;
+	return range;
+}
+
+// Host reads of non-coherent memory need invalidate
+void invalidateAllocation( MemoryAllocator& allocator, const MemoryAllocation& allocation )
+{
+	if( allocation.coherent || !allocation.memory )
+	{
+		return;
+	}
+
+	VkMappedMemoryRange range = getMappedRange( allocator, allocation );
+	HR( vkInvalidateMappedMemoryRanges( allocator.device, 1, &range ) );
+}
+
+// Host writes to non-coherent memory need flush before GPU reads them
+void flushAllocation( MemoryAllocator& allocator, const MemoryAllocation& allocation,
+					  VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE )
+{
+	if( allocation.coherent || !allocation.memory )
+	{
+		return;
+	}
+
+	VkMappedMemoryRange range = getMappedRange( allocator, allocation, offset, size );
+	HR( vkFlushMappedMemoryRanges( allocator.device, 1, &range ) );
+}
+
+bool allocateImageMemory( VkImage image, VkMemoryPropertyFlags required, MemoryAllocation* allocation )
+{
+	VkMemoryRequirements reqs;
+	vkGetImageMemoryRequirements( gDevice, image, &reqs );
+	if( !allocateMemory( gMemoryAllocator, reqs, required, 0, false, allocation ) )
+	{
+		return false;
+	}
+	HR( vkBindImageMemory( gDevice, image, allocation->memory, allocation->offset ) );
+	return true;
+}
+
+bool allocateBufferMemory( VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, MemoryAllocation* allocation )
+{
+	VkMemoryRequirements reqs;
+	vkGetBufferMemoryRequirements( gDevice, buffer, &reqs );
+	if( !allocateMemory( gMemoryAllocator, reqs, required, preferred, true, allocation ) )
+	{
+		return false;
+	}
+	HR( vkBindBufferMemory( gDevice, buffer, allocation->memory, allocation->offset ) );
+	return true;
+}
+
+// Usage and fragmentation per memory type. Internal fragmentation is space lost to rounding up
+// to buddy sizes, external is how much free space can't be served as one largest allocation.
+void printMemoryStats( MemoryAllocator& allocator )
+{
+	std::lock_guard<std::mutex> lock( allocator.mutex );
+
+	std::cout << "device memory: " << allocator.allocations << " allocations, " << allocator.blocks.size() << " blocks, "
+			  << allocator.deviceAllocations << " vkAllocateMemory calls\n";
+
+	for( u32 type = 0; type < allocator.props.memoryTypeCount; ++type )
+	{
+		u32 blocks = 0;
+		u32 dedicated = 0;
+		VkDeviceSize blockBytes = 0;
+		VkDeviceSize allocated = 0;
+		VkDeviceSize requested = 0;
+		VkDeviceSize largestFree = 0;
+
+		for( u32 i = 0; i < allocator.blocks.size(); ++i )
+		{
+			const MemoryBlock* block = allocator.blocks[i];
+			if( block->memoryType != type )
+			{
+				continue;
+			}
+
+			++blocks;
+			dedicated += block->dedicated ? 1 : 0;
+			blockBytes += block->size;
+			allocated += block->allocatedBytes;
+			requested += block->requestedBytes;
+			for( i32 k = (i32)block->maxOrder; k >= 0 && !block->dedicated; --k )
+			{
+				if( !block->freeLists[k].empty() )
+				{
+					largestFree = max( largestFree, MIN_ALLOCATION_SIZE << k );
+					break;
+				}
+			}
+		}
+		if( !blocks )
+		{
+			continue;
+		}
+
+		VkDeviceSize freeBytes = blockBytes - allocated;
+		std::cout << "\ttype " << type << ": " << blocks << " blocks (" << dedicated << " dedicated), "
+				  << blockBytes / 1024 << " KB reserved, " << requested / 1024 << " KB used, "
+				  << "internal fragmentation " << ( allocated ? 100.0 * ( allocated - requested ) / allocated : 0.0 ) << "%, "
+				  << "external fragmentation " << ( freeBytes ? 100.0 * ( freeBytes - largestFree ) / freeBytes : 0.0 ) << "%\n";
+	}
+}
+
+// Allocation made by allocator benchmark, with what was asked for
+struct BenchAllocation
+{
+	MemoryAllocation	allocation;
+	VkDeviceSize		alignment;
+	bool				linear;
+};
+
+// Checks what allocator handed out: alignment, allocations inside their blocks and not overlapping,
+// buffers and optimal images never on the same granularity page, heaps not over-committed, buddy
+// lists covering the rest of every block with no two free buddies left unmerged.
+// Prints every violation and returns their count.
+u32 checkAllocations( const MemoryAllocator& allocator, std::vector<BenchAllocation> live )
+{
+	u32 errors = 0;
+	for( u32 i = 0; i < live.size(); ++i )
+	{
+		const MemoryAllocation& a = live[i].allocation;
+		if( a.offset % live[i].alignment || a.offset + a.size > a.block->size )
+		{
+			std::cout << "\terror: allocation of " << a.size << " bytes at " << a.offset << " is misaligned or out of its block\n";
+			++errors;
+		}
+	}
+
+	std::sort( live.begin(), live.end(), []( const BenchAllocation& a, const BenchAllocation& b )
+	{
+		if( a.allocation.block != b.allocation.block )
+			return a.allocation.block < b.allocation.block;
+		return a.allocation.offset < b.allocation.offset;
+	} );
+
+	VkDeviceSize granularity = allocator.bufferImageGranularity;
+	for( u32 i = 1; i < live.size(); ++i )
+	{
+		const MemoryAllocation& prev = live[i - 1].allocation;
+		const MemoryAllocation& next = live[i].allocation;
+		if( prev.block != next.block )
+		{
+			continue;
+		}
+
+		if( prev.offset + prev.size > next.offset )
+		{
+			std::cout << "\terror: allocations at " << prev.offset << " and " << next.offset << " overlap\n";
+			++errors;
+		}
+		else if( granularity > 1 && live[i - 1].linear != live[i].linear && ( prev.offset + prev.size - 1 ) / granularity == next.offset / granularity )
+		{
+			std::cout << "\terror: linear and optimal allocations at " << prev.offset << " and " << next.offset << " share granularity page\n";
+			++errors;
+		}
+	}
+
+	VkDeviceSize heapBytes[VK_MAX_MEMORY_HEAPS] = {};
+	for( u32 i = 0; i < allocator.blocks.size(); ++i )
+	{
+		const MemoryBlock* block = allocator.blocks[i];
+		heapBytes[allocator.props.memoryTypes[block->memoryType].heapIndex] += block->size;
+
+		VkDeviceSize freeBytes = 0;
+		bool merged = true;
+		for( u32 k = 0; k < block->freeLists.size(); ++k )
+		{
+			VkDeviceSize buddySize = MIN_ALLOCATION_SIZE << k;
+			freeBytes += block->freeLists[k].size() * buddySize;
+			for( std::set<VkDeviceSize>::const_iterator it = block->freeLists[k].begin(); it != block->freeLists[k].end() && k < block->maxOrder; ++it )
+			{
+				merged = merged && !block->freeLists[k].count( *it ^ buddySize );
+			}
+		}
+		if( !block->dedicated && ( freeBytes + block->allocatedBytes != block->size || !merged ) )
+		{
+			std::cout << "\terror: block " << i << " has " << freeBytes / 1024 << " KB free and " << block->allocatedBytes / 1024
+					  << " KB allocated of " << block->size / 1024 << " KB" << ( merged ? "\n" : ", free buddies not merged\n" );
+			++errors;
+		}
+	}
+	for( u32 heap = 0; heap < allocator.props.memoryHeapCount; ++heap )
+	{
+		if( heapBytes[heap] > allocator.props.memoryHeaps[heap].size || heapBytes[heap] != allocator.heapUsage[heap] )
+		{
+			std::cout << "\terror: heap " << heap << " holds " << heapBytes[heap] / 1024 << " KB of blocks, accounted "
+					  << allocator.heapUsage[heap] / 1024 << " KB, size " << allocator.props.memoryHeaps[heap].size / 1024 << " KB\n";
+			++errors;
+		}
+	}
+	return errors;
+}
+
+// Once everything is freed, blocks kept around must have merged back into one free buddy of top order
+u32 checkEmptyAllocator( const MemoryAllocator& allocator )
+{
+	u32 errors = 0;
+	if( allocator.allocations )
+	{
+		std::cout << "\terror: " << allocator.allocations << " allocations counted after freeing all\n";
+		++errors;
+	}
+
+	for( u32 i = 0; i < allocator.blocks.size(); ++i )
+	{
+		const MemoryBlock* block = allocator.blocks[i];
+		bool coalesced = !block->dedicated && !block->allocatedBytes && !block->requestedBytes && block->orders.empty();
+		for( u32 k = 0; k <= block->maxOrder && coalesced; ++k )
+		{
+			coalesced = k < block->maxOrder ? block->freeLists[k].empty() : block->freeLists[k].size() == 1 && *block->freeLists[k].begin() == 0;
+		}
+		if( !coalesced )
+		{
+			std::cout << "\terror: block " << i << " of type " << block->memoryType << " didn't coalesce after freeing all\n";
+			++errors;
+		}
+	}
+	return errors;
+}
+
+// Runs random alloc/free workload against made up heaps, no GPU needed. Fails if allocator
+// breaks any of its invariants on the way.
+bool runAllocatorBenchmark()
+{
+	std::cout << "memory allocator benchmark, " << gBenchAllocs << " operations\n";
+
+	// Discrete GPU like layout: VRAM, system memory and small host visible VRAM window
+	VkPhysicalDeviceMemoryProperties props = {};
+	props.memoryHeapCount = 3;
+	props.memoryHeaps[0].size = (VkDeviceSize)8 * 1024 * 1024 * 1024;
+	props.memoryHeaps[0].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+	props.memoryHeaps[1].size = (VkDeviceSize)16 * 1024 * 1024 * 1024;
+	props.memoryHeaps[2].size = 256 * 1024 * 1024;
+	props.memoryHeaps[2].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+	props.memoryTypeCount = 4;
+	props.memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	props.memoryTypes[0].heapIndex = 0;
+	props.memoryTypes[1].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	props.memoryTypes[1].heapIndex = 1;
+	props.memoryTypes[2].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	props.memoryTypes[2].heapIndex = 1;
+	props.memoryTypes[3].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	props.memoryTypes[3].heapIndex = 2;
+
+	// Granularity as big as on some discrete GPUs, most allocations would share pages without separation
+	VkPhysicalDeviceLimits limits = {};
+	limits.bufferImageGranularity = 64 * 1024;
+	limits.nonCoherentAtomSize = 64;
+
+	MemoryAllocator allocator;
+	initMemoryAllocator( allocator, VK_NULL_HANDLE, props, limits, gMemoryBlockSize );
+
+	// Fixed seed so runs are comparable
+	u32 seed = 12345;
+	struct Random
+	{
+		static u32 next( u32& state )
+		{
+			state = state * 1664525 + 1013904223;
+			return state >> 8;
+		}
+	};
+
+	// Every eighth request wants host visible VRAM, small heap of it runs out and such requests fail
+	const VkMemoryPropertyFlags usages[] = { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+											 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+											 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT };
+	const u32 CHECK_INTERVAL = 1024;
+	std::vector<BenchAllocation> live;
+	live.reserve( 4096 );
+	u32 failures = 0;
+	u32 errors = 0;
+	double checkMs = 0.0;
+
+	u64 start = getTimerTicks();
+	for( u32 op = 0; op < gBenchAllocs; ++op )
+	{
+		if( op % CHECK_INTERVAL == 0 )
+		{
+			u64 checkStart = getTimerTicks();
+			errors += checkAllocations( allocator, live );
+			checkMs += ticksToMs( getTimerTicks() - checkStart );
+		}
+
+		// Keep about 2000 live allocations, freeing random ones
+		if( !live.empty() && ( live.size() >= 4000 || Random::next( seed ) % 2 == 0 ) )
+		{
+			u32 index = Random::next( seed ) % live.size();
+			freeMemory( allocator, live[index].allocation );
+			live[index] = live.back();
+			live.pop_back();
+			continue;
+		}
+
+		// Sizes are log uniform from 256 bytes to 16 MB, alignments from 256 bytes to 64 KB
+		VkMemoryRequirements reqs;
+		reqs.size = ( (VkDeviceSize)1 << ( 8 + Random::next( seed ) % 17 ) ) + Random::next( seed ) % 4096;
+		reqs.alignment = (VkDeviceSize)1 << ( 8 + Random::next( seed ) % 9 );
+		reqs.memoryTypeBits = 0xF;
+
+		BenchAllocation bench;
+		bench.alignment = reqs.alignment;
+		bench.linear = Random::next( seed ) % 2 == 0;
+		if( allocateMemory( allocator, reqs, usages[Random::next( seed ) % 8], 0, bench.linear, &bench.allocation ) )
+		{
+			live.push_back( bench );
+		}
+		else
+		{
+			++failures;
+		}
+	}
+	double ms = ticksToMs( getTimerTicks() - start ) - checkMs;
+
+	std::cout << "\t" << ms * 1000000.0 / max( gBenchAllocs, 1u ) << " ns per operation, " << failures << " failures\n";
+	errors += checkAllocations( allocator, live );
+	printMemoryStats( allocator );
+
+	for( u32 i = 0; i < live.size(); ++i )
+	{
+		freeMemory( allocator, live[i].allocation );
+	}
+	errors += checkEmptyAllocator( allocator );
+	destroyMemoryAllocator( allocator );
+
+	if( errors )
+	{
+		std::cout << "\t" << errors << " allocator errors\n";
+	}
+	return !errors;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Vulkan init
+//
+bool initVkInstance( const char* appName, const char* engineName )
+{
+	CpuZone zone( "initVkInstance" );
+	std::cout << "\nTrying to init vulkan API\n";
+
+	std::vector<const char*> extensions;
+	std::vector<const char*> layers;
+
+	if( !gHeadless )
+	{
+		extensions.push_back( VK_KHR_SURFACE_EXTENSION_NAME );
+		extensions.push_back( VK_KHR_WIN32_SURFACE_EXTENSION_NAME );
+	}
+	for( u32 i = 0; i < gLayers.size(); ++i )
+	{
+		layers.push_back( gLayers[i].c_str() );
+	}
+
+	VkApplicationInfo appInfo = {};
+	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.applicationVersion = 1;
+	appInfo.engineVersion = 1;
+	appInfo.pApplicationName = appName;
+	appInfo.pEngineName = engineName;
+	appInfo.pNext = nullptr;
+	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+
+
+	VkInstanceCreateInfo instInfo = {};
+	instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instInfo.pNext = nullptr;
+	instInfo.pApplicationInfo = &appInfo;
+	instInfo.flags = 0;
+	instInfo.enabledExtensionCount = extensions.size();
+	instInfo.ppEnabledExtensionNames = extensions.size() ? extensions.data() : nullptr;
+	instInfo.enabledLayerCount = layers.size();
+	instInfo.ppEnabledLayerNames = layers.size() ? layers.data() : nullptr;
+
+	VkResult res;
+
+	res = vkCreateInstance( &instInfo, gAllocator, &gInstance );
+	if( res == VK_ERROR_INCOMPATIBLE_DRIVER )
+	{
+		std::cout << "Incompatible driver\n";
+	}
+	else if( res )
+	{
+		std::cout << "Unknown error\n";
+	}
+	else
+	{
+		std::cout << "Instance inited\n";
+		return true;
+	}
+	return false;
+}
+
+const char* deviceTypeName( VkPhysicalDeviceType type )
+{
+	switch( type )
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:	return "integrated";
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:		return "discrete";
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:		return "virtual";
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:				return "cpu";
+	default:										return "other";
+	}
+}
+
+// Queries heaps, queue families and limits of device
+void probeDevice( DeviceInfo& info )
+{
+	VkPhysicalDeviceMemoryProperties memory;
+	vkGetPhysicalDeviceMemoryProperties( info.device, &memory );
+
+	info.deviceLocalBytes = 0;
+	for( u32 i = 0; i < memory.memoryHeapCount; ++i )
+	{
+		if( memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT )
+		{
+			info.deviceLocalBytes = max( info.deviceLocalBytes, memory.memoryHeaps[i].size );
+		}
+	}
+
+	u32 familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties( info.device, &familyCount, nullptr );
+	std::vector<VkQueueFamilyProperties> families( familyCount );
+	vkGetPhysicalDeviceQueueFamilyProperties( info.device, &familyCount, families.data() );
+
+	info.graphics = false;
+	info.asyncCompute = false;
+	info.asyncTransfer = false;
+	for( u32 i = 0; i < familyCount; ++i )
+	{
+		VkQueueFlags flags = families[i].queueFlags;
+		info.graphics |= ( flags & VK_QUEUE_GRAPHICS_BIT ) != 0;
+		info.asyncCompute |= ( flags & VK_QUEUE_COMPUTE_BIT ) && !( flags & VK_QUEUE_GRAPHICS_BIT );
+		info.asyncTransfer |= ( flags & VK_QUEUE_TRANSFER_BIT ) && !( flags & ( VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT ) );
+	}
+}
+
+// Higher is better. Device type dominates, then video memory, then extra queues and limits.
+i32 scoreDevice( const DeviceInfo& info )
+{
+	if( !info.graphics )
+	{
+		return -1;
+	}
+
+	i32 score = 0;
+	switch( info.type )
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:		score += 10000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:	score += 5000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:		score += 2000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:				score += 100; break;
+	default:										break;
+	}
+
+	score += (i32)min( info.deviceLocalBytes / ( 64 * 1024 * 1024 ), (VkDeviceSize)4000 );
+	score += info.asyncCompute ? 200 : 0;
+	score += info.asyncTransfer ? 100 : 0;
+	score += info.maxImageDimension2D / 1024;
+	return score;
+}
+
+// Cache lines are "vendor device driver localBytes graphics compute transfer maxImage2D"
+void loadDeviceCache( std::vector<DeviceInfo>& cached )
+{
+	std::ifstream file( gDeviceCacheFile );
+	DeviceInfo info;
+	while( file >> info.vendorID >> info.deviceID >> info.driverVersion >> info.deviceLocalBytes
+				>> info.graphics >> info.asyncCompute >> info.asyncTransfer >> info.maxImageDimension2D )
+	{
+		cached.push_back( info );
+	}
+}
+
+void writeDeviceCacheLine( std::ofstream& file, const DeviceInfo& info )
+{
+	file << info.vendorID << " " << info.deviceID << " " << info.driverVersion << " " << info.deviceLocalBytes << " "
+		 << info.graphics << " " << info.asyncCompute << " " << info.asyncTransfer << " " << info.maxImageDimension2D << "\n";
+}
+
+// Writes present devices and keeps cached entries of devices which aren't plugged in this run.
+// Entries of present devices with another driver version are outdated and dropped.
+void saveDeviceCache( const std::vector<DeviceInfo>& cached )
+{
+	std::ofstream file( gDeviceCacheFile );
+	for( u32 i = 0; i < gDevices.size(); ++i )
+	{
+		writeDeviceCacheLine( file, gDevices[i] );
+	}
+	for( u32 c = 0; c < cached.size(); ++c )
+	{
+		bool present = false;
+		for( u32 i = 0; i < gDevices.size() && !present; ++i )
+		{
+			present = cached[c].vendorID == gDevices[i].vendorID && cached[c].deviceID == gDevices[i].deviceID;
+		}
+		if( !present )
+		{
+			writeDeviceCacheLine( file, cached[c] );
+		}
+	}
+}
+
+// Enumerates all devices. Devices found in cache with the same driver version aren't probed again.
+void getDevicesList()
+{
+	CpuZone zone( "getDevicesList" );
+	HR( vkEnumeratePhysicalDevices( gInstance, &gDeviceCount, nullptr ) );
+	std::vector<VkPhysicalDevice> devices( gDeviceCount );
+	HR( vkEnumeratePhysicalDevices( gInstance, &gDeviceCount, devices.data() ) );
+
+	std::vector<DeviceInfo> cached;
+	loadDeviceCache( cached );
+
+	bool cacheDirty = false;
+	gDevices.resize( gDeviceCount );
+	for( u32 i = 0; i < gDeviceCount; ++i )
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties( devices[i], &properties );
+
+		DeviceInfo& info = gDevices[i];
+		info.device = devices[i];
+		info.vendorID = properties.vendorID;
+		info.deviceID = properties.deviceID;
+		info.driverVersion = properties.driverVersion;
+
+		bool found = false;
+		for( u32 c = 0; c < cached.size() && !found; ++c )
+		{
+			if( cached[c].vendorID == info.vendorID && cached[c].deviceID == info.deviceID && cached[c].driverVersion == info.driverVersion )
+			{
+				info = cached[c];
+				info.device = devices[i];
+				found = true;
+			}
+		}
+		if( !found )
+		{
+			probeDevice( info );
+			info.maxImageDimension2D = properties.limits.maxImageDimension2D;
+			cacheDirty = true;
+		}
+
+		info.name = properties.deviceName;
+		info.type = properties.deviceType;
+		info.score = scoreDevice( info );
+	}
+
+	if( cacheDirty )
+	{
+		saveDeviceCache( cached );
+	}
+
+	std::cout << "Device list:\n";
+	for( u32 i = 0; i < gDeviceCount; ++i )
+	{
+		const DeviceInfo& info = gDevices[i];
+		std::cout << "\t" << i << ": " << info.name << " (" << deviceTypeName( info.type ) << ", "
+				  << info.deviceLocalBytes / ( 1024 * 1024 ) << " MB, score " << info.score << ")" << std::endl;
+	}
+}
+
+// Surface doesn't exist yet, so presentation is asked per family of the window system
+bool canPresent( const DeviceInfo& info )
+{
+	u32 familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties( info.device, &familyCount, nullptr );
+	std::vector<VkQueueFamilyProperties> families( familyCount );
+	vkGetPhysicalDeviceQueueFamilyProperties( info.device, &familyCount, families.data() );
+
+	for( u32 i = 0; i < familyCount; ++i )
+	{
+		if( ( families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT ) && vkGetPhysicalDeviceWin32PresentationSupportKHR( info.device, i ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns why device can't run the renderer or nullptr when it can
+const char* deviceUnusableReason( const DeviceInfo& info )
+{
+	if( !info.graphics )
+	{
+		return "has no graphics queue";
+	}
+	if( !gHeadless && !canPresent( info ) )
+	{
+		return "has no graphics queue able to present to window";
+	}
+	return nullptr;
+}
+
+// Picks device forced by -device or -device_name, otherwise the best scored one.
+// Forced device which can't render or present is rejected instead of silently replaced.
+bool selectPhysicalDevice()
+{
+	CpuZone zone( "selectPhysicalDevice" );
+	i32 selected = -1;
+	if( gDeviceIndex >= 0 && gDeviceIndex < (i32)gDevices.size() )
+	{
+		selected = gDeviceIndex;
+	}
+	else if( !gDeviceName.empty() )
+	{
+		for( u32 i = 0; i < gDevices.size(); ++i )
+		{
+			if( gDevices[i].name.find( gDeviceName ) == std::string::npos )
+			{
+				continue;
+			}
+			if( selected < 0 )
+			{
+				selected = i;
+			}
+			if( !deviceUnusableReason( gDevices[i] ) )
+			{
+				selected = i;
+				break;
+			}
+		}
+	}
+
+	if( selected >= 0 )
+	{
+		const char* reason = deviceUnusableReason( gDevices[selected] );
+		if( reason )
+		{
+			std::cout << "requested device " << selected << ": " << gDevices[selected].name << " " << reason << std::endl;
+			return false;
+		}
+	}
+
+	if( selected < 0 )
+	{
+		if( gDeviceIndex >= 0 || !gDeviceName.empty() )
+		{
+			std::cout << "requested device not found, using best one\n";
+		}
+		for( u32 i = 0; i < gDevices.size(); ++i )
+		{
+			if( !deviceUnusableReason( gDevices[i] ) && ( selected < 0 || gDevices[i].score > gDevices[selected].score ) )
+			{
+				selected = i;
+			}
+		}
+	}
+
+	if( selected < 0 )
+	{
+		std::cout << "no usable device\n";
+		return false;
+	}
+
+	gPhysicalDevice = gDevices[selected].device;
+	std::cout << "using device " << selected << ": " << gDevices[selected].name << std::endl;
+	return true;
+}
+
+// Picks families for compute and transfer work next to graphics one and fills queue create infos.
+// Compute prefers family without graphics, transfer prefers transfer only family, then compute one.
+// Every type gets its own queue while family has enough of them.
+void selectQueueFamilies()
+{
+	u32 families[QUEUE_TYPE_COUNT] = { gQueueFamilyIndex, gQueueFamilyIndex, gQueueFamilyIndex };
+	if( !gSingleQueue )
+	{
+		for( u32 i = 0; i < gQueueCount; ++i )
+		{
+			VkQueueFlags flags = gQueueProps[i].queueFlags;
+			if( families[QUEUE_COMPUTE] == gQueueFamilyIndex && ( flags & VK_QUEUE_COMPUTE_BIT ) && !( flags & VK_QUEUE_GRAPHICS_BIT ) )
+			{
+				families[QUEUE_COMPUTE] = i;
+			}
+			if( families[QUEUE_TRANSFER] == gQueueFamilyIndex && ( flags & VK_QUEUE_TRANSFER_BIT ) &&
+				!( flags & ( VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT ) ) )
+			{
+				families[QUEUE_TRANSFER] = i;
+			}
+		}
+		if( families[QUEUE_TRANSFER] == gQueueFamilyIndex )
+		{
+			families[QUEUE_TRANSFER] = families[QUEUE_COMPUTE];
+		}
+	}
+
+	const char* names[] = { "graphics", "compute", "transfer" };
+	std::vector<u32> used( gQueueCount, 0 );
+	for( u32 type = 0; type < QUEUE_TYPE_COUNT; ++type )
+	{
+		DeviceQueue& queue = gQueues[type];
+		queue.queue = VK_NULL_HANDLE;
+		queue.familyIndex = families[type];
+		queue.dedicated = families[type] != gQueueFamilyIndex;
+		queue.submits = 0;
+
+		u32 family = families[type];
+		if( used[family] < gQueueProps[family].queueCount && !( gSingleQueue && type != QUEUE_GRAPHICS ) )
+		{
+			queue.queueIndex = used[family]++;
+			queue.mutex = &gQueueMutexes[type];
+		}
+		else
+		{
+			// Family is exhausted, share latest queue taken from it
+			for( u32 other = 0; other < type; ++other )
+			{
+				if( gQueues[other].familyIndex == family )
+				{
+					queue.queueIndex = gQueues[other].queueIndex;
+					queue.mutex = gQueues[other].mutex;
+				}
+			}
+		}
+
+		std::cout << "\t" << names[type] << " queue: family " << family << ", index " << queue.queueIndex
+				  << ( queue.dedicated ? ", dedicated" : "" ) << "\n";
+	}
+
+	gQueueInfos.clear();
+	for( u32 i = 0; i < gQueueCount; ++i )
+	{
+		if( used[i] )
+		{
+			VkDeviceQueueCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			info.pNext = nullptr;
+			info.queueFamilyIndex = i;
+			info.queueCount = used[i];
+			info.pQueuePriorities = gQueuePriorities;
+			gQueueInfos.push_back( info );
+		}
+	}
+}
+
+bool findSupportedQueue()
+{
+	CpuZone zone( "findSupportedQueue" );
+	vkGetPhysicalDeviceQueueFamilyProperties( gPhysicalDevice, &gQueueCount, nullptr );
+
+	gQueueProps.resize( gQueueCount );
+	vkGetPhysicalDeviceQueueFamilyProperties( gPhysicalDevice, &gQueueCount, gQueueProps.data() );
+
+	gQueueFamilyIndex = -1;
+
+	// Without surface any graphics queue will do
+	if( gHeadless )
+	{
+		for( u32 i = 0; i < gQueueCount; ++i )
+		{
+			if( gQueueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT )
+			{
+				gQueueFamilyIndex = i;
+				break;
+			}
+		}
+		if( gQueueFamilyIndex == -1 )
+		{
+			std::cout << "supported queue not found\n" << std::endl;
+			return false;
+		}
+
+		std::cout << "supported queue found\n";
+		selectQueueFamilies();
+		return true;
+	}
+
+	VkWin32SurfaceCreateInfoKHR createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+	createInfo.pNext = nullptr;
+	createInfo.hinstance = ghInstance;
+	createInfo.hwnd = ghWnd;
+	createInfo.flags = 0;
+
+	VkResult res = vkCreateWin32SurfaceKHR( gInstance, &createInfo, gAllocator, &gSurface );
+
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "surface creating error " << res << std::endl;
+		return false;
+	}
+
+	for( u32 i = 0; i < gQueueCount; ++i )
+	{
+		if( gQueueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT )
+		{
+			VkBool32 support = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR( gPhysicalDevice, i, gSurface, &support );
+			if( support == VK_TRUE )
+			{
+				gQueueFamilyIndex = i;
+				break;
+			}
+		}
+	}
+	if( gQueueFamilyIndex == -1 )
+	{
+		std::cout << "supported queue not found\n" << std::endl;
+		return false;
+	}
+
+	std::cout << "supported queue found\n";
+	selectQueueFamilies();
+	return true;
+}
+
+bool createDevice()
+{
+	CpuZone zone( "createDevice" );
+	std::vector<const char*> extensions;
+	std::vector<const char*> layers;
+
+	if( !gHeadless )
+	{
+		extensions.push_back( VK_KHR_SWAPCHAIN_EXTENSION_NAME );
+	}
+	for( u32 i = 0; i < gLayers.size(); ++i )
+	{
+		layers.push_back( gLayers[i].c_str() );
+	}
+
+	VkDeviceCreateInfo deviceInfo = {};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.pNext = nullptr;
+	deviceInfo.queueCreateInfoCount = gQueueInfos.size();
+	deviceInfo.pQueueCreateInfos = gQueueInfos.data();
+	deviceInfo.enabledExtensionCount = extensions.size();
+	deviceInfo.ppEnabledExtensionNames = extensions.size() ? extensions.data() : nullptr;
+	deviceInfo.enabledLayerCount = layers.size();
+	deviceInfo.ppEnabledLayerNames = layers.size() ? layers.data() : nullptr;
+	deviceInfo.pEnabledFeatures = nullptr;
+
+	VkResult res = vkCreateDevice( gPhysicalDevice, &deviceInfo, gAllocator, &gDevice );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "vulkan device create error " << res <<std::endl;
+		return false;
+	}
+
+	for( u32 type = 0; type < QUEUE_TYPE_COUNT; ++type )
+	{
+		vkGetDeviceQueue( gDevice, gQueues[type].familyIndex, gQueues[type].queueIndex, &gQueues[type].queue );
+	}
+	vkGetPhysicalDeviceProperties( gPhysicalDevice, &gDeviceProps );
+	vkGetPhysicalDeviceMemoryProperties( gPhysicalDevice, &gMemoryProps );
+	initMemoryAllocator( gMemoryAllocator, gDevice, gMemoryProps, gDeviceProps.limits, gMemoryBlockSize );
+	
+	std::cout << "device created\n";
+	return true;
+}
+ 
+bool initCommandAllocator( CommandAllocator& allocator, u32 queueFamilyIndex )
+{
+	VkCommandPoolCreateInfo cmdPoolInfo = {};
+	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmdPoolInfo.pNext = nullptr;
+	cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+	cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkResult res = vkCreateCommandPool( gDevice, &cmdPoolInfo, gAllocator, &allocator.pool );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "error creating command pool " << res << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Destroying pool frees all its buffers at once
+void destroyCommandAllocator( CommandAllocator& allocator )
+{
+	if( allocator.pool )
+	{
+		vkDestroyCommandPool( gDevice, allocator.pool, gAllocator );
+	}
+	allocator = CommandAllocator();
+}
+
+// Returns buffer in initial state, valid until next reset of allocator
+VkCommandBuffer acquireCommandBuffer( CommandAllocator& allocator, VkCommandBufferLevel level )
+{
+	bool primary = level == VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	std::vector<VkCommandBuffer>& freeList = primary ? allocator.freePrimaries : allocator.freeSecondaries;
+	std::vector<VkCommandBuffer>& usedList = primary ? allocator.usedPrimaries : allocator.usedSecondaries;
+
+	VkCommandBuffer cmd = VK_NULL_HANDLE;
+	if( !freeList.empty() )
+	{
+		cmd = freeList.back();
+		freeList.pop_back();
+		++gCmdAllocatorStats.recycled;
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo cmdInfo = {};
+		cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdInfo.pNext = nullptr;
+		cmdInfo.commandPool = allocator.pool;
+		cmdInfo.level = level;
+		cmdInfo.commandBufferCount = 1;
+
+		HR( vkAllocateCommandBuffers( gDevice, &cmdInfo, &cmd ) );
+		++gCmdAllocatorStats.allocations;
+	}
+
+	usedList.push_back( cmd );
+	return cmd;
+}
+
+// Resets all buffers of the pool with one call, none of them may be pending on GPU
+void resetCommandAllocator( CommandAllocator& allocator )
+{
+	if( allocator.usedPrimaries.empty() && allocator.usedSecondaries.empty() )
+	{
+		return;
+	}
+
+	HR( vkResetCommandPool( gDevice, allocator.pool, 0 ) );
+	++gCmdAllocatorStats.resets;
+
+	allocator.freePrimaries.insert( allocator.freePrimaries.end(), allocator.usedPrimaries.begin(), allocator.usedPrimaries.end() );
+	allocator.freeSecondaries.insert( allocator.freeSecondaries.end(), allocator.usedSecondaries.begin(), allocator.usedSecondaries.end() );
+	allocator.usedPrimaries.clear();
+	allocator.usedSecondaries.clear();
+}
+
+void printCommandAllocatorStats()
+{
+	std::cout << "command buffers: " << gCmdAllocatorStats.allocations << " allocated, "
+			  << gCmdAllocatorStats.recycled << " recycled, "
+			  << gCmdAllocatorStats.resets << " pool resets\n";
+}
+
+bool initCommandBuffers()
+{
+	CpuZone zone( "initCommandBuffers" );
+	if( !initCommandAllocator( gCmdAllocator, gQueueFamilyIndex ) )
+	{
+		return false;
+	}
+	gCmd = acquireCommandBuffer( gCmdAllocator, VK_COMMAND_BUFFER_LEVEL_PRIMARY );
+
+	std::cout << "command buffer created\n";
+	return true;
+}
+
+bool getSurfaceFormats()
+{
+	VkResult res;
+	u32 formatCount = 0;
+	res = vkGetPhysicalDeviceSurfaceFormatsKHR( gPhysicalDevice, gSurface, &formatCount, nullptr );
+	if( res == VK_SUCCESS )
+	{
+		gFormates.resize( formatCount );
+		res = vkGetPhysicalDeviceSurfaceFormatsKHR( gPhysicalDevice, gSurface, &formatCount, gFormates.data() );
+		if( res != VK_SUCCESS )
+		{
+			std::cout << "getting surface formats failed\n";
+			return false;
+		}
+
+		if( formatCount == 1 && gFormates[0].format == VK_FORMAT_UNDEFINED )
+		{
+			gFormat = VK_FORMAT_B8G8R8A8_UNORM;
+		}
+		else
+		{
+			gFormat = gFormates[0].format;
+		}
+	}
+	else
+	{
+		std::cout << "getting surface formats failed\n";
+		return false;
+	}
+	return true;
+}
+
+bool getSurfacePresentModes()
+{
+	u32 modesCount = 0;
+	HR( vkGetPhysicalDeviceSurfacePresentModesKHR( gPhysicalDevice, gSurface, &modesCount, nullptr ) );
+	gPresentModes.resize( modesCount );
+	HR( vkGetPhysicalDeviceSurfacePresentModesKHR( gPhysicalDevice, gSurface, &modesCount, gPresentModes.data() ) );
+	return true;
+}
+
+// One shot transition of untracked image, access and stages are derived from both layouts
+bool setImageLayout( VkCommandBuffer cmdBuf, VkImage image, VkImageAspectFlags aspects, VkImageLayout oldLayout, VkImageLayout newLayout )
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = layoutAccess( oldLayout ) & ACCESS_WRITE_MASK;
+	barrier.dstAccessMask = layoutAccess( newLayout );
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspects;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier( cmdBuf, layoutStages( oldLayout ), layoutStages( newLayout ), 
+						  0, 0, nullptr, 0, nullptr, 1, &barrier );
+
+	return true;
+}
+
+void beginCommandBuffer( VkCommandBuffer cmdBuf )
+{
+	VkCommandBufferBeginInfo cmd = {};
+	cmd.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmd.pNext = nullptr;
+	cmd.flags = 0;
+	cmd.pInheritanceInfo = 0;
+
+	HR( vkBeginCommandBuffer( cmdBuf, &cmd ) );
+}
+
+void endCommandBuffer( VkCommandBuffer cmdBuf )
+{
+	HR( vkEndCommandBuffer( cmdBuf ) );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Workers
+//
+void workerThreadFunc( u32 worker )
+{
+	setZoneThreadName( "worker" );
+	u64 generation = 0;
+	for( ;; )
+	{
+		const std::function<void( u32, u32 )>* func;
+		u32 count;
+		{
+			std::unique_lock<std::mutex> lock( gWorkMutex );
+			while( gWorkGeneration == generation && !gWorkQuit )
+			{
+				gWorkCondition.wait( lock );
+			}
+			if( gWorkQuit )
+			{
+				return;
+			}
+			generation = gWorkGeneration;
+			func = gWorkFunc;
+			count = gWorkCount;
+		}
+
+		for( u32 job = gWorkNext++; job < count; job = gWorkNext++ )
+		{
+			( *func )( job, worker );
+		}
+
+		std::lock_guard<std::mutex> lock( gWorkMutex );
+		if( --gWorkBusy == 0 )
+		{
+			gWorkDoneCondition.notify_one();
+		}
+	}
+}
+
+void initWorkers()
+{
+	if( !gWorkerCount )
+	{
+		gWorkerCount = max( std::thread::hardware_concurrency(), 1u );
+	}
+
+	gWorkQuit = false;
+	for( u32 i = 1; i < gWorkerCount; ++i )
+	{
+		gWorkers.push_back( std::thread( workerThreadFunc, i ) );
+	}
+	std::cout << "started " << gWorkerCount << " workers\n";
+}
+
+void shutdownWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock( gWorkMutex );
+		gWorkQuit = true;
+		gWorkCondition.notify_all();
+	}
+	for( u32 i = 0; i < gWorkers.size(); ++i )
+	{
+		gWorkers[i].join();
+	}
+	gWorkers.clear();
+}
+
+// Runs func( job, worker ) for every job in [0, count) on all workers and returns when all are done.
+// Worker index is stable for a thread, so it can be used to pick per thread resources.
+void runParallel( u32 count, const std::function<void( u32, u32 )>& func )
+{
+	if( gWorkers.empty() || count <= 1 )
+	{
+		for( u32 job = 0; job < count; ++job )
+		{
+			func( job, 0 );
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( gWorkMutex );
+		gWorkFunc = &func;
+		gWorkCount = count;
+		gWorkNext = 0;
+		gWorkBusy = gWorkers.size();
+		++gWorkGeneration;
+		gWorkCondition.notify_all();
+	}
+
+	for( u32 job = gWorkNext++; job < count; job = gWorkNext++ )
+	{
+		func( job, 0 );
+	}
+
+	std::unique_lock<std::mutex> lock( gWorkMutex );
+	while( gWorkBusy )
+	{
+		gWorkDoneCondition.wait( lock );
+	}
+	gWorkFunc = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Fences and submit completion
+//
+const u32 MAX_PENDING_SUBMITS = 64;		// async submits in flight, more block the submitting thread
+
+VkFence acquireFence()
+{
+	{
+		std::lock_guard<std::mutex> lock( gFencePoolMutex );
+		if( !gFreeFences.empty() )
+		{
+			VkFence fence = gFreeFences.back();
+			gFreeFences.pop_back();
+			return fence;
+		}
+		++gFencesCreated;
+	}
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.pNext = nullptr;
+	fenceInfo.flags = 0;
+
+	VkFence fence = VK_NULL_HANDLE;
+	HR( vkCreateFence( gDevice, &fenceInfo, gAllocator, &fence ) );
+	return fence;
+}
+
+// Fence must be signaled or never submitted
+void releaseFence( VkFence fence )
+{
+	HR( vkResetFences( gDevice, 1, &fence ) );
+
+	std::lock_guard<std::mutex> lock( gFencePoolMutex );
+	gFreeFences.push_back( fence );
+}
+
+void destroyFencePool()
+{
+	std::lock_guard<std::mutex> lock( gFencePoolMutex );
+	for( u32 i = 0; i < gFreeFences.size(); ++i )
+	{
+		vkDestroyFence( gDevice, gFreeFences[i], gAllocator );
+	}
+	gFreeFences.clear();
+}
+
+// Queue scheduler. Work of every type goes to its own queue if device has one, so transfers and
+// compute can run next to graphics. Aliased types end up on the same queue under the same lock.
+DeviceQueue& getQueue( QueueType type )
+{
+	return gQueues[type];
+}
+
+void submitQueue( QueueType type, u32 count, const VkSubmitInfo* infos, VkFence fence )
+{
+	DeviceQueue& queue = gQueues[type];
+	std::lock_guard<std::mutex> lock( *queue.mutex );
+	HR( vkQueueSubmit( queue.queue, count, infos, fence ) );
+	++queue.submits;
+}
+
+VkImageMemoryBarrier ownershipBarrier( VkImage image, const TrackedImage& tracked, VkImageLayout layout, QueueType from, QueueType to )
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = 0;
+	barrier.oldLayout = tracked.states[0].layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = getQueue( from ).familyIndex;
+	barrier.dstQueueFamilyIndex = getQueue( to ).familyIndex;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = tracked.aspects;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = tracked.mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = tracked.arrayLayers;
+	return barrier;
+}
+
+VkBufferMemoryBarrier ownershipBarrier( VkBuffer buffer, QueueType from, QueueType to )
+{
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = getQueue( from ).familyIndex;
+	barrier.dstQueueFamilyIndex = getQueue( to ).familyIndex;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	return barrier;
+}
+
+void printQueueStats()
+{
+	const char* names[] = { "graphics", "compute", "transfer" };
+
+	std::cout << "queue submits:";
+	for( u32 type = 0; type < QUEUE_TYPE_COUNT; ++type )
+	{
+		std::cout << " " << names[type] << " " << gQueues[type].submits;
+	}
+	std::cout << "\n";
+}
+
+void submitToQueue( VkCommandBuffer cmd, VkFence fence )
+{
+	const VkCommandBuffer cmds[] = { cmd };
+
+	VkPipelineStageFlags pipeStageFlags = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	VkSubmitInfo submitInfo[1] = {};
+	submitInfo[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo[0].pNext = nullptr;
+	submitInfo[0].waitSemaphoreCount = 0;
+	submitInfo[0].pWaitSemaphores = nullptr;
+	submitInfo[0].pWaitDstStageMask = &pipeStageFlags;
+	submitInfo[0].commandBufferCount = 1;
+	submitInfo[0].pCommandBuffers = cmds;
+	submitInfo[0].signalSemaphoreCount = 0;
+	submitInfo[0].pSignalSemaphores = nullptr;
+
+	submitQueue( QUEUE_GRAPHICS, 1, submitInfo, fence );
+}
+
+// Submits and blocks until GPU is done, fence is taken from pool
+void executeQueue( VkCommandBuffer cmd )
+{
+	VkFence fence = acquireFence();
+	submitToQueue( cmd, fence );
+	HR( vkWaitForFences( gDevice, 1, &fence, VK_TRUE, UINT64_MAX ) );
+	releaseFence( fence );
+}
+
+// Submits without blocking unless MAX_PENDING_SUBMITS are in flight already, which also bounds
+// fences in the pool. Callbacks may submit again, completion thread itself is never held back.
+// onComplete is called from completion thread once GPU is done, returned serial can be passed to waitForSerial().
+u64 executeQueueAsync( VkCommandBuffer cmd, std::function<void()> onComplete )
+{
+	std::unique_lock<std::mutex> lock( gPendingMutex );
+	while( gPendingSubmits.size() >= MAX_PENDING_SUBMITS && std::this_thread::get_id() != gCompletionThread.get_id() )
+	{
+		gPendingCondition.wait( lock );
+	}
+
+	VkFence fence = acquireFence();
+
+	// Submit under pending lock so serials are in queue order
+	submitToQueue( cmd, fence );
+
+	PendingSubmit pending;
+	pending.fence = fence;
+	pending.serial = ++gSubmitSerial;
+	pending.onComplete = onComplete;
+	gPendingSubmits.push_back( pending );
+
+	gPendingCondition.notify_all();
+	return pending.serial;
+}
+
+void waitForSerial( u64 serial )
+{
+	std::unique_lock<std::mutex> lock( gPendingMutex );
+	while( gCompletedSerial < serial && !gCompletionQuit )
+	{
+		gPendingCondition.wait( lock );
+	}
+}
+
+// Submits go to one queue in serial order, so they complete in that order too. Thread waits for
+// the oldest one only and then takes every following one that is done as well.
+void completionThreadFunc()
+{
+	setZoneThreadName( "completion" );
+	std::vector<PendingSubmit> completed;
+
+	for( ;; )
+	{
+		VkFence oldest;
+		{
+			std::unique_lock<std::mutex> lock( gPendingMutex );
+			while( gPendingSubmits.empty() && !gCompletionQuit )
+			{
+				gPendingCondition.wait( lock );
+			}
+			if( gPendingSubmits.empty() && gCompletionQuit )
+			{
+				return;
+			}
+			oldest = gPendingSubmits.front().fence;
+		}
+
+		HR( vkWaitForFences( gDevice, 1, &oldest, VK_TRUE, UINT64_MAX ) );
+
+		completed.clear();
+		{
+			std::lock_guard<std::mutex> lock( gPendingMutex );
+			do
+			{
+				completed.push_back( gPendingSubmits.front() );
+				gPendingSubmits.pop_front();
+			}
+			while( !gPendingSubmits.empty() && vkGetFenceStatus( gDevice, gPendingSubmits.front().fence ) == VK_SUCCESS );
+		}
+
+		// Callbacks are called without lock so they can submit again
+		for( u32 i = 0; i < completed.size(); ++i )
+		{
+			if( completed[i].onComplete )
+			{
+				completed[i].onComplete();
+			}
+			releaseFence( completed[i].fence );
+		}
+
+		{
+			std::lock_guard<std::mutex> lock( gPendingMutex );
+			gCompletedSerial = max( gCompletedSerial, completed.back().serial );
+			gPendingCondition.notify_all();
+		}
+	}
+}
+
+void initCompletionThread()
+{
+	gCompletionQuit = false;
+	gCompletionThread = std::thread( completionThreadFunc );
+}
+
+// Waits for all async submits and stops completion thread
+void shutdownCompletionThread()
+{
+	{
+		std::lock_guard<std::mutex> lock( gPendingMutex );
+		gCompletionQuit = true;
+		gPendingCondition.notify_all();
+	}
+	if( gCompletionThread.joinable() )
+	{
+		gCompletionThread.join();
+	}
+	destroyFencePool();
+}
+
+// Compares old create/wait/destroy submit path with pooled and async ones
+void runSubmitBenchmark()
+{
+	std::cout << "submit benchmark, " << gBenchSubmits << " submits per run\n";
+
+	VkCommandBuffer cmd = acquireCommandBuffer( gCmdAllocator, VK_COMMAND_BUFFER_LEVEL_PRIMARY );
+
+	// Same empty buffer is submitted many times, async run keeps several of them in flight
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	HR( vkBeginCommandBuffer( cmd, &beginInfo ) );
+	endCommandBuffer( cmd );
+
+	// 1. fence created, waited in 100ms steps and destroyed on every submit
+	u64 start = getTimerTicks();
+	for( u32 i = 0; i < gBenchSubmits; ++i )
+	{
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		VkFence fence;
+		vkCreateFence( gDevice, &fenceInfo, gAllocator, &fence );
+		submitToQueue( cmd, fence );
+		VkResult res;
+		do {
+			res = vkWaitForFences( gDevice, 1, &fence, VK_TRUE, 100000000 );
+		} while( res == VK_TIMEOUT );
+		vkDestroyFence( gDevice, fence, gAllocator );
+	}
+	double createMs = ticksToMs( getTimerTicks() - start );
+
+	// 2. blocking submit with pooled fence
+	start = getTimerTicks();
+	for( u32 i = 0; i < gBenchSubmits; ++i )
+	{
+		executeQueue( cmd );
+	}
+	double pooledMs = ticksToMs( getTimerTicks() - start );
+
+	// 3. async submit, submitting thread never waits
+	u32 completed = 0;
+	std::mutex completedMutex;
+	u64 lastSerial = 0;
+	start = getTimerTicks();
+	for( u32 i = 0; i < gBenchSubmits; ++i )
+	{
+		lastSerial = executeQueueAsync( cmd, [&]()
+		{
+			std::lock_guard<std::mutex> lock( completedMutex );
+			++completed;
+		} );
+	}
+	double asyncSubmitMs = ticksToMs( getTimerTicks() - start );
+	waitForSerial( lastSerial );
+	double asyncMs = ticksToMs( getTimerTicks() - start );
+
+	std::cout << std::fixed << std::setprecision( 1 );
+	std::cout << "\tcreate/destroy fence: " << gBenchSubmits * 1000.0 / createMs << " submits/s\n";
+	std::cout << "\tpooled fence:         " << gBenchSubmits * 1000.0 / pooledMs << " submits/s\n";
+	std::cout << "\tasync completion:     " << gBenchSubmits * 1000.0 / asyncMs << " submits/s ("
+			  << gBenchSubmits * 1000.0 / asyncSubmitMs << " submits/s on submitting thread, "
+			  << completed << " callbacks)\n";
+	std::cout << "\tfences created by pool: " << gFencesCreated << ", at most " << MAX_PENDING_SUBMITS << " async submits in flight" << std::endl;
+	std::cout.unsetf( std::ios::floatfield );
+}
+
+const char* presentModeName( VkPresentModeKHR mode )
+{
+	switch( mode )
+	{
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:		return "immediate";
+	case VK_PRESENT_MODE_MAILBOX_KHR:		return "mailbox";
+	case VK_PRESENT_MODE_FIFO_KHR:			return "fifo";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:	return "fifo relaxed";
+	default:								return "unknown";
+	}
+}
+
+const u32 LATENCY_SAMPLES = 4096;		// latency percentiles are over this many most recent frames
+
+// Pacing controller. Frame start is held back until its deadline, deadlines advance by target
+// frame time, so frames come out evenly instead of in bursts limited by queue depth. Frame that
+// starts a whole period late resets deadlines rather than trying to catch up.
+void initFramePacer( double targetFrameMs )
+{
+	gFramePacer = FramePacer();
+	gFramePacer.frameTicks = targetFrameMs > 0.0 ? msToTicks( targetFrameMs ) : 0;
+}
+
+// Latency is frame start to GPU done, observed either here or when slot is retired, so it's
+// accurate to about one frame. Time between GPU done and scanout is not visible to us.
+void recordFrameLatency( FrameSlot& slot, bool wait )
+{
+	if( !slot.latencyPending || ( !wait && vkGetFenceStatus( gDevice, slot.fence ) != VK_SUCCESS ) )
+	{
+		return;
+	}
+
+	u64 now = getTimerTicks();
+	slot.latencyPending = false;
+	if( gFramePacer.latencies.empty() )
+	{
+		gFramePacer.latencies.resize( LATENCY_SAMPLES );
+	}
+	gFramePacer.latencies[gFramePacer.latencyCount++ % LATENCY_SAMPLES] = (float)ticksToMs( now - slot.startTicks );
+	if( slot.inputRecord >= 0 )
+	{
+		InputFrameRecord& record = gInputRecords[slot.inputRecord];
+		record.gpuMs = (float)ticksToMs( now - record.inputTicks );
+		slot.inputRecord = -1;
+	}
+}
+
+// Waits for deadline of next frame and returns its start time
+u64 pacerBeginFrame()
+{
+	for( u32 i = 0; i < gFrames.size(); ++i )
+	{
+		recordFrameLatency( gFrames[i], false );
+	}
+
+	u64 now = getTimerTicks();
+	if( gFramePacer.frameTicks && gFramePacer.deadline )
+	{
+		// Sleep is coarse, last two milliseconds are spun
+		u64 spinTicks = msToTicks( 2.0 );
+		while( now < gFramePacer.deadline )
+		{
+			if( gFramePacer.deadline - now > spinTicks )
+				Sleep( 1 );
+			else
+				YieldProcessor();
+			u64 time = getTimerTicks();
+			gFramePacer.sleepMs += ticksToMs( time - now );
+			now = time;
+		}
+
+		if( now > gFramePacer.deadline + gFramePacer.frameTicks )
+		{
+			++gFramePacer.missed;
+			gFramePacer.deadline = now;
+		}
+	}
+	else
+	{
+		gFramePacer.deadline = now;
+	}
+	gFramePacer.deadline += gFramePacer.frameTicks;
+
+	if( gFramePacer.frames )
+	{
+		double interval = ticksToMs( now - gFramePacer.lastStart );
+		gFramePacer.intervalMs += interval;
+		gFramePacer.intervalSqMs += interval * interval;
+	}
+	gFramePacer.lastStart = now;
+	++gFramePacer.frames;
+	return now;
+}
+
+void printPresentStats()
+{
+	FramePacer& pacer = gFramePacer;
+	if( pacer.frames < 2 )
+	{
+		return;
+	}
+
+	double intervals = (double)( pacer.frames - 1 );
+	double avg = pacer.intervalMs / intervals;
+	double jitter = sqrt( max( pacer.intervalSqMs / intervals - avg * avg, 0.0 ) );
+	std::cout << "presentation: " << gPresentPolicies[gPresentPolicy].name << " policy, " << presentModeName( gPresentMode )
+			  << ", " << gSwapBuffers.size() << " images, " << gFramesInFlight << " frames in flight\n";
+	std::cout << "  target " << ( pacer.frameTicks ? ticksToMs( pacer.frameTicks ) : 0.0 ) << " ms, achieved " << avg
+			  << " ms (" << 1000.0 / avg << " fps), jitter " << jitter << " ms, " << pacer.missed << " missed, "
+			  << pacer.sleepMs / pacer.frames << " ms paced per frame\n";
+
+	if( pacer.latencyCount )
+	{
+		std::vector<float> sorted( pacer.latencies.begin(), pacer.latencies.begin() + (size_t)min( pacer.latencyCount, (u64)pacer.latencies.size() ) );
+		std::sort( sorted.begin(), sorted.end() );
+		std::cout << "  latency to GPU done over last " << sorted.size() << " frames: p50 " << percentile( sorted, 50 ) << " ms, p99 "
+				  << percentile( sorted, 99 ) << " ms, max " << sorted.back() << " ms\n";
+	}
+}
+
+// Creates swapchain of current surface size with views of its images. Old swapchain is handed to
+// driver so it can reuse its resources, it stays valid until destroyed by caller. Returns false
+// without touching current swapchain if surface has zero size.
+bool createSwapchain( VkSwapchainKHR oldSwapchain )
+{
+	VkResult res;
+	res = vkGetPhysicalDeviceSurfaceCapabilitiesKHR( gPhysicalDevice, gSurface, &gSurfaceCaps );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "error getting surface capabilities\n";
+	}
+
+	// Surface size may be left to swapchain, window size is used then
+	VkExtent2D swapChainExtent = gSurfaceCaps.currentExtent;
+	if( swapChainExtent.width == 0xFFFFFFFF )
+	{
+		swapChainExtent.width = min( max( gWidth, gSurfaceCaps.minImageExtent.width ), gSurfaceCaps.maxImageExtent.width );
+		swapChainExtent.height = min( max( gHeight, gSurfaceCaps.minImageExtent.height ), gSurfaceCaps.maxImageExtent.height );
+	}
+	if( !swapChainExtent.width || !swapChainExtent.height )
+	{
+		return false;
+	}
+
+	// Depth comes from policy, clamped to what surface allows. maxImageCount 0 means no limit.
+	uint32_t desiredNumberOfSwapChainImages = gSurfaceCaps.minImageCount + gPresentPolicies[gPresentPolicy].extraImages;
+	desiredNumberOfSwapChainImages = gSurfaceCaps.maxImageCount ? min( desiredNumberOfSwapChainImages, gSurfaceCaps.maxImageCount ) : desiredNumberOfSwapChainImages;
+
+	VkSurfaceTransformFlagBitsKHR preTransform;
+	preTransform = gSurfaceCaps.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR ? VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR : gSurfaceCaps.currentTransform;
+
+	VkSwapchainCreateInfoKHR swapChain = {};
+	swapChain.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	swapChain.pNext = nullptr;
+	swapChain.surface = gSurface;
+	swapChain.minImageCount = desiredNumberOfSwapChainImages;
+	swapChain.imageFormat = gFormat;
+	swapChain.imageExtent = swapChainExtent;
+	swapChain.preTransform = preTransform;
+	swapChain.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	swapChain.imageArrayLayers = 1;
+	swapChain.presentMode = gPresentMode;
+	swapChain.oldSwapchain = oldSwapchain;
+	swapChain.clipped = true;
+	swapChain.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+	swapChain.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	swapChain.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	swapChain.queueFamilyIndexCount = 0;
+	swapChain.pQueueFamilyIndices = nullptr;
+
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+	res = vkCreateSwapchainKHR( gDevice, &swapChain, gAllocator, &swapchain );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "error creating swapchain "<< res << std::endl;
+		return false;
+	}
+	gSwapchain = swapchain;
+	gWidth = swapChainExtent.width;
+	gHeight = swapChainExtent.height;
+
+	std::vector<VkImage> images;
+	u32 imagesCount = 0;
+	HR( vkGetSwapchainImagesKHR(gDevice, gSwapchain, &imagesCount, nullptr ) );
+	images.resize( imagesCount );
+	HR( vkGetSwapchainImagesKHR(gDevice, gSwapchain, &imagesCount, images.data() ) );
+
+	gSwapBuffers.resize( imagesCount );
+	for( u32 i = 0; i < gSwapBuffers.size(); ++i )
+	{
+		VkImageViewCreateInfo imageView = {};
+		imageView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		imageView.pNext = nullptr;
+		imageView.format = gFormat;
+		imageView.components.r = VK_COMPONENT_SWIZZLE_R;
+		imageView.components.g = VK_COMPONENT_SWIZZLE_G;
+		imageView.components.b = VK_COMPONENT_SWIZZLE_B;
+		imageView.components.a = VK_COMPONENT_SWIZZLE_A;
+		imageView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageView.subresourceRange.baseMipLevel = 0;
+		imageView.subresourceRange.levelCount = 1;
+		imageView.subresourceRange.baseArrayLayer = 0;
+		imageView.subresourceRange.layerCount = 1;
+		imageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageView.flags = 0;
+		imageView.image = images[i];
+		gSwapBuffers[i].image = images[i];
+
+		// No initial transition, every frame treats acquired image contents as undefined anyway
+		trackImage( gSwapBuffers[i].image, VK_IMAGE_ASPECT_COLOR_BIT, 1, 1, VK_IMAGE_LAYOUT_UNDEFINED );
+		HR( vkCreateImageView( gDevice, &imageView, gAllocator, &gSwapBuffers[i].view ) );
+	}
+
+	return true;
+}
+
+bool initSwapChains()
+{
+	CpuZone zone( "initSwapChains" );
+	if( !getSurfaceFormats() || !getSurfacePresentModes() )
+	{
+		return false;
+	}
+
+	// First supported mode of policy, frame ring depth and pacing target follow it too
+	const PresentPolicyDesc& policy = gPresentPolicies[gPresentPolicy];
+	gPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	for( u32 i = 0; i < 3; ++i )
+	{
+		if( std::find( gPresentModes.begin(), gPresentModes.end(), policy.modes[i] ) != gPresentModes.end() )
+		{
+			gPresentMode = policy.modes[i];
+			break;
+		}
+	}
+	// Default policy keeps default ring depth, only picked one brings its own
+	if( gPresentPolicySet && !gFramesInFlightSet )
+	{
+		gFramesInFlight = policy.framesInFlight;
+	}
+	initFramePacer( gTargetFrameMs < 0.0 ? policy.targetFrameMs : gTargetFrameMs );
+
+	if( !createSwapchain( VK_NULL_HANDLE ) )
+	{
+		std::cout << "error creating swapchain\n";
+		return false;
+	}
+
+	std::cout << "swapchain inited, " << policy.name << " policy, " << presentModeName( gPresentMode ) << ", "
+			  << gSwapBuffers.size() << " images\n";
+	return true;
+}
+
+// Replaces swapchain after resize or out of date surface. Device keeps running: frames in flight
+// finish with old swapchain, which is only retired here and destroyed later.
+bool recreateSwapchain()
+{
+	u64 start = getTimerTicks();
+
+	VkSwapchainKHR oldSwapchain = gSwapchain;
+	std::vector<SwapChainBuffer> oldBuffers = gSwapBuffers;
+	if( !createSwapchain( oldSwapchain ) )
+	{
+		return false;
+	}
+
+	RetiredSwapchain retired;
+	retired.swapchain = oldSwapchain;
+	retired.buffers = oldBuffers;
+	retired.frame = gFrameNumber;
+	gRetiredSwapchains.push_back( retired );
+	for( u32 i = 0; i < oldBuffers.size(); ++i )
+	{
+		untrackImage( oldBuffers[i].image );
+	}
+	gSwapchainDirty = false;
+
+	double ms = ticksToMs( getTimerTicks() - start );
+	++gSwapchainStats.recreations;
+	gSwapchainStats.totalMs += ms;
+	gSwapchainStats.maxMs = max( gSwapchainStats.maxMs, ms );
+
+	std::cout << "swapchain recreated " << gWidth << "x" << gHeight << " in " << ms << " ms\n";
+	return true;
+}
+
+void destroySwapchainBuffers( std::vector<SwapChainBuffer>& buffers )
+{
+	for( u32 i = 0; i < buffers.size(); ++i )
+	{
+		vkDestroyImageView( gDevice, buffers[i].view, gAllocator );
+	}
+	buffers.clear();
+}
+
+// Destroys retired swapchains no frame in flight can use anymore, or all of them
+void destroyRetiredSwapchains( bool all )
+{
+	for( u32 i = 0; i < gRetiredSwapchains.size(); )
+	{
+		RetiredSwapchain& retired = gRetiredSwapchains[i];
+
+		// Last frame using it is retired when frame gFrames.size() later begins
+		if( !all && gFrameNumber + 1 < retired.frame + gFrames.size() )
+		{
+			++i;
+			continue;
+		}
+
+		destroySwapchainBuffers( retired.buffers );
+		vkDestroySwapchainKHR( gDevice, retired.swapchain, gAllocator );
+		gRetiredSwapchains.erase( gRetiredSwapchains.begin() + i );
+	}
+}
+
+// Frames must be finished
+void destroySwapchains()
+{
+	destroyRetiredSwapchains( true );
+	destroySwapchainBuffers( gSwapBuffers );
+	if( gSwapchain )
+	{
+		vkDestroySwapchainKHR( gDevice, gSwapchain, gAllocator );
+		gSwapchain = VK_NULL_HANDLE;
+	}
+}
+
+void printSwapchainStats()
+{
+	std::cout << "swapchain: " << gSwapchainStats.recreations << " recreations, "
+			  << ( gSwapchainStats.recreations ? gSwapchainStats.totalMs / gSwapchainStats.recreations : 0.0 ) << " ms average, "
+			  << gSwapchainStats.maxMs << " ms max\n";
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Submit batching
+//
+// Producers add command buffers with their semaphores during the frame, nothing reaches
+// the queue until flushSubmits() which sends everything with one vkQueueSubmit.
+//
+void batchSubmit( const VkCommandBuffer* cmds, u32 cmdCount,
+				  const VkSemaphore* waits, const VkPipelineStageFlags* waitStages, u32 waitCount,
+				  const VkSemaphore* signals, u32 signalCount )
+{
+	std::lock_guard<std::mutex> lock( gBatchMutex );
+
+	BatchedSubmit submit;
+	submit.firstCmd = gBatchCmds.size();
+	submit.cmdCount = cmdCount;
+	submit.firstWait = gBatchWaits.size();
+	submit.waitCount = waitCount;
+	submit.firstSignal = gBatchSignals.size();
+	submit.signalCount = signalCount;
+
+	gBatchCmds.insert( gBatchCmds.end(), cmds, cmds + cmdCount );
+	gBatchWaits.insert( gBatchWaits.end(), waits, waits + waitCount );
+	gBatchWaitStages.insert( gBatchWaitStages.end(), waitStages, waitStages + waitCount );
+	gBatchSignals.insert( gBatchSignals.end(), signals, signals + signalCount );
+	gBatchedSubmits.push_back( submit );
+
+	++gBatchStats.submits;
+	gBatchStats.cmdBuffers += cmdCount;
+}
+
+void batchSubmit( VkCommandBuffer cmd, VkSemaphore waitSemaphore, VkPipelineStageFlags waitStage, VkSemaphore signalSemaphore )
+{
+	batchSubmit( &cmd, 1, &waitSemaphore, &waitStage, waitSemaphore ? 1 : 0, &signalSemaphore, signalSemaphore ? 1 : 0 );
+}
+
+// Builds gBatchInfos from batched submits. Submits are merged into as few VkSubmitInfo as possible:
+// next submit joins previous one when it waits for nothing and previous one signals nothing, which
+// keeps ordering of all semaphore operations. Called with gBatchMutex locked.
+void mergeBatchedSubmits()
+{
+	gBatchInfos.clear();
+	for( u32 i = 0; i < gBatchedSubmits.size(); ++i )
+	{
+		const BatchedSubmit& submit = gBatchedSubmits[i];
+
+		if( !gBatchInfos.empty() && !submit.waitCount && !gBatchInfos.back().signalSemaphoreCount )
+		{
+			// Command buffers of consecutive submits are adjacent, but previous one may have had none
+			VkSubmitInfo& info = gBatchInfos.back();
+			if( !info.commandBufferCount && submit.cmdCount )
+			{
+				info.pCommandBuffers = &gBatchCmds[submit.firstCmd];
+			}
+			info.commandBufferCount += submit.cmdCount;
+			info.signalSemaphoreCount = submit.signalCount;
+			info.pSignalSemaphores = submit.signalCount ? &gBatchSignals[submit.firstSignal] : nullptr;
+			continue;
+		}
+
+		VkSubmitInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		info.pNext = nullptr;
+		info.waitSemaphoreCount = submit.waitCount;
+		info.pWaitSemaphores = submit.waitCount ? &gBatchWaits[submit.firstWait] : nullptr;
+		info.pWaitDstStageMask = submit.waitCount ? &gBatchWaitStages[submit.firstWait] : nullptr;
+		info.commandBufferCount = submit.cmdCount;
+		info.pCommandBuffers = submit.cmdCount ? &gBatchCmds[submit.firstCmd] : nullptr;
+		info.signalSemaphoreCount = submit.signalCount;
+		info.pSignalSemaphores = submit.signalCount ? &gBatchSignals[submit.firstSignal] : nullptr;
+		gBatchInfos.push_back( info );
+	}
+}
+
+void clearBatchedSubmits()
+{
+	gBatchedSubmits.clear();
+	gBatchCmds.clear();
+	gBatchWaits.clear();
+	gBatchWaitStages.clear();
+	gBatchSignals.clear();
+}
+
+// Explicit flush point, everything batched goes in one vkQueueSubmit. Fence is signaled when
+// all flushed work is done.
+void flushSubmits( VkFence fence )
+{
+	std::lock_guard<std::mutex> lock( gBatchMutex );
+
+	if( gBatchedSubmits.empty() && !fence )
+	{
+		return;
+	}
+
+	mergeBatchedSubmits();
+	submitQueue( QUEUE_GRAPHICS, gBatchInfos.size(), gBatchInfos.size() ? gBatchInfos.data() : nullptr, fence );
+
+	++gBatchStats.flushes;
+	++gBatchStats.queueSubmits;
+	gBatchStats.submitInfos += gBatchInfos.size();
+	clearBatchedSubmits();
+}
+
+// Adds work recorded into frame so far to the batch and continues the frame in a new command buffer,
+// so others can batch work that goes between the two parts
+void batchFramePart( FrameSlot& slot, VkSemaphore signalSemaphore )
+{
+	// Upload lane acquires are in the batched part, so it has to wait for the lane
+	VkSemaphore waitSemaphore = slot.uploads.waitPending ? slot.uploads.done : VK_NULL_HANDLE;
+	slot.uploads.waitPending = false;
+
+	endCommandBuffer( slot.cmd );
+	batchSubmit( slot.cmd, waitSemaphore, VK_PIPELINE_STAGE_TRANSFER_BIT, signalSemaphore );
+
+	slot.cmd = acquireCommandBuffer( slot.cmdAllocator, VK_COMMAND_BUFFER_LEVEL_PRIMARY );
+
+	VkCommandBufferBeginInfo cmd = {};
+	cmd.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmd.pNext = nullptr;
+	cmd.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	cmd.pInheritanceInfo = nullptr;
+	HR( vkBeginCommandBuffer( slot.cmd, &cmd ) );
+}
+
+// Submits work recorded into frame so far, together with everything batched before it, and continues
+// the frame in a new command buffer. Rest of the frame is still submitted by endFrame().
+void splitFrame( FrameSlot& slot, VkSemaphore signalSemaphore, VkFence fence )
+{
+	batchFramePart( slot, signalSemaphore );
+	flushSubmits( fence );
+}
+
+void printSubmitBatchStats()
+{
+	if( !gBatchStats.flushes )
+	{
+		return;
+	}
+
+	std::cout << "submit batching: " << gBatchStats.submits << " submits with " << gBatchStats.cmdBuffers << " command buffers went in "
+			  << gBatchStats.queueSubmits << " vkQueueSubmit calls carrying " << gBatchStats.submitInfos << " VkSubmitInfo, "
+			  << (double)gBatchStats.submits / gBatchStats.queueSubmits << " submits per call\n";
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// GPU timers
+//
+// Every frame slot has its own timestamp query pool, so frame N is written while results of frames
+// before it are still in flight. Both timestamps of a pass are taken at bottom of pipe, so pass time
+// is from completion of everything before it to its own completion and passes add up to the frame.
+//
+const u32 GPU_TIMER_QUERIES = 64;
+
+bool initGpuTimers( GpuTimers& timers )
+{
+	timers.pool = VK_NULL_HANDLE;
+	timers.used = 0;
+	if( !gGpuTimers )
+	{
+		return true;
+	}
+
+	VkQueryPoolCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	info.pNext = nullptr;
+	info.flags = 0;
+	info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	info.queryCount = GPU_TIMER_QUERIES;
+	info.pipelineStatistics = 0;
+	HR( vkCreateQueryPool( gDevice, &info, gAllocator, &timers.pool ) );
+	return true;
+}
+
+void destroyGpuTimers( GpuTimers& timers )
+{
+	if( timers.pool )
+	{
+		vkDestroyQueryPool( gDevice, timers.pool, gAllocator );
+		timers.pool = VK_NULL_HANDLE;
+	}
+}
+
+// Recorded at the start of the frame, before any pass is timed
+void resetGpuTimers( GpuTimers& timers, VkCommandBuffer cmdBuf )
+{
+	timers.used = 0;
+	timers.scopes.clear();
+	if( timers.pool )
+	{
+		vkCmdResetQueryPool( cmdBuf, timers.pool, 0, GPU_TIMER_QUERIES );
+	}
+}
+
+u32 getGpuPassStats( const std::string& name )
+{
+	for( u32 i = 0; i < gGpuPassStats.size(); ++i )
+	{
+		if( gGpuPassStats[i].name == name )
+		{
+			return i;
+		}
+	}
+
+	GpuPassStats stats;
+	stats.name = name;
+	gGpuPassStats.push_back( stats );
+	return gGpuPassStats.size() - 1;
+}
+
+// Returns scope to pass to endGpuTimer(), -1 if pass isn't timed
+i32 beginGpuTimer( GpuTimers* timers, VkCommandBuffer cmdBuf, const std::string& name )
+{
+	if( !timers || !timers->pool )
+	{
+		return -1;
+	}
+	if( timers->used + 2 > GPU_TIMER_QUERIES )
+	{
+		++gGpuTimerOverflows;
+		return -1;
+	}
+
+	GpuTimerScope scope;
+	scope.pass = getGpuPassStats( name );
+	scope.query = timers->used;
+	timers->used += 2;
+	timers->scopes.push_back( scope );
+
+	vkCmdWriteTimestamp( cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timers->pool, scope.query );
+	return timers->scopes.size() - 1;
+}
+
+void endGpuTimer( GpuTimers* timers, VkCommandBuffer cmdBuf, i32 scope )
+{
+	if( scope >= 0 )
+	{
+		vkCmdWriteTimestamp( cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timers->pool, timers->scopes[scope].query + 1 );
+	}
+}
+
+// Reads timestamps of retired slot. Fence is signaled, so no waiting flag is needed.
+void resolveGpuTimers( GpuTimers& timers )
+{
+	if( timers.scopes.empty() )
+	{
+		return;
+	}
+
+	u64 timestamps[GPU_TIMER_QUERIES];
+	VkResult res = vkGetQueryPoolResults( gDevice, timers.pool, 0, timers.used, timers.used * sizeof( u64 ), timestamps, sizeof( u64 ), VK_QUERY_RESULT_64_BIT );
+	if( res != VK_SUCCESS )
+	{
+		++gGpuTimerMisses;
+		timers.scopes.clear();
+		return;
+	}
+
+	double msPerTick = gDeviceProps.limits.timestampPeriod / 1000000.0;
+	for( u32 i = 0; i < timers.scopes.size(); ++i )
+	{
+		const GpuTimerScope& scope = timers.scopes[i];
+		u64 ticks = ( timestamps[scope.query + 1] - timestamps[scope.query] ) & gTimestampMask;
+		gGpuPassStats[scope.pass].samples.push_back( (float)( ticks * msPerTick ) );
+	}
+	timers.scopes.clear();
+}
+
+void printGpuTimers()
+{
+	if( gGpuPassStats.empty() )
+	{
+		return;
+	}
+
+	std::cout << "GPU time per pass:\n";
+	for( u32 i = 0; i < gGpuPassStats.size(); ++i )
+	{
+		std::vector<float> sorted = gGpuPassStats[i].samples;
+		std::sort( sorted.begin(), sorted.end() );
+
+		double sum = 0.0;
+		for( u32 s = 0; s < sorted.size(); ++s )
+		{
+			sum += sorted[s];
+		}
+
+		std::cout << "\t" << gGpuPassStats[i].name << ": " << sorted.size() << " frames, avg "
+				  << ( sorted.empty() ? 0.0 : sum / sorted.size() ) << " ms, p50 " << percentile( sorted, 50 )
+				  << " ms, p99 " << percentile( sorted, 99 ) << " ms, max " << ( sorted.empty() ? 0.0f : sorted.back() ) << " ms\n";
+	}
+	if( gGpuTimerOverflows || gGpuTimerMisses )
+	{
+		std::cout << "\t" << gGpuTimerOverflows << " passes not timed, out of queries, " << gGpuTimerMisses << " frames without results\n";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Frame graph
+//
+// Passes declare resources they read and write, graph culls passes nobody consumes, computes
+// resource lifetimes and records live passes with barriers placed through the state tracker.
+// Passes are declared in a valid order (producer before consumer) and keep that order.
+//
+void graphReset( FrameGraph& graph )
+{
+	graph.resources.clear();
+	graph.passes.clear();
+	graph.order.clear();
+}
+
+u32 graphImportImage( FrameGraph& graph, const char* name, VkImage image )
+{
+	GraphResource resource;
+	resource.name = name;
+	resource.image = image;
+	resource.buffer = VK_NULL_HANDLE;
+	resource.output = false;
+	resource.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resource.finalAccess = 0;
+	resource.finalStages = 0;
+	resource.firstPass = -1;
+	resource.lastPass = -1;
+	graph.resources.push_back( resource );
+	return graph.resources.size() - 1;
+}
+
+u32 graphImportBuffer( FrameGraph& graph, const char* name, VkBuffer buffer )
+{
+	u32 index = graphImportImage( graph, name, VK_NULL_HANDLE );
+	graph.resources[index].buffer = buffer;
+	if( gTrackedBuffers.find( buffer ) == gTrackedBuffers.end() )
+	{
+		trackBuffer( buffer );
+	}
+	return index;
+}
+
+// Resource is used after the graph, e.g. presented or read by CPU. It's left in given state.
+void graphSetOutput( FrameGraph& graph, u32 resource, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	GraphResource& res = graph.resources[resource];
+	res.output = true;
+	res.finalLayout = layout;
+	res.finalAccess = access;
+	res.finalStages = stages;
+}
+
+u32 graphAddPass( FrameGraph& graph, const char* name, const std::function<void( VkCommandBuffer )>& execute )
+{
+	GraphPass pass;
+	pass.name = name;
+	pass.execute = execute;
+	pass.culled = false;
+	graph.passes.push_back( pass );
+	return graph.passes.size() - 1;
+}
+
+void graphAccess( FrameGraph& graph, u32 pass, u32 resource, bool write, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	GraphAccess use;
+	use.resource = resource;
+	use.write = write;
+	use.keep = false;
+	use.layout = layout;
+	use.access = access;
+	use.stages = stages;
+	graph.passes[pass].accesses.push_back( use );
+}
+
+void graphRead( FrameGraph& graph, u32 pass, u32 resource, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	graphAccess( graph, pass, resource, false, layout, access, stages );
+}
+
+void graphWrite( FrameGraph& graph, u32 pass, u32 resource, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	graphAccess( graph, pass, resource, true, layout, access, stages );
+}
+
+// Same as above with access and stages derived from image layout
+void graphRead( FrameGraph& graph, u32 pass, u32 resource, VkImageLayout layout )
+{
+	graphAccess( graph, pass, resource, false, layout, layoutAccess( layout ) & ~ACCESS_WRITE_MASK, layoutStages( layout ) );
+}
+
+void graphWrite( FrameGraph& graph, u32 pass, u32 resource, VkImageLayout layout )
+{
+	graphAccess( graph, pass, resource, true, layout, layoutAccess( layout ), layoutStages( layout ) );
+}
+
+// Write which updates only part of resource, whatever earlier passes wrote is still needed
+void graphModify( FrameGraph& graph, u32 pass, u32 resource, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	graphWrite( graph, pass, resource, layout, access, stages );
+	graph.passes[pass].accesses.back().keep = true;
+}
+
+void graphModify( FrameGraph& graph, u32 pass, u32 resource, VkImageLayout layout )
+{
+	graphModify( graph, pass, resource, layout, layoutAccess( layout ), layoutStages( layout ) );
+}
+
+void graphCompile( FrameGraph& graph )
+{
+	// Walking backwards: pass is live if it writes an output or something a later live pass reads
+	std::vector<bool> needed( graph.resources.size(), false );
+	for( u32 i = 0; i < graph.resources.size(); ++i )
+	{
+		needed[i] = graph.resources[i].output;
+	}
+
+	for( i32 p = (i32)graph.passes.size() - 1; p >= 0; --p )
+	{
+		GraphPass& pass = graph.passes[p];
+
+		pass.culled = true;
+		for( u32 a = 0; a < pass.accesses.size(); ++a )
+		{
+			if( pass.accesses[a].write && needed[pass.accesses[a].resource] )
+			{
+				pass.culled = false;
+				break;
+			}
+		}
+		if( pass.culled )
+		{
+			continue;
+		}
+
+		// Resources fully produced here aren't needed from earlier passes, unless this pass also reads them
+		for( u32 a = 0; a < pass.accesses.size(); ++a )
+		{
+			if( pass.accesses[a].write && !pass.accesses[a].keep )
+				needed[pass.accesses[a].resource] = false;
+		}
+		for( u32 a = 0; a < pass.accesses.size(); ++a )
+		{
+			if( !pass.accesses[a].write || pass.accesses[a].keep )
+				needed[pass.accesses[a].resource] = true;
+		}
+	}
+
+	graph.order.clear();
+	for( u32 r = 0; r < graph.resources.size(); ++r )
+	{
+		graph.resources[r].firstPass = -1;
+		graph.resources[r].lastPass = -1;
+	}
+	for( u32 p = 0; p < graph.passes.size(); ++p )
+	{
+		if( graph.passes[p].culled )
+		{
+			continue;
+		}
+
+		i32 index = graph.order.size();
+		graph.order.push_back( p );
+
+		for( u32 a = 0; a < graph.passes[p].accesses.size(); ++a )
+		{
+			GraphResource& res = graph.resources[graph.passes[p].accesses[a].resource];
+			if( res.firstPass < 0 )
+				res.firstPass = index;
+			res.lastPass = index;
+		}
+	}
+}
+
+// Records compiled graph into command buffer. With timers every live pass and the whole graph are timed.
+// passCmds are secondary buffers the live passes were already recorded into, in compiled order,
+// they are executed in place of passes then.
+void graphExecute( FrameGraph& graph, VkCommandBuffer cmdBuf, GpuTimers* timers, const VkCommandBuffer* passCmds = nullptr )
+{
+	i32 graphScope = beginGpuTimer( timers, cmdBuf, "frame graph" );
+	for( u32 i = 0; i < graph.order.size(); ++i )
+	{
+		GraphPass& pass = graph.passes[graph.order[i]];
+		i32 passScope = beginGpuTimer( timers, cmdBuf, pass.name );
+		for( u32 a = 0; a < pass.accesses.size(); ++a )
+		{
+			const GraphAccess& use = pass.accesses[a];
+			const GraphResource& res = graph.resources[use.resource];
+			if( res.image )
+				transitionImage( res.image, use.layout, use.access, use.stages );
+			else
+				transitionBuffer( res.buffer, use.access, use.stages );
+		}
+		flushBarriers( cmdBuf );
+
+		if( passCmds )
+			vkCmdExecuteCommands( cmdBuf, 1, &passCmds[i] );
+		else
+			pass.execute( cmdBuf );
+		endGpuTimer( timers, cmdBuf, passScope );
+	}
+
+	// Leave outputs in the state their consumers expect
+	for( u32 r = 0; r < graph.resources.size(); ++r )
+	{
+		const GraphResource& res = graph.resources[r];
+		if( !res.output || res.lastPass < 0 )
+		{
+			continue;
+		}
+		if( res.image )
+			transitionImage( res.image, res.finalLayout, res.finalAccess, res.finalStages );
+		else
+			transitionBuffer( res.buffer, res.finalAccess, res.finalStages );
+	}
+	flushBarriers( cmdBuf );
+	endGpuTimer( timers, cmdBuf, graphScope );
+}
+
+void printGraph( const FrameGraph& graph )
+{
+	std::cout << "frame graph: " << graph.order.size() << " of " << graph.passes.size() << " passes live\n";
+	for( u32 p = 0; p < graph.passes.size(); ++p )
+	{
+		std::cout << "\tpass " << graph.passes[p].name << ( graph.passes[p].culled ? " (culled)" : "" ) << std::endl;
+	}
+	for( u32 r = 0; r < graph.resources.size(); ++r )
+	{
+		const GraphResource& res = graph.resources[r];
+		std::cout << "\tresource " << res.name;
+		if( res.firstPass < 0 )
+			std::cout << " unused\n";
+		else
+			std::cout << " lives in passes " << res.firstPass << ".." << res.lastPass << ( res.output ? ", output\n" : "\n" );
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Uploads
+//
+// Data is written straight into the persistently mapped ring and copies are recorded in batches,
+// one vkCmdCopyBuffer/vkCmdCopyBufferToImage per destination. Ring space is given back when
+// fence of the frame the copies were recorded into is signaled. Destinations must be known
+// to state tracker and are left in transfer write state. With a separate transfer queue, copies
+// into destinations graphics doesn't have to hand over, never used ones and streamed buffers,
+// go to upload lane of the frame on that queue. The rest go into the command buffer of the frame
+// being recorded, so they keep their order with the rest of its work.
+//
+u64 greatestCommonDivisor( u64 a, u64 b )
+{
+	while( b )
+	{
+		u64 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+VkDeviceSize alignUp( VkDeviceSize value, VkDeviceSize alignment )
+{
+	return ( value + alignment - 1 ) / alignment * alignment;
+}
+
+bool initUploadRing()
+{
+	CpuZone zone( "initUploadRing" );
+	UploadRing& ring = gUploadRing;
+	ring = UploadRing();
+	ring.size = gUploadRingSize;
+	ring.alignment = max( gDeviceProps.limits.optimalBufferCopyOffsetAlignment, (VkDeviceSize)4 );
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.flags = 0;
+	bufferInfo.size = ring.size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	bufferInfo.queueFamilyIndexCount = 0;
+	bufferInfo.pQueueFamilyIndices = nullptr;
+
+	// Graphics and transfer queues read it at the same time
+	u32 families[] = { gQueueFamilyIndex, getQueue( QUEUE_TRANSFER ).familyIndex };
+	if( families[0] != families[1] )
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = families;
+	}
+
+	VkResult res = vkCreateBuffer( gDevice, &bufferInfo, gAllocator, &ring.buffer );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "error creating upload ring " << res << std::endl;
+		return false;
+	}
+
+	// Write combined memory is fine, CPU never reads from it
+	if( !allocateBufferMemory( ring.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ring.memory ) )
+	{
+		std::cout << "error allocating upload ring memory\n";
+		return false;
+	}
+	ring.data = (u8*)ring.memory.mapped;
+
+	return initCommandAllocator( ring.stallAllocator, gQueueFamilyIndex );
+}
+
+void destroyUploadRing()
+{
+	UploadRing& ring = gUploadRing;
+	destroyCommandAllocator( ring.stallAllocator );
+	if( ring.buffer )
+		vkDestroyBuffer( gDevice, ring.buffer, gAllocator );
+	freeMemory( gMemoryAllocator, ring.memory );
+	ring.buffer = VK_NULL_HANDLE;
+	ring.data = nullptr;
+}
+
+// Flushes bytes queued since last flush, ring may wrap in between
+void flushUploadMemory()
+{
+	UploadRing& ring = gUploadRing;
+	VkDeviceSize begin = ring.flushedHead % ring.size;
+	VkDeviceSize end = ring.head % ring.size;
+	if( ring.head - ring.flushedHead >= ring.size )
+	{
+		flushAllocation( gMemoryAllocator, ring.memory );
+	}
+	else if( begin < end )
+	{
+		flushAllocation( gMemoryAllocator, ring.memory, begin, end - begin );
+	}
+	else
+	{
+		flushAllocation( gMemoryAllocator, ring.memory, begin, ring.size - begin );
+		flushAllocation( gMemoryAllocator, ring.memory, 0, end );
+	}
+}
+
+// Groups queued copies by destination and image subresource
+void sortUploads()
+{
+	UploadRing& ring = gUploadRing;
+	std::stable_sort( ring.bufferCopies.begin(), ring.bufferCopies.end(), []( const UploadBufferCopy& a, const UploadBufferCopy& b )
+	{
+		return a.dst < b.dst;
+	} );
+	std::stable_sort( ring.imageCopies.begin(), ring.imageCopies.end(), []( const UploadImageCopy& a, const UploadImageCopy& b )
+	{
+		if( a.dst != b.dst )
+			return a.dst < b.dst;
+		if( a.region.imageSubresource.mipLevel != b.region.imageSubresource.mipLevel )
+			return a.region.imageSubresource.mipLevel < b.region.imageSubresource.mipLevel;
+		return a.region.imageSubresource.baseArrayLayer < b.region.imageSubresource.baseArrayLayer;
+	} );
+}
+
+bool sameSubresource( const UploadImageCopy& a, const UploadImageCopy& b )
+{
+	return a.dst == b.dst && a.region.imageSubresource.mipLevel == b.region.imageSubresource.mipLevel &&
+		   a.region.imageSubresource.baseArrayLayer == b.region.imageSubresource.baseArrayLayer;
+}
+
+// One copy command per destination, copies must be sorted
+void recordCopyCommands( VkCommandBuffer cmdBuf, const std::vector<UploadBufferCopy>& bufferCopies, const std::vector<UploadImageCopy>& imageCopies )
+{
+	UploadRing& ring = gUploadRing;
+
+	std::vector<VkBufferCopy> bufferRegions;
+	for( u32 i = 0; i < bufferCopies.size(); ++i )
+	{
+		bufferRegions.push_back( bufferCopies[i].region );
+		if( i + 1 == bufferCopies.size() || bufferCopies[i + 1].dst != bufferCopies[i].dst )
+		{
+			vkCmdCopyBuffer( cmdBuf, ring.buffer, bufferCopies[i].dst, (u32)bufferRegions.size(), &bufferRegions[0] );
+			bufferRegions.clear();
+		}
+	}
+
+	std::vector<VkBufferImageCopy> imageRegions;
+	for( u32 i = 0; i < imageCopies.size(); ++i )
+	{
+		imageRegions.push_back( imageCopies[i].region );
+		if( i + 1 == imageCopies.size() || imageCopies[i + 1].dst != imageCopies[i].dst )
+		{
+			vkCmdCopyBufferToImage( cmdBuf, ring.buffer, imageCopies[i].dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+									(u32)imageRegions.size(), &imageRegions[0] );
+			imageRegions.clear();
+		}
+	}
+}
+
+// Records sorted copies into graphics command buffer, sharing one barrier call
+void recordGraphicsCopies( VkCommandBuffer cmdBuf, const std::vector<UploadBufferCopy>& bufferCopies, const std::vector<UploadImageCopy>& imageCopies )
+{
+	// One transition per destination subresource, so copies into it don't wait for each other
+	for( u32 i = 0; i < bufferCopies.size(); ++i )
+	{
+		if( i == 0 || bufferCopies[i].dst != bufferCopies[i - 1].dst )
+		{
+			// Streamed buffers between frames belong to transfer queue, only upload lane takes them
+			assert( gTrackedBuffers[bufferCopies[i].dst].queue != QUEUE_TRANSFER );
+			transitionBuffer( bufferCopies[i].dst, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT );
+		}
+	}
+	for( u32 i = 0; i < imageCopies.size(); ++i )
+	{
+		const VkImageSubresourceLayers& sub = imageCopies[i].region.imageSubresource;
+		if( i == 0 || !sameSubresource( imageCopies[i], imageCopies[i - 1] ) )
+		{
+			transitionImage( imageCopies[i].dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 sub.mipLevel, 1, sub.baseArrayLayer, 1 );
+		}
+	}
+	flushBarriers( cmdBuf );
+
+	recordCopyCommands( cmdBuf, bufferCopies, imageCopies );
+}
+
+// Marks queued copies as recorded
+void finishUploadFlush()
+{
+	UploadRing& ring = gUploadRing;
+	ring.stats.regions += ring.bufferCopies.size() + ring.imageCopies.size();
+	++ring.stats.flushes;
+	ring.bufferCopies.clear();
+	ring.imageCopies.clear();
+	ring.flushedHead = ring.head;
+}
+
+// Records all queued copies into cmdBuf. Copies into the same destination go out as one command with many regions.
+void recordUploads( VkCommandBuffer cmdBuf )
+{
+	UploadRing& ring = gUploadRing;
+	if( ring.bufferCopies.empty() && ring.imageCopies.empty() )
+	{
+		return;
+	}
+
+	flushUploadMemory();
+	sortUploads();
+	recordGraphicsCopies( cmdBuf, ring.bufferCopies, ring.imageCopies );
+	finishUploadFlush();
+}
+
+bool uploadLaneEnabled()
+{
+	return getQueue( QUEUE_TRANSFER ).queue != getQueue( QUEUE_GRAPHICS ).queue;
+}
+
+bool initUploadLane( UploadLane& lane )
+{
+	lane.waitPending = false;
+	if( !initCommandAllocator( lane.allocator, getQueue( QUEUE_TRANSFER ).familyIndex ) )
+	{
+		return false;
+	}
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = nullptr;
+	semaphoreInfo.flags = 0;
+	HR( vkCreateSemaphore( gDevice, &semaphoreInfo, gAllocator, &lane.done ) );
+	return true;
+}
+
+void destroyUploadLane( UploadLane& lane )
+{
+	vkDestroySemaphore( gDevice, lane.done, gAllocator );
+	destroyCommandAllocator( lane.allocator );
+	lane.returnBuffers.clear();
+}
+
+// Marks buffer as rewritten by uploads in every frame that uses it. Between frames it belongs to
+// transfer queue, so frame must upload into it before anything else touches it.
+void setBufferStreamed( VkBuffer buffer )
+{
+	gTrackedBuffers[buffer].streamed = true;
+}
+
+// Transfer queue may write buffer without graphics handing it over: graphics never used it,
+// or it's a streamed buffer given back at end of an earlier frame
+bool laneTakesBuffer( VkBuffer buffer )
+{
+	const BufferState& state = gTrackedBuffers[buffer];
+	return state.queue == QUEUE_TRANSFER || ( state.queue == QUEUE_GRAPHICS && !state.access && !state.stages );
+}
+
+bool laneTakesImage( VkImage image )
+{
+	const TrackedImage& tracked = gTrackedImages[image];
+	if( tracked.queue != QUEUE_GRAPHICS )
+	{
+		return false;
+	}
+	for( u32 i = 0; i < tracked.states.size(); ++i )
+	{
+		const ImageSubresourceState& state = tracked.states[i];
+		if( state.layout != VK_IMAGE_LAYOUT_UNDEFINED || state.access || state.stages )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Blocks until GPU is done with given frame
+void waitForFrame( u64 frame )
+{
+	FrameSlot& slot = gFrames[frame % gFrames.size()];
+	if( slot.submitted && slot.frame == frame )
+	{
+		HR( vkWaitForFences( gDevice, 1, &slot.fence, VK_TRUE, UINT64_MAX ) );
+	}
+}
+
+VkImageMemoryBarrier uploadImageBarrier( const UploadImageCopy& copy, VkImageLayout oldLayout, u32 srcFamily, u32 dstFamily )
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = 0;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = srcFamily;
+	barrier.dstQueueFamilyIndex = dstFamily;
+	barrier.image = copy.dst;
+	barrier.subresourceRange.aspectMask = copy.region.imageSubresource.aspectMask;
+	barrier.subresourceRange.baseMipLevel = copy.region.imageSubresource.mipLevel;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = copy.region.imageSubresource.baseArrayLayer;
+	barrier.subresourceRange.layerCount = 1;
+	return barrier;
+}
+
+// Records sorted copies into new command buffer of frame upload lane and submits it to transfer queue.
+// When families differ, streamed buffers are acquired from graphics first and every destination
+// is released to graphics after its copies, graphics halves are recorded into frame command buffer.
+void recordLaneCopies( FrameSlot& slot, const std::vector<UploadBufferCopy>& bufferCopies, const std::vector<UploadImageCopy>& imageCopies )
+{
+	UploadRing& ring = gUploadRing;
+	UploadLane& lane = slot.uploads;
+	bool handOver = getQueue( QUEUE_TRANSFER ).familyIndex != gQueueFamilyIndex;
+
+	VkCommandBuffer cmd = acquireCommandBuffer( lane.allocator, VK_COMMAND_BUFFER_LEVEL_PRIMARY );
+	beginCommandBuffer( cmd );
+
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	for( u32 i = 0; i < bufferCopies.size(); ++i )
+	{
+		VkBuffer dst = bufferCopies[i].dst;
+		const BufferState& state = gTrackedBuffers[dst];
+		if( ( i && dst == bufferCopies[i - 1].dst ) || state.queue != QUEUE_TRANSFER )
+		{
+			continue;
+		}
+
+		// Frame which gave the buffer back must be done reading it, its fence also covers the release
+		waitForFrame( state.releaseFrame );
+		if( handOver )
+		{
+			VkBufferMemoryBarrier barrier = ownershipBarrier( dst, QUEUE_GRAPHICS, QUEUE_TRANSFER );
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			bufferBarriers.push_back( barrier );
+		}
+	}
+	for( u32 i = 0; i < imageCopies.size(); ++i )
+	{
+		if( i == 0 || !sameSubresource( imageCopies[i], imageCopies[i - 1] ) )
+		{
+			VkImageMemoryBarrier barrier = uploadImageBarrier( imageCopies[i], VK_IMAGE_LAYOUT_UNDEFINED, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED );
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			imageBarriers.push_back( barrier );
+		}
+	}
+	if( bufferBarriers.size() || imageBarriers.size() )
+	{
+		vkCmdPipelineBarrier( cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+							  bufferBarriers.size(), bufferBarriers.size() ? bufferBarriers.data() : nullptr,
+							  imageBarriers.size(), imageBarriers.size() ? imageBarriers.data() : nullptr );
+	}
+
+	recordCopyCommands( cmd, bufferCopies, imageCopies );
+
+	// Graphics state after acquire: written at transfer stage, which graphics waits for on semaphore
+	bufferBarriers.clear();
+	imageBarriers.clear();
+	for( u32 i = 0; i < bufferCopies.size(); ++i )
+	{
+		VkBuffer dst = bufferCopies[i].dst;
+		if( i && dst == bufferCopies[i - 1].dst )
+		{
+			continue;
+		}
+
+		BufferState& state = gTrackedBuffers[dst];
+		state.queue = QUEUE_GRAPHICS;
+		state.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+		state.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		if( state.streamed )
+		{
+			lane.returnBuffers.push_back( dst );
+		}
+		if( handOver )
+		{
+			bufferBarriers.push_back( ownershipBarrier( dst, QUEUE_TRANSFER, QUEUE_GRAPHICS ) );
+		}
+	}
+	for( u32 i = 0; i < imageCopies.size(); ++i )
+	{
+		const UploadImageCopy& copy = imageCopies[i];
+		if( i && sameSubresource( copy, imageCopies[i - 1] ) )
+		{
+			continue;
+		}
+
+		TrackedImage& tracked = gTrackedImages[copy.dst];
+		ImageSubresourceState& state = tracked.states[copy.region.imageSubresource.mipLevel * tracked.arrayLayers + copy.region.imageSubresource.baseArrayLayer];
+		state.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		state.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+		state.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		if( handOver )
+		{
+			imageBarriers.push_back( uploadImageBarrier( copy, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, getQueue( QUEUE_TRANSFER ).familyIndex, gQueueFamilyIndex ) );
+		}
+	}
+
+	if( bufferBarriers.size() || imageBarriers.size() )
+	{
+		for( u32 i = 0; i < bufferBarriers.size(); ++i )
+			bufferBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		for( u32 i = 0; i < imageBarriers.size(); ++i )
+			imageBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier( cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+							  bufferBarriers.size(), bufferBarriers.size() ? bufferBarriers.data() : nullptr,
+							  imageBarriers.size(), imageBarriers.size() ? imageBarriers.data() : nullptr );
+
+		// Later graphics barriers make the writes visible, acquire only has to come after the semaphore
+		for( u32 i = 0; i < bufferBarriers.size(); ++i )
+			bufferBarriers[i].srcAccessMask = 0;
+		for( u32 i = 0; i < imageBarriers.size(); ++i )
+			imageBarriers[i].srcAccessMask = 0;
+		vkCmdPipelineBarrier( slot.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+							  bufferBarriers.size(), bufferBarriers.size() ? bufferBarriers.data() : nullptr,
+							  imageBarriers.size(), imageBarriers.size() ? imageBarriers.data() : nullptr );
+		ring.stats.transfers += bufferBarriers.size() + imageBarriers.size();
+	}
+
+	endCommandBuffer( cmd );
+
+	VkSubmitInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	info.pNext = nullptr;
+	info.waitSemaphoreCount = 0;
+	info.pWaitSemaphores = nullptr;
+	info.pWaitDstStageMask = nullptr;
+	info.commandBufferCount = 1;
+	info.pCommandBuffers = &cmd;
+	info.signalSemaphoreCount = 1;
+	info.pSignalSemaphores = &lane.done;
+	submitQueue( QUEUE_TRANSFER, 1, &info, VK_NULL_HANDLE );
+
+	lane.waitPending = true;
+	ring.stats.laneRegions += bufferCopies.size() + imageCopies.size();
+}
+
+// Records queued copies of the frame being recorded. Copies the lane can take go to transfer queue,
+// the rest into frame command buffer.
+void recordFrameUploads( FrameSlot& slot )
+{
+	UploadRing& ring = gUploadRing;
+	if( !uploadLaneEnabled() )
+	{
+		recordUploads( slot.cmd );
+		return;
+	}
+	if( ring.bufferCopies.empty() && ring.imageCopies.empty() )
+	{
+		return;
+	}
+
+	// Lane semaphore can be signaled again only once graphics waits for it
+	if( slot.uploads.waitPending )
+	{
+		splitFrame( slot, VK_NULL_HANDLE, VK_NULL_HANDLE );
+	}
+
+	flushUploadMemory();
+	sortUploads();
+
+	// Decided once per destination, the first lane copy changes what the state says
+	std::vector<UploadBufferCopy> laneBuffers, graphicsBuffers;
+	bool onLane = false;
+	for( u32 i = 0; i < ring.bufferCopies.size(); ++i )
+	{
+		if( i == 0 || ring.bufferCopies[i].dst != ring.bufferCopies[i - 1].dst )
+		{
+			onLane = laneTakesBuffer( ring.bufferCopies[i].dst );
+		}
+		( onLane ? laneBuffers : graphicsBuffers ).push_back( ring.bufferCopies[i] );
+	}
+
+	std::vector<UploadImageCopy> laneImages, graphicsImages;
+	for( u32 i = 0; i < ring.imageCopies.size(); ++i )
+	{
+		if( i == 0 || ring.imageCopies[i].dst != ring.imageCopies[i - 1].dst )
+		{
+			onLane = laneTakesImage( ring.imageCopies[i].dst );
+		}
+		( onLane ? laneImages : graphicsImages ).push_back( ring.imageCopies[i] );
+	}
+
+	recordGraphicsCopies( slot.cmd, graphicsBuffers, graphicsImages );
+	if( laneBuffers.size() || laneImages.size() )
+	{
+		recordLaneCopies( slot, laneBuffers, laneImages );
+	}
+	finishUploadFlush();
+}
+
+// Gives streamed buffers back to transfer queue at the end of frame command buffer
+void returnStreamedBuffers( FrameSlot& slot )
+{
+	UploadLane& lane = slot.uploads;
+	bool handOver = getQueue( QUEUE_TRANSFER ).familyIndex != gQueueFamilyIndex;
+
+	std::vector<VkBufferMemoryBarrier> barriers;
+	VkPipelineStageFlags stages = 0;
+	for( u32 i = 0; i < lane.returnBuffers.size(); ++i )
+	{
+		BufferState& state = gTrackedBuffers[lane.returnBuffers[i]];
+		if( handOver )
+		{
+			VkBufferMemoryBarrier barrier = ownershipBarrier( lane.returnBuffers[i], QUEUE_GRAPHICS, QUEUE_TRANSFER );
+			barrier.srcAccessMask = state.access & ACCESS_WRITE_MASK;
+			barriers.push_back( barrier );
+			stages |= state.stages ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		}
+
+		state.queue = QUEUE_TRANSFER;
+		state.access = 0;
+		state.stages = 0;
+		state.releaseFrame = slot.frame;
+	}
+
+	if( barriers.size() )
+	{
+		vkCmdPipelineBarrier( slot.cmd, stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr );
+		gUploadRing.stats.transfers += barriers.size();
+	}
+	lane.returnBuffers.clear();
+}
+
+// Frees ring space when it runs out. Frames in flight are waited for oldest first. If only the frame
+// being recorded holds the space, its queued copies are recorded, the frame is split right there and
+// waited for. Outside of frames queued copies are submitted on their own. Fails only if the ring
+// is simply too small.
+bool stallUploads()
+{
+	UploadRing& ring = gUploadRing;
+	++ring.stats.stalls;
+
+	// Slot keeps its submitted flag, it is retired as usual when reused
+	for( u32 i = 0; i < gFrames.size(); ++i )
+	{
+		FrameSlot& slot = gFrames[( gFrameNumber + i ) % gFrames.size()];
+		if( slot.submitted && slot.uploadEnd > ring.tail )
+		{
+			HR( vkWaitForFences( gDevice, 1, &slot.fence, VK_TRUE, UINT64_MAX ) );
+			ring.tail = slot.uploadEnd;
+			return true;
+		}
+	}
+
+	if( gRecordingFrame && ring.head != ring.tail )
+	{
+		VkFence fence = acquireFence();
+		recordFrameUploads( *gRecordingFrame );
+		splitFrame( *gRecordingFrame, VK_NULL_HANDLE, fence );
+		HR( vkWaitForFences( gDevice, 1, &fence, VK_TRUE, UINT64_MAX ) );
+		releaseFence( fence );
+		ring.tail = ring.flushedHead;
+		return true;
+	}
+
+	if( !gRecordingFrame && ring.flushedHead == ring.tail && ring.head != ring.flushedHead )
+	{
+		VkCommandBuffer cmd = acquireCommandBuffer( ring.stallAllocator, VK_COMMAND_BUFFER_LEVEL_PRIMARY );
+		beginCommandBuffer( cmd );
+		recordUploads( cmd );
+		endCommandBuffer( cmd );
+		executeQueue( cmd );
+		resetCommandAllocator( ring.stallAllocator );
+		ring.tail = ring.flushedHead;
+		return true;
+	}
+
+	std::cout << "upload ring of " << ring.size / 1024 << " KB is full\n";
+	return false;
+}
+
+// Reserves bytes at given alignment, wrapping to ring start if they don't fit before its end
+bool reserveUpload( VkDeviceSize bytes, VkDeviceSize alignment, VkDeviceSize* offset )
+{
+	UploadRing& ring = gUploadRing;
+	if( bytes > ring.size )
+	{
+		return false;
+	}
+
+	for( ;; )
+	{
+		VkDeviceSize position = ring.head % ring.size;
+		VkDeviceSize aligned = alignUp( position, alignment );
+		if( aligned + bytes > ring.size )
+		{
+			aligned = ring.size;
+		}
+
+		VkDeviceSize end = ring.head + ( aligned - position ) + bytes;
+		if( end - ring.tail <= ring.size )
+		{
+			*offset = aligned % ring.size;
+			ring.head = end;
+			return true;
+		}
+
+		if( !stallUploads() )
+		{
+			return false;
+		}
+	}
+}
+
+// Queues upload of size bytes into buffer. Big uploads are split so that every piece fits into half of ring.
+bool uploadToBuffer( VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size )
+{
+	UploadRing& ring = gUploadRing;
+	VkDeviceSize maxChunk = ring.size / 2;
+
+	for( VkDeviceSize done = 0; done < size; )
+	{
+		VkDeviceSize chunk = min( size - done, maxChunk );
+		VkDeviceSize offset;
+		if( !reserveUpload( chunk, ring.alignment, &offset ) )
+		{
+			return false;
+		}
+		memcpy( ring.data + offset, (const u8*)data + done, (size_t)chunk );
+
+		UploadBufferCopy copy;
+		copy.dst = dst;
+		copy.region.srcOffset = offset;
+		copy.region.dstOffset = dstOffset + done;
+		copy.region.size = chunk;
+		ring.bufferCopies.push_back( copy );
+
+		done += chunk;
+	}
+
+	++ring.stats.uploads;
+	ring.stats.bytes += size;
+	return true;
+}
+
+// Queues upload of tightly packed texels into color image region. 2D regions bigger than half
+// of ring are split into bands of rows.
+bool uploadToImage( VkImage dst, u32 mipLevel, u32 arrayLayer, VkOffset3D offset, VkExtent3D extent, u32 texelSize, const void* data )
+{
+	UploadRing& ring = gUploadRing;
+	VkDeviceSize maxChunk = ring.size / 2;
+	VkDeviceSize rowBytes = (VkDeviceSize)extent.width * texelSize;
+	VkDeviceSize size = rowBytes * extent.height * extent.depth;
+
+	// Buffer offset has to be multiple of both texel size and 4
+	VkDeviceSize alignment = ring.alignment;
+	alignment = alignment / greatestCommonDivisor( alignment, texelSize ) * texelSize;
+	alignment = alignment / greatestCommonDivisor( alignment, 4 ) * 4;
+
+	u32 rowsPerChunk = extent.height;
+	if( size > maxChunk )
+	{
+		if( extent.depth != 1 || rowBytes > maxChunk )
+		{
+			std::cout << "image upload of " << size / 1024 << " KB doesn't fit into upload ring\n";
+			return false;
+		}
+		rowsPerChunk = (u32)( maxChunk / rowBytes );
+	}
+
+	for( u32 row = 0; row < extent.height; row += rowsPerChunk )
+	{
+		u32 rows = min( rowsPerChunk, extent.height - row );
+		VkDeviceSize chunk = rowBytes * rows * extent.depth;
+		VkDeviceSize ringOffset;
+		if( !reserveUpload( chunk, alignment, &ringOffset ) )
+		{
+			return false;
+		}
+		memcpy( ring.data + ringOffset, (const u8*)data + rowBytes * row, (size_t)chunk );
+
+		UploadImageCopy copy;
+		copy.dst = dst;
+		copy.region.bufferOffset = ringOffset;
+		copy.region.bufferRowLength = 0;
+		copy.region.bufferImageHeight = 0;
+		copy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copy.region.imageSubresource.mipLevel = mipLevel;
+		copy.region.imageSubresource.baseArrayLayer = arrayLayer;
+		copy.region.imageSubresource.layerCount = 1;
+		copy.region.imageOffset = offset;
+		copy.region.imageOffset.y += row;
+		copy.region.imageExtent = extent;
+		copy.region.imageExtent.height = rows;
+		ring.imageCopies.push_back( copy );
+	}
+
+	++ring.stats.uploads;
+	ring.stats.bytes += size;
+	return true;
+}
+
+void printUploadStats()
+{
+	const UploadStats& stats = gUploadRing.stats;
+	std::cout << "uploads: " << stats.uploads << " uploads, " << stats.bytes / 1024 << " KB, " << stats.regions << " regions in "
+			  << stats.flushes << " flushes, " << stats.stalls << " stalls on full ring\n";
+	if( stats.laneRegions )
+	{
+		std::cout << "\t" << stats.laneRegions << " regions copied on transfer queue, " << stats.transfers << " ownership transfers\n";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Async compute
+//
+// Frame may record work into its compute lane, which goes to compute queue and overlaps graphics.
+// Resources are declared with computeUse*/computeRelease*. Taking resource from graphics splits frame:
+// graphics work recorded so far is submitted first and signals semaphore compute waits for. Results
+// handed back make rest of the frame wait for compute at stages they are used at. Ownership transfers
+// are generated for whole images and buffers, which must be in one state at that point. When compute
+// has no queue of its own, lane just goes into frame's batch on graphics queue.
+//
+bool initComputeLane( ComputeLane& lane )
+{
+	lane.cmd = VK_NULL_HANDLE;
+	lane.waitStages = 0;
+	lane.graphicsWaitStages = 0;
+	lane.releaseStages = 0;
+	lane.submitted = false;
+
+	if( !initCommandAllocator( lane.allocator, getQueue( QUEUE_COMPUTE ).familyIndex ) )
+	{
+		return false;
+	}
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = nullptr;
+	semaphoreInfo.flags = 0;
+	HR( vkCreateSemaphore( gDevice, &semaphoreInfo, gAllocator, &lane.graphicsDone ) );
+	HR( vkCreateSemaphore( gDevice, &semaphoreInfo, gAllocator, &lane.computeDone ) );
+	return true;
+}
+
+void destroyComputeLane( ComputeLane& lane )
+{
+	if( lane.graphicsDone )
+		vkDestroySemaphore( gDevice, lane.graphicsDone, gAllocator );
+	if( lane.computeDone )
+		vkDestroySemaphore( gDevice, lane.computeDone, gAllocator );
+	destroyCommandAllocator( lane.allocator );
+	lane.graphicsDone = VK_NULL_HANDLE;
+	lane.computeDone = VK_NULL_HANDLE;
+}
+
+// Starts recording compute work of the frame, at most once per frame
+VkCommandBuffer beginCompute( FrameSlot& slot )
+{
+	ComputeLane& lane = slot.compute;
+	assert( !lane.cmd && !lane.submitted );
+
+	lane.cmd = acquireCommandBuffer( lane.allocator, VK_COMMAND_BUFFER_LEVEL_PRIMARY );
+
+	VkCommandBufferBeginInfo cmd = {};
+	cmd.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmd.pNext = nullptr;
+	cmd.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	cmd.pInheritanceInfo = nullptr;
+	HR( vkBeginCommandBuffer( lane.cmd, &cmd ) );
+
+	++gComputeStats.lanes;
+	return lane.cmd;
+}
+
+bool familiesDiffer()
+{
+	return getQueue( QUEUE_GRAPHICS ).familyIndex != getQueue( QUEUE_COMPUTE ).familyIndex;
+}
+
+// Makes image usable by compute lane in given state
+void computeUseImage( FrameSlot& slot, VkImage image, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	ComputeLane& lane = slot.compute;
+	TrackedImage& tracked = gTrackedImages[image];
+
+	if( tracked.queue == QUEUE_GRAPHICS )
+	{
+		lane.waitStages |= stages;
+		tracked.queue = QUEUE_COMPUTE;
+
+		if( familiesDiffer() )
+		{
+			const ImageSubresourceState& state = tracked.states[0];
+			VkImageMemoryBarrier barrier = ownershipBarrier( image, tracked, layout, QUEUE_GRAPHICS, QUEUE_COMPUTE );
+
+			barrier.srcAccessMask = state.access & ACCESS_WRITE_MASK;
+			lane.releaseImages.push_back( barrier );
+			lane.releaseStages |= state.stages ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+			// Acquire waits for semaphore, which is waited for at the same stages
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = access;
+			vkCmdPipelineBarrier( lane.cmd, stages, stages, 0, 0, nullptr, 0, nullptr, 1, &barrier );
+
+			setImageState( image, layout, access, stages );
+			++gComputeStats.transfers;
+			return;
+		}
+	}
+
+	transitionImage( image, layout, access, stages );
+	flushBarriers( lane.cmd );
+}
+
+void computeUseBuffer( FrameSlot& slot, VkBuffer buffer, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	ComputeLane& lane = slot.compute;
+	BufferState& state = gTrackedBuffers[buffer];
+
+	if( state.queue == QUEUE_GRAPHICS )
+	{
+		lane.waitStages |= stages;
+		state.queue = QUEUE_COMPUTE;
+
+		if( familiesDiffer() )
+		{
+			VkBufferMemoryBarrier barrier = ownershipBarrier( buffer, QUEUE_GRAPHICS, QUEUE_COMPUTE );
+
+			barrier.srcAccessMask = state.access & ACCESS_WRITE_MASK;
+			lane.releaseBuffers.push_back( barrier );
+			lane.releaseStages |= state.stages ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = access;
+			vkCmdPipelineBarrier( lane.cmd, stages, stages, 0, 0, nullptr, 1, &barrier, 0, nullptr );
+
+			state.access = access;
+			state.stages = stages;
+			++gComputeStats.transfers;
+			return;
+		}
+	}
+
+	transitionBuffer( buffer, access, stages );
+	flushBarriers( lane.cmd );
+}
+
+// Hands image used by compute back to graphics, which is going to use it in given state
+void computeReleaseImage( FrameSlot& slot, VkImage image, VkImageLayout layout, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	ComputeLane& lane = slot.compute;
+	TrackedImage& tracked = gTrackedImages[image];
+	assert( tracked.queue == QUEUE_COMPUTE );
+
+	lane.graphicsWaitStages |= stages;
+	tracked.queue = QUEUE_GRAPHICS;
+
+	// Within one family graphics gets its barrier from tracker on first use
+	if( familiesDiffer() )
+	{
+		const ImageSubresourceState& state = tracked.states[0];
+		VkImageMemoryBarrier barrier = ownershipBarrier( image, tracked, layout, QUEUE_COMPUTE, QUEUE_GRAPHICS );
+
+		barrier.srcAccessMask = state.access & ACCESS_WRITE_MASK;
+		vkCmdPipelineBarrier( lane.cmd, state.stages ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+							  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier );
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = access;
+		lane.acquireImages.push_back( barrier );
+
+		setImageState( image, layout, access, stages );
+		++gComputeStats.transfers;
+	}
+}
+
+void computeReleaseBuffer( FrameSlot& slot, VkBuffer buffer, VkAccessFlags access, VkPipelineStageFlags stages )
+{
+	ComputeLane& lane = slot.compute;
+	BufferState& state = gTrackedBuffers[buffer];
+	assert( state.queue == QUEUE_COMPUTE );
+
+	lane.graphicsWaitStages |= stages;
+	state.queue = QUEUE_GRAPHICS;
+
+	if( familiesDiffer() )
+	{
+		VkBufferMemoryBarrier barrier = ownershipBarrier( buffer, QUEUE_COMPUTE, QUEUE_GRAPHICS );
+
+		barrier.srcAccessMask = state.access & ACCESS_WRITE_MASK;
+		vkCmdPipelineBarrier( lane.cmd, state.stages ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+							  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr );
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = access;
+		lane.acquireBuffers.push_back( barrier );
+
+		state.access = access;
+		state.stages = stages;
+		++gComputeStats.transfers;
+	}
+}
+
+// Submits compute lane. If it takes anything from graphics, graphics work recorded so far is
+// submitted before it and frame continues in a new command buffer.
+// When compute shares graphics queue, lane is only batched between the two parts of the frame instead.
+// Queue runs it in submission order and tracker barriers already sync it, so no semaphores are needed.
+// Separate compute queue of graphics family still gets semaphores, so lane overlaps graphics.
+void submitCompute( FrameSlot& slot )
+{
+	ComputeLane& lane = slot.compute;
+	endCommandBuffer( lane.cmd );
+
+	if( getQueue( QUEUE_COMPUTE ).queue == getQueue( QUEUE_GRAPHICS ).queue )
+	{
+		if( lane.waitStages )
+		{
+			batchFramePart( slot, VK_NULL_HANDLE );
+		}
+		batchSubmit( lane.cmd, VK_NULL_HANDLE, 0, VK_NULL_HANDLE );
+		++gComputeStats.folded;
+
+		lane.cmd = VK_NULL_HANDLE;
+		lane.waitStages = 0;
+		lane.graphicsWaitStages = 0;
+		return;
+	}
+
+	if( lane.waitStages )
+	{
+		if( !lane.releaseImages.empty() || !lane.releaseBuffers.empty() )
+		{
+			vkCmdPipelineBarrier( slot.cmd, lane.releaseStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+								  lane.releaseBuffers.size(), lane.releaseBuffers.size() ? lane.releaseBuffers.data() : nullptr,
+								  lane.releaseImages.size(), lane.releaseImages.size() ? lane.releaseImages.data() : nullptr );
+		}
+		splitFrame( slot, lane.graphicsDone, VK_NULL_HANDLE );
+		++gComputeStats.splits;
+	}
+
+	VkSubmitInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	info.pNext = nullptr;
+	info.waitSemaphoreCount = lane.waitStages ? 1 : 0;
+	info.pWaitSemaphores = &lane.graphicsDone;
+	info.pWaitDstStageMask = &lane.waitStages;
+	info.commandBufferCount = 1;
+	info.pCommandBuffers = &lane.cmd;
+	info.signalSemaphoreCount = 1;
+	info.pSignalSemaphores = &lane.computeDone;
+	submitQueue( QUEUE_COMPUTE, 1, &info, VK_NULL_HANDLE );
+
+	// Acquires go first in the rest of the frame, right after semaphore wait
+	if( !lane.acquireImages.empty() || !lane.acquireBuffers.empty() )
+	{
+		vkCmdPipelineBarrier( slot.cmd, lane.graphicsWaitStages, lane.graphicsWaitStages, 0, 0, nullptr,
+							  lane.acquireBuffers.size(), lane.acquireBuffers.size() ? lane.acquireBuffers.data() : nullptr,
+							  lane.acquireImages.size(), lane.acquireImages.size() ? lane.acquireImages.data() : nullptr );
+	}
+
+	lane.cmd = VK_NULL_HANDLE;
+	lane.waitStages = 0;
+	lane.releaseStages = 0;
+	lane.releaseImages.clear();
+	lane.releaseBuffers.clear();
+	lane.acquireImages.clear();
+	lane.acquireBuffers.clear();
+	lane.submitted = true;
+}
+
+void printComputeStats()
+{
+	std::cout << "async compute: " << gComputeStats.lanes << " lanes, " << gComputeStats.splits << " graphics splits, "
+			  << gComputeStats.transfers << " ownership transfers, " << gComputeStats.folded << " folded into graphics batch on shared queue\n";
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Frames in flight
+//
+const u32 OVERLAY_SIZE = 64;		// overlay square streamed every frame, in texels
+
+bool initFrameRing()
+{
+	CpuZone zone( "initFrameRing" );
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = nullptr;
+	semaphoreInfo.flags = 0;
+
+	// Created signaled so first wait on every slot passes
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.pNext = nullptr;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	VkBufferCreateInfo overlayInfo = {};
+	overlayInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	overlayInfo.pNext = nullptr;
+	overlayInfo.flags = 0;
+	overlayInfo.size = OVERLAY_SIZE * OVERLAY_SIZE * 4;
+	overlayInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	overlayInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	overlayInfo.queueFamilyIndexCount = 0;
+	overlayInfo.pQueueFamilyIndices = nullptr;
+
+	// Timestamps need valid bits on graphics family, period converts them to ns
+	u32 timestampBits = gQueueProps[gQueueFamilyIndex].timestampValidBits;
+	if( gGpuTimers && !timestampBits )
+	{
+		std::cout << "graphics queue has no timestamps, GPU timers are off\n";
+		gGpuTimers = false;
+	}
+	gTimestampMask = timestampBits >= 64 ? ~0ull : ( 1ull << timestampBits ) - 1;
+
+	gFrames.resize( gFramesInFlight );
+	for( u32 i = 0; i < gFrames.size(); ++i )
+	{
+		FrameSlot& slot = gFrames[i];
+		slot.submitted = false;
+		slot.frame = 0;
+		slot.cmd = VK_NULL_HANDLE;
+		slot.uploadEnd = 0;
+		slot.overlay = VK_NULL_HANDLE;
+		slot.overlayMemory = MemoryAllocation();
+		slot.startTicks = 0;
+		slot.latencyPending = false;
+		slot.inputRecord = -1;
+
+		if( !initCommandAllocator( slot.cmdAllocator, gQueueFamilyIndex ) )
+		{
+			return false;
+		}
+
+		HR( vkCreateSemaphore( gDevice, &semaphoreInfo, gAllocator, &slot.acquireSemaphore ) );
+		HR( vkCreateSemaphore( gDevice, &semaphoreInfo, gAllocator, &slot.renderSemaphore ) );
+		HR( vkCreateFence( gDevice, &fenceInfo, gAllocator, &slot.fence ) );
+
+		// Tracked once the frame imports it, tracker belongs to rendering thread
+		HR( vkCreateBuffer( gDevice, &overlayInfo, gAllocator, &slot.overlay ) );
+		if( !allocateBufferMemory( slot.overlay, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &slot.overlayMemory ) )
+		{
+			std::cout << "error allocating overlay memory\n";
+			return false;
+		}
+
+		if( !initUploadLane( slot.uploads ) || !initComputeLane( slot.compute ) || !initGpuTimers( slot.timers ) )
+		{
+			return false;
+		}
+
+		// Command pools are externally synchronized, so every recording thread gets its own
+		slot.threadAllocators.resize( gWorkerCount );
+		for( u32 t = 0; t < slot.threadAllocators.size(); ++t )
+		{
+			if( !initCommandAllocator( slot.threadAllocators[t], gQueueFamilyIndex ) )
+			{
+				return false;
+			}
+		}
+	}
+
+	gFrameNumber = 0;
+	gFramePacing = FramePacingStats();
+
+	std::cout << gFrames.size() << " frame slots created\n";
+	return true;
+}
+
+// Waits until GPU is done with slot and runs its completion callback
+void retireFrameSlot( FrameSlot& slot )
+{
+	if( !slot.submitted )
+	{
+		return;
+	}
+
+	if( vkGetFenceStatus( gDevice, slot.fence ) == VK_NOT_READY )
+	{
+		CpuZone zone( "wait frame slot" );
+		u64 start = getTimerTicks();
+		HR( vkWaitForFences( gDevice, 1, &slot.fence, VK_TRUE, UINT64_MAX ) );
+		double ms = ticksToMs( getTimerTicks() - start );
+
+		++gFramePacing.waits;
+		gFramePacing.waitMs += ms;
+		gFramePacing.maxWaitMs = max( gFramePacing.maxWaitMs, ms );
+	}
+
+	recordFrameLatency( slot, true );
+	resolveGpuTimers( slot.timers );
+	slot.submitted = false;
+	gUploadRing.tail = max( gUploadRing.tail, slot.uploadEnd );
+	if( slot.onComplete )
+	{
+		slot.onComplete();
+		slot.onComplete = nullptr;
+	}
+}
+
+void waitAllFrames()
+{
+	for( u32 i = 0; i < gFrames.size(); ++i )
+	{
+		retireFrameSlot( gFrames[( gFrameNumber + i ) % gFrames.size()] );
+	}
+}
+
+void destroyFrameRing()
+{
+	waitAllFrames();
+	for( u32 i = 0; i < gFrames.size(); ++i )
+	{
+		FrameSlot& slot = gFrames[i];
+		vkDestroyFence( gDevice, slot.fence, gAllocator );
+		vkDestroySemaphore( gDevice, slot.renderSemaphore, gAllocator );
+		vkDestroySemaphore( gDevice, slot.acquireSemaphore, gAllocator );
+		destroyCommandAllocator( slot.cmdAllocator );
+		if( slot.overlay )
+		{
+			untrackBuffer( slot.overlay );
+			vkDestroyBuffer( gDevice, slot.overlay, gAllocator );
+		}
+		freeMemory( gMemoryAllocator, slot.overlayMemory );
+		destroyUploadLane( slot.uploads );
+		destroyComputeLane( slot.compute );
+		destroyGpuTimers( slot.timers );
+		for( u32 t = 0; t < slot.threadAllocators.size(); ++t )
+		{
+			destroyCommandAllocator( slot.threadAllocators[t] );
+		}
+	}
+	gFrames.clear();
+}
+
+// Takes next slot of the ring, waits for it only if GPU still uses it and starts recording
+FrameSlot& beginFrame()
+{
+	FrameSlot& slot = gFrames[gFrameNumber % gFrames.size()];
+	retireFrameSlot( slot );
+
+	HR( vkResetFences( gDevice, 1, &slot.fence ) );
+	resetCommandAllocator( slot.cmdAllocator );
+	resetCommandAllocator( slot.uploads.allocator );
+	resetCommandAllocator( slot.compute.allocator );
+	for( u32 t = 0; t < slot.threadAllocators.size(); ++t )
+	{
+		resetCommandAllocator( slot.threadAllocators[t] );
+	}
+	slot.cmd = acquireCommandBuffer( slot.cmdAllocator, VK_COMMAND_BUFFER_LEVEL_PRIMARY );
+
+	if( gAllocator )
+	{
+		resetHostFrameAllocator( gHostAllocator );
+	}
+
+	VkCommandBufferBeginInfo cmd = {};
+	cmd.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmd.pNext = nullptr;
+	cmd.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	cmd.pInheritanceInfo = nullptr;
+	HR( vkBeginCommandBuffer( slot.cmd, &cmd ) );
+	resetGpuTimers( slot.timers, slot.cmd );
+
+	slot.frame = gFrameNumber;
+	gRecordingFrame = &slot;
+	return slot;
+}
+
+// Ends recording, adds slot buffer to the batch after everything other producers added during
+// the frame and flushes the batch with slot fence. Semaphores are optional, headless frames don't use them.
+void endFrame( FrameSlot& slot, VkSemaphore waitSemaphore, VkPipelineStageFlags waitStage, VkSemaphore signalSemaphore )
+{
+	returnStreamedBuffers( slot );
+	endCommandBuffer( slot.cmd );
+
+	// Fence of the slot has to cover compute lane too, so its semaphore is always waited for.
+	// If graphics doesn't use its results, wait at the very end doesn't hold anything.
+	VkSemaphore waits[3];
+	VkPipelineStageFlags waitStages[3];
+	u32 waitCount = 0;
+	if( waitSemaphore )
+	{
+		waits[waitCount] = waitSemaphore;
+		waitStages[waitCount++] = waitStage;
+	}
+	if( slot.uploads.waitPending )
+	{
+		waits[waitCount] = slot.uploads.done;
+		waitStages[waitCount++] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		slot.uploads.waitPending = false;
+	}
+	if( slot.compute.submitted )
+	{
+		waits[waitCount] = slot.compute.computeDone;
+		waitStages[waitCount++] = slot.compute.graphicsWaitStages ? slot.compute.graphicsWaitStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		slot.compute.submitted = false;
+		slot.compute.graphicsWaitStages = 0;
+	}
+
+	batchSubmit( &slot.cmd, 1, waits, waitStages, waitCount, &signalSemaphore, signalSemaphore ? 1 : 0 );
+	flushSubmits( slot.fence );
+
+	slot.submitted = true;
+	slot.uploadEnd = gUploadRing.flushedHead;
+	gRecordingFrame = nullptr;
+	++gFrameNumber;
+	++gFramePacing.frames;
+}
+
+// Records jobCount secondary command buffers in parallel into secondaries, each worker uses its own pool of the slot
+void recordSecondaries( FrameSlot& slot, u32 jobCount, const std::function<void( VkCommandBuffer, u32 )>& record, std::vector<VkCommandBuffer>& secondaries )
+{
+	secondaries.resize( jobCount );
+
+	runParallel( jobCount, [&]( u32 job, u32 worker )
+	{
+		CpuZone zone( "record job" );
+		VkCommandBuffer cmd = acquireCommandBuffer( slot.threadAllocators[worker], VK_COMMAND_BUFFER_LEVEL_SECONDARY );
+
+		VkCommandBufferInheritanceInfo inheritance = {};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.pNext = nullptr;
+		inheritance.renderPass = VK_NULL_HANDLE;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = VK_NULL_HANDLE;
+		inheritance.occlusionQueryEnable = VK_FALSE;
+		inheritance.queryFlags = 0;
+		inheritance.pipelineStatistics = 0;
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.pNext = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritance;
+
+		HR( vkBeginCommandBuffer( cmd, &beginInfo ) );
+		record( cmd, job );
+		HR( vkEndCommandBuffer( cmd ) );
+
+		secondaries[job] = cmd;
+	} );
+}
+
+// Secondaries are executed from slot primary buffer in job order, so result is the same as if
+// jobs were recorded one after another. Must be called outside of render pass.
+void recordParallel( FrameSlot& slot, u32 jobCount, const std::function<void( VkCommandBuffer, u32 )>& record )
+{
+	std::vector<VkCommandBuffer> secondaries;
+	recordSecondaries( slot, jobCount, record, secondaries );
+
+	if( jobCount )
+	{
+		vkCmdExecuteCommands( slot.cmd, jobCount, secondaries.data() );
+	}
+}
+
+// Records every live pass of compiled graph into its own secondary on workers. Barriers and timers
+// are placed in slot primary buffer in pass order, as tracker state is only valid in that order.
+// Passes must record into the buffer they are given only.
+void graphExecuteParallel( FrameGraph& graph, FrameSlot& slot )
+{
+	std::vector<VkCommandBuffer> passCmds;
+	recordSecondaries( slot, graph.order.size(), [&]( VkCommandBuffer cmd, u32 job )
+	{
+		graph.passes[graph.order[job]].execute( cmd );
+	}, passCmds );
+
+	graphExecute( graph, slot.cmd, &slot.timers, passCmds.size() ? passCmds.data() : nullptr );
+}
+
+// Overlay is copied into color target as is, so it needs one of the usual 8 bit formats
+bool isRgba8Format( VkFormat format )
+{
+	return format >= VK_FORMAT_R8G8B8A8_UNORM && format <= VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+// Small square written on CPU every frame and streamed through upload ring into slot overlay
+// buffer, then copied over color target at position moving with the frame. Texels are gray,
+// so it looks the same in RGBA and BGRA targets.
+void addOverlayPass( FrameGraph& graph, FrameSlot& slot, u32 colorTarget )
+{
+	u32 size = min( OVERLAY_SIZE, min( gWidth, gHeight ) );
+	if( !size || !isRgba8Format( gFormat ) )
+	{
+		return;
+	}
+
+	gOverlayTexels.resize( size * size * 4 );
+	for( u32 y = 0; y < size; ++y )
+	{
+		for( u32 x = 0; x < size; ++x )
+		{
+			u8* texel = &gOverlayTexels[( y * size + x ) * 4];
+			texel[0] = texel[1] = texel[2] = (u8)( ( x + y ) * 2 + slot.frame * 4 );
+			texel[3] = 255;
+		}
+	}
+
+	u32 overlay = graphImportBuffer( graph, "overlay", slot.overlay );
+	setBufferStreamed( slot.overlay );
+	if( !uploadToBuffer( slot.overlay, 0, gOverlayTexels.data(), gOverlayTexels.size() ) )
+	{
+		return;
+	}
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset.x = (i32)( slot.frame * 2 % ( gWidth - size + 1 ) );
+	region.imageOffset.y = (i32)( ( gHeight - size ) / 2 );
+	region.imageOffset.z = 0;
+	region.imageExtent.width = size;
+	region.imageExtent.height = size;
+	region.imageExtent.depth = 1;
+
+	VkBuffer buffer = slot.overlay;
+	VkImage image = graph.resources[colorTarget].image;
+	u32 pass = graphAddPass( graph, "overlay", [=]( VkCommandBuffer cmd )
+	{
+		vkCmdCopyBufferToImage( cmd, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
+	} );
+	graphRead( graph, pass, overlay, VK_IMAGE_LAYOUT_UNDEFINED, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT );
+	graphModify( graph, pass, colorTarget, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+}
+
+void printFramePacing()
+{
+	if( !gFramePacing.frames )
+	{
+		return;
+	}
+
+	std::cout << "frame pacing: " << gFramePacing.frames << " frames, " << gFramesInFlight << " in flight, CPU waited on "
+			  << gFramePacing.waits << " slots (" << gFramePacing.waits * 100.0 / gFramePacing.frames << "%), avg wait "
+			  << ( gFramePacing.waits ? gFramePacing.waitMs / gFramePacing.waits : 0.0 ) << " ms, max wait "
+			  << gFramePacing.maxWaitMs << " ms\n";
+}
+
+// Renders one frame into swapchain and presents it
+void renderFrame()
+{
+	CpuZone zone( "frame" );
+	if( gSwapchainDirty && !recreateSwapchain() )
+	{
+		return;
+	}
+
+	u64 start = pacerBeginFrame();
+	FrameSlot& slot = beginFrame();
+	destroyRetiredSwapchains( false );
+
+	// Out of date frame is dropped, suboptimal one is still presented
+	u32 imageIndex = 0;
+	VkResult res;
+	{
+		CpuZone zone( "acquire" );
+		res = vkAcquireNextImageKHR( gDevice, gSwapchain, UINT64_MAX, slot.acquireSemaphore, VK_NULL_HANDLE, &imageIndex );
+	}
+	if( res == VK_SUBOPTIMAL_KHR )
+	{
+		gSwapchainDirty = true;
+	}
+	else if( res != VK_SUCCESS )
+	{
+		if( res == VK_ERROR_OUT_OF_DATE_KHR )
+			gSwapchainDirty = true;
+		else
+			std::cout << "error acquiring swapchain image " << res << std::endl;
+		endCommandBuffer( slot.cmd );
+		gRecordingFrame = nullptr;
+		return;
+	}
+
+	VkImage image = gSwapBuffers[imageIndex].image;
+
+	VkImageSubresourceRange range = {};
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = 1;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
+
+	VkClearColorValue color;
+	color.float32[0] = ( slot.frame % 256 ) / 255.0f;
+	color.float32[1] = 0.2f;
+	color.float32[2] = 0.4f;
+	color.float32[3] = 1.0f;
+
+	// Contents are discarded, first barrier only has to wait for acquire semaphore at transfer stage
+	setImageState( image, VK_IMAGE_LAYOUT_UNDEFINED, 0, VK_PIPELINE_STAGE_TRANSFER_BIT );
+
+	FrameGraph& graph = gFrameGraph;
+	graphReset( graph );
+	u32 backbuffer = graphImportImage( graph, "backbuffer", image );
+	graphSetOutput( graph, backbuffer, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT );
+
+	u32 clear = graphAddPass( graph, "clear", [&]( VkCommandBuffer cmd )
+	{
+		vkCmdClearColorImage( cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range );
+	} );
+	graphWrite( graph, clear, backbuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+	addOverlayPass( graph, slot, backbuffer );
+
+	graphCompile( graph );
+	recordFrameUploads( slot );
+	graphExecuteParallel( graph, slot );
+
+	endFrame( slot, slot.acquireSemaphore, VK_PIPELINE_STAGE_TRANSFER_BIT, slot.renderSemaphore );
+	slot.startTicks = start;
+	slot.latencyPending = true;
+
+	// Frame consumes all input received before it started
+	slot.inputRecord = -1;
+	if( gPendingInputCount )
+	{
+		InputFrameRecord record = {};
+		record.frame = slot.frame;
+		record.inputs = gPendingInputCount;
+		record.inputTicks = gPendingInputTicks;
+		slot.inputRecord = (i32)gInputRecords.size();
+		gInputRecords.push_back( record );
+		gPendingInputCount = 0;
+	}
+
+	VkPresentInfoKHR present = {};
+	present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present.pNext = nullptr;
+	present.waitSemaphoreCount = 1;
+	present.pWaitSemaphores = &slot.renderSemaphore;
+	present.swapchainCount = 1;
+	present.pSwapchains = &gSwapchain;
+	present.pImageIndices = &imageIndex;
+	present.pResults = nullptr;
+
+	DeviceQueue& queue = getQueue( QUEUE_GRAPHICS );
+	std::lock_guard<std::mutex> lock( *queue.mutex );
+	{
+		CpuZone zone( "present" );
+		res = vkQueuePresentKHR( queue.queue, &present );
+	}
+	if( ( res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR ) && slot.inputRecord >= 0 )
+	{
+		InputFrameRecord& record = gInputRecords[slot.inputRecord];
+		record.presentMs = (float)ticksToMs( getTimerTicks() - record.inputTicks );
+	}
+
+	if( res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR )
+	{
+		gSwapchainDirty = true;
+	}
+	else if( res != VK_SUCCESS )
+	{
+		std::cout << "error presenting swapchain image " << res << std::endl;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Render thread
+//
+// Render thread owns acquire, recording, submit and present. Window thread blocks in GetMessage and
+// only exchanges events with it through lock-free queues, so neither ever waits for the other.
+//
+// Swapchain is only marked dirty here, it's recreated before the next frame
+void processWindowEvents()
+{
+	WindowEvent event;
+	while( spscPop( gWindowEvents, &event ) )
+	{
+		switch( event.type )
+		{
+		case WINDOW_EVENT_RESIZE:
+			gMinimized = event.minimized;
+			if( !event.minimized && ( event.width != gWidth || event.height != gHeight ) )
+			{
+				gSwapchainDirty = true;
+			}
+
+			// Input can't be shown while minimized, it would only skew latency
+			if( gMinimized )
+			{
+				gPendingInputCount = 0;
+			}
+			break;
+		case WINDOW_EVENT_INPUT:
+			if( !gPendingInputCount )
+			{
+				gPendingInputTicks = event.ticks;
+			}
+			++gPendingInputCount;
+			break;
+		}
+	}
+}
+
+// Event is dropped if window thread is too far behind, next one carries newer data anyway
+void postRenderEvent( const RenderEvent& event )
+{
+	if( spscPush( gRenderEvents, event ) )
+	{
+		PostMessage( ghWnd, WM_RENDER_EVENTS, 0, 0 );
+	}
+}
+
+void renderThreadFunc()
+{
+	setZoneThreadName( "render" );
+	u64 statsStart = getTimerTicks();
+	u64 statsFrame = gFrameNumber;
+
+	while( !gClose )
+	{
+		processWindowEvents();
+
+		// Nothing to render into while minimized, sleep until window changes
+		if( gMinimized )
+		{
+			WaitForSingleObject( gRenderWakeEvent, INFINITE );
+			continue;
+		}
+
+		renderFrame();
+
+		// Window title shows frame rate, updated twice a second
+		u64 now = getTimerTicks();
+		double ms = ticksToMs( now - statsStart );
+		if( ms >= 500.0 && gFrameNumber > statsFrame )
+		{
+			RenderEvent event = {};
+			event.type = RENDER_EVENT_STATS;
+			event.frameMs = ms / ( gFrameNumber - statsFrame );
+			postRenderEvent( event );
+
+			statsStart = now;
+			statsFrame = gFrameNumber;
+		}
+	}
+
+	waitAllFrames();
+	gRenderDone = true;
+	PostMessage( ghWnd, WM_RENDER_EVENTS, 0, 0 );
+}
+
+void printRenderThreadStats()
+{
+	if( gDroppedWindowEvents )
+	{
+		std::cout << "render thread: " << gDroppedWindowEvents << " window events dropped\n";
+	}
+}
+
+// Input to present is measured on CPU when present call returns, input to GPU done when frame fence
+// is seen signaled. Scanout comes after both and can't be observed without display timing extensions.
+void printInputLatency()
+{
+	std::vector<float> toPresent;
+	std::vector<float> toGpu;
+	u64 inputs = 0;
+	for( u32 i = 0; i < gInputRecords.size(); ++i )
+	{
+		const InputFrameRecord& record = gInputRecords[i];
+		inputs += record.inputs;
+		if( record.presentMs > 0.0f )
+			toPresent.push_back( record.presentMs );
+		if( record.gpuMs > 0.0f )
+			toGpu.push_back( record.gpuMs );
+	}
+	if( toPresent.empty() )
+	{
+		return;
+	}
+
+	std::sort( toPresent.begin(), toPresent.end() );
+	std::sort( toGpu.begin(), toGpu.end() );
+	std::cout << "input latency: " << inputs << " inputs in " << gInputRecords.size() << " frames\n";
+	std::cout << "  to present: p50 " << percentile( toPresent, 50 ) << " ms, p90 " << percentile( toPresent, 90 )
+			  << " ms, p99 " << percentile( toPresent, 99 ) << " ms, max " << toPresent.back() << " ms\n";
+	if( !toGpu.empty() )
+	{
+		std::cout << "  to GPU done: p50 " << percentile( toGpu, 50 ) << " ms, p90 " << percentile( toGpu, 90 )
+				  << " ms, p99 " << percentile( toGpu, 99 ) << " ms, max " << toGpu.back() << " ms\n";
+	}
+}
+
+// Per frame records as "frame,inputs,present_ms,gpu_ms"
+void saveInputLatency( const std::string& path )
+{
+	std::ofstream file( path.c_str() );
+	if( !file )
+	{
+		std::cout << "can't write " << path << std::endl;
+		return;
+	}
+
+	file << "frame,inputs,present_ms,gpu_ms\n";
+	for( u32 i = 0; i < gInputRecords.size(); ++i )
+	{
+		const InputFrameRecord& record = gInputRecords[i];
+		file << record.frame << "," << record.inputs << "," << record.presentMs << "," << record.gpuMs << "\n";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Headless rendering
+//
+bool createOffscreenTarget( OffscreenTarget& target )
+{
+	target = OffscreenTarget();
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+	imageInfo.flags = 0;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = gFormat;
+	imageInfo.extent.width = gWidth;
+	imageInfo.extent.height = gHeight;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.queueFamilyIndexCount = 0;
+	imageInfo.pQueueFamilyIndices = nullptr;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkResult res = vkCreateImage( gDevice, &imageInfo, gAllocator, &target.image );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "error creating offscreen image " << res << std::endl;
+		return false;
+	}
+	trackImage( target.image, VK_IMAGE_ASPECT_COLOR_BIT, 1, 1, VK_IMAGE_LAYOUT_UNDEFINED );
+
+	if( !allocateImageMemory( target.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &target.imageMemory ) )
+	{
+		std::cout << "error allocating offscreen image memory\n";
+		return false;
+	}
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.flags = 0;
+	bufferInfo.size = gWidth * gHeight * 4;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	bufferInfo.queueFamilyIndexCount = 0;
+	bufferInfo.pQueueFamilyIndices = nullptr;
+
+	res = vkCreateBuffer( gDevice, &bufferInfo, gAllocator, &target.readback );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "error creating readback buffer " << res << std::endl;
+		return false;
+	}
+
+	// Cached memory is much faster to read from CPU, but it may be not coherent. Memory stays mapped.
+	if( !allocateBufferMemory( target.readback, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, &target.readbackMemory ) )
+	{
+		std::cout << "error allocating readback memory\n";
+		return false;
+	}
+	trackBuffer( target.readback );
+
+	return true;
+}
+
+void destroyOffscreenTarget( OffscreenTarget& target )
+{
+	if( target.readback )
+	{
+		untrackBuffer( target.readback );
+		vkDestroyBuffer( gDevice, target.readback, gAllocator );
+	}
+	freeMemory( gMemoryAllocator, target.readbackMemory );
+	if( target.image )
+	{
+		untrackImage( target.image );
+		vkDestroyImage( gDevice, target.image, gAllocator );
+	}
+	freeMemory( gMemoryAllocator, target.imageMemory );
+	target = OffscreenTarget();
+}
+
+bool initOffscreenTargets()
+{
+	CpuZone zone( "initOffscreenTargets" );
+
+	// Headless only, so swapchain stage never runs next to this one: ring depth is the
+	// -frames_in_flight one and gFormat is not written by anyone else
+	gFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+	gOffscreenTargets.resize( gFramesInFlight );
+	for( u32 i = 0; i < gOffscreenTargets.size(); ++i )
+	{
+		if( !createOffscreenTarget( gOffscreenTargets[i] ) )
+		{
+			return false;
+		}
+	}
+
+	std::cout << gOffscreenTargets.size() << " targets " << gWidth << "x" << gHeight << " created\n";
+	return true;
+}
+
+void destroyOffscreenTargets()
+{
+	for( u32 i = 0; i < gOffscreenTargets.size(); ++i )
+	{
+		destroyOffscreenTarget( gOffscreenTargets[i] );
+	}
+	gOffscreenTargets.clear();
+}
+
+// Records rendering of one frame into target and copying of result into its readback buffer
+void recordOffscreenFrame( FrameSlot& slot, OffscreenTarget& target, u32 frame )
+{
+	VkImageSubresourceRange range = {};
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = 1;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
+
+	// Nothing to draw yet, so frame is just animated clear color
+	VkClearColorValue color;
+	color.float32[0] = ( frame % 256 ) / 255.0f;
+	color.float32[1] = 0.2f;
+	color.float32[2] = 0.4f;
+	color.float32[3] = 1.0f;
+
+	FrameGraph& graph = gFrameGraph;
+	graphReset( graph );
+	u32 colorTarget = graphImportImage( graph, "color", target.image );
+	u32 readback = graphImportBuffer( graph, "readback", target.readback );
+
+	// CPU reads readback buffer after fence is signaled
+	graphSetOutput( graph, readback, VK_IMAGE_LAYOUT_UNDEFINED, VK_ACCESS_HOST_READ_BIT, VK_PIPELINE_STAGE_HOST_BIT );
+
+	if( gAsyncCompute )
+	{
+		// Clear runs on compute queue, readback waits for it only at transfer stage
+		VkCommandBuffer computeCmd = beginCompute( slot );
+		computeUseImage( slot, target.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT );
+		vkCmdClearColorImage( computeCmd, target.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range );
+		computeReleaseImage( slot, target.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT );
+		submitCompute( slot );
+	}
+	else
+	{
+		u32 clear = graphAddPass( graph, "clear", [&]( VkCommandBuffer cmd )
+		{
+			vkCmdClearColorImage( cmd, target.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range );
+		} );
+		graphWrite( graph, clear, colorTarget, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+	}
+	addOverlayPass( graph, slot, colorTarget );
+
+	// Readback is split into horizontal bands, each its own pass, so they are recorded on all workers.
+	// Every band writes only its part of readback buffer, so earlier bands stay live.
+	u32 bands = min( gWorkerCount, gHeight );
+	for( u32 band = 0; band < bands; ++band )
+	{
+		std::stringstream name;
+		name << "readback " << band;
+		u32 copy = graphAddPass( graph, name.str().c_str(), [&, band]( VkCommandBuffer cmd )
+		{
+			u32 y0 = gHeight * band / bands;
+			u32 y1 = gHeight * ( band + 1 ) / bands;
+
+			VkBufferImageCopy region = {};
+			region.bufferOffset = (VkDeviceSize)y0 * gWidth * 4;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = 0;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset.x = 0;
+			region.imageOffset.y = y0;
+			region.imageOffset.z = 0;
+			region.imageExtent.width = gWidth;
+			region.imageExtent.height = y1 - y0;
+			region.imageExtent.depth = 1;
+			vkCmdCopyImageToBuffer( cmd, target.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.readback, 1, &region );
+		} );
+		graphRead( graph, copy, colorTarget, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL );
+		graphModify( graph, copy, readback, VK_IMAGE_LAYOUT_UNDEFINED, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT );
+	}
+
+	graphCompile( graph );
+	if( gPrintGraph )
+	{
+		printGraph( graph );
+		gPrintGraph = false;
+	}
+	recordFrameUploads( slot );
+	graphExecuteParallel( graph, slot );
+}
+
+// Called when GPU finished frame, pixels are in target readback buffer
+// Writes RGBA8 pixels of gWidth x gHeight frame as .ppm
+void saveFrame( const u8* pixels, u32 frame )
+{
+	std::stringstream name;
+	name << "frame_" << std::setw( 5 ) << std::setfill( '0' ) << frame << ".ppm";
+
+	std::ofstream file( name.str().c_str(), std::ios::binary );
+	file << "P6\n" << gWidth << " " << gHeight << "\n255\n";
+
+	std::vector<u8> row( gWidth * 3 );
+	for( u32 y = 0; y < gHeight; ++y )
+	{
+		for( u32 x = 0; x < gWidth; ++x )
+		{
+			row[x * 3 + 0] = pixels[( y * gWidth + x ) * 4 + 0];
+			row[x * 3 + 1] = pixels[( y * gWidth + x ) * 4 + 1];
+			row[x * 3 + 2] = pixels[( y * gWidth + x ) * 4 + 2];
+		}
+		file.write( (const char*)row.data(), row.size() );
+	}
+}
+
+void consumeOffscreenFrame( OffscreenTarget& target, u32 frame )
+{
+	invalidateAllocation( gMemoryAllocator, target.readbackMemory );
+
+	if( gHeadlessDump )
+	{
+		saveFrame( (const u8*)target.readbackMemory.mapped, frame );
+	}
+}
+
+void runHeadless()
+{
+	std::cout << "rendering " << gHeadlessFrames << " headless frames...\n";
+
+	u64 start = getTimerTicks();
+	for( u32 frame = 0; frame < gHeadlessFrames; ++frame )
+	{
+		CpuZone zone( "frame" );
+		FrameSlot& slot = beginFrame();
+
+		// Slot and target go together, target is free once slot fence is signaled
+		OffscreenTarget& target = gOffscreenTargets[slot.frame % gOffscreenTargets.size()];
+		u32 frameIndex = (u32)slot.frame;
+
+		recordOffscreenFrame( slot, target, frameIndex );
+		slot.onComplete = [&target, frameIndex]()
+		{
+			consumeOffscreenFrame( target, frameIndex );
+		};
+
+		endFrame( slot, VK_NULL_HANDLE, 0, VK_NULL_HANDLE );
+	}
+	waitAllFrames();
+	double ms = ticksToMs( getTimerTicks() - start );
+
+	std::cout << "rendered " << gHeadlessFrames << " frames in " << ms << " ms, "
+			  << ( ms > 0.0 ? gHeadlessFrames * 1000.0 / ms : 0.0 ) << " fps\n";
+	printFramePacing();
+	printGpuTimers();
+	printSubmitBatchStats();
+	printUploadStats();
+	printQueueStats();
+	printComputeStats();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Multi GPU
+//
+// Every usable GPU gets its own logical device and thread. Threads pull jobs from one shared
+// queue, so faster devices simply take more of them. Jobs must not depend on each other.
+//
+bool createGpuContext( const DeviceInfo& info, GpuContext& ctx )
+{
+	ctx.name = info.name;
+	ctx.physicalDevice = info.device;
+	ctx.jobs = 0;
+	ctx.busyMs = 0.0;
+
+	u32 familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties( ctx.physicalDevice, &familyCount, nullptr );
+	std::vector<VkQueueFamilyProperties> families( familyCount );
+	vkGetPhysicalDeviceQueueFamilyProperties( ctx.physicalDevice, &familyCount, families.data() );
+
+	ctx.familyIndex = -1;
+	for( u32 i = 0; i < familyCount && ctx.familyIndex == -1; ++i )
+	{
+		if( families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT )
+		{
+			ctx.familyIndex = i;
+		}
+	}
+	if( ctx.familyIndex == -1 )
+	{
+		return false;
+	}
+
+	VkDeviceQueueCreateInfo queueInfo = {};
+	queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfo.pNext = nullptr;
+	queueInfo.queueFamilyIndex = ctx.familyIndex;
+	queueInfo.queueCount = 1;
+	queueInfo.pQueuePriorities = gQueuePriorities;
+
+	std::vector<const char*> layers;
+	for( u32 i = 0; i < gLayers.size(); ++i )
+	{
+		layers.push_back( gLayers[i].c_str() );
+	}
+
+	VkDeviceCreateInfo deviceInfo = {};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.pNext = nullptr;
+	deviceInfo.queueCreateInfoCount = 1;
+	deviceInfo.pQueueCreateInfos = &queueInfo;
+	deviceInfo.enabledExtensionCount = 0;
+	deviceInfo.ppEnabledExtensionNames = nullptr;
+	deviceInfo.enabledLayerCount = layers.size();
+	deviceInfo.ppEnabledLayerNames = layers.size() ? layers.data() : nullptr;
+	deviceInfo.pEnabledFeatures = nullptr;
+
+	VkResult res = vkCreateDevice( ctx.physicalDevice, &deviceInfo, gAllocator, &ctx.device );
+	if( res != VK_SUCCESS )
+	{
+		std::cout << "error creating device for " << ctx.name << " " << res << std::endl;
+		return false;
+	}
+	vkGetDeviceQueue( ctx.device, ctx.familyIndex, 0, &ctx.queue );
+
+	VkPhysicalDeviceProperties props;
+	VkPhysicalDeviceMemoryProperties memoryProps;
+	vkGetPhysicalDeviceProperties( ctx.physicalDevice, &props );
+	vkGetPhysicalDeviceMemoryProperties( ctx.physicalDevice, &memoryProps );
+	initMemoryAllocator( ctx.memory, ctx.device, memoryProps, props.limits, gMemoryBlockSize );
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = ctx.familyIndex;
+	HR( vkCreateCommandPool( ctx.device, &poolInfo, gAllocator, &ctx.pool ) );
+
+	VkCommandBufferAllocateInfo cmdInfo = {};
+	cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdInfo.pNext = nullptr;
+	cmdInfo.commandPool = ctx.pool;
+	cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdInfo.commandBufferCount = 1;
+	HR( vkAllocateCommandBuffers( ctx.device, &cmdInfo, &ctx.cmd ) );
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.pNext = nullptr;
+	fenceInfo.flags = 0;
+	HR( vkCreateFence( ctx.device, &fenceInfo, gAllocator, &ctx.fence ) );
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+	imageInfo.flags = 0;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	imageInfo.extent.width = gWidth;
+	imageInfo.extent.height = gHeight;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.queueFamilyIndexCount = 0;
+	imageInfo.pQueueFamilyIndices = nullptr;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	HR( vkCreateImage( ctx.device, &imageInfo, gAllocator, &ctx.image ) );
+
+	VkMemoryRequirements reqs;
+	vkGetImageMemoryRequirements( ctx.device, ctx.image, &reqs );
+	if( !allocateMemory( ctx.memory, reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false, &ctx.imageMemory ) )
+	{
+		return false;
+	}
+	HR( vkBindImageMemory( ctx.device, ctx.image, ctx.imageMemory.memory, ctx.imageMemory.offset ) );
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.flags = 0;
+	bufferInfo.size = (VkDeviceSize)gWidth * gHeight * 4;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	bufferInfo.queueFamilyIndexCount = 0;
+	bufferInfo.pQueueFamilyIndices = nullptr;
+	HR( vkCreateBuffer( ctx.device, &bufferInfo, gAllocator, &ctx.readback ) );
+
+	vkGetBufferMemoryRequirements( ctx.device, ctx.readback, &reqs );
+	if( !allocateMemory( ctx.memory, reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, true, &ctx.readbackMemory ) )
+	{
+		return false;
+	}
+	HR( vkBindBufferMemory( ctx.device, ctx.readback, ctx.readbackMemory.memory, ctx.readbackMemory.offset ) );
+
+	return true;
+}
+
+void destroyGpuContext( GpuContext& ctx )
+{
+	if( !ctx.device )
+	{
+		return;
+	}
+
+	vkDeviceWaitIdle( ctx.device );
+	if( ctx.readback )
+		vkDestroyBuffer( ctx.device, ctx.readback, gAllocator );
+	if( ctx.image )
+		vkDestroyImage( ctx.device, ctx.image, gAllocator );
+	freeMemory( ctx.memory, ctx.readbackMemory );
+	freeMemory( ctx.memory, ctx.imageMemory );
+	destroyMemoryAllocator( ctx.memory );
+	if( ctx.fence )
+		vkDestroyFence( ctx.device, ctx.fence, gAllocator );
+	if( ctx.pool )
+		vkDestroyCommandPool( ctx.device, ctx.pool, gAllocator );
+	vkDestroyDevice( ctx.device, gAllocator );
+	ctx.device = VK_NULL_HANDLE;
+}
+
+// Device thread runs one job at a time: record, submit, wait, complete
+void gpuThreadFunc( GpuContext* context )
+{
+	setZoneThreadName( "gpu" );
+	GpuContext& ctx = *context;
+	for( ;; )
+	{
+		u32 index = gNextGpuJob++;
+		if( index >= gGpuJobs.size() )
+		{
+			break;
+		}
+		const GpuJob& job = gGpuJobs[index];
+
+		u64 start = getTimerTicks();
+		HR( vkResetCommandPool( ctx.device, ctx.pool, 0 ) );
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.pNext = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr;
+		HR( vkBeginCommandBuffer( ctx.cmd, &beginInfo ) );
+		job.record( ctx, ctx.cmd );
+		HR( vkEndCommandBuffer( ctx.cmd ) );
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = nullptr;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &ctx.cmd;
+		HR( vkQueueSubmit( ctx.queue, 1, &submitInfo, ctx.fence ) );
+		HR( vkWaitForFences( ctx.device, 1, &ctx.fence, VK_TRUE, UINT64_MAX ) );
+		HR( vkResetFences( ctx.device, 1, &ctx.fence ) );
+
+		if( job.complete )
+		{
+			job.complete( ctx );
+		}
+
+		++ctx.jobs;
+		ctx.busyMs += ticksToMs( getTimerTicks() - start );
+	}
+}
+
+// Same frame as headless mode renders, but on whichever device takes it
+GpuJob makeRenderJob( u32 frame )
+{
+	GpuJob job;
+	job.record = [frame]( GpuContext& ctx, VkCommandBuffer cmd )
+	{
+		VkImageSubresourceRange range = {};
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.baseMipLevel = 0;
+		range.levelCount = 1;
+		range.baseArrayLayer = 0;
+		range.layerCount = 1;
+
+		VkClearColorValue color;
+		color.float32[0] = ( frame % 256 ) / 255.0f;
+		color.float32[1] = 0.2f;
+		color.float32[2] = 0.4f;
+		color.float32[3] = 1.0f;
+
+		setImageLayout( cmd, ctx.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+		vkCmdClearColorImage( cmd, ctx.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range );
+		setImageLayout( cmd, ctx.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL );
+
+		VkBufferImageCopy region = {};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent.width = gWidth;
+		region.imageExtent.height = gHeight;
+		region.imageExtent.depth = 1;
+		vkCmdCopyImageToBuffer( cmd, ctx.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ctx.readback, 1, &region );
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = ctx.readback;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier( cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr );
+	};
+	job.complete = [frame]( GpuContext& ctx )
+	{
+		invalidateAllocation( ctx.memory, ctx.readbackMemory );
+		if( gHeadlessDump )
+		{
+			saveFrame( (const u8*)ctx.readbackMemory.mapped, frame );
+		}
+	};
+	return job;
+}
+
+// Renders headless frames on all usable devices at once
+void runMultiGpu()
+{
+	for( u32 i = 0; i < gDevices.size(); ++i )
+	{
+		if( gDevices[i].score < 0 )
+		{
+			continue;
+		}
+
+		GpuContext* ctx = new GpuContext();
+		if( createGpuContext( gDevices[i], *ctx ) )
+		{
+			gGpuContexts.push_back( ctx );
+		}
+		else
+		{
+			destroyGpuContext( *ctx );
+			delete ctx;
+		}
+	}
+	if( gGpuContexts.empty() )
+	{
+		std::cout << "no usable device\n";
+		return;
+	}
+
+	gGpuJobs.clear();
+	for( u32 frame = 0; frame < gHeadlessFrames; ++frame )
+	{
+		gGpuJobs.push_back( makeRenderJob( frame ) );
+	}
+	gNextGpuJob = 0;
+
+	std::cout << "rendering " << gHeadlessFrames << " frames on " << gGpuContexts.size() << " devices...\n";
+
+	u64 start = getTimerTicks();
+	for( u32 i = 0; i < gGpuContexts.size(); ++i )
+	{
+		gGpuContexts[i]->thread = std::thread( gpuThreadFunc, gGpuContexts[i] );
+	}
+	for( u32 i = 0; i < gGpuContexts.size(); ++i )
+	{
+		gGpuContexts[i]->thread.join();
+	}
+	double ms = ticksToMs( getTimerTicks() - start );
+
+	std::cout << "rendered " << gHeadlessFrames << " frames in " << ms << " ms, "
+			  << ( ms > 0.0 ? gHeadlessFrames * 1000.0 / ms : 0.0 ) << " fps\n";
+	for( u32 i = 0; i < gGpuContexts.size(); ++i )
+	{
+		const GpuContext& ctx = *gGpuContexts[i];
+		std::cout << "\t" << ctx.name << ": " << ctx.jobs << " jobs, "
+				  << ( ctx.jobs ? ctx.busyMs / ctx.jobs : 0.0 ) << " ms per job\n";
+	}
+
+	for( u32 i = 0; i < gGpuContexts.size(); ++i )
+	{
+		destroyGpuContext( *gGpuContexts[i] );
+		delete gGpuContexts[i];
+	}
+	gGpuContexts.clear();
+	gGpuJobs.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Self tests
+//
+// CPU side checks of logic which doesn't need GPU, run with -self_test. Vulkan handles used here are
+// made up and never reach driver. Failed checks are printed and the run exits with error.
+//
+void selfCheck( bool condition, const char* test, const char* what )
+{
+	if( !condition )
+	{
+		std::cout << "\t" << test << ": " << what << " failed\n";
+		++gSelfTestFailures;
+	}
+}
+
+// Semaphore only submits mixed with command buffer ones, merged infos must keep order of everything
+// and never have command buffers counted without pointer to them
+void testSubmitBatching()
+{
+	const char* test = "submit batching";
+	VkCommandBuffer cmds[4];
+	VkSemaphore semaphores[4];
+	for( u32 i = 0; i < 4; ++i )
+	{
+		cmds[i] = (VkCommandBuffer)(uintptr_t)( 0x1000 + i );
+		semaphores[i] = (VkSemaphore)(uintptr_t)( 0x2000 + i );
+	}
+	VkPipelineStageFlags stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+	clearBatchedSubmits();
+	batchSubmit( nullptr, 0, nullptr, nullptr, 0, &semaphores[0], 1 );		// signal only
+	batchSubmit( &cmds[0], 1, &semaphores[0], &stage, 1, nullptr, 0 );		// new info, waits
+	batchSubmit( &cmds[1], 1, nullptr, nullptr, 0, nullptr, 0 );			// merged
+	batchSubmit( nullptr, 0, &semaphores[1], &stage, 1, nullptr, 0 );		// wait only, new info
+	batchSubmit( &cmds[2], 1, nullptr, nullptr, 0, nullptr, 0 );			// merged into info without command buffers
+	batchSubmit( nullptr, 0, nullptr, nullptr, 0, &semaphores[2], 1 );		// signal only, merged
+	batchSubmit( &cmds[3], 1, nullptr, nullptr, 0, nullptr, 0 );			// new info, previous one signals
+	mergeBatchedSubmits();
+
+	selfCheck( gBatchInfos.size() == 4, test, "merged submit count" );
+
+	std::vector<VkCommandBuffer> order;
+	std::vector<VkSemaphore> waits;
+	std::vector<VkSemaphore> signals;
+	for( u32 i = 0; i < gBatchInfos.size(); ++i )
+	{
+		const VkSubmitInfo& info = gBatchInfos[i];
+		selfCheck( !info.commandBufferCount || info.pCommandBuffers, test, "command buffers without pointer" );
+		selfCheck( !info.waitSemaphoreCount || ( info.pWaitSemaphores && info.pWaitDstStageMask ), test, "waits without pointer" );
+		selfCheck( !info.signalSemaphoreCount || info.pSignalSemaphores, test, "signals without pointer" );
+		if( info.pCommandBuffers )
+			order.insert( order.end(), info.pCommandBuffers, info.pCommandBuffers + info.commandBufferCount );
+		if( info.pWaitSemaphores )
+			waits.insert( waits.end(), info.pWaitSemaphores, info.pWaitSemaphores + info.waitSemaphoreCount );
+		if( info.pSignalSemaphores )
+			signals.insert( signals.end(), info.pSignalSemaphores, info.pSignalSemaphores + info.signalSemaphoreCount );
+	}
+	selfCheck( order == std::vector<VkCommandBuffer>( cmds, cmds + 4 ), test, "command buffer order" );
+	selfCheck( waits.size() == 2 && waits[0] == semaphores[0] && waits[1] == semaphores[1], test, "wait order" );
+	selfCheck( signals.size() == 2 && signals[0] == semaphores[0] && signals[1] == semaphores[2], test, "signal order" );
+	selfCheck( gBatchInfos.size() == 4 && gBatchInfos[1].commandBufferCount == 2 && gBatchInfos[2].commandBufferCount == 1,
+			   test, "commands merged into wrong submits" );
+
+	clearBatchedSubmits();
+	gBatchInfos.clear();
+	gBatchStats = SubmitBatchStats();
+}
+
+// Graph compile on its own: pass nobody consumes and writer overwritten before anyone reads are
+// culled, partial update keeps earlier writer, lifetimes span live passes only
+void testFrameGraphCompile()
+{
+	const char* test = "frame graph";
+	FrameGraph graph;
+	u32 color = graphImportImage( graph, "color", VK_NULL_HANDLE );
+	u32 shadow = graphImportImage( graph, "shadow", VK_NULL_HANDLE );
+	u32 scratch = graphImportImage( graph, "scratch", VK_NULL_HANDLE );
+	u32 debug = graphImportImage( graph, "debug", VK_NULL_HANDLE );
+	graphSetOutput( graph, color, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT );
+
+	u32 shadowPass = graphAddPass( graph, "shadow", nullptr );
+	graphWrite( graph, shadowPass, shadow, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL );
+	u32 prefillPass = graphAddPass( graph, "prefill", nullptr );
+	graphWrite( graph, prefillPass, scratch, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+	u32 debugPass = graphAddPass( graph, "debug", nullptr );
+	graphRead( graph, debugPass, shadow, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+	graphWrite( graph, debugPass, debug, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL );
+	u32 fillPass = graphAddPass( graph, "fill", nullptr );
+	graphWrite( graph, fillPass, scratch, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+	u32 mainPass = graphAddPass( graph, "main", nullptr );
+	graphRead( graph, mainPass, shadow, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+	graphRead( graph, mainPass, scratch, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+	graphWrite( graph, mainPass, color, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL );
+	u32 overlayPass = graphAddPass( graph, "overlay", nullptr );
+	graphModify( graph, overlayPass, color, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+	graphCompile( graph );
+
+	selfCheck( graph.passes[debugPass].culled, test, "culling pass with unconsumed output" );
+	selfCheck( graph.passes[prefillPass].culled, test, "culling writer overwritten before read" );
+	selfCheck( !graph.passes[mainPass].culled, test, "keeping writer before partial update" );
+	selfCheck( graph.order.size() == 4 && graph.order[0] == shadowPass && graph.order[1] == fillPass &&
+			   graph.order[2] == mainPass && graph.order[3] == overlayPass, test, "live pass order" );
+	selfCheck( graph.resources[shadow].firstPass == 0 && graph.resources[shadow].lastPass == 2, test, "lifetime of resource read later" );
+	selfCheck( graph.resources[scratch].firstPass == 1 && graph.resources[scratch].lastPass == 2, test, "lifetime without culled writer" );
+	selfCheck( graph.resources[color].firstPass == 2 && graph.resources[color].lastPass == 3, test, "lifetime of output" );
+	selfCheck( graph.resources[debug].firstPass < 0, test, "resource of culled pass unused" );
+
+	// Full overwrite instead of partial update makes main pass dead, and shadow and fill with it
+	graph.passes[overlayPass].accesses.back().keep = false;
+	graphCompile( graph );
+	selfCheck( graph.resources[shadow].firstPass < 0, test, "lifetime reset on recompile" );
+	selfCheck( graph.order.size() == 1 && graph.order[0] == overlayPass, test, "culling writer before full overwrite" );
+}
+
+bool runSelfTests()
+{
+	std::cout << "self tests:\n";
+	gSelfTestFailures = 0;
+
+	testSubmitBatching();
+	testFrameGraphCompile();
+
+	if( gSelfTestFailures )
+		std::cout << "\t" << gSelfTestFailures << " checks failed\n";
+	else
+		std::cout << "\tall passed\n";
+	return gSelfTestFailures == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Startup
+//
+// Startup is a graph of stages. Every stage starts on its own thread as soon as stages it depends on
+// are done, so window is created while instance is, and command buffers, swapchain, upload ring and
+// worker threads are set up side by side once device exists. Window has to be created on main thread,
+// which pumps its messages later, and swapchain stays there too as driver may talk to window while
+// creating it. -serial_startup runs stages one by one on main thread, to compare with.
+
+void setStartupStage( StartupStageId id, const char* name, u32 deps, bool mainThread, std::function<bool()> run )
+{
+	assert( deps < ( 1u << id ) );
+
+	StartupStage& stage = gStartup[id];
+	stage.name = name;
+	stage.run = run;
+	stage.deps = deps;
+	stage.mainThread = mainThread;
+	stage.state = STARTUP_PENDING;
+	stage.ranOnMain = false;
+	stage.startMs = 0.0;
+	stage.ms = 0.0;
+}
+
+void initStartupStages()
+{
+	const u32 device = 1 << STARTUP_DEVICE;
+
+	setStartupStage( STARTUP_WINDOW, "window", 0, true, createWindow );
+	setStartupStage( STARTUP_INSTANCE, "instance", 0, false, []() { return initVkInstance( "vulkan_test", "lamp_engine" ); } );
+	setStartupStage( STARTUP_DEVICE_LIST, "device list", 1 << STARTUP_INSTANCE, false, []() { getDevicesList(); return true; } );
+	setStartupStage( STARTUP_PHYSICAL_DEVICE, "physical device", 1 << STARTUP_DEVICE_LIST, false, selectPhysicalDevice );
+	setStartupStage( STARTUP_QUEUES, "queues", ( 1 << STARTUP_PHYSICAL_DEVICE ) | ( 1 << STARTUP_WINDOW ), false, findSupportedQueue );
+	setStartupStage( STARTUP_DEVICE, "device", 1 << STARTUP_QUEUES, false, createDevice );
+	setStartupStage( STARTUP_WORKERS, "workers", 0, false, []() { initWorkers(); return true; } );
+	setStartupStage( STARTUP_COMPLETION, "completion thread", device, false, []() { initCompletionThread(); return true; } );
+	setStartupStage( STARTUP_COMMAND_BUFFERS, "command buffers", device, false, initCommandBuffers );
+	setStartupStage( STARTUP_SWAPCHAIN, "swapchain", device, true, initSwapChains );
+	setStartupStage( STARTUP_UPLOAD_RING, "upload ring", device, false, initUploadRing );
+	setStartupStage( STARTUP_OFFSCREEN, "offscreen targets", device, false, initOffscreenTargets );
+
+	// Ring depth comes from present policy applied with swapchain, threads get a command pool each
+	setStartupStage( STARTUP_FRAME_RING, "frame ring", device | ( 1 << STARTUP_SWAPCHAIN ) | ( 1 << STARTUP_WORKERS ), false, initFrameRing );
+}
+
+// True if stage started at some point, so it has something to destroy
+bool startupStageRan( StartupStageId id )
+{
+	return gStartup[id].state == STARTUP_DONE || gStartup[id].state == STARTUP_FAILED;
+}
+
+// Returns STARTUP_DONE if everything stage depends on is done, STARTUP_SKIPPED if something failed
+StartupState getStartupDepsState( const StartupStage& stage )
+{
+	StartupState result = STARTUP_DONE;
+	for( u32 i = 0; i < STARTUP_STAGE_COUNT; ++i )
+	{
+		if( !( stage.deps & ( 1 << i ) ) )
+		{
+			continue;
+		}
+
+		StartupState state = gStartup[i].state;
+		if( state == STARTUP_FAILED || state == STARTUP_SKIPPED )
+		{
+			return STARTUP_SKIPPED;
+		}
+		if( state != STARTUP_DONE && state != STARTUP_UNUSED )
+		{
+			result = STARTUP_PENDING;
+		}
+	}
+	return result;
+}
+
+// Runs stage on calling thread and wakes main thread to start stages which were waiting for it
+void runStartupStage( u32 index )
+{
+	StartupStage& stage = gStartup[index];
+	u64 begin = getTimerTicks();
+	bool ok = stage.run();
+	u64 end = getTimerTicks();
+
+	std::lock_guard<std::mutex> lock( gStartupMutex );
+	stage.startMs = ticksToMs( begin - gStartupTicks );
+	stage.ms = ticksToMs( end - begin );
+	stage.state = ok ? STARTUP_DONE : STARTUP_FAILED;
+	gStartupCondition.notify_all();
+}
+
+void startupThreadFunc( u32 index )
+{
+	setZoneThreadName( "startup" );
+	runStartupStage( index );
+}
+
+// Starts threads for stages which are ready to run. Stages are in dependency order, so one pass
+// also skips everything downstream of failed stage. Called with gStartupMutex locked.
+void launchStartupStages()
+{
+	for( u32 i = 0; i < STARTUP_STAGE_COUNT; ++i )
+	{
+		StartupStage& stage = gStartup[i];
+		if( stage.state != STARTUP_PENDING )
+		{
+			continue;
+		}
+
+		StartupState deps = getStartupDepsState( stage );
+		if( deps == STARTUP_SKIPPED )
+		{
+			stage.state = STARTUP_SKIPPED;
+		}
+		else if( deps == STARTUP_DONE && !stage.mainThread && !gSerialStartup )
+		{
+			stage.state = STARTUP_RUNNING;
+			gStartupThreads.push_back( std::thread( startupThreadFunc, i ) );
+		}
+	}
+}
+
+// Runs stages in needed mask, the rest are left out. Main thread starts stages as they become
+// ready, runs its own ones and waits for the others. Returns true if every needed stage succeeded.
+bool runStartup( u32 needed )
+{
+	gStartupTicks = getTimerTicks();
+	for( u32 i = 0; i < STARTUP_STAGE_COUNT; ++i )
+	{
+		gStartup[i].state = ( needed & ( 1 << i ) ) ? STARTUP_PENDING : STARTUP_UNUSED;
+	}
+
+	std::unique_lock<std::mutex> lock( gStartupMutex );
+	for( ;; )
+	{
+		launchStartupStages();
+
+		u32 next = STARTUP_STAGE_COUNT;
+		bool finished = true;
+		for( u32 i = 0; i < STARTUP_STAGE_COUNT; ++i )
+		{
+			StartupStage& stage = gStartup[i];
+			if( stage.state == STARTUP_PENDING || stage.state == STARTUP_RUNNING )
+			{
+				finished = false;
+			}
+			if( stage.state == STARTUP_PENDING && next == STARTUP_STAGE_COUNT && ( stage.mainThread || gSerialStartup ) &&
+				getStartupDepsState( stage ) == STARTUP_DONE )
+			{
+				next = i;
+			}
+		}
+
+		if( finished )
+		{
+			break;
+		}
+		if( next == STARTUP_STAGE_COUNT )
+		{
+			gStartupCondition.wait( lock );
+			continue;
+		}
+
+		gStartup[next].state = STARTUP_RUNNING;
+		gStartup[next].ranOnMain = true;
+		lock.unlock();
+		runStartupStage( next );
+		lock.lock();
+	}
+	lock.unlock();
+
+	for( u32 i = 0; i < gStartupThreads.size(); ++i )
+	{
+		gStartupThreads[i].join();
+	}
+	gStartupThreads.clear();
+	gStartupMs = ticksToMs( getTimerTicks() - gStartupTicks );
+
+	for( u32 i = 0; i < STARTUP_STAGE_COUNT; ++i )
+	{
+		if( gStartup[i].state != STARTUP_DONE && gStartup[i].state != STARTUP_UNUSED )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Stage times next to wall time, sum over wall time is how much overlapping stages saved
+void printStartup()
+{
+	double stagesMs = 0.0;
+	for( u32 i = 0; i < STARTUP_STAGE_COUNT; ++i )
+	{
+		stagesMs += gStartup[i].ms;
+	}
+
+	std::cout << "startup: " << gStartupMs << " ms, stages took " << stagesMs << " ms together"
+			  << ( gSerialStartup ? ", serial\n" : "\n" );
+	for( u32 i = 0; i < STARTUP_STAGE_COUNT; ++i )
+	{
+		const StartupStage& stage = gStartup[i];
+		if( stage.state == STARTUP_UNUSED )
+		{
+			continue;
+		}
+
+		std::cout << "\t" << stage.name << ": ";
+		if( stage.state == STARTUP_SKIPPED )
+		{
+			std::cout << "skipped\n";
+			continue;
+		}
+		std::cout << stage.ms << " ms at " << stage.startMs << " ms on " << ( stage.ranOnMain ? "main" : "startup" ) << " thread"
+				  << ( stage.state == STARTUP_FAILED ? ", failed\n" : "\n" );
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+int main( int argc, char** argv )
+{
+	gZoneStartTicks = getTimerTicks();
+	setZoneThreadName( "main" );
+	loadConfig( gConfigFile );
+	parseCommandLine( argc, argv );
+
+	if( gBenchAllocs )
+	{
+		return runAllocatorBenchmark() ? 0 : 1;
+	}
+
+	if( gSelfTest )
+	{
+		return runSelfTests() ? 0 : 1;
+	}
+
+	if( gHostAlloc )
+	{
+		initHostAllocator( gHostAllocator );
+		gAllocator = &gHostAllocator.callbacks;
+	}
+
+	// Multi GPU mode creates its own devices, everything else needs the one selected device
+	u32 needed = ( 1 << STARTUP_INSTANCE ) | ( 1 << STARTUP_DEVICE_LIST );
+	if( !gMultiGpu )
+	{
+		needed |= ( 1 << STARTUP_PHYSICAL_DEVICE ) | ( 1 << STARTUP_QUEUES ) | ( 1 << STARTUP_DEVICE ) | ( 1 << STARTUP_WORKERS ) |
+				  ( 1 << STARTUP_COMPLETION ) | ( 1 << STARTUP_COMMAND_BUFFERS );
+	}
+	if( !gHeadless )
+	{
+		needed |= ( 1 << STARTUP_WINDOW ) | ( 1 << STARTUP_SWAPCHAIN ) | ( 1 << STARTUP_UPLOAD_RING ) | ( 1 << STARTUP_FRAME_RING );
+	}
+	else if( !gMultiGpu && !gBenchSubmits )
+	{
+		needed |= ( 1 << STARTUP_OFFSCREEN ) | ( 1 << STARTUP_UPLOAD_RING ) | ( 1 << STARTUP_FRAME_RING );
+	}
+	assert( !( needed & ( 1 << STARTUP_SWAPCHAIN ) ) || !( needed & ( 1 << STARTUP_OFFSCREEN ) ) );
+
+	initStartupStages();
+	bool started = runStartup( needed );
+	printStartup();
+
+	if( !started )
+	{
+		std::cout << "startup failed\n";
+	}
+	else if( gMultiGpu )
+	{
+		runMultiGpu();
+	}
+	else if( gBenchSubmits )
+	{
+		runSubmitBenchmark();
+	}
+	else if( gHeadless )
+	{
+		runHeadless();
+	}
+	else
+	{
+		// Render thread owns frames from here on, this one only pumps messages
+		gRenderWakeEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+		ShowWindow( ghWnd, true );
+		gRenderThread = std::thread( renderThreadFunc );
+
+		// Start loop, ends when render thread is done and window is destroyed
+		MSG msg;
+		while( GetMessage( &msg, NULL, 0, 0 ) > 0 )
+		{
+			TranslateMessage( &msg );
+			DispatchMessage( &msg );
+		}
+		gClose = true;
+		SetEvent( gRenderWakeEvent );
+		gRenderThread.join();
+		CloseHandle( gRenderWakeEvent );
+		gRenderWakeEvent = NULL;
+
+		printRenderThreadStats();
+		printInputLatency();
+		if( !gLatencyCsvFile.empty() )
+		{
+			saveInputLatency( gLatencyCsvFile );
+		}
+		printFramePacing();
+		printGpuTimers();
+		printSubmitBatchStats();
+		printUploadStats();
+		printQueueStats();
+		printSwapchainStats();
+		printPresentStats();
+	}
+
+	// Teardown in reverse, of what startup got to, failed stages may have created part of their objects
+	if( startupStageRan( STARTUP_FRAME_RING ) )
+	{
+		destroyFrameRing();
+	}
+	if( startupStageRan( STARTUP_UPLOAD_RING ) )
+	{
+		destroyUploadRing();
+	}
+	if( startupStageRan( STARTUP_OFFSCREEN ) )
+	{
+		destroyOffscreenTargets();
+	}
+	if( startupStageRan( STARTUP_SWAPCHAIN ) )
+	{
+		destroySwapchains();
+	}
+	if( startupStageRan( STARTUP_COMMAND_BUFFERS ) )
+	{
+		printCommandAllocatorStats();
+		destroyCommandAllocator( gCmdAllocator );
+	}
+	if( startupStageRan( STARTUP_WORKERS ) )
+	{
+		shutdownWorkers();
+	}
+	if( startupStageRan( STARTUP_COMPLETION ) )
+	{
+		shutdownCompletionThread();
+	}
+	if( gStartup[STARTUP_DEVICE].state == STARTUP_DONE )
+	{
+		printMemoryStats( gMemoryAllocator );
+		destroyMemoryAllocator( gMemoryAllocator );
+		vkDestroyDevice( gDevice, gAllocator );
+	}
+	if( gStartup[STARTUP_INSTANCE].state == STARTUP_DONE )
+	{
+		vkDestroyInstance( gInstance, gAllocator );
+	}
+
+	if( gAllocator )
+	{
+		printHostAllocatorStats( gHostAllocator );
+		destroyHostAllocator( gHostAllocator );
+	}
+
+	// Threads register on first recorded zone, so there is something to save only if profiler ran
+	if( !gZoneThreads.empty() )
+	{
+		saveZones( gZoneFile );
+	}
+	destroyZones();
+
+	// Headless runs are scripted, don't block them
+	if( !gHeadless )
+	{
+		system("PAUSE");
+	}
 
 	return 0;
 }
\ No newline at end of file
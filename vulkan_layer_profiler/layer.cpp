@@ -0,0 +1,980 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cstddef>
+#include <intrin.h>
+#include <Windows.h>
+
+#define VK_PROTOTYPES
+#define VK_USE_PLATFORM_WIN32_KHR
+
+#include "../vulkan_sdk/include/vulkan.h"
+#include "../vulkan_sdk/include/vk_layer.h"
+#include "../vulkan_replay/trace.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Defines
+//
+// VK_LAYER_LAMP_profiler counts calls and measures CPU time of every instance and device entry point
+// it sits in front of. Enable it with VK_LAYER_PATH pointing to directory of VkLayer_profiler.json and
+// -layer VK_LAYER_LAMP_profiler (or VK_INSTANCE_LAYERS). Environment:
+//   VK_PROFILER_FILE			where profile is written, vk_profile.txt by default
+//   VK_PROFILER_DUMP_PRESENTS	also write it every that many presents
+//   VK_CAPTURE_FILE			also record calls listed in TRACE_CALLS into this trace for vulkan_replay
+// Profile is always written when last instance is destroyed, or any time profilerDump() is called.
+//
+
+typedef				__int8		i8;
+typedef				__int16		i16;
+typedef				__int32		i32;
+typedef				__int64		i64;
+typedef unsigned	__int8		u8;
+typedef unsigned	__int16		u16;
+typedef unsigned	__int32		u32;
+typedef unsigned	__int64		u64;
+
+#define LAYER_NAME				"VK_LAYER_LAMP_profiler"
+#define HISTOGRAM_BUCKETS		32		// bucket i counts calls taking [2^i, 2^(i+1)) ns
+#define MAX_OBJECTS				16		// instances or devices alive at once
+#define CAPTURE_FLUSH_BYTES		( 1 << 20 )
+
+// Index of entry point in dispatch table, also used as index of its stats
+#define DEVICE_ENTRY( name )	( offsetof( VkLayerDispatchTable, name ) / sizeof( PFN_vkVoidFunction ) )
+#define INSTANCE_ENTRY( name )	( offsetof( VkLayerInstanceDispatchTable, name ) / sizeof( PFN_vkVoidFunction ) )
+#define DEVICE_ENTRY_COUNT		( sizeof( VkLayerDispatchTable ) / sizeof( PFN_vkVoidFunction ) )
+#define INSTANCE_ENTRY_COUNT	( sizeof( VkLayerInstanceDispatchTable ) / sizeof( PFN_vkVoidFunction ) )
+
+// Device entry points timed by generic hook. GetDeviceProcAddr, DestroyDevice and QueuePresentKHR
+// have hooks of their own.
+#define DEVICE_TIMED_ENTRY_POINTS( X )																		\
+	X( GetDeviceQueue ) X( QueueSubmit ) X( QueueWaitIdle ) X( DeviceWaitIdle ) X( AllocateMemory )			\
+	X( FreeMemory ) X( MapMemory ) X( UnmapMemory ) X( FlushMappedMemoryRanges )								\
+	X( InvalidateMappedMemoryRanges ) X( GetDeviceMemoryCommitment ) X( GetImageSparseMemoryRequirements )		\
+	X( GetImageMemoryRequirements ) X( GetBufferMemoryRequirements ) X( BindImageMemory )						\
+	X( BindBufferMemory ) X( QueueBindSparse ) X( CreateFence ) X( DestroyFence ) X( GetFenceStatus )			\
+	X( ResetFences ) X( WaitForFences ) X( CreateSemaphore ) X( DestroySemaphore ) X( CreateEvent )			\
+	X( DestroyEvent ) X( GetEventStatus ) X( SetEvent ) X( ResetEvent ) X( CreateQueryPool )					\
+	X( DestroyQueryPool ) X( GetQueryPoolResults ) X( CreateBuffer ) X( DestroyBuffer ) X( CreateBufferView )	\
+	X( DestroyBufferView ) X( CreateImage ) X( DestroyImage ) X( GetImageSubresourceLayout )					\
+	X( CreateImageView ) X( DestroyImageView ) X( CreateShaderModule ) X( DestroyShaderModule )				\
+	X( CreatePipelineCache ) X( DestroyPipelineCache ) X( GetPipelineCacheData ) X( MergePipelineCaches )		\
+	X( CreateGraphicsPipelines ) X( CreateComputePipelines ) X( DestroyPipeline ) X( CreatePipelineLayout )	\
+	X( DestroyPipelineLayout ) X( CreateSampler ) X( DestroySampler ) X( CreateDescriptorSetLayout )			\
+	X( DestroyDescriptorSetLayout ) X( CreateDescriptorPool ) X( DestroyDescriptorPool )						\
+	X( ResetDescriptorPool ) X( AllocateDescriptorSets ) X( FreeDescriptorSets ) X( UpdateDescriptorSets )		\
+	X( CreateFramebuffer ) X( DestroyFramebuffer ) X( CreateRenderPass ) X( DestroyRenderPass )				\
+	X( GetRenderAreaGranularity ) X( CreateCommandPool ) X( DestroyCommandPool ) X( ResetCommandPool )			\
+	X( AllocateCommandBuffers ) X( FreeCommandBuffers ) X( BeginCommandBuffer ) X( EndCommandBuffer )			\
+	X( ResetCommandBuffer ) X( CmdBindPipeline ) X( CmdBindDescriptorSets ) X( CmdBindVertexBuffers )			\
+	X( CmdBindIndexBuffer ) X( CmdSetViewport ) X( CmdSetScissor ) X( CmdSetLineWidth ) X( CmdSetDepthBias )	\
+	X( CmdSetBlendConstants ) X( CmdSetDepthBounds ) X( CmdSetStencilCompareMask )							\
+	X( CmdSetStencilWriteMask ) X( CmdSetStencilReference ) X( CmdDraw ) X( CmdDrawIndexed )					\
+	X( CmdDrawIndirect ) X( CmdDrawIndexedIndirect ) X( CmdDispatch ) X( CmdDispatchIndirect )				\
+	X( CmdCopyBuffer ) X( CmdCopyImage ) X( CmdBlitImage ) X( CmdCopyBufferToImage )							\
+	X( CmdCopyImageToBuffer ) X( CmdUpdateBuffer ) X( CmdFillBuffer ) X( CmdClearColorImage )					\
+	X( CmdClearDepthStencilImage ) X( CmdClearAttachments ) X( CmdResolveImage ) X( CmdSetEvent )				\
+	X( CmdResetEvent ) X( CmdWaitEvents ) X( CmdPipelineBarrier ) X( CmdBeginQuery ) X( CmdEndQuery )			\
+	X( CmdResetQueryPool ) X( CmdWriteTimestamp ) X( CmdCopyQueryPoolResults ) X( CmdPushConstants )			\
+	X( CmdBeginRenderPass ) X( CmdNextSubpass ) X( CmdEndRenderPass ) X( CmdExecuteCommands )					\
+	X( CreateSwapchainKHR ) X( DestroySwapchainKHR ) X( GetSwapchainImagesKHR ) X( AcquireNextImageKHR )
+
+// Entry points of generic hooks that are also recorded in capture mode, see TRACE_CALLS
+#define DEVICE_CAPTURED_ENTRY_POINTS( X )																	\
+	X( GetDeviceQueue ) X( QueueSubmit ) X( QueueWaitIdle ) X( DeviceWaitIdle ) X( AllocateMemory )			\
+	X( FreeMemory ) X( MapMemory ) X( UnmapMemory ) X( FlushMappedMemoryRanges )								\
+	X( InvalidateMappedMemoryRanges ) X( GetImageMemoryRequirements ) X( GetBufferMemoryRequirements )		\
+	X( BindImageMemory ) X( BindBufferMemory ) X( CreateFence ) X( DestroyFence ) X( GetFenceStatus )		\
+	X( ResetFences ) X( WaitForFences ) X( CreateSemaphore ) X( DestroySemaphore ) X( CreateBuffer )			\
+	X( DestroyBuffer ) X( CreateImage ) X( DestroyImage ) X( CreateImageView ) X( DestroyImageView )			\
+	X( CreateCommandPool ) X( DestroyCommandPool ) X( ResetCommandPool ) X( AllocateCommandBuffers )			\
+	X( FreeCommandBuffers ) X( BeginCommandBuffer ) X( EndCommandBuffer ) X( CmdPipelineBarrier )				\
+	X( CmdClearColorImage ) X( CmdCopyBuffer ) X( CmdCopyBufferToImage ) X( CmdCopyImageToBuffer )			\
+	X( CmdExecuteCommands ) X( CreateSwapchainKHR ) X( DestroySwapchainKHR ) X( GetSwapchainImagesKHR )		\
+	X( AcquireNextImageKHR ) X( CreateQueryPool ) X( DestroyQueryPool ) X( CmdResetQueryPool )				\
+	X( CmdWriteTimestamp ) X( GetQueryPoolResults )
+
+#define INSTANCE_CAPTURED_ENTRY_POINTS( X )																	\
+	X( EnumeratePhysicalDevices ) X( GetPhysicalDeviceProperties ) X( GetPhysicalDeviceQueueFamilyProperties )	\
+	X( GetPhysicalDeviceMemoryProperties ) X( CreateWin32SurfaceKHR ) X( DestroySurfaceKHR )					\
+	X( GetPhysicalDeviceSurfaceSupportKHR ) X( GetPhysicalDeviceSurfaceCapabilitiesKHR )						\
+	X( GetPhysicalDeviceSurfaceFormatsKHR ) X( GetPhysicalDeviceSurfacePresentModesKHR )						\
+	X( GetPhysicalDeviceWin32PresentationSupportKHR )
+
+// Instance entry points timed by generic hook. GetInstanceProcAddr, DestroyInstance and device
+// layer/extension queries have hooks of their own.
+#define INSTANCE_TIMED_ENTRY_POINTS( X )																	\
+	X( EnumeratePhysicalDevices ) X( GetPhysicalDeviceFeatures ) X( GetPhysicalDeviceImageFormatProperties )	\
+	X( GetPhysicalDeviceFormatProperties ) X( GetPhysicalDeviceSparseImageFormatProperties )					\
+	X( GetPhysicalDeviceProperties ) X( GetPhysicalDeviceQueueFamilyProperties )								\
+	X( GetPhysicalDeviceMemoryProperties ) X( DestroySurfaceKHR ) X( GetPhysicalDeviceSurfaceSupportKHR )		\
+	X( GetPhysicalDeviceSurfaceCapabilitiesKHR ) X( GetPhysicalDeviceSurfaceFormatsKHR )						\
+	X( GetPhysicalDeviceSurfacePresentModesKHR ) X( CreateDebugReportCallbackEXT )							\
+	X( DestroyDebugReportCallbackEXT ) X( DebugReportMessageEXT ) X( CreateWin32SurfaceKHR )					\
+	X( GetPhysicalDeviceWin32PresentationSupportKHR ) X( GetPhysicalDeviceDisplayPropertiesKHR )				\
+	X( GetPhysicalDeviceDisplayPlanePropertiesKHR ) X( GetDisplayPlaneSupportedDisplaysKHR )					\
+	X( GetDisplayModePropertiesKHR ) X( CreateDisplayModeKHR ) X( GetDisplayPlaneCapabilitiesKHR )			\
+	X( CreateDisplayPlaneSurfaceKHR )
+
+// Entry points without dispatch table slot
+enum GlobalEntry
+{
+	GLOBAL_CREATE_INSTANCE,
+	GLOBAL_CREATE_DEVICE,
+	GLOBAL_ENTRY_COUNT,
+};
+
+// Counters are updated from any thread without locks
+struct EntryStats
+{
+	std::atomic<u64>	calls;
+	std::atomic<u64>	ticks;
+	std::atomic<u64>	maxTicks;
+	std::atomic<u32>	histogram[HISTOGRAM_BUCKETS];
+};
+
+struct EntryPoint
+{
+	const char*			name;
+	u32					entry;		// dispatch table index
+	PFN_vkVoidFunction	hook;
+};
+
+// Dispatchable objects are found by loader dispatch pointer they start with. Queues and command
+// buffers share it with their device, physical devices with their instance.
+struct InstanceData
+{
+	bool							used;
+	std::atomic<void*>				key;		// nullptr while slot is free or being filled
+	VkInstance						instance;
+	VkLayerInstanceDispatchTable	table;
+};
+
+struct DeviceData
+{
+	bool							used;
+	std::atomic<void*>				key;
+	VkDevice						device;
+	VkLayerDispatchTable			table;
+};
+
+// Profile line, built at dump time
+struct EntryReport
+{
+	const char*			name;
+	const EntryStats*	stats;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Globals
+//
+
+// objects, written under mutex, read without it
+InstanceData							gInstances[MAX_OBJECTS];
+DeviceData								gDevices[MAX_OBJECTS];
+std::mutex								gObjectMutex;
+
+// stats
+EntryStats								gInstanceStats[INSTANCE_ENTRY_COUNT];
+EntryStats								gDeviceStats[DEVICE_ENTRY_COUNT];
+EntryStats								gGlobalStats[GLOBAL_ENTRY_COUNT];
+double									gNsPerTick = 0.0;
+std::atomic<u64>						gPresents;
+std::mutex								gDumpMutex;
+
+// settings, read from environment on first instance
+std::string								gProfileFile = "vk_profile.txt";
+u32										gDumpPresents = 0;	// 0 means only on shutdown
+
+// capture, records are buffered in stream and written out under mutex
+bool									gCapturing = false;
+std::ofstream							gCaptureFile;
+TraceStream								gCapture;
+std::mutex								gCaptureMutex;
+std::atomic<u64>						gCapturedCalls;
+
+const VkLayerProperties					gLayerProperties =
+{
+	LAYER_NAME, VK_MAKE_VERSION( 1, 0, VK_HEADER_VERSION ), 1, "Per entry point call counts and CPU time"
+};
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Utils
+//
+u64 getTicks()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter( &counter );
+	return counter.QuadPart;
+}
+
+std::string getEnvironment( const char* name )
+{
+	char value[MAX_PATH];
+	DWORD length = GetEnvironmentVariable( name, value, sizeof( value ) );
+	return length && length < sizeof( value ) ? std::string( value, length ) : std::string();
+}
+
+void initSettings()
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency( &freq );
+	gNsPerTick = 1000000000.0 / (double)freq.QuadPart;
+
+	std::string file = getEnvironment( "VK_PROFILER_FILE" );
+	if( !file.empty() )
+	{
+		gProfileFile = file;
+	}
+	gDumpPresents = atoi( getEnvironment( "VK_PROFILER_DUMP_PRESENTS" ).c_str() );
+
+	std::string capture = getEnvironment( "VK_CAPTURE_FILE" );
+	if( !capture.empty() )
+	{
+		gCaptureFile.open( capture.c_str(), std::ios::binary );
+		if( gCaptureFile )
+		{
+			TraceHeader header = { TRACE_MAGIC, TRACE_VERSION };
+			gCaptureFile.write( (const char*)&header, sizeof( header ) );
+			gCapture.reading = false;
+			gCapturing = true;
+		}
+	}
+}
+
+template< typename T >
+void* dispatchKey( T object )
+{
+	return *(void**)object;
+}
+
+void recordCall( EntryStats& stats, u64 ticks )
+{
+	stats.calls.fetch_add( 1, std::memory_order_relaxed );
+	stats.ticks.fetch_add( ticks, std::memory_order_relaxed );
+
+	u64 maxTicks = stats.maxTicks.load( std::memory_order_relaxed );
+	while( ticks > maxTicks && !stats.maxTicks.compare_exchange_weak( maxTicks, ticks, std::memory_order_relaxed ) )
+	{
+	}
+
+	unsigned long bucket = 0;
+	u64 ns = (u64)( (double)ticks * gNsPerTick );
+	if( ns )
+	{
+		_BitScanReverse( &bucket, (unsigned long)min( ns, (u64)0xFFFFFFFF ) );
+	}
+	stats.histogram[bucket].fetch_add( 1, std::memory_order_relaxed );
+}
+
+// Times the scope it lives in
+struct ScopedTimer
+{
+	EntryStats&		stats;
+	u64				start;
+
+	ScopedTimer( EntryStats& entryStats ) : stats( entryStats ), start( getTicks() ) {}
+	~ScopedTimer() { recordCall( stats, getTicks() - start ); }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Capture
+//
+// Records go to gCapture, caller holds gCaptureMutex.
+//
+void flushCapture()
+{
+	if( !gCapture.data.empty() )
+	{
+		gCaptureFile.write( (const char*)&gCapture.data[0], gCapture.data.size() );
+		gCapture.data.clear();
+	}
+}
+
+// Appends record header, returns where it is so size can be filled once arguments follow
+size_t beginRecord( u32 call, u64 ticks, VkResult result )
+{
+	TraceRecord record = { call, 0, (u32)min( (u64)( (double)ticks * gNsPerTick ), (u64)0xFFFFFFFF ), result };
+	size_t offset = gCapture.data.size();
+	traceValue( gCapture, record );
+	return offset;
+}
+
+void endRecord( size_t offset )
+{
+	TraceRecord* record = (TraceRecord*)&gCapture.data[offset];
+	record->size = (u32)( gCapture.data.size() - offset - sizeof( TraceRecord ) );
+	++gCapturedCalls;
+	if( gCapture.data.size() >= CAPTURE_FLUSH_BYTES )
+	{
+		flushCapture();
+	}
+}
+
+void closeCapture()
+{
+	std::lock_guard<std::mutex> lock( gCaptureMutex );
+	flushCapture();
+	gCaptureFile.close();
+	gCapturing = false;
+}
+
+// Records call made outside of generic hooks, once it returned
+template< typename... Args >
+void captureRecord( u32 call, u64 ticks, VkResult result, void (*trace)( TraceStream&, Args&... ), Args&... args )
+{
+	std::lock_guard<std::mutex> lock( gCaptureMutex );
+	size_t record = beginRecord( call, ticks, result );
+	trace( gCapture, args... );
+	endRecord( record );
+}
+
+// Calls next layer and records the call. Blocking calls are recorded once they return, others hold
+// capture lock through the call, so order of records is the order calls took effect in.
+template< typename Capture, typename R >
+struct CaptureCall
+{
+	template< typename Pfn, typename... Args >
+	static R call( EntryStats& stats, Pfn next, Args&... args )
+	{
+		std::unique_lock<std::mutex> lock( gCaptureMutex, std::defer_lock );
+		bool blocking = gTraceCallBlocking[Capture::call];
+		if( !blocking )
+		{
+			lock.lock();
+		}
+
+		u64 start = getTicks();
+		R result = next( args... );
+		u64 ticks = getTicks() - start;
+		recordCall( stats, ticks );
+
+		if( blocking )
+		{
+			lock.lock();
+		}
+		size_t record = beginRecord( Capture::call, ticks, (VkResult)result );
+		Capture::trace( gCapture, args... );
+		endRecord( record );
+		return result;
+	}
+};
+
+template< typename Capture >
+struct CaptureCall< Capture, void >
+{
+	template< typename Pfn, typename... Args >
+	static void call( EntryStats& stats, Pfn next, Args&... args )
+	{
+		std::unique_lock<std::mutex> lock( gCaptureMutex, std::defer_lock );
+		bool blocking = gTraceCallBlocking[Capture::call];
+		if( !blocking )
+		{
+			lock.lock();
+		}
+
+		u64 start = getTicks();
+		next( args... );
+		u64 ticks = getTicks() - start;
+		recordCall( stats, ticks );
+
+		if( blocking )
+		{
+			lock.lock();
+		}
+		size_t record = beginRecord( Capture::call, ticks, VK_SUCCESS );
+		Capture::trace( gCapture, args... );
+		endRecord( record );
+	}
+};
+
+// Which trace function records entry point, if any
+template< u32 Entry >
+struct DeviceCapture
+{
+	static const u32 call = TRACE_CALL_NONE;
+	template< typename... Args > static void trace( TraceStream&, Args&... ) {}
+};
+
+template< u32 Entry >
+struct InstanceCapture
+{
+	static const u32 call = TRACE_CALL_NONE;
+	template< typename... Args > static void trace( TraceStream&, Args&... ) {}
+};
+
+#define DEVICE_CAPTURE( name )																				\
+	template<> struct DeviceCapture< DEVICE_ENTRY( name ) >													\
+	{																										\
+		static const u32 call = TRACE_vk##name;																	\
+		template< typename... Args > static void trace( TraceStream& s, Args&... args ) { trace_vk##name( s, args... ); }	\
+	};
+#define INSTANCE_CAPTURE( name )																			\
+	template<> struct InstanceCapture< INSTANCE_ENTRY( name ) >												\
+	{																										\
+		static const u32 call = TRACE_vk##name;																	\
+		template< typename... Args > static void trace( TraceStream& s, Args&... args ) { trace_vk##name( s, args... ); }	\
+	};
+DEVICE_CAPTURED_ENTRY_POINTS( DEVICE_CAPTURE )
+INSTANCE_CAPTURED_ENTRY_POINTS( INSTANCE_CAPTURE )
+#undef DEVICE_CAPTURE
+#undef INSTANCE_CAPTURE
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Objects
+//
+// Slot is reserved before next layer creates object and published once its table is filled,
+// so lookups from other threads never see half filled table.
+//
+InstanceData* reserveInstance()
+{
+	std::lock_guard<std::mutex> lock( gObjectMutex );
+	for( u32 i = 0; i < MAX_OBJECTS; ++i )
+	{
+		if( !gInstances[i].used )
+		{
+			gInstances[i].used = true;
+			return &gInstances[i];
+		}
+	}
+	return nullptr;
+}
+
+DeviceData* reserveDevice()
+{
+	std::lock_guard<std::mutex> lock( gObjectMutex );
+	for( u32 i = 0; i < MAX_OBJECTS; ++i )
+	{
+		if( !gDevices[i].used )
+		{
+			gDevices[i].used = true;
+			return &gDevices[i];
+		}
+	}
+	return nullptr;
+}
+
+InstanceData* findInstance( void* key )
+{
+	for( u32 i = 0; i < MAX_OBJECTS; ++i )
+	{
+		if( gInstances[i].key.load( std::memory_order_acquire ) == key )
+		{
+			return &gInstances[i];
+		}
+	}
+	return nullptr;
+}
+
+DeviceData* findDevice( void* key )
+{
+	for( u32 i = 0; i < MAX_OBJECTS; ++i )
+	{
+		if( gDevices[i].key.load( std::memory_order_acquire ) == key )
+		{
+			return &gDevices[i];
+		}
+	}
+	return nullptr;
+}
+
+// Returns number of instances still alive
+u32 releaseInstance( InstanceData* data )
+{
+	std::lock_guard<std::mutex> lock( gObjectMutex );
+	data->key.store( nullptr, std::memory_order_release );
+	data->instance = VK_NULL_HANDLE;
+	data->used = false;
+
+	u32 alive = 0;
+	for( u32 i = 0; i < MAX_OBJECTS; ++i )
+	{
+		alive += gInstances[i].used ? 1 : 0;
+	}
+	return alive;
+}
+
+void releaseDevice( DeviceData* data )
+{
+	std::lock_guard<std::mutex> lock( gObjectMutex );
+	data->key.store( nullptr, std::memory_order_release );
+	data->device = VK_NULL_HANDLE;
+	data->used = false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Profile output
+//
+// Bucket lower bound as text
+std::string bucketName( u32 bucket )
+{
+	u64 ns = (u64)1 << bucket;
+	std::ostringstream name;
+	if( ns < 1000 )
+		name << ns << "ns";
+	else if( ns < 1000000 )
+		name << ns / 1000 << "us";
+	else
+		name << ns / 1000000 << "ms";
+	return name.str();
+}
+
+bool compareReports( const EntryReport& a, const EntryReport& b )
+{
+	return a.stats->ticks > b.stats->ticks;
+}
+
+void addReports( std::vector<EntryReport>& reports, const EntryPoint* entryPoints, u32 count, const EntryStats* stats )
+{
+	for( u32 i = 0; i < count; ++i )
+	{
+		if( stats[entryPoints[i].entry].calls )
+		{
+			EntryReport report = { entryPoints[i].name, &stats[entryPoints[i].entry] };
+			reports.push_back( report );
+		}
+	}
+}
+
+void writeProfile( const char* path );
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Hooks
+//
+// Generic hooks look up next layer's function by table index and time the call, in capture mode
+// they also record it. Dispatchable handle is always the first argument.
+//
+template< typename Pfn, u32 Entry > struct DeviceHook;
+template< typename Pfn, u32 Entry > struct InstanceHook;
+
+template< typename R, typename First, typename... Args, u32 Entry >
+struct DeviceHook< R (VKAPI_PTR*)( First, Args... ), Entry >
+{
+	typedef R (VKAPI_PTR* Pfn)( First, Args... );
+
+	static R VKAPI_CALL call( First first, Args... args )
+	{
+		Pfn next = ( (Pfn*)&findDevice( dispatchKey( first ) )->table )[Entry];
+		if( DeviceCapture<Entry>::call != TRACE_CALL_NONE && gCapturing )
+		{
+			return CaptureCall< DeviceCapture<Entry>, R >::call( gDeviceStats[Entry], next, first, args... );
+		}
+		ScopedTimer timer( gDeviceStats[Entry] );
+		return next( first, args... );
+	}
+};
+
+template< typename R, typename First, typename... Args, u32 Entry >
+struct InstanceHook< R (VKAPI_PTR*)( First, Args... ), Entry >
+{
+	typedef R (VKAPI_PTR* Pfn)( First, Args... );
+
+	static R VKAPI_CALL call( First first, Args... args )
+	{
+		Pfn next = ( (Pfn*)&findInstance( dispatchKey( first ) )->table )[Entry];
+		if( InstanceCapture<Entry>::call != TRACE_CALL_NONE && gCapturing )
+		{
+			return CaptureCall< InstanceCapture<Entry>, R >::call( gInstanceStats[Entry], next, first, args... );
+		}
+		ScopedTimer timer( gInstanceStats[Entry] );
+		return next( first, args... );
+	}
+};
+
+VKAPI_ATTR VkResult VKAPI_CALL layerCreateInstance( const VkInstanceCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkInstance* pInstance )
+{
+	ScopedTimer timer( gGlobalStats[GLOBAL_CREATE_INSTANCE] );
+
+	// Loader passes link to next layer in pNext chain, it's advanced for the next one
+	VkLayerInstanceCreateInfo* chain = (VkLayerInstanceCreateInfo*)pCreateInfo->pNext;
+	while( chain && !( chain->sType == VK_STRUCTURE_TYPE_LOADER_INSTANCE_CREATE_INFO && chain->function == VK_LAYER_LINK_INFO ) )
+	{
+		chain = (VkLayerInstanceCreateInfo*)chain->pNext;
+	}
+	if( !chain )
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	PFN_vkGetInstanceProcAddr nextGetProcAddr = chain->u.pLayerInfo->pfnNextGetInstanceProcAddr;
+	PFN_vkCreateInstance nextCreate = (PFN_vkCreateInstance)nextGetProcAddr( VK_NULL_HANDLE, "vkCreateInstance" );
+	InstanceData* data = reserveInstance();
+	if( !nextCreate || !data )
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+	chain->u.pLayerInfo = chain->u.pLayerInfo->pNext;
+
+	// Settings go first, capture has to see this call too
+	if( !gNsPerTick )
+	{
+		initSettings();
+	}
+
+	u64 start = getTicks();
+	VkResult res = nextCreate( pCreateInfo, pAllocator, pInstance );
+	if( gCapturing )
+	{
+		captureRecord( TRACE_vkCreateInstance, getTicks() - start, res, &trace_vkCreateInstance, pCreateInfo, pAllocator, pInstance );
+	}
+	if( res != VK_SUCCESS )
+	{
+		releaseInstance( data );
+		return res;
+	}
+
+	VkLayerInstanceDispatchTable& table = data->table;
+	table.GetInstanceProcAddr = nextGetProcAddr;
+	table.DestroyInstance = (PFN_vkDestroyInstance)nextGetProcAddr( *pInstance, "vkDestroyInstance" );
+	table.EnumerateDeviceExtensionProperties = (PFN_vkEnumerateDeviceExtensionProperties)nextGetProcAddr( *pInstance, "vkEnumerateDeviceExtensionProperties" );
+	table.EnumerateDeviceLayerProperties = (PFN_vkEnumerateDeviceLayerProperties)nextGetProcAddr( *pInstance, "vkEnumerateDeviceLayerProperties" );
+#define LOAD_INSTANCE_ENTRY( name )	table.name = (PFN_vk##name)nextGetProcAddr( *pInstance, "vk" #name );
+	INSTANCE_TIMED_ENTRY_POINTS( LOAD_INSTANCE_ENTRY )
+#undef LOAD_INSTANCE_ENTRY
+
+	data->instance = *pInstance;
+	data->key.store( dispatchKey( *pInstance ), std::memory_order_release );
+	return res;
+}
+
+VKAPI_ATTR void VKAPI_CALL layerDestroyInstance( VkInstance instance, const VkAllocationCallbacks* pAllocator )
+{
+	InstanceData* data = findInstance( dispatchKey( instance ) );
+	u64 start = getTicks();
+	data->table.DestroyInstance( instance, pAllocator );
+	u64 ticks = getTicks() - start;
+	recordCall( gInstanceStats[INSTANCE_ENTRY( DestroyInstance )], ticks );
+	if( gCapturing )
+	{
+		captureRecord( TRACE_vkDestroyInstance, ticks, VK_SUCCESS, &trace_vkDestroyInstance, instance, pAllocator );
+	}
+
+	// Shutdown dump
+	if( !releaseInstance( data ) )
+	{
+		writeProfile( gProfileFile.c_str() );
+		if( gCapturing )
+		{
+			closeCapture();
+		}
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL layerCreateDevice( VkPhysicalDevice physicalDevice, const VkDeviceCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDevice* pDevice )
+{
+	ScopedTimer timer( gGlobalStats[GLOBAL_CREATE_DEVICE] );
+
+	VkLayerDeviceCreateInfo* chain = (VkLayerDeviceCreateInfo*)pCreateInfo->pNext;
+	while( chain && !( chain->sType == VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO && chain->function == VK_LAYER_LINK_INFO ) )
+	{
+		chain = (VkLayerDeviceCreateInfo*)chain->pNext;
+	}
+	if( !chain )
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	PFN_vkGetInstanceProcAddr nextGetInstanceProcAddr = chain->u.pLayerInfo->pfnNextGetInstanceProcAddr;
+	PFN_vkGetDeviceProcAddr nextGetProcAddr = chain->u.pLayerInfo->pfnNextGetDeviceProcAddr;
+	InstanceData* instance = findInstance( dispatchKey( physicalDevice ) );
+	PFN_vkCreateDevice nextCreate = (PFN_vkCreateDevice)nextGetInstanceProcAddr( instance->instance, "vkCreateDevice" );
+	DeviceData* data = reserveDevice();
+	if( !nextCreate || !data )
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+	chain->u.pLayerInfo = chain->u.pLayerInfo->pNext;
+
+	u64 start = getTicks();
+	VkResult res = nextCreate( physicalDevice, pCreateInfo, pAllocator, pDevice );
+	if( gCapturing )
+	{
+		captureRecord( TRACE_vkCreateDevice, getTicks() - start, res, &trace_vkCreateDevice, physicalDevice, pCreateInfo, pAllocator, pDevice );
+	}
+	if( res != VK_SUCCESS )
+	{
+		releaseDevice( data );
+		return res;
+	}
+
+	VkLayerDispatchTable& table = data->table;
+	table.GetDeviceProcAddr = nextGetProcAddr;
+	table.DestroyDevice = (PFN_vkDestroyDevice)nextGetProcAddr( *pDevice, "vkDestroyDevice" );
+	table.QueuePresentKHR = (PFN_vkQueuePresentKHR)nextGetProcAddr( *pDevice, "vkQueuePresentKHR" );
+#define LOAD_DEVICE_ENTRY( name )	table.name = (PFN_vk##name)nextGetProcAddr( *pDevice, "vk" #name );
+	DEVICE_TIMED_ENTRY_POINTS( LOAD_DEVICE_ENTRY )
+#undef LOAD_DEVICE_ENTRY
+
+	data->device = *pDevice;
+	data->key.store( dispatchKey( *pDevice ), std::memory_order_release );
+	return res;
+}
+
+VKAPI_ATTR void VKAPI_CALL layerDestroyDevice( VkDevice device, const VkAllocationCallbacks* pAllocator )
+{
+	DeviceData* data = findDevice( dispatchKey( device ) );
+	u64 start = getTicks();
+	data->table.DestroyDevice( device, pAllocator );
+	u64 ticks = getTicks() - start;
+	recordCall( gDeviceStats[DEVICE_ENTRY( DestroyDevice )], ticks );
+	if( gCapturing )
+	{
+		captureRecord( TRACE_vkDestroyDevice, ticks, VK_SUCCESS, &trace_vkDestroyDevice, device, pAllocator );
+	}
+	releaseDevice( data );
+}
+
+// Timed and captured like others, also drives periodic dumps
+VKAPI_ATTR VkResult VKAPI_CALL layerQueuePresentKHR( VkQueue queue, const VkPresentInfoKHR* pPresentInfo )
+{
+	DeviceData* data = findDevice( dispatchKey( queue ) );
+	u64 start = getTicks();
+	VkResult res = data->table.QueuePresentKHR( queue, pPresentInfo );
+	u64 ticks = getTicks() - start;
+	recordCall( gDeviceStats[DEVICE_ENTRY( QueuePresentKHR )], ticks );
+	if( gCapturing )
+	{
+		captureRecord( TRACE_vkQueuePresentKHR, ticks, res, &trace_vkQueuePresentKHR, queue, pPresentInfo );
+	}
+
+	u64 presents = gPresents.fetch_add( 1, std::memory_order_relaxed ) + 1;
+	if( gDumpPresents && presents % gDumpPresents == 0 )
+	{
+		writeProfile( gProfileFile.c_str() );
+	}
+	return res;
+}
+
+#define DEVICE_ENTRY_POINT( name )		{ "vk" #name, DEVICE_ENTRY( name ), (PFN_vkVoidFunction)&DeviceHook< PFN_vk##name, DEVICE_ENTRY( name ) >::call },
+#define INSTANCE_ENTRY_POINT( name )	{ "vk" #name, INSTANCE_ENTRY( name ), (PFN_vkVoidFunction)&InstanceHook< PFN_vk##name, INSTANCE_ENTRY( name ) >::call },
+
+const EntryPoint gDeviceEntryPoints[] =
+{
+	{ "vkDestroyDevice", DEVICE_ENTRY( DestroyDevice ), (PFN_vkVoidFunction)&layerDestroyDevice },
+	{ "vkQueuePresentKHR", DEVICE_ENTRY( QueuePresentKHR ), (PFN_vkVoidFunction)&layerQueuePresentKHR },
+	DEVICE_TIMED_ENTRY_POINTS( DEVICE_ENTRY_POINT )
+};
+
+const EntryPoint gInstanceEntryPoints[] =
+{
+	{ "vkDestroyInstance", INSTANCE_ENTRY( DestroyInstance ), (PFN_vkVoidFunction)&layerDestroyInstance },
+	INSTANCE_TIMED_ENTRY_POINTS( INSTANCE_ENTRY_POINT )
+};
+
+const EntryPoint gGlobalEntryPoints[] =
+{
+	{ "vkCreateInstance", GLOBAL_CREATE_INSTANCE, (PFN_vkVoidFunction)&layerCreateInstance },
+	{ "vkCreateDevice", GLOBAL_CREATE_DEVICE, (PFN_vkVoidFunction)&layerCreateDevice },
+};
+
+const u32 gDeviceEntryPointCount = sizeof( gDeviceEntryPoints ) / sizeof( gDeviceEntryPoints[0] );
+const u32 gInstanceEntryPointCount = sizeof( gInstanceEntryPoints ) / sizeof( gInstanceEntryPoints[0] );
+const u32 gGlobalEntryPointCount = sizeof( gGlobalEntryPoints ) / sizeof( gGlobalEntryPoints[0] );
+
+const EntryPoint* findEntryPoint( const EntryPoint* entryPoints, u32 count, const char* name )
+{
+	for( u32 i = 0; i < count; ++i )
+	{
+		if( !strcmp( entryPoints[i].name, name ) )
+		{
+			return &entryPoints[i];
+		}
+	}
+	return nullptr;
+}
+
+// Sorted by total time. Counters keep running while it's written, so numbers of busy entry points
+// may be a few calls apart between columns.
+void writeProfile( const char* path )
+{
+	std::lock_guard<std::mutex> lock( gDumpMutex );
+
+	std::vector<EntryReport> reports;
+	addReports( reports, gGlobalEntryPoints, gGlobalEntryPointCount, gGlobalStats );
+	addReports( reports, gInstanceEntryPoints, gInstanceEntryPointCount, gInstanceStats );
+	addReports( reports, gDeviceEntryPoints, gDeviceEntryPointCount, gDeviceStats );
+	std::sort( reports.begin(), reports.end(), compareReports );
+
+	u64 totalCalls = 0;
+	u64 totalTicks = 0;
+	for( u32 i = 0; i < reports.size(); ++i )
+	{
+		totalCalls += reports[i].stats->calls;
+		totalTicks += reports[i].stats->ticks;
+	}
+
+	std::ofstream file( path );
+	if( !file )
+	{
+		return;
+	}
+
+	double msPerTick = gNsPerTick / 1000000.0;
+	file << std::fixed << std::setprecision( 3 );
+	file << LAYER_NAME << ": " << totalCalls << " calls, " << totalTicks * msPerTick << " ms in driver and layers below\n";
+	if( gCapturing )
+	{
+		file << gCapturedCalls << " calls captured\n";
+	}
+	file << "\n";
+	file << std::left << std::setw( 48 ) << "entry point" << std::right << std::setw( 12 ) << "calls" << std::setw( 14 ) << "total ms"
+		 << std::setw( 12 ) << "avg us" << std::setw( 12 ) << "max us" << std::setw( 9 ) << "share" << "\n";
+
+	for( u32 i = 0; i < reports.size(); ++i )
+	{
+		const EntryStats& stats = *reports[i].stats;
+		u64 calls = stats.calls;
+		u64 ticks = stats.ticks;
+		file << std::left << std::setw( 48 ) << reports[i].name << std::right << std::setw( 12 ) << calls
+			 << std::setw( 14 ) << ticks * msPerTick << std::setw( 12 ) << ticks * msPerTick * 1000.0 / calls
+			 << std::setw( 12 ) << stats.maxTicks * msPerTick * 1000.0
+			 << std::setw( 8 ) << ( totalTicks ? ticks * 100.0 / totalTicks : 0.0 ) << "%\n";
+
+		// Histogram of non-empty buckets, bucket is named by its lower bound
+		file << "    ";
+		for( u32 b = 0; b < HISTOGRAM_BUCKETS; ++b )
+		{
+			if( stats.histogram[b] )
+			{
+				file << " " << bucketName( b ) << ":" << stats.histogram[b];
+			}
+		}
+		file << "\n";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Exports
+//
+// Writes profile on demand, path may be null to use VK_PROFILER_FILE. Applications get it with
+// GetProcAddress( GetModuleHandle( "VkLayer_profiler.dll" ), "profilerDump" ).
+extern "C" void profilerDump( const char* path )
+{
+	writeProfile( path ? path : gProfileFile.c_str() );
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateInstanceLayerProperties( uint32_t* pPropertyCount, VkLayerProperties* pProperties )
+{
+	if( !pProperties )
+	{
+		*pPropertyCount = 1;
+		return VK_SUCCESS;
+	}
+	if( !*pPropertyCount )
+	{
+		return VK_INCOMPLETE;
+	}
+
+	*pPropertyCount = 1;
+	*pProperties = gLayerProperties;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateDeviceLayerProperties( VkPhysicalDevice physicalDevice, uint32_t* pPropertyCount, VkLayerProperties* pProperties )
+{
+	return vkEnumerateInstanceLayerProperties( pPropertyCount, pProperties );
+}
+
+// Layer has no extensions of its own
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateInstanceExtensionProperties( const char* pLayerName, uint32_t* pPropertyCount, VkExtensionProperties* pProperties )
+{
+	if( !pLayerName || strcmp( pLayerName, LAYER_NAME ) )
+	{
+		return VK_ERROR_LAYER_NOT_PRESENT;
+	}
+
+	*pPropertyCount = 0;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateDeviceExtensionProperties( VkPhysicalDevice physicalDevice, const char* pLayerName, uint32_t* pPropertyCount, VkExtensionProperties* pProperties )
+{
+	if( pLayerName && !strcmp( pLayerName, LAYER_NAME ) )
+	{
+		*pPropertyCount = 0;
+		return VK_SUCCESS;
+	}
+	if( !physicalDevice )
+	{
+		return VK_ERROR_LAYER_NOT_PRESENT;
+	}
+
+	InstanceData* data = findInstance( dispatchKey( physicalDevice ) );
+	return data->table.EnumerateDeviceExtensionProperties( physicalDevice, pLayerName, pPropertyCount, pProperties );
+}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetDeviceProcAddr( VkDevice device, const char* pName )
+{
+	if( !strcmp( pName, "vkGetDeviceProcAddr" ) )
+	{
+		return (PFN_vkVoidFunction)&vkGetDeviceProcAddr;
+	}
+	if( !device )
+	{
+		return nullptr;
+	}
+
+	// Hooked only if layers below implement it
+	DeviceData* data = findDevice( dispatchKey( device ) );
+	const EntryPoint* entryPoint = findEntryPoint( gDeviceEntryPoints, gDeviceEntryPointCount, pName );
+	if( entryPoint && ( (PFN_vkVoidFunction*)&data->table )[entryPoint->entry] )
+	{
+		return entryPoint->hook;
+	}
+	return data->table.GetDeviceProcAddr( device, pName );
+}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetInstanceProcAddr( VkInstance instance, const char* pName )
+{
+	if( !strcmp( pName, "vkGetInstanceProcAddr" ) )
+		return (PFN_vkVoidFunction)&vkGetInstanceProcAddr;
+	if( !strcmp( pName, "vkGetDeviceProcAddr" ) )
+		return (PFN_vkVoidFunction)&vkGetDeviceProcAddr;
+	if( !strcmp( pName, "vkEnumerateInstanceLayerProperties" ) )
+		return (PFN_vkVoidFunction)&vkEnumerateInstanceLayerProperties;
+	if( !strcmp( pName, "vkEnumerateInstanceExtensionProperties" ) )
+		return (PFN_vkVoidFunction)&vkEnumerateInstanceExtensionProperties;
+	if( !strcmp( pName, "vkEnumerateDeviceLayerProperties" ) )
+		return (PFN_vkVoidFunction)&vkEnumerateDeviceLayerProperties;
+	if( !strcmp( pName, "vkEnumerateDeviceExtensionProperties" ) )
+		return (PFN_vkVoidFunction)&vkEnumerateDeviceExtensionProperties;
+
+	const EntryPoint* entryPoint = findEntryPoint( gGlobalEntryPoints, gGlobalEntryPointCount, pName );
+	if( entryPoint )
+	{
+		return entryPoint->hook;
+	}
+	if( !instance )
+	{
+		return nullptr;
+	}
+
+	InstanceData* data = findInstance( dispatchKey( instance ) );
+	entryPoint = findEntryPoint( gInstanceEntryPoints, gInstanceEntryPointCount, pName );
+	if( entryPoint )
+	{
+		return ( (PFN_vkVoidFunction*)&data->table )[entryPoint->entry] ? entryPoint->hook : nullptr;
+	}
+
+	// Device entry points asked through instance go to the same hooks, if layers below have them
+	PFN_vkVoidFunction next = data->table.GetInstanceProcAddr( instance, pName );
+	entryPoint = findEntryPoint( gDeviceEntryPoints, gDeviceEntryPointCount, pName );
+	return next && entryPoint ? entryPoint->hook : next;
+}
@@ -0,0 +1,543 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <tuple>
+#include <memory>
+#include <unordered_map>
+#include <string>
+#include <Windows.h>
+
+#define VK_PROTOTYPES
+#define VK_USE_PLATFORM_WIN32_KHR
+
+#include "../vulkan_sdk/include/vulkan.h"
+#include "trace.h"
+#pragma comment(lib, "../vulkan_sdk/lib/vulkan-1.lib")
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Defines
+//
+// Re-issues trace written by VK_CAPTURE_FILE mode of VK_LAYER_LAMP_profiler and reports how long each
+// call took against capture. Runs on whatever driver loader picks, VK_ICD_FILENAMES points it to
+// another one, e.g. a null driver to measure CPU side alone.
+//
+//   vulkan_replay <trace> [-keep_layers] [-report file]
+//
+
+typedef				__int8		i8;
+typedef				__int16		i16;
+typedef				__int32		i32;
+typedef				__int64		i64;
+typedef unsigned	__int8		u8;
+typedef unsigned	__int16		u16;
+typedef unsigned	__int32		u32;
+typedef unsigned	__int64		u64;
+
+struct CallStats
+{
+	u64						calls;
+	u64						capturedNs;
+	u64						ticks;
+	u64						maxTicks;
+	u32						skipped;		// dispatchable handle wasn't there at replay
+	u32						mismatches;		// result differs from capture
+};
+
+// Replay acquires whatever image driver gives, images captured process used are remapped to it
+struct SwapchainImages
+{
+	std::vector<u64>		captured;
+	std::vector<VkImage>	live;
+	u32						acquired;
+};
+
+// Index pack for unpacking call arguments kept in tuple
+template< u32... I > struct Indices {};
+template< u32 N, u32... I > struct MakeIndices : MakeIndices< N - 1, N - 1, I... > {};
+template< u32... I > struct MakeIndices< 0, I... > { typedef Indices< I... > type; };
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Globals
+//
+HINSTANCE									ghInstance = NULL;
+HWND										ghWnd = NULL;
+
+// settings
+std::string									gTraceFile;
+std::string									gReportFile;
+bool										gKeepLayers = false;
+
+// replay state
+TraceStream									gStream;
+std::unordered_map<u64, SwapchainImages>	gSwapchains;		// by live handle
+u32											gCapturedImageIndex = 0;
+u32											gUnknownCalls = 0;
+u32											gOverruns = 0;
+
+// stats
+CallStats									gCallStats[TRACE_CALL_COUNT];
+std::vector<float>							gFrameMs;			// present to present
+u64											gLastPresent = 0;
+u64											gTimerFrequency = 0;
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Utils
+//
+u64 getTicks()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter( &counter );
+	return counter.QuadPart;
+}
+
+double ticksToMs( u64 ticks )
+{
+	return (double)ticks * 1000.0 / (double)gTimerFrequency;
+}
+
+float percentile( const std::vector<float>& sorted, u32 p )
+{
+	return sorted.empty() ? 0.0f : sorted[min( (u32)( sorted.size() * p / 100 ), (u32)sorted.size() - 1 )];
+}
+
+void parseCommandLine( int argc, char** argv )
+{
+	for( int i = 1; i < argc; ++i )
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if( !strcmp( arg, "-keep_layers" ) )
+		{
+			gKeepLayers = true;
+		}
+		else if( !strcmp( arg, "-report" ) && value )
+		{
+			gReportFile = value;
+			++i;
+		}
+		else
+		{
+			gTraceFile = arg;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// WinAPI
+//
+// Window exists only for surfaces the trace creates, it's sized to match swapchain before each is
+// created since Win32 swapchain extent has to be the window's.
+//
+LRESULT CALLBACK wndCallback( HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam )
+{
+	return DefWindowProc( hwnd, msg, wparam, lparam );
+}
+
+HWND getWindow()
+{
+	if( ghWnd )
+	{
+		return ghWnd;
+	}
+
+	ghInstance = GetModuleHandle( NULL );
+	WNDCLASS wndclass = {};
+	wndclass.lpszClassName	= "vulkan_replay";
+	wndclass.style			= CS_HREDRAW | CS_VREDRAW;
+	wndclass.lpfnWndProc	= &wndCallback;
+	wndclass.hbrBackground	= (HBRUSH)COLOR_WINDOW;
+	wndclass.hInstance		= ghInstance;
+	RegisterClass( &wndclass );
+
+	ghWnd = CreateWindow( "vulkan_replay", "Vulkan Replay", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT,
+						  CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, NULL, NULL, ghInstance, NULL );
+	ShowWindow( ghWnd, SW_SHOW );
+	return ghWnd;
+}
+
+void resizeWindow( VkExtent2D extent )
+{
+	RECT rect = { 0, 0, (LONG)extent.width, (LONG)extent.height };
+	AdjustWindowRect( &rect, WS_OVERLAPPEDWINDOW, FALSE );
+	SetWindowPos( getWindow(), NULL, 0, 0, rect.right - rect.left, rect.bottom - rect.top, SWP_NOMOVE | SWP_NOZORDER );
+}
+
+void pumpMessages()
+{
+	MSG msg;
+	while( PeekMessage( &msg, NULL, 0, 0, PM_REMOVE ) )
+	{
+		TranslateMessage( &msg );
+		DispatchMessage( &msg );
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Hooks
+//
+// Fix up arguments of calls that depend on the process or the driver: before runs once arguments are
+// read, after once call returned and its handles are bound.
+//
+struct NoReplayHook
+{
+	template< typename... Args > static void before( Args&... ) {}
+	template< typename... Args > static void after( VkResult, Args&... ) {}
+};
+
+template< u32 Call > struct ReplayHook : NoReplayHook {};
+
+// Layers of captured process, profiler among them, aren't wanted unless asked for
+template<> struct ReplayHook< TRACE_vkCreateInstance > : NoReplayHook
+{
+	static void before( const VkInstanceCreateInfo*& pCreateInfo, const VkAllocationCallbacks*&, VkInstance*& )
+	{
+		if( !gKeepLayers )
+		{
+			const_cast<VkInstanceCreateInfo*>( pCreateInfo )->enabledLayerCount = 0;
+		}
+	}
+};
+
+template<> struct ReplayHook< TRACE_vkCreateDevice > : NoReplayHook
+{
+	static void before( VkPhysicalDevice&, const VkDeviceCreateInfo*& pCreateInfo, const VkAllocationCallbacks*&, VkDevice*& )
+	{
+		if( !gKeepLayers )
+		{
+			const_cast<VkDeviceCreateInfo*>( pCreateInfo )->enabledLayerCount = 0;
+		}
+	}
+};
+
+template<> struct ReplayHook< TRACE_vkCreateWin32SurfaceKHR > : NoReplayHook
+{
+	static void before( VkInstance&, const VkWin32SurfaceCreateInfoKHR*& pCreateInfo, const VkAllocationCallbacks*&, VkSurfaceKHR*& )
+	{
+		VkWin32SurfaceCreateInfoKHR* info = const_cast<VkWin32SurfaceCreateInfoKHR*>( pCreateInfo );
+		info->hwnd = getWindow();
+		info->hinstance = ghInstance;
+	}
+};
+
+template<> struct ReplayHook< TRACE_vkCreateSwapchainKHR > : NoReplayHook
+{
+	static void before( VkDevice&, const VkSwapchainCreateInfoKHR*& pCreateInfo, const VkAllocationCallbacks*&, VkSwapchainKHR*& )
+	{
+		resizeWindow( pCreateInfo->imageExtent );
+		pumpMessages();
+	}
+};
+
+template<> struct ReplayHook< TRACE_vkDestroySwapchainKHR > : NoReplayHook
+{
+	static void before( VkDevice&, VkSwapchainKHR& swapchain, const VkAllocationCallbacks*& )
+	{
+		gSwapchains.erase( traceHandleId( swapchain ) );
+	}
+};
+
+// Captured image ids are still waiting in outputs, live images come back from the call
+template<> struct ReplayHook< TRACE_vkGetSwapchainImagesKHR >
+{
+	static void before( VkDevice&, VkSwapchainKHR& swapchain, uint32_t*&, VkImage*& pSwapchainImages )
+	{
+		if( pSwapchainImages )
+		{
+			SwapchainImages& images = gSwapchains[traceHandleId( swapchain )];
+			images.captured.clear();
+			for( size_t i = 0; i < gStream.outputs.size(); ++i )
+			{
+				images.captured.push_back( gStream.outputs[i].id );
+			}
+		}
+	}
+
+	static void after( VkResult result, VkDevice&, VkSwapchainKHR& swapchain, uint32_t*& pSwapchainImageCount, VkImage*& pSwapchainImages )
+	{
+		if( pSwapchainImages && result >= VK_SUCCESS )
+		{
+			SwapchainImages& images = gSwapchains[traceHandleId( swapchain )];
+			images.live.assign( pSwapchainImages, pSwapchainImages + *pSwapchainImageCount );
+			images.acquired = 0;
+		}
+	}
+};
+
+// Image captured process got now stands for the one replay got, commands recorded for the frame
+// reference it by captured id
+template<> struct ReplayHook< TRACE_vkAcquireNextImageKHR >
+{
+	static void before( VkDevice&, VkSwapchainKHR&, uint64_t&, VkSemaphore&, VkFence&, uint32_t*& pImageIndex )
+	{
+		gCapturedImageIndex = *pImageIndex;
+	}
+
+	static void after( VkResult result, VkDevice&, VkSwapchainKHR& swapchain, uint64_t&, VkSemaphore&, VkFence&, uint32_t*& pImageIndex )
+	{
+		std::unordered_map<u64, SwapchainImages>::iterator it = gSwapchains.find( traceHandleId( swapchain ) );
+		if( ( result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR ) || it == gSwapchains.end() )
+		{
+			return;
+		}
+
+		SwapchainImages& images = it->second;
+		if( gCapturedImageIndex < images.captured.size() && *pImageIndex < images.live.size() )
+		{
+			gStream.handles[images.captured[gCapturedImageIndex]] = traceHandleId( images.live[*pImageIndex] );
+		}
+		images.acquired = *pImageIndex;
+	}
+};
+
+template<> struct ReplayHook< TRACE_vkQueuePresentKHR >
+{
+	static void before( VkQueue&, const VkPresentInfoKHR*& pPresentInfo )
+	{
+		uint32_t* indices = const_cast<uint32_t*>( pPresentInfo->pImageIndices );
+		for( u32 i = 0; indices && i < pPresentInfo->swapchainCount; ++i )
+		{
+			std::unordered_map<u64, SwapchainImages>::iterator it = gSwapchains.find( traceHandleId( pPresentInfo->pSwapchains[i] ) );
+			if( it != gSwapchains.end() )
+			{
+				indices[i] = it->second.acquired;
+			}
+		}
+	}
+
+	static void after( VkResult, VkQueue&, const VkPresentInfoKHR*& )
+	{
+		u64 now = getTicks();
+		if( gLastPresent )
+		{
+			gFrameMs.push_back( (float)ticksToMs( now - gLastPresent ) );
+		}
+		gLastPresent = now;
+		pumpMessages();
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Replay
+//
+template< typename R >
+struct Invoke
+{
+	template< typename Pfn, typename... Args >
+	static VkResult call( Pfn fn, Args&... args )
+	{
+		return (VkResult)fn( args... );
+	}
+};
+
+template<>
+struct Invoke<void>
+{
+	template< typename Pfn, typename... Args >
+	static VkResult call( Pfn fn, Args&... args )
+	{
+		fn( args... );
+		return VK_SUCCESS;
+	}
+};
+
+// Arguments are read into tuple of call's own parameter types and handed to it. Calls on a
+// dispatchable handle replay doesn't have, e.g. second GPU of captured machine, are skipped.
+template< u32 Call, typename R, typename... Args, u32... I >
+void replayUnpacked( const TraceRecord& record, R (VKAPI_PTR* fn)( Args... ), void (*trace)( TraceStream&, Args&... ), Indices< I... > )
+{
+	CallStats& stats = gCallStats[Call];
+	std::tuple< Args... > args;
+	trace( gStream, std::get<I>( args )... );
+	if( !traceHandleId( std::get<0>( args ) ) )
+	{
+		++stats.skipped;
+		gStream.outputs.clear();
+		return;
+	}
+	ReplayHook<Call>::before( std::get<I>( args )... );
+
+	u64 start = getTicks();
+	VkResult result = Invoke<R>::call( fn, std::get<I>( args )... );
+	u64 ticks = getTicks() - start;
+
+	traceBindOutputs( gStream );
+	ReplayHook<Call>::after( result, std::get<I>( args )... );
+
+	++stats.calls;
+	stats.capturedNs += record.ns;
+	stats.ticks += ticks;
+	stats.maxTicks = max( stats.maxTicks, ticks );
+	stats.mismatches += result != (VkResult)record.result ? 1 : 0;
+}
+
+template< u32 Call, typename R, typename... Args >
+void replayCall( const TraceRecord& record, R (VKAPI_PTR* fn)( Args... ), void (*trace)( TraceStream&, Args&... ) )
+{
+	replayUnpacked<Call>( record, fn, trace, typename MakeIndices< sizeof...( Args ) >::type() );
+}
+
+void replayRecord( const TraceRecord& record )
+{
+	switch( record.call )
+	{
+#define REPLAY_CALL( name, blocking )	case TRACE_vk##name: replayCall< TRACE_vk##name >( record, &vk##name, &trace_vk##name ); break;
+	TRACE_CALLS( REPLAY_CALL )
+#undef REPLAY_CALL
+	default:
+		++gUnknownCalls;
+		break;
+	}
+}
+
+bool replayTrace( const char* path )
+{
+	std::ifstream file( path, std::ios::binary );
+	TraceHeader header = {};
+	if( !file.read( (char*)&header, sizeof( header ) ) || header.magic != TRACE_MAGIC )
+	{
+		std::cout << path << " is not a trace\n";
+		return false;
+	}
+	if( header.version != TRACE_VERSION )
+	{
+		std::cout << path << " is trace version " << header.version << ", replay reads " << TRACE_VERSION << "\n";
+		return false;
+	}
+
+	gStream.reading = true;
+	TraceRecord record;
+	while( file.read( (char*)&record, sizeof( record ) ) )
+	{
+		gStream.data.resize( record.size );
+		if( record.size && !file.read( (char*)&gStream.data[0], record.size ) )
+		{
+			std::cout << "trace is truncated\n";
+			break;
+		}
+		gStream.pos = 0;
+		gStream.arena.clear();
+		gStream.overrun = false;
+
+		replayRecord( record );
+		gOverruns += gStream.overrun ? 1 : 0;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Report
+//
+bool compareCallStats( const CallStats* a, const CallStats* b )
+{
+	return a->ticks > b->ticks;
+}
+
+// Sorted by replay time, ratio above 1 means replay is slower than capture
+void writeReport( std::ostream& out, double wallMs )
+{
+	std::vector<const CallStats*> sorted;
+	u64 totalCalls = 0;
+	u64 totalTicks = 0;
+	u64 totalCapturedNs = 0;
+	u32 skipped = 0;
+	u32 mismatches = 0;
+	for( u32 i = 0; i < TRACE_CALL_COUNT; ++i )
+	{
+		const CallStats& stats = gCallStats[i];
+		if( stats.calls || stats.skipped )
+		{
+			sorted.push_back( &stats );
+		}
+		totalCalls += stats.calls;
+		totalTicks += stats.ticks;
+		totalCapturedNs += stats.capturedNs;
+		skipped += stats.skipped;
+		mismatches += stats.mismatches;
+	}
+	std::sort( sorted.begin(), sorted.end(), compareCallStats );
+
+	out << std::fixed << std::setprecision( 3 );
+	out << "replayed " << totalCalls << " calls in " << wallMs << " ms, " << ticksToMs( totalTicks ) << " ms in driver, "
+		<< totalCapturedNs / 1000000.0 << " ms at capture\n";
+	if( skipped || mismatches || gUnknownCalls || gOverruns || gStream.missing )
+	{
+		out << "  " << skipped << " skipped, " << mismatches << " results differ from capture, " << gUnknownCalls << " unknown, "
+			<< gOverruns << " malformed, " << gStream.missing << " handles missing\n";
+	}
+
+	if( !gFrameMs.empty() )
+	{
+		std::vector<float> frames = gFrameMs;
+		std::sort( frames.begin(), frames.end() );
+		double sum = 0.0;
+		for( size_t i = 0; i < frames.size(); ++i )
+		{
+			sum += frames[i];
+		}
+		out << "frames: " << frames.size() + 1 << ", avg " << sum / frames.size() << " ms, p50 " << percentile( frames, 50 )
+			<< " ms, p99 " << percentile( frames, 99 ) << " ms, max " << frames.back() << " ms\n";
+	}
+
+	out << "\n" << std::left << std::setw( 48 ) << "call" << std::right << std::setw( 10 ) << "calls" << std::setw( 14 ) << "replay ms"
+		<< std::setw( 14 ) << "capture ms" << std::setw( 10 ) << "ratio" << std::setw( 12 ) << "avg us" << std::setw( 12 ) << "max us" << "\n";
+	for( size_t i = 0; i < sorted.size(); ++i )
+	{
+		const CallStats& stats = *sorted[i];
+		double replayMs = ticksToMs( stats.ticks );
+		double capturedMs = stats.capturedNs / 1000000.0;
+		out << std::left << std::setw( 48 ) << gTraceCallNames[&stats - gCallStats] << std::right << std::setw( 10 ) << stats.calls
+			<< std::setw( 14 ) << replayMs << std::setw( 14 ) << capturedMs << std::setw( 10 ) << ( capturedMs > 0.0 ? replayMs / capturedMs : 0.0 )
+			<< std::setw( 12 ) << ( stats.calls ? replayMs * 1000.0 / stats.calls : 0.0 ) << std::setw( 12 ) << ticksToMs( stats.maxTicks ) * 1000.0 << "\n";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+int main( int argc, char** argv )
+{
+	parseCommandLine( argc, argv );
+	if( gTraceFile.empty() )
+	{
+		std::cout << "usage: vulkan_replay <trace> [-keep_layers] [-report file]\n";
+		return 1;
+	}
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency( &freq );
+	gTimerFrequency = freq.QuadPart;
+
+	u64 start = getTicks();
+	if( !replayTrace( gTraceFile.c_str() ) )
+	{
+		return 1;
+	}
+	double wallMs = ticksToMs( getTicks() - start );
+
+	writeReport( std::cout, wallMs );
+	if( !gReportFile.empty() )
+	{
+		std::ofstream report( gReportFile.c_str() );
+		writeReport( report, wallMs );
+	}
+
+	if( ghWnd )
+	{
+		DestroyWindow( ghWnd );
+	}
+	return 0;
+}
@@ -0,0 +1,962 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstring>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Binary trace of Vulkan calls. Written by capture mode of VK_LAYER_LAMP_profiler, read by vulkan_replay.
+//
+// File is TraceHeader followed by records, each is TraceRecord and payload with call arguments in
+// order. Handles are stored as 64 bit ids, value they had in captured process. Arrays are prefixed
+// with presence flag and structs are stored raw with their handles and pointers written again after
+// them. Same trace_vk* function writes arguments at capture and reads them back at replay, so two
+// sides can't drift apart.
+//
+// Not recorded: pNext chains, allocation callbacks, window handles and contents of mapped memory.
+//
+
+#define TRACE_MAGIC			0x52544B56		// "VKTR"
+#define TRACE_VERSION		1
+
+// X( name, blocking ). Blocking calls may wait for other threads, so capture records them after they
+// return instead of holding its lock through them. New calls go to the end, ids are stored in traces.
+#define TRACE_CALLS( X )																					\
+	X( CreateInstance, 0 ) X( DestroyInstance, 0 ) X( EnumeratePhysicalDevices, 0 )							\
+	X( GetPhysicalDeviceProperties, 0 ) X( GetPhysicalDeviceQueueFamilyProperties, 0 )						\
+	X( GetPhysicalDeviceMemoryProperties, 0 ) X( CreateWin32SurfaceKHR, 0 ) X( DestroySurfaceKHR, 0 )		\
+	X( GetPhysicalDeviceSurfaceSupportKHR, 0 ) X( GetPhysicalDeviceSurfaceCapabilitiesKHR, 0 )				\
+	X( GetPhysicalDeviceSurfaceFormatsKHR, 0 ) X( GetPhysicalDeviceSurfacePresentModesKHR, 0 )				\
+	X( CreateDevice, 0 ) X( DestroyDevice, 0 ) X( GetDeviceQueue, 0 ) X( QueueSubmit, 0 )					\
+	X( QueueWaitIdle, 1 ) X( DeviceWaitIdle, 1 ) X( AllocateMemory, 0 ) X( FreeMemory, 0 )					\
+	X( MapMemory, 0 ) X( UnmapMemory, 0 ) X( FlushMappedMemoryRanges, 0 )									\
+	X( InvalidateMappedMemoryRanges, 0 ) X( GetImageMemoryRequirements, 0 )									\
+	X( GetBufferMemoryRequirements, 0 ) X( BindImageMemory, 0 ) X( BindBufferMemory, 0 )					\
+	X( CreateFence, 0 ) X( DestroyFence, 0 ) X( GetFenceStatus, 0 ) X( ResetFences, 0 )						\
+	X( WaitForFences, 1 ) X( CreateSemaphore, 0 ) X( DestroySemaphore, 0 ) X( CreateBuffer, 0 )				\
+	X( DestroyBuffer, 0 ) X( CreateImage, 0 ) X( DestroyImage, 0 ) X( CreateImageView, 0 )					\
+	X( DestroyImageView, 0 ) X( CreateCommandPool, 0 ) X( DestroyCommandPool, 0 )							\
+	X( ResetCommandPool, 0 ) X( AllocateCommandBuffers, 0 ) X( FreeCommandBuffers, 0 )						\
+	X( BeginCommandBuffer, 0 ) X( EndCommandBuffer, 0 ) X( CmdPipelineBarrier, 0 )							\
+	X( CmdClearColorImage, 0 ) X( CmdCopyBuffer, 0 ) X( CmdCopyBufferToImage, 0 )							\
+	X( CmdCopyImageToBuffer, 0 ) X( CmdExecuteCommands, 0 ) X( CreateSwapchainKHR, 0 )						\
+	X( DestroySwapchainKHR, 0 ) X( GetSwapchainImagesKHR, 0 ) X( AcquireNextImageKHR, 1 )					\
+	X( QueuePresentKHR, 1 ) X( CreateQueryPool, 0 ) X( DestroyQueryPool, 0 ) X( CmdResetQueryPool, 0 )			\
+	X( CmdWriteTimestamp, 0 ) X( GetQueryPoolResults, 0 )													\
+	X( GetPhysicalDeviceWin32PresentationSupportKHR, 0 )
+
+enum TraceCall
+{
+	TRACE_CALL_NONE,
+#define TRACE_CALL_ID( name, blocking )		TRACE_vk##name,
+	TRACE_CALLS( TRACE_CALL_ID )
+#undef TRACE_CALL_ID
+	TRACE_CALL_COUNT,
+};
+
+#define TRACE_CALL_NAME( name, blocking )		"vk" #name,
+#define TRACE_CALL_BLOCKING( name, blocking )	blocking != 0,
+static const char* const	gTraceCallNames[TRACE_CALL_COUNT] = { "none", TRACE_CALLS( TRACE_CALL_NAME ) };
+static const bool			gTraceCallBlocking[TRACE_CALL_COUNT] = { false, TRACE_CALLS( TRACE_CALL_BLOCKING ) };
+#undef TRACE_CALL_NAME
+#undef TRACE_CALL_BLOCKING
+
+struct TraceHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+};
+
+struct TraceRecord
+{
+	uint32_t	call;		// TraceCall
+	uint32_t	size;		// payload bytes following the record
+	uint32_t	ns;			// time call took at capture, saturated
+	int32_t		result;		// VkResult, VK_SUCCESS for void calls
+};
+
+// Handle created by call being replayed, bound to its captured id once call returns
+struct TraceOutput
+{
+	uint64_t	id;
+	void*		handle;
+	uint32_t	size;
+};
+
+struct TraceStream
+{
+	bool										reading;
+	std::vector<uint8_t>						data;		// writing: records not flushed yet, reading: payload of one record
+	size_t										pos;		// reading position in data
+
+	// reading only
+	std::vector< std::unique_ptr<uint8_t[]> >	arena;		// memory read arguments point to
+	std::unordered_map<uint64_t, uint64_t>		handles;	// captured id -> live handle
+	std::vector<TraceOutput>					outputs;
+	uint32_t									missing;	// ids without live handle
+	bool										overrun;	// payload ended early
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Primitives
+//
+// At capture they append value to stream, at replay they read it back to the same place and
+// allocate memory for anything captured pointers pointed to.
+//
+inline void traceBytes( TraceStream& s, void* bytes, size_t size )
+{
+	if( !size )
+	{
+		return;
+	}
+	if( !s.reading )
+	{
+		const uint8_t* begin = (const uint8_t*)bytes;
+		s.data.insert( s.data.end(), begin, begin + size );
+		return;
+	}
+	if( s.pos + size > s.data.size() )
+	{
+		s.overrun = true;
+		memset( bytes, 0, size );
+		return;
+	}
+	memcpy( bytes, &s.data[s.pos], size );
+	s.pos += size;
+}
+
+template< typename T >
+void traceValue( TraceStream& s, T& value )
+{
+	traceBytes( s, &value, sizeof( T ) );
+}
+
+// Zeroed memory living until next record is read
+template< typename T >
+T* traceAlloc( TraceStream& s, uint32_t count )
+{
+	size_t size = ( count ? count : 1 ) * sizeof( T );
+	s.arena.push_back( std::unique_ptr<uint8_t[]>( new uint8_t[size]() ) );
+	return (T*)s.arena.back().get();
+}
+
+// Writes whether array is there, at replay allocates it. Returns true if there are items to trace.
+template< typename T >
+bool tracePresent( TraceStream& s, const T*& items, uint32_t count )
+{
+	uint8_t present = !s.reading && items;
+	traceValue( s, present );
+	if( s.reading )
+	{
+		items = present ? traceAlloc<T>( s, count ) : nullptr;
+	}
+	return present && count;
+}
+
+template< typename T >
+uint64_t traceHandleId( const T& handle )
+{
+	uint64_t id = 0;
+	memcpy( &id, &handle, sizeof( T ) );
+	return id;
+}
+
+// Handles aren't overloaded on type: on 32 bit builds non-dispatchable ones are all uint64_t
+template< typename T >
+void traceHandle( TraceStream& s, T& handle )
+{
+	uint64_t id = traceHandleId( handle );
+	traceValue( s, id );
+	if( s.reading )
+	{
+		uint64_t live = 0;
+		if( id )
+		{
+			std::unordered_map<uint64_t, uint64_t>::const_iterator it = s.handles.find( id );
+			if( it != s.handles.end() )
+				live = it->second;
+			else
+				++s.missing;
+		}
+		memcpy( &handle, &live, sizeof( T ) );
+	}
+}
+
+template< typename T >
+void traceHandles( TraceStream& s, uint32_t count, const T*& handles )
+{
+	if( tracePresent( s, handles, count ) )
+	{
+		for( uint32_t i = 0; i < count; ++i )
+		{
+			traceHandle( s, const_cast<T&>( handles[i] ) );
+		}
+	}
+}
+
+template< typename T >
+void traceValues( TraceStream& s, uint32_t count, const T*& values )
+{
+	if( tracePresent( s, values, count ) )
+	{
+		traceBytes( s, const_cast<T*>( values ), count * sizeof( T ) );
+	}
+}
+
+template< typename T >
+void traceStructs( TraceStream& s, uint32_t count, const T*& items )
+{
+	if( tracePresent( s, items, count ) )
+	{
+		for( uint32_t i = 0; i < count; ++i )
+		{
+			traceStruct( s, const_cast<T&>( items[i] ) );
+		}
+	}
+}
+
+template< typename T >
+void traceStructPtr( TraceStream& s, const T*& item )
+{
+	traceStructs( s, 1, item );
+}
+
+// Struct without handles or pointers besides pNext
+template< typename T >
+void tracePlain( TraceStream& s, T& value )
+{
+	traceValue( s, value );
+	if( s.reading )
+	{
+		value.pNext = nullptr;
+	}
+}
+
+inline void traceString( TraceStream& s, const char*& str )
+{
+	uint32_t length = !s.reading && str ? (uint32_t)strlen( str ) + 1 : 0;
+	traceValue( s, length );
+	if( s.reading )
+	{
+		str = length ? traceAlloc<char>( s, length ) : nullptr;
+	}
+	traceBytes( s, const_cast<char*>( str ), length );
+}
+
+inline void traceStrings( TraceStream& s, uint32_t count, const char* const*& strings )
+{
+	if( tracePresent( s, strings, count ) )
+	{
+		for( uint32_t i = 0; i < count; ++i )
+		{
+			traceString( s, const_cast<const char*&>( strings[i] ) );
+		}
+	}
+}
+
+inline void traceAllocator( TraceStream& s, const VkAllocationCallbacks*& allocator )
+{
+	if( s.reading )
+	{
+		allocator = nullptr;
+	}
+}
+
+// Handles returned by call
+template< typename T >
+void traceOutputs( TraceStream& s, uint32_t count, T*& handles )
+{
+	if( s.reading )
+	{
+		handles = traceAlloc<T>( s, count );
+	}
+	for( uint32_t i = 0; i < count; ++i )
+	{
+		uint64_t id = traceHandleId( handles[i] );
+		traceValue( s, id );
+		if( s.reading )
+		{
+			TraceOutput output = { id, &handles[i], sizeof( T ) };
+			s.outputs.push_back( output );
+		}
+	}
+}
+
+template< typename T >
+void traceOutput( TraceStream& s, T*& handle )
+{
+	traceOutputs( s, 1, handle );
+}
+
+// Value returned through pointer, recorded so replay can look at what capture got
+template< typename T >
+void traceOutputValue( TraceStream& s, T*& value )
+{
+	if( s.reading )
+	{
+		value = traceAlloc<T>( s, 1 );
+	}
+	traceValue( s, *value );
+}
+
+// Value returned through pointer that isn't recorded, replay only gets somewhere to write it
+template< typename T >
+void traceOutputStorage( TraceStream& s, T*& value )
+{
+	if( s.reading )
+	{
+		value = traceAlloc<T>( s, 1 );
+	}
+}
+
+// Count and handles of enumeration, handles are bound by index at replay
+template< typename T >
+void traceEnumeratedHandles( TraceStream& s, uint32_t*& pCount, T*& handles )
+{
+	traceOutputValue( s, pCount );
+	uint8_t present = !s.reading && handles;
+	traceValue( s, present );
+	if( present )
+	{
+		traceOutputs( s, *pCount, handles );
+	}
+	else if( s.reading )
+	{
+		handles = nullptr;
+	}
+}
+
+template< typename T >
+void traceEnumeratedValues( TraceStream& s, uint32_t*& pCount, T*& values )
+{
+	traceOutputValue( s, pCount );
+	uint8_t present = !s.reading && values;
+	traceValue( s, present );
+	if( s.reading )
+	{
+		values = present ? traceAlloc<T>( s, *pCount ) : nullptr;
+	}
+}
+
+template< typename Parent, typename Info, typename T >
+void traceCreate( TraceStream& s, Parent& parent, const Info*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, T*& pObject )
+{
+	traceHandle( s, parent );
+	traceStructPtr( s, pCreateInfo );
+	traceAllocator( s, pAllocator );
+	traceOutput( s, pObject );
+}
+
+template< typename Parent, typename T >
+void traceDestroy( TraceStream& s, Parent& parent, T& object, const VkAllocationCallbacks*& pAllocator )
+{
+	traceHandle( s, parent );
+	traceHandle( s, object );
+	traceAllocator( s, pAllocator );
+}
+
+// Replay side, called once replayed call returned
+inline void traceBindOutputs( TraceStream& s )
+{
+	for( size_t i = 0; i < s.outputs.size(); ++i )
+	{
+		uint64_t live = 0;
+		memcpy( &live, s.outputs[i].handle, s.outputs[i].size );
+		if( s.outputs[i].id )
+		{
+			s.handles[s.outputs[i].id] = live;
+		}
+	}
+	s.outputs.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Structs
+//
+inline void traceStruct( TraceStream& s, VkApplicationInfo& info )
+{
+	tracePlain( s, info );
+	traceString( s, info.pApplicationName );
+	traceString( s, info.pEngineName );
+}
+
+inline void traceStruct( TraceStream& s, VkInstanceCreateInfo& info )
+{
+	tracePlain( s, info );
+	traceStructPtr( s, info.pApplicationInfo );
+	traceStrings( s, info.enabledLayerCount, info.ppEnabledLayerNames );
+	traceStrings( s, info.enabledExtensionCount, info.ppEnabledExtensionNames );
+}
+
+inline void traceStruct( TraceStream& s, VkDeviceQueueCreateInfo& info )
+{
+	tracePlain( s, info );
+	traceValues( s, info.queueCount, info.pQueuePriorities );
+}
+
+inline void traceStruct( TraceStream& s, VkDeviceCreateInfo& info )
+{
+	tracePlain( s, info );
+	traceStructs( s, info.queueCreateInfoCount, info.pQueueCreateInfos );
+	traceStrings( s, info.enabledLayerCount, info.ppEnabledLayerNames );
+	traceStrings( s, info.enabledExtensionCount, info.ppEnabledExtensionNames );
+	traceValues( s, 1, info.pEnabledFeatures );
+}
+
+// Window belongs to captured process, replay puts its own in
+inline void traceStruct( TraceStream& s, VkWin32SurfaceCreateInfoKHR& info )
+{
+	tracePlain( s, info );
+	if( s.reading )
+	{
+		info.hinstance = nullptr;
+		info.hwnd = nullptr;
+	}
+}
+
+inline void traceStruct( TraceStream& s, VkSwapchainCreateInfoKHR& info )
+{
+	tracePlain( s, info );
+	traceHandle( s, info.surface );
+	traceValues( s, info.queueFamilyIndexCount, info.pQueueFamilyIndices );
+	traceHandle( s, info.oldSwapchain );
+}
+
+inline void traceStruct( TraceStream& s, VkPresentInfoKHR& info )
+{
+	tracePlain( s, info );
+	traceHandles( s, info.waitSemaphoreCount, info.pWaitSemaphores );
+	traceHandles( s, info.swapchainCount, info.pSwapchains );
+	traceValues( s, info.swapchainCount, info.pImageIndices );
+	if( s.reading )
+	{
+		info.pResults = nullptr;
+	}
+}
+
+inline void traceStruct( TraceStream& s, VkCommandPoolCreateInfo& info )	{ tracePlain( s, info ); }
+inline void traceStruct( TraceStream& s, VkFenceCreateInfo& info )			{ tracePlain( s, info ); }
+inline void traceStruct( TraceStream& s, VkSemaphoreCreateInfo& info )		{ tracePlain( s, info ); }
+inline void traceStruct( TraceStream& s, VkMemoryAllocateInfo& info )		{ tracePlain( s, info ); }
+inline void traceStruct( TraceStream& s, VkMemoryBarrier& barrier )			{ tracePlain( s, barrier ); }
+inline void traceStruct( TraceStream& s, VkQueryPoolCreateInfo& info )		{ tracePlain( s, info ); }
+
+inline void traceStruct( TraceStream& s, VkCommandBufferAllocateInfo& info )
+{
+	tracePlain( s, info );
+	traceHandle( s, info.commandPool );
+}
+
+inline void traceStruct( TraceStream& s, VkCommandBufferInheritanceInfo& info )
+{
+	tracePlain( s, info );
+	traceHandle( s, info.renderPass );
+	traceHandle( s, info.framebuffer );
+}
+
+inline void traceStruct( TraceStream& s, VkCommandBufferBeginInfo& info )
+{
+	tracePlain( s, info );
+	traceStructPtr( s, info.pInheritanceInfo );
+}
+
+inline void traceStruct( TraceStream& s, VkSubmitInfo& info )
+{
+	tracePlain( s, info );
+	traceHandles( s, info.waitSemaphoreCount, info.pWaitSemaphores );
+	traceValues( s, info.waitSemaphoreCount, info.pWaitDstStageMask );
+	traceHandles( s, info.commandBufferCount, info.pCommandBuffers );
+	traceHandles( s, info.signalSemaphoreCount, info.pSignalSemaphores );
+}
+
+inline void traceStruct( TraceStream& s, VkImageCreateInfo& info )
+{
+	tracePlain( s, info );
+	traceValues( s, info.queueFamilyIndexCount, info.pQueueFamilyIndices );
+}
+
+inline void traceStruct( TraceStream& s, VkBufferCreateInfo& info )
+{
+	tracePlain( s, info );
+	traceValues( s, info.queueFamilyIndexCount, info.pQueueFamilyIndices );
+}
+
+inline void traceStruct( TraceStream& s, VkImageViewCreateInfo& info )
+{
+	tracePlain( s, info );
+	traceHandle( s, info.image );
+}
+
+inline void traceStruct( TraceStream& s, VkMappedMemoryRange& range )
+{
+	tracePlain( s, range );
+	traceHandle( s, range.memory );
+}
+
+inline void traceStruct( TraceStream& s, VkBufferMemoryBarrier& barrier )
+{
+	tracePlain( s, barrier );
+	traceHandle( s, barrier.buffer );
+}
+
+inline void traceStruct( TraceStream& s, VkImageMemoryBarrier& barrier )
+{
+	tracePlain( s, barrier );
+	traceHandle( s, barrier.image );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Calls
+//
+// Parameters match PFN_vk* ones by reference, so capture passes its arguments straight in and replay
+// passes locals it then calls the function with.
+//
+inline void trace_vkCreateInstance( TraceStream& s, const VkInstanceCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkInstance*& pInstance )
+{
+	traceStructPtr( s, pCreateInfo );
+	traceAllocator( s, pAllocator );
+	traceOutput( s, pInstance );
+}
+
+inline void trace_vkDestroyInstance( TraceStream& s, VkInstance& instance, const VkAllocationCallbacks*& pAllocator )
+{
+	traceHandle( s, instance );
+	traceAllocator( s, pAllocator );
+}
+
+inline void trace_vkEnumeratePhysicalDevices( TraceStream& s, VkInstance& instance, uint32_t*& pPhysicalDeviceCount, VkPhysicalDevice*& pPhysicalDevices )
+{
+	traceHandle( s, instance );
+	traceEnumeratedHandles( s, pPhysicalDeviceCount, pPhysicalDevices );
+}
+
+inline void trace_vkGetPhysicalDeviceProperties( TraceStream& s, VkPhysicalDevice& physicalDevice, VkPhysicalDeviceProperties*& pProperties )
+{
+	traceHandle( s, physicalDevice );
+	traceOutputStorage( s, pProperties );
+}
+
+inline void trace_vkGetPhysicalDeviceQueueFamilyProperties( TraceStream& s, VkPhysicalDevice& physicalDevice, uint32_t*& pQueueFamilyPropertyCount, VkQueueFamilyProperties*& pQueueFamilyProperties )
+{
+	traceHandle( s, physicalDevice );
+	traceEnumeratedValues( s, pQueueFamilyPropertyCount, pQueueFamilyProperties );
+}
+
+inline void trace_vkGetPhysicalDeviceMemoryProperties( TraceStream& s, VkPhysicalDevice& physicalDevice, VkPhysicalDeviceMemoryProperties*& pMemoryProperties )
+{
+	traceHandle( s, physicalDevice );
+	traceOutputStorage( s, pMemoryProperties );
+}
+
+inline void trace_vkCreateWin32SurfaceKHR( TraceStream& s, VkInstance& instance, const VkWin32SurfaceCreateInfoKHR*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkSurfaceKHR*& pSurface )
+{
+	traceCreate( s, instance, pCreateInfo, pAllocator, pSurface );
+}
+
+inline void trace_vkDestroySurfaceKHR( TraceStream& s, VkInstance& instance, VkSurfaceKHR& surface, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, instance, surface, pAllocator );
+}
+
+inline void trace_vkGetPhysicalDeviceSurfaceSupportKHR( TraceStream& s, VkPhysicalDevice& physicalDevice, uint32_t& queueFamilyIndex, VkSurfaceKHR& surface, VkBool32*& pSupported )
+{
+	traceHandle( s, physicalDevice );
+	traceValue( s, queueFamilyIndex );
+	traceHandle( s, surface );
+	traceOutputStorage( s, pSupported );
+}
+
+inline void trace_vkGetPhysicalDeviceSurfaceCapabilitiesKHR( TraceStream& s, VkPhysicalDevice& physicalDevice, VkSurfaceKHR& surface, VkSurfaceCapabilitiesKHR*& pSurfaceCapabilities )
+{
+	traceHandle( s, physicalDevice );
+	traceHandle( s, surface );
+	traceOutputStorage( s, pSurfaceCapabilities );
+}
+
+inline void trace_vkGetPhysicalDeviceSurfaceFormatsKHR( TraceStream& s, VkPhysicalDevice& physicalDevice, VkSurfaceKHR& surface, uint32_t*& pSurfaceFormatCount, VkSurfaceFormatKHR*& pSurfaceFormats )
+{
+	traceHandle( s, physicalDevice );
+	traceHandle( s, surface );
+	traceEnumeratedValues( s, pSurfaceFormatCount, pSurfaceFormats );
+}
+
+inline void trace_vkGetPhysicalDeviceSurfacePresentModesKHR( TraceStream& s, VkPhysicalDevice& physicalDevice, VkSurfaceKHR& surface, uint32_t*& pPresentModeCount, VkPresentModeKHR*& pPresentModes )
+{
+	traceHandle( s, physicalDevice );
+	traceHandle( s, surface );
+	traceEnumeratedValues( s, pPresentModeCount, pPresentModes );
+}
+
+inline void trace_vkGetPhysicalDeviceWin32PresentationSupportKHR( TraceStream& s, VkPhysicalDevice& physicalDevice, uint32_t& queueFamilyIndex )
+{
+	traceHandle( s, physicalDevice );
+	traceValue( s, queueFamilyIndex );
+}
+
+inline void trace_vkCreateDevice( TraceStream& s, VkPhysicalDevice& physicalDevice, const VkDeviceCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkDevice*& pDevice )
+{
+	traceCreate( s, physicalDevice, pCreateInfo, pAllocator, pDevice );
+}
+
+inline void trace_vkDestroyDevice( TraceStream& s, VkDevice& device, const VkAllocationCallbacks*& pAllocator )
+{
+	traceHandle( s, device );
+	traceAllocator( s, pAllocator );
+}
+
+inline void trace_vkGetDeviceQueue( TraceStream& s, VkDevice& device, uint32_t& queueFamilyIndex, uint32_t& queueIndex, VkQueue*& pQueue )
+{
+	traceHandle( s, device );
+	traceValue( s, queueFamilyIndex );
+	traceValue( s, queueIndex );
+	traceOutput( s, pQueue );
+}
+
+inline void trace_vkQueueSubmit( TraceStream& s, VkQueue& queue, uint32_t& submitCount, const VkSubmitInfo*& pSubmits, VkFence& fence )
+{
+	traceHandle( s, queue );
+	traceValue( s, submitCount );
+	traceStructs( s, submitCount, pSubmits );
+	traceHandle( s, fence );
+}
+
+inline void trace_vkQueueWaitIdle( TraceStream& s, VkQueue& queue )
+{
+	traceHandle( s, queue );
+}
+
+inline void trace_vkDeviceWaitIdle( TraceStream& s, VkDevice& device )
+{
+	traceHandle( s, device );
+}
+
+inline void trace_vkAllocateMemory( TraceStream& s, VkDevice& device, const VkMemoryAllocateInfo*& pAllocateInfo, const VkAllocationCallbacks*& pAllocator, VkDeviceMemory*& pMemory )
+{
+	traceCreate( s, device, pAllocateInfo, pAllocator, pMemory );
+}
+
+inline void trace_vkFreeMemory( TraceStream& s, VkDevice& device, VkDeviceMemory& memory, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, memory, pAllocator );
+}
+
+inline void trace_vkMapMemory( TraceStream& s, VkDevice& device, VkDeviceMemory& memory, VkDeviceSize& offset, VkDeviceSize& size, VkMemoryMapFlags& flags, void**& ppData )
+{
+	traceHandle( s, device );
+	traceHandle( s, memory );
+	traceValue( s, offset );
+	traceValue( s, size );
+	traceValue( s, flags );
+	traceOutputStorage( s, ppData );
+}
+
+inline void trace_vkUnmapMemory( TraceStream& s, VkDevice& device, VkDeviceMemory& memory )
+{
+	traceHandle( s, device );
+	traceHandle( s, memory );
+}
+
+inline void trace_vkFlushMappedMemoryRanges( TraceStream& s, VkDevice& device, uint32_t& memoryRangeCount, const VkMappedMemoryRange*& pMemoryRanges )
+{
+	traceHandle( s, device );
+	traceValue( s, memoryRangeCount );
+	traceStructs( s, memoryRangeCount, pMemoryRanges );
+}
+
+inline void trace_vkInvalidateMappedMemoryRanges( TraceStream& s, VkDevice& device, uint32_t& memoryRangeCount, const VkMappedMemoryRange*& pMemoryRanges )
+{
+	trace_vkFlushMappedMemoryRanges( s, device, memoryRangeCount, pMemoryRanges );
+}
+
+inline void trace_vkGetImageMemoryRequirements( TraceStream& s, VkDevice& device, VkImage& image, VkMemoryRequirements*& pMemoryRequirements )
+{
+	traceHandle( s, device );
+	traceHandle( s, image );
+	traceOutputStorage( s, pMemoryRequirements );
+}
+
+inline void trace_vkGetBufferMemoryRequirements( TraceStream& s, VkDevice& device, VkBuffer& buffer, VkMemoryRequirements*& pMemoryRequirements )
+{
+	traceHandle( s, device );
+	traceHandle( s, buffer );
+	traceOutputStorage( s, pMemoryRequirements );
+}
+
+inline void trace_vkBindImageMemory( TraceStream& s, VkDevice& device, VkImage& image, VkDeviceMemory& memory, VkDeviceSize& memoryOffset )
+{
+	traceHandle( s, device );
+	traceHandle( s, image );
+	traceHandle( s, memory );
+	traceValue( s, memoryOffset );
+}
+
+inline void trace_vkBindBufferMemory( TraceStream& s, VkDevice& device, VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize& memoryOffset )
+{
+	traceHandle( s, device );
+	traceHandle( s, buffer );
+	traceHandle( s, memory );
+	traceValue( s, memoryOffset );
+}
+
+inline void trace_vkCreateFence( TraceStream& s, VkDevice& device, const VkFenceCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkFence*& pFence )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pFence );
+}
+
+inline void trace_vkDestroyFence( TraceStream& s, VkDevice& device, VkFence& fence, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, fence, pAllocator );
+}
+
+inline void trace_vkGetFenceStatus( TraceStream& s, VkDevice& device, VkFence& fence )
+{
+	traceHandle( s, device );
+	traceHandle( s, fence );
+}
+
+inline void trace_vkResetFences( TraceStream& s, VkDevice& device, uint32_t& fenceCount, const VkFence*& pFences )
+{
+	traceHandle( s, device );
+	traceValue( s, fenceCount );
+	traceHandles( s, fenceCount, pFences );
+}
+
+inline void trace_vkWaitForFences( TraceStream& s, VkDevice& device, uint32_t& fenceCount, const VkFence*& pFences, VkBool32& waitAll, uint64_t& timeout )
+{
+	trace_vkResetFences( s, device, fenceCount, pFences );
+	traceValue( s, waitAll );
+	traceValue( s, timeout );
+}
+
+inline void trace_vkCreateSemaphore( TraceStream& s, VkDevice& device, const VkSemaphoreCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkSemaphore*& pSemaphore )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pSemaphore );
+}
+
+inline void trace_vkDestroySemaphore( TraceStream& s, VkDevice& device, VkSemaphore& semaphore, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, semaphore, pAllocator );
+}
+
+inline void trace_vkCreateBuffer( TraceStream& s, VkDevice& device, const VkBufferCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkBuffer*& pBuffer )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pBuffer );
+}
+
+inline void trace_vkDestroyBuffer( TraceStream& s, VkDevice& device, VkBuffer& buffer, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, buffer, pAllocator );
+}
+
+inline void trace_vkCreateImage( TraceStream& s, VkDevice& device, const VkImageCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkImage*& pImage )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pImage );
+}
+
+inline void trace_vkDestroyImage( TraceStream& s, VkDevice& device, VkImage& image, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, image, pAllocator );
+}
+
+inline void trace_vkCreateImageView( TraceStream& s, VkDevice& device, const VkImageViewCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkImageView*& pView )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pView );
+}
+
+inline void trace_vkDestroyImageView( TraceStream& s, VkDevice& device, VkImageView& imageView, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, imageView, pAllocator );
+}
+
+inline void trace_vkCreateCommandPool( TraceStream& s, VkDevice& device, const VkCommandPoolCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkCommandPool*& pCommandPool )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pCommandPool );
+}
+
+inline void trace_vkDestroyCommandPool( TraceStream& s, VkDevice& device, VkCommandPool& commandPool, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, commandPool, pAllocator );
+}
+
+inline void trace_vkResetCommandPool( TraceStream& s, VkDevice& device, VkCommandPool& commandPool, VkCommandPoolResetFlags& flags )
+{
+	traceHandle( s, device );
+	traceHandle( s, commandPool );
+	traceValue( s, flags );
+}
+
+inline void trace_vkAllocateCommandBuffers( TraceStream& s, VkDevice& device, const VkCommandBufferAllocateInfo*& pAllocateInfo, VkCommandBuffer*& pCommandBuffers )
+{
+	traceHandle( s, device );
+	traceStructPtr( s, pAllocateInfo );
+	traceOutputs( s, pAllocateInfo->commandBufferCount, pCommandBuffers );
+}
+
+inline void trace_vkFreeCommandBuffers( TraceStream& s, VkDevice& device, VkCommandPool& commandPool, uint32_t& commandBufferCount, const VkCommandBuffer*& pCommandBuffers )
+{
+	traceHandle( s, device );
+	traceHandle( s, commandPool );
+	traceValue( s, commandBufferCount );
+	traceHandles( s, commandBufferCount, pCommandBuffers );
+}
+
+inline void trace_vkBeginCommandBuffer( TraceStream& s, VkCommandBuffer& commandBuffer, const VkCommandBufferBeginInfo*& pBeginInfo )
+{
+	traceHandle( s, commandBuffer );
+	traceStructPtr( s, pBeginInfo );
+}
+
+inline void trace_vkEndCommandBuffer( TraceStream& s, VkCommandBuffer& commandBuffer )
+{
+	traceHandle( s, commandBuffer );
+}
+
+inline void trace_vkCmdPipelineBarrier( TraceStream& s, VkCommandBuffer& commandBuffer, VkPipelineStageFlags& srcStageMask, VkPipelineStageFlags& dstStageMask,
+										VkDependencyFlags& dependencyFlags, uint32_t& memoryBarrierCount, const VkMemoryBarrier*& pMemoryBarriers,
+										uint32_t& bufferMemoryBarrierCount, const VkBufferMemoryBarrier*& pBufferMemoryBarriers,
+										uint32_t& imageMemoryBarrierCount, const VkImageMemoryBarrier*& pImageMemoryBarriers )
+{
+	traceHandle( s, commandBuffer );
+	traceValue( s, srcStageMask );
+	traceValue( s, dstStageMask );
+	traceValue( s, dependencyFlags );
+	traceValue( s, memoryBarrierCount );
+	traceStructs( s, memoryBarrierCount, pMemoryBarriers );
+	traceValue( s, bufferMemoryBarrierCount );
+	traceStructs( s, bufferMemoryBarrierCount, pBufferMemoryBarriers );
+	traceValue( s, imageMemoryBarrierCount );
+	traceStructs( s, imageMemoryBarrierCount, pImageMemoryBarriers );
+}
+
+inline void trace_vkCmdClearColorImage( TraceStream& s, VkCommandBuffer& commandBuffer, VkImage& image, VkImageLayout& imageLayout, const VkClearColorValue*& pColor,
+										uint32_t& rangeCount, const VkImageSubresourceRange*& pRanges )
+{
+	traceHandle( s, commandBuffer );
+	traceHandle( s, image );
+	traceValue( s, imageLayout );
+	traceValues( s, 1, pColor );
+	traceValue( s, rangeCount );
+	traceValues( s, rangeCount, pRanges );
+}
+
+inline void trace_vkCmdCopyBuffer( TraceStream& s, VkCommandBuffer& commandBuffer, VkBuffer& srcBuffer, VkBuffer& dstBuffer, uint32_t& regionCount, const VkBufferCopy*& pRegions )
+{
+	traceHandle( s, commandBuffer );
+	traceHandle( s, srcBuffer );
+	traceHandle( s, dstBuffer );
+	traceValue( s, regionCount );
+	traceValues( s, regionCount, pRegions );
+}
+
+inline void trace_vkCmdCopyBufferToImage( TraceStream& s, VkCommandBuffer& commandBuffer, VkBuffer& srcBuffer, VkImage& dstImage, VkImageLayout& dstImageLayout,
+										  uint32_t& regionCount, const VkBufferImageCopy*& pRegions )
+{
+	traceHandle( s, commandBuffer );
+	traceHandle( s, srcBuffer );
+	traceHandle( s, dstImage );
+	traceValue( s, dstImageLayout );
+	traceValue( s, regionCount );
+	traceValues( s, regionCount, pRegions );
+}
+
+inline void trace_vkCmdCopyImageToBuffer( TraceStream& s, VkCommandBuffer& commandBuffer, VkImage& srcImage, VkImageLayout& srcImageLayout, VkBuffer& dstBuffer,
+										  uint32_t& regionCount, const VkBufferImageCopy*& pRegions )
+{
+	traceHandle( s, commandBuffer );
+	traceHandle( s, srcImage );
+	traceValue( s, srcImageLayout );
+	traceHandle( s, dstBuffer );
+	traceValue( s, regionCount );
+	traceValues( s, regionCount, pRegions );
+}
+
+inline void trace_vkCmdExecuteCommands( TraceStream& s, VkCommandBuffer& commandBuffer, uint32_t& commandBufferCount, const VkCommandBuffer*& pCommandBuffers )
+{
+	traceHandle( s, commandBuffer );
+	traceValue( s, commandBufferCount );
+	traceHandles( s, commandBufferCount, pCommandBuffers );
+}
+
+inline void trace_vkCreateSwapchainKHR( TraceStream& s, VkDevice& device, const VkSwapchainCreateInfoKHR*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkSwapchainKHR*& pSwapchain )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pSwapchain );
+}
+
+inline void trace_vkDestroySwapchainKHR( TraceStream& s, VkDevice& device, VkSwapchainKHR& swapchain, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, swapchain, pAllocator );
+}
+
+inline void trace_vkGetSwapchainImagesKHR( TraceStream& s, VkDevice& device, VkSwapchainKHR& swapchain, uint32_t*& pSwapchainImageCount, VkImage*& pSwapchainImages )
+{
+	traceHandle( s, device );
+	traceHandle( s, swapchain );
+	traceEnumeratedHandles( s, pSwapchainImageCount, pSwapchainImages );
+}
+
+// Captured image index is kept, replay maps images by it
+inline void trace_vkAcquireNextImageKHR( TraceStream& s, VkDevice& device, VkSwapchainKHR& swapchain, uint64_t& timeout, VkSemaphore& semaphore, VkFence& fence, uint32_t*& pImageIndex )
+{
+	traceHandle( s, device );
+	traceHandle( s, swapchain );
+	traceValue( s, timeout );
+	traceHandle( s, semaphore );
+	traceHandle( s, fence );
+	traceOutputValue( s, pImageIndex );
+}
+
+inline void trace_vkQueuePresentKHR( TraceStream& s, VkQueue& queue, const VkPresentInfoKHR*& pPresentInfo )
+{
+	traceHandle( s, queue );
+	traceStructPtr( s, pPresentInfo );
+}
+
+inline void trace_vkCreateQueryPool( TraceStream& s, VkDevice& device, const VkQueryPoolCreateInfo*& pCreateInfo, const VkAllocationCallbacks*& pAllocator, VkQueryPool*& pQueryPool )
+{
+	traceCreate( s, device, pCreateInfo, pAllocator, pQueryPool );
+}
+
+inline void trace_vkDestroyQueryPool( TraceStream& s, VkDevice& device, VkQueryPool& queryPool, const VkAllocationCallbacks*& pAllocator )
+{
+	traceDestroy( s, device, queryPool, pAllocator );
+}
+
+inline void trace_vkCmdResetQueryPool( TraceStream& s, VkCommandBuffer& commandBuffer, VkQueryPool& queryPool, uint32_t& firstQuery, uint32_t& queryCount )
+{
+	traceHandle( s, commandBuffer );
+	traceHandle( s, queryPool );
+	traceValue( s, firstQuery );
+	traceValue( s, queryCount );
+}
+
+inline void trace_vkCmdWriteTimestamp( TraceStream& s, VkCommandBuffer& commandBuffer, VkPipelineStageFlagBits& pipelineStage, VkQueryPool& queryPool, uint32_t& query )
+{
+	traceHandle( s, commandBuffer );
+	traceValue( s, pipelineStage );
+	traceHandle( s, queryPool );
+	traceValue( s, query );
+}
+
+// Results aren't recorded, replay only gets somewhere to write them
+inline void trace_vkGetQueryPoolResults( TraceStream& s, VkDevice& device, VkQueryPool& queryPool, uint32_t& firstQuery, uint32_t& queryCount,
+										 size_t& dataSize, void*& pData, VkDeviceSize& stride, VkQueryResultFlags& flags )
+{
+	traceHandle( s, device );
+	traceHandle( s, queryPool );
+	traceValue( s, firstQuery );
+	traceValue( s, queryCount );
+	uint64_t size = dataSize;
+	traceValue( s, size );
+	if( s.reading )
+	{
+		dataSize = (size_t)size;
+		pData = traceAlloc<uint8_t>( s, (uint32_t)size );
+	}
+	traceValue( s, stride );
+	traceValue( s, flags );
+}